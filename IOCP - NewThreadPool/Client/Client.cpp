@@ -31,6 +31,7 @@ namespace
 		OVERLAPPED overlapped;
 		Client* client;
 		Type type;
+		BYTE* buffer; // what a SEND sends. Freed with the event.
 
 	private:
 		IOEvent();
@@ -53,6 +54,7 @@ namespace
 
 	/* static */ void IOEvent::Destroy(IOEvent* event)
 	{
+		delete [] event->buffer;
 		IOEventPool::free(event);
 	}
 
@@ -122,7 +124,8 @@ namespace
 //---------------------------------------------------------------------------------//
 //---------------------------------------------------------------------------------//
 Client::Client()
-: m_pTPIO(NULL), m_Socket(INVALID_SOCKET), m_State(WAIT)
+: m_pTPIO(NULL), m_Socket(INVALID_SOCKET), m_State(WAIT),
+  m_Streaming(false), m_StreamData(NULL), m_StreamSize(0), m_StreamReceived(NULL)
 {
 }
 
@@ -261,7 +264,8 @@ void Client::PostReceive()
 
 	WSABUF recvBufferDescriptor;
 	recvBufferDescriptor.buf = reinterpret_cast<char*>(m_recvBuffer);
-	recvBufferDescriptor.len = Client::MAX_RECV_BUFFER;
+	// Room for the terminator OnRecv() puts after text.
+	recvBufferDescriptor.len = Client::MAX_RECV_BUFFER - 1;
 
 	DWORD numberOfBytes = 0;
 	DWORD recvFlags = 0;
@@ -321,17 +325,19 @@ void Client::PostSend(const char* buffer, unsigned int size)
 		return;
 	}
 
+	IOEvent* event = IOEvent::Create(this, IOEvent::SEND);
+
+	// Each send has a buffer of its own, so that pipelined calls can be in flight together.
+	event->buffer = new BYTE[size];
+	CopyMemory(event->buffer, buffer, size);
+
 	WSABUF recvBufferDescriptor;
-	recvBufferDescriptor.buf = reinterpret_cast<char*>(m_sendBuffer);
+	recvBufferDescriptor.buf = reinterpret_cast<char*>(event->buffer);
 	recvBufferDescriptor.len = size;
 
-	CopyMemory(m_sendBuffer, buffer, size);
-
 	DWORD numberOfBytes = size;
 	DWORD sendFlags = 0;
 
-	IOEvent* event = IOEvent::Create(this, IOEvent::SEND);
-
 	StartThreadpoolIo( m_pTPIO );
 
 	int ret = WSASend(m_Socket, &recvBufferDescriptor, 1, &numberOfBytes, sendFlags, &event->overlapped, NULL);
@@ -345,6 +351,8 @@ void Client::PostSend(const char* buffer, unsigned int size)
 
 			ERROR_CODE(error, "WSASend() failed.");
 
+			IOEvent::Destroy(event);
+
 			// Error Handling!!! //
 			Destroy();
 		}
@@ -375,6 +383,59 @@ bool Client::Shutdown()
 }
 
 
+void Client::StartRpc(const RpcStub::Config& config, Histogram* latencies, RpcStub::DoneFunc done, void* context)
+{
+	std::vector<BYTE> frames;
+	m_Rpc.Start(config, latencies, done, context, frames);
+
+	if(!frames.empty())
+	{
+		PostSend(reinterpret_cast<const char*>(&frames[0]), static_cast<unsigned int>(frames.size()));
+	}
+}
+
+
+void Client::StartLoad(const LoadStub::Config& config, Histogram* latencies)
+{
+	std::vector<BYTE> frames;
+	m_Load.Start(config, latencies, frames);
+
+	if(!frames.empty())
+	{
+		PostSend(reinterpret_cast<const char*>(&frames[0]), static_cast<unsigned int>(frames.size()));
+	}
+}
+
+
+void Client::SendLoad(ULONGLONG now)
+{
+	std::vector<BYTE> frames;
+	m_Load.MakeFrames(now, frames);
+
+	if(!frames.empty())
+	{
+		PostSend(reinterpret_cast<const char*>(&frames[0]), static_cast<unsigned int>(frames.size()));
+	}
+}
+
+
+void Client::StartStream(const BYTE* data, DWORD size, DWORD depth, volatile LONGLONG* received)
+{
+	assert(data);
+	assert(received);
+
+	m_StreamData = data;
+	m_StreamSize = size;
+	m_StreamReceived = received;
+	m_Streaming = true;
+
+	for(DWORD i = 0 ; i < depth ; ++i)
+	{
+		PostSend(reinterpret_cast<const char*>(m_StreamData), m_StreamSize);
+	}
+}
+
+
 void Client::OnConnect()
 {
 	// The socket s does not enable previously set properties or options until SO_UPDATE_CONNECT_CONTEXT is set on the socket. 
@@ -391,10 +452,40 @@ void Client::OnConnect()
 
 void Client::OnRecv(DWORD dwNumberOfBytesTransfered)
 {
-	// Do not process packet received here.
-	// Instead, publish event with the packet and call PostRecv()
-	m_recvBuffer[dwNumberOfBytesTransfered] = '\0';
-	TRACE("OnRecv() : %s", m_recvBuffer);
+	if(m_Load.IsRunning())
+	{
+		if(!m_Load.OnRecv(m_recvBuffer, dwNumberOfBytesTransfered))
+		{
+			ClientMan::Instance()->PostRemoveClient(this);
+			return;
+		}
+	}
+	else if(m_Rpc.HasStarted())
+	{
+		// Answered calls are replaced right away to keep the depth.
+		m_RpcFrames.clear();
+		if(!m_Rpc.OnRecv(m_recvBuffer, dwNumberOfBytesTransfered, m_RpcFrames))
+		{
+			ClientMan::Instance()->PostRemoveClient(this);
+			return;
+		}
+
+		if(!m_RpcFrames.empty())
+		{
+			PostSend(reinterpret_cast<const char*>(&m_RpcFrames[0]), static_cast<unsigned int>(m_RpcFrames.size()));
+		}
+	}
+	else if(m_StreamReceived != NULL)
+	{
+		InterlockedExchangeAdd64(m_StreamReceived, dwNumberOfBytesTransfered);
+	}
+	else
+	{
+		// Do not process packet received here.
+		// Instead, publish event with the packet and call PostRecv()
+		m_recvBuffer[dwNumberOfBytesTransfered] = '\0';
+		TRACE("OnRecv() : %s", m_recvBuffer);
+	}
 
 	// To maximize performance, post recv request ASAP. 
 	PostReceive();
@@ -404,6 +495,12 @@ void Client::OnRecv(DWORD dwNumberOfBytesTransfered)
 void Client::OnSend(DWORD dwNumberOfBytesTransfered)
 {
 	TRACE("OnSend() : %d", dwNumberOfBytesTransfered);
+
+	// One in for each one out, to keep the depth.
+	if(m_Streaming)
+	{
+		PostSend(reinterpret_cast<const char*>(m_StreamData), m_StreamSize);
+	}
 }
 
 
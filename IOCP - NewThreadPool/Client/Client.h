@@ -2,14 +2,17 @@
 
 #include <winsock2.h>
 #include <string>
+#include <vector>
+
+#include "RpcStub.h"
+#include "LoadStub.h"
 
 class Client
 {
 private:
 	enum
 	{
-		MAX_RECV_BUFFER = 1024,
-		MAX_SEND_BUFFER = 1024,
+		MAX_RECV_BUFFER = 8 * 1024,
 	};
 
 public:
@@ -37,6 +40,20 @@ public:
 
 	bool Shutdown();
 
+	// See RpcStub. Only for connected clients.
+	void StartRpc(const RpcStub::Config& config, Histogram* latencies, RpcStub::DoneFunc done, void* context);
+	RpcStub::Stats StopRpc() { return m_Rpc.Stop(); }
+
+	// See LoadStub. Only for connected clients. SendLoad() sends what's due by now, Clock::GetMicroseconds().
+	void StartLoad(const LoadStub::Config& config, Histogram* latencies);
+	void SendLoad(ULONGLONG now);
+	LoadStub::Stats StopLoad() { return m_Load.Stop(); }
+
+	// Keeps depth sends of data in flight until StopStream(), and adds the bytes that come back to received.
+	// data must stay as it is until then.
+	void StartStream(const BYTE* data, DWORD size, DWORD depth, volatile LONGLONG* received);
+	void StopStream() { m_Streaming = false; }
+
 	void OnConnect();
 	void OnRecv(DWORD dwNumberOfBytesTransfered);
 	void OnSend(DWORD dwNumberOfBytesTransfered);
@@ -55,5 +72,14 @@ private:
 	State m_State;
 	SOCKET m_Socket;
 	BYTE m_recvBuffer[MAX_RECV_BUFFER];
-	BYTE m_sendBuffer[MAX_SEND_BUFFER];
+
+	RpcStub m_Rpc;
+	std::vector<BYTE> m_RpcFrames; // only touched by OnRecv().
+
+	LoadStub m_Load;
+
+	volatile bool m_Streaming;
+	const BYTE* m_StreamData;
+	DWORD m_StreamSize;
+	volatile LONGLONG* m_StreamReceived; // kept after the stream stops, for the bytes still coming back.
 };
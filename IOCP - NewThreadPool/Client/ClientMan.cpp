@@ -2,6 +2,7 @@
 #include "Client.h"
 
 #include "..\Log.h"
+#include "..\Clock.h"
 
 #include <cassert>
 
@@ -9,6 +10,13 @@ namespace
 {
 	// Memory Pool for clients.
 	typedef boost::singleton_pool<Client, sizeof(Client)> PoolClient;
+
+	const DWORD STREAM_WARM_UP_MS = 1000;
+
+	// How often a load run sends what's due. The sends of a client are this far apart at most.
+	const DWORD LOAD_TICK_MS = 10;
+	// How long echoes sent at the end of a load run have to come back.
+	const DWORD LOAD_DRAIN_MS = 2000;
 }
 
 
@@ -21,15 +29,42 @@ namespace
 }
 
 
+/* static */ void ClientMan::OnRpcDone(void* context)
+{
+	ClientMan* clientMan = static_cast<ClientMan*>(context);
+	assert(clientMan);
+
+	if(InterlockedDecrement(&clientMan->m_NumRpcRunning) == 0)
+	{
+		SetEvent(clientMan->m_RpcDoneEvent);
+	}
+}
+
+
+/* static */ void CALLBACK ClientMan::WorkerSendLoad(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */)
+{
+	ClientMan* clientMan = static_cast<ClientMan*>(Context);
+	assert(clientMan);
+
+	clientMan->SendLoad();
+}
+
+
 ClientMan::ClientMan(void)
+: m_NumRpcRunning(0),
+  m_StreamReceived(0)
 {
 	InitializeCriticalSection(&m_CSForClients);
+
+	m_RpcDoneEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 }
 
 ClientMan::~ClientMan(void)
 {
 	RemoveClients();
 
+	CloseHandle(m_RpcDoneEvent);
+
 	EnterCriticalSection(&m_CSForClients);
 }
 
@@ -104,6 +139,223 @@ void ClientMan::Send(const string& msg)
 	LeaveCriticalSection(&m_CSForClients);
 }
 
+void ClientMan::RunRpc(const RpcStub::Config& config, DWORD timeoutMs)
+{
+	m_RpcLatencies.Reset();
+	ResetEvent(m_RpcDoneEvent);
+
+	// One for this call, so that clients done before the others have started can't signal the end.
+	m_NumRpcRunning = 1;
+
+	EnterCriticalSection(&m_CSForClients);
+
+	ULONGLONG start = Clock::GetMicroseconds();
+
+	DWORD numClients = 0;
+	for(int i = 0 ; i != static_cast<int>(m_listClient.size()) ; ++i)
+	{
+		if(m_listClient[i]->GetState() == Client::CONNECTED)
+		{
+			InterlockedIncrement(&m_NumRpcRunning);
+			m_listClient[i]->StartRpc(config, &m_RpcLatencies, ClientMan::OnRpcDone, this);
+			++numClients;
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	if(numClients == 0)
+	{
+		TRACE(" No connected clients.");
+		return;
+	}
+
+	if(InterlockedDecrement(&m_NumRpcRunning) != 0 && WaitForSingleObject(m_RpcDoneEvent, timeoutMs) != WAIT_OBJECT_0)
+	{
+		ERROR_MSG("RPC run timed out. %d clients are not done.", m_NumRpcRunning);
+	}
+
+	ULONGLONG elapsed = Clock::GetMicroseconds() - start;
+
+	RpcStub::Stats total;
+	ZeroMemory(&total, sizeof(total));
+
+	EnterCriticalSection(&m_CSForClients);
+
+	for(int i = 0 ; i != static_cast<int>(m_listClient.size()) ; ++i)
+	{
+		// Calls still in flight are given up on.
+		RpcStub::Stats stats = m_listClient[i]->StopRpc();
+		total.succeeded += stats.succeeded;
+		total.failed += stats.failed;
+		total.expired += stats.expired;
+		total.unexpected += stats.unexpected;
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	ULONGLONG answered = m_RpcLatencies.GetCount();
+	ULONGLONG callsPerSecond = elapsed > 0 ? answered * 1000000 / elapsed : 0;
+
+	TRACE(" depth %d, %d clients : %I64d calls answered in %I64d ms, %I64d calls/s",
+		config.depth, numClients, answered, elapsed / 1000, callsPerSecond);
+	TRACE("   succeeded : %d, failed : %d, expired : %d, unexpected : %d",
+		total.succeeded, total.failed, total.expired, total.unexpected);
+	m_RpcLatencies.Trace("RPC round trip", "us");
+}
+
+
+void ClientMan::RunStream(DWORD sendSize, DWORD depth, DWORD seconds)
+{
+	assert(sendSize > 0);
+
+	m_StreamData.assign(sendSize, 'x');
+	m_StreamReceived = 0;
+
+	EnterCriticalSection(&m_CSForClients);
+
+	DWORD numClients = 0;
+	for(int i = 0 ; i != static_cast<int>(m_listClient.size()) ; ++i)
+	{
+		if(m_listClient[i]->GetState() == Client::CONNECTED)
+		{
+			m_listClient[i]->StartStream(&m_StreamData[0], sendSize, depth, &m_StreamReceived);
+			++numClients;
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	if(numClients == 0)
+	{
+		TRACE(" No connected clients.");
+		return;
+	}
+
+	// Until the socket buffers along the way are full.
+	Sleep(STREAM_WARM_UP_MS);
+
+	LONGLONG startBytes = m_StreamReceived;
+	ULONGLONG start = Clock::GetMicroseconds();
+
+	Sleep(seconds * 1000);
+
+	LONGLONG bytes = m_StreamReceived - startBytes;
+	ULONGLONG elapsed = Clock::GetMicroseconds() - start;
+
+	EnterCriticalSection(&m_CSForClients);
+
+	for(int i = 0 ; i != static_cast<int>(m_listClient.size()) ; ++i)
+	{
+		m_listClient[i]->StopStream();
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	ULONGLONG bytesPerSecond = elapsed > 0 ? bytes * 1000000 / elapsed : 0;
+
+	TRACE(" %d clients, %d sends of %d bytes in flight each : %I64d bytes back in %I64d ms, %I64d MB/s",
+		numClients, depth, sendSize, bytes, elapsed / 1000, bytesPerSecond / (1024 * 1024));
+}
+
+
+void ClientMan::RunLoad(const LoadStub::Config& config, DWORD seconds)
+{
+	m_LoadLatencies.Reset();
+
+	TP_TIMER* timer = CreateThreadpoolTimer(ClientMan::WorkerSendLoad, this, NULL);
+	if(timer == NULL)
+	{
+		ERROR_CODE(GetLastError(), "Could not create the load timer.");
+		return;
+	}
+
+	EnterCriticalSection(&m_CSForClients);
+
+	DWORD numClients = 0;
+	for(int i = 0 ; i != static_cast<int>(m_listClient.size()) ; ++i)
+	{
+		if(m_listClient[i]->GetState() == Client::CONNECTED)
+		{
+			m_listClient[i]->StartLoad(config, &m_LoadLatencies);
+			++numClients;
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	if(numClients == 0)
+	{
+		CloseThreadpoolTimer(timer);
+		TRACE(" No connected clients.");
+		return;
+	}
+
+	ULONGLONG start = Clock::GetMicroseconds();
+
+	// Negative due time is relative, in 100 nanoseconds.
+	ULARGE_INTEGER dueTime;
+	dueTime.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(LOAD_TICK_MS) * 10000);
+
+	FILETIME fileDueTime;
+	fileDueTime.dwHighDateTime = dueTime.HighPart;
+	fileDueTime.dwLowDateTime = dueTime.LowPart;
+
+	SetThreadpoolTimer(timer, &fileDueTime, LOAD_TICK_MS, 0);
+
+	Sleep(seconds * 1000);
+
+	SetThreadpoolTimer(timer, NULL, 0, 0);
+	WaitForThreadpoolTimerCallbacks(timer, TRUE);
+	CloseThreadpoolTimer(timer);
+
+	ULONGLONG elapsed = Clock::GetMicroseconds() - start;
+
+	Sleep(LOAD_DRAIN_MS);
+
+	LoadStub::Stats total;
+	ZeroMemory(&total, sizeof(total));
+
+	EnterCriticalSection(&m_CSForClients);
+
+	for(int i = 0 ; i != static_cast<int>(m_listClient.size()) ; ++i)
+	{
+		LoadStub::Stats stats = m_listClient[i]->StopLoad();
+		total.echoesSent += stats.echoesSent;
+		total.echoesAnswered += stats.echoesAnswered;
+		total.publishesSent += stats.publishesSent;
+		total.publishesReceived += stats.publishesReceived;
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	ULONGLONG echoesPerSecond = elapsed > 0 ? total.echoesAnswered * 1000000 / elapsed : 0;
+
+	TRACE(" %d clients, %d echoes/s and %d publishes/s each for %I64d ms : echoes %I64d sent, %I64d answered, %I64d answered/s",
+		numClients, config.echoRate, config.publishRate, elapsed / 1000, total.echoesSent, total.echoesAnswered, echoesPerSecond);
+	TRACE("   publishes : %I64d sent, %I64d delivered", total.publishesSent, total.publishesReceived);
+	m_LoadLatencies.Trace("Echo round trip", "us");
+}
+
+
+void ClientMan::SendLoad()
+{
+	ULONGLONG now = Clock::GetMicroseconds();
+
+	EnterCriticalSection(&m_CSForClients);
+
+	for(int i = 0 ; i != static_cast<int>(m_listClient.size()) ; ++i)
+	{
+		if(m_listClient[i]->GetState() == Client::CONNECTED)
+		{
+			m_listClient[i]->SendLoad(now);
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
 void ClientMan::PostRemoveClient(Client* client)
 {
 	if(TrySubmitThreadpoolCallback(ClientMan::WorkerRemoveClient, client, NULL) == false)
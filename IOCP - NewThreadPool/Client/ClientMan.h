@@ -5,6 +5,9 @@
 #include <boost\pool\object_pool.hpp>
 
 #include "..\TSingleton.h"
+#include "..\Histogram.h"
+#include "RpcStub.h"
+#include "LoadStub.h"
 
 class Client;
 
@@ -15,6 +18,11 @@ class ClientMan : public TSingleton<ClientMan>
 private:
 	static void CALLBACK WorkerRemoveClient(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context);
 
+	// RpcStub callback
+	static void OnRpcDone(void* context);
+
+	static void CALLBACK WorkerSendLoad(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */);
+
 public:
 	ClientMan(void);
 	virtual ~ClientMan(void);
@@ -26,11 +34,25 @@ public:
 	void PostRemoveClient(Client* client);
 	void Send(const string& msg);
 
+	// Makes config.numCalls calls on every connected client, config.depth at a time,
+	// and traces the round trips once they are all answered or timeoutMs has passed.
+	void RunRpc(const RpcStub::Config& config, DWORD timeoutMs);
+
+	// Streams sendSize-byte sends from every connected client, depth in flight each, to an echo server or
+	// a proxy in front of one, and traces the bytes/s that came back over seconds after a second of warm-up.
+	void RunStream(DWORD sendSize, DWORD depth, DWORD seconds);
+
+	// Sends config.echoRate echoes and config.publishRate publishes a second from every connected client for seconds,
+	// whether they are answered or not, and traces how many came back and the round trips of the echoes.
+	// Run at twice the echoes/s the server can answer to see what it does when overloaded.
+	void RunLoad(const LoadStub::Config& config, DWORD seconds);
+
 	bool IsAlive(const Client* client);
 	size_t GetNumClients();
 
 private:
 	void RemoveClient(Client* client);
+	void SendLoad();
 
 
 private:
@@ -41,4 +63,16 @@ private:
 	PoolTypeClient m_PoolClient;
 
 	CRITICAL_SECTION m_CSForClients;
+
+	// Of the current RunRpc().
+	Histogram m_RpcLatencies;
+	volatile LONG m_NumRpcRunning;
+	HANDLE m_RpcDoneEvent;
+
+	// Of the current RunStream().
+	vector<BYTE> m_StreamData;
+	volatile LONGLONG m_StreamReceived;
+
+	// Of the current RunLoad().
+	Histogram m_LoadLatencies;
 };
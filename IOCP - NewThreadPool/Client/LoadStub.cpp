@@ -0,0 +1,206 @@
+#include "LoadStub.h"
+
+#include "..\Log.h"
+#include "..\Clock.h"
+#include "..\Histogram.h"
+#include "..\Protocol.h"
+#include "..\Messages.h"
+
+#include <cassert>
+
+using namespace std;
+
+
+LoadStub::LoadStub()
+: m_Running(false),
+  m_StartTime(0),
+  m_Latencies(NULL)
+{
+	ZeroMemory(&m_Config, sizeof(m_Config));
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	InitializeCriticalSection(&m_CS);
+}
+
+
+LoadStub::~LoadStub()
+{
+	DeleteCriticalSection(&m_CS);
+}
+
+
+void LoadStub::Start(const Config& config, Histogram* latencies, vector<BYTE>& frames)
+{
+	assert(config.echoRate == 0 || config.echoSize >= sizeof(ULONGLONG));
+	assert(latencies);
+
+	EnterCriticalSection(&m_CS);
+
+	m_Running = true;
+	m_Config = config;
+	m_StartTime = Clock::GetMicroseconds();
+	m_Partial.clear();
+	m_Latencies = latencies;
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	if(m_Config.publishRate > 0)
+	{
+		size_t offset = frames.size();
+		frames.resize(offset + Messages::SubscribeBuilder::GetFrameSize());
+
+		Messages::SubscribeBuilder builder(&frames[offset]);
+		builder.SetChannel(m_Config.channel);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+LoadStub::Stats LoadStub::Stop()
+{
+	EnterCriticalSection(&m_CS);
+
+	m_Running = false;
+
+	Stats stats = m_Stats;
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	LeaveCriticalSection(&m_CS);
+
+	return stats;
+}
+
+
+void LoadStub::MakeFrames(ULONGLONG now, vector<BYTE>& frames)
+{
+	EnterCriticalSection(&m_CS);
+
+	if(!m_Running)
+	{
+		LeaveCriticalSection(&m_CS);
+		return;
+	}
+
+	// As many as are due since the start, so that a late call catches up instead of lowering the rate.
+	ULONGLONG elapsed = now - m_StartTime;
+	ULONGLONG echoesDue = elapsed * m_Config.echoRate / 1000000;
+	ULONGLONG publishesDue = elapsed * m_Config.publishRate / 1000000;
+
+	DWORD echoFrameSize = Protocol::HEADER_SIZE + m_Config.echoSize;
+	for( ; m_Stats.echoesSent < echoesDue ; ++m_Stats.echoesSent)
+	{
+		size_t offset = frames.size();
+		frames.resize(offset + echoFrameSize, 0);
+
+		BYTE* payload = Schema::WriteHeader(&frames[offset], Protocol::OP_ECHO, m_Config.echoSize);
+		Schema::Store(payload, now);
+	}
+
+	DWORD publishFrameSize = Messages::PublishBuilder::GetFrameSize(m_Config.publishSize);
+	for( ; m_Stats.publishesSent < publishesDue ; ++m_Stats.publishesSent)
+	{
+		size_t offset = frames.size();
+		frames.resize(offset + publishFrameSize);
+
+		Messages::PublishBuilder builder(&frames[offset], m_Config.publishSize);
+		builder.SetChannel(m_Config.channel);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+bool LoadStub::OnRecv(const BYTE* data, DWORD size)
+{
+	ULONGLONG now = Clock::GetMicroseconds();
+	bool valid = true;
+
+	EnterCriticalSection(&m_CS);
+
+	// Finish the split frame first. Whole frames after it are read in place.
+	if(!m_Partial.empty())
+	{
+		m_Partial.insert(m_Partial.end(), data, data + size);
+		data = &m_Partial[0];
+		size = static_cast<DWORD>(m_Partial.size());
+	}
+
+	DWORD offset = 0;
+	while(offset < size)
+	{
+		DWORD frameSize = GetFrameSize(data + offset, size - offset);
+		if(frameSize == 0)
+		{
+			break;
+		}
+
+		if(frameSize > Protocol::MAX_FRAME_SIZE)
+		{
+			ERROR_MSG("Frame too big : %d bytes", frameSize);
+			valid = false;
+			break;
+		}
+
+		if(frameSize > size - offset)
+		{
+			break;
+		}
+
+		OnFrame(data + offset, frameSize, now);
+		offset += frameSize;
+	}
+
+	if(valid)
+	{
+		// Keep the rest for the next recv. data may point into m_Partial itself.
+		if(!m_Partial.empty())
+		{
+			m_Partial.erase(m_Partial.begin(), m_Partial.begin() + offset);
+		}
+		else
+		{
+			m_Partial.assign(data + offset, data + size);
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+
+	return valid;
+}
+
+
+/* static */ DWORD LoadStub::GetFrameSize(const BYTE* data, DWORD size)
+{
+	if(size < Protocol::HEADER_SIZE)
+	{
+		return 0;
+	}
+
+	Protocol::Header header;
+	CopyMemory(&header, data, sizeof(header));
+
+	// Compared before adding, so that a huge size can't overflow.
+	if(header.size > Protocol::MAX_PAYLOAD_SIZE)
+	{
+		return Protocol::MAX_FRAME_SIZE + 1;
+	}
+
+	return Protocol::HEADER_SIZE + header.size;
+}
+
+
+void LoadStub::OnFrame(const BYTE* frame, DWORD size, ULONGLONG now)
+{
+	Protocol::Header header;
+	CopyMemory(&header, frame, sizeof(header));
+
+	if(header.opcode == Protocol::OP_ECHO && header.size >= sizeof(ULONGLONG))
+	{
+		m_Latencies->Record(now - Schema::Load<ULONGLONG>(frame + Protocol::HEADER_SIZE));
+		++m_Stats.echoesAnswered;
+	}
+	else if(header.opcode == Protocol::OP_PUBLISH)
+	{
+		++m_Stats.publishesReceived;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <winsock2.h>
+#include <vector>
+
+class Histogram;
+
+// Client side of an open-loop load on one connection : echoes and publishes at fixed rates, whether the server
+// keeps up or not. RpcStub waits for answers, so it slows down with the server and never overloads it.
+// Echoes carry the time they were sent, and the round trips of the ones that come back are recorded.
+// Publishes go to a channel the connection subscribes to, like every other connection of the run.
+// While this runs, everything the connection receives has to be Protocol frames.
+class LoadStub
+{
+public:
+	struct Config
+	{
+		DWORD echoRate;		// a second.
+		DWORD echoSize;		// payload bytes, a ULONGLONG at least.
+		DWORD publishRate;	// a second.
+		DWORD publishSize;	// data bytes.
+		DWORD channel;
+	};
+
+	struct Stats
+	{
+		ULONGLONG echoesSent;
+		ULONGLONG echoesAnswered;
+		ULONGLONG publishesSent;
+		ULONGLONG publishesReceived;
+	};
+
+public:
+	LoadStub();
+	~LoadStub();
+
+	// Starts a run. frames gets the subscription to send. latencies are in microseconds and can be shared.
+	void Start(const Config& config, Histogram* latencies, std::vector<BYTE>& frames);
+	// Returns the stats of the run. Echoes still in flight are never answered as far as it's concerned.
+	Stats Stop();
+
+	// frames gets the echoes and publishes that are due by now, Clock::GetMicroseconds().
+	void MakeFrames(ULONGLONG now, std::vector<BYTE>& frames);
+
+	// Takes received bytes. Returns false if they aren't Protocol frames.
+	bool OnRecv(const BYTE* data, DWORD size);
+
+	bool IsRunning() { return m_Running; }
+
+private:
+	// Returns the size of the frame at data, or 0 if its header isn't all there yet.
+	static DWORD GetFrameSize(const BYTE* data, DWORD size);
+
+	void OnFrame(const BYTE* frame, DWORD size, ULONGLONG now);
+
+private:
+	LoadStub(const LoadStub& rhs);
+	LoadStub& operator=(const LoadStub& rhs);
+
+private:
+	// Everything is guarded by m_CS.
+	volatile bool m_Running;
+	Config m_Config;
+	ULONGLONG m_StartTime;
+
+	// The start of a frame that was split across recvs.
+	std::vector<BYTE> m_Partial;
+
+	Histogram* m_Latencies;
+	Stats m_Stats;
+
+	CRITICAL_SECTION m_CS;
+};
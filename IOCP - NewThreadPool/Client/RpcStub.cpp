@@ -0,0 +1,230 @@
+#include "RpcStub.h"
+
+#include "..\Log.h"
+#include "..\Clock.h"
+#include "..\Histogram.h"
+#include "..\Protocol.h"
+#include "..\Messages.h"
+
+#include <cassert>
+
+using namespace std;
+
+
+RpcStub::RpcStub()
+: m_Started(false),
+  m_Running(false),
+  m_NumCallsMade(0),
+  m_NextId(0),
+  m_Latencies(NULL),
+  m_Done(NULL),
+  m_DoneContext(NULL)
+{
+	ZeroMemory(&m_Config, sizeof(m_Config));
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	InitializeCriticalSection(&m_CS);
+}
+
+
+RpcStub::~RpcStub()
+{
+	DeleteCriticalSection(&m_CS);
+}
+
+
+void RpcStub::Start(const Config& config, Histogram* latencies, DoneFunc done, void* context, vector<BYTE>& frames)
+{
+	assert(config.depth > 0 && config.depth <= MAX_DEPTH);
+	assert(latencies);
+
+	EnterCriticalSection(&m_CS);
+
+	m_Started = true;
+	m_Running = true;
+	m_Config = config;
+	m_NumCallsMade = 0;
+	m_Calls.clear();
+	m_Latencies = latencies;
+	m_Done = done;
+	m_DoneContext = context;
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	MakeCalls(Clock::GetMicroseconds(), frames);
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+RpcStub::Stats RpcStub::Stop()
+{
+	EnterCriticalSection(&m_CS);
+
+	m_Running = false;
+	m_Calls.clear();
+
+	Stats stats = m_Stats;
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	LeaveCriticalSection(&m_CS);
+
+	return stats;
+}
+
+
+bool RpcStub::OnRecv(const BYTE* data, DWORD size, vector<BYTE>& frames)
+{
+	ULONGLONG now = Clock::GetMicroseconds();
+	bool valid = true;
+
+	EnterCriticalSection(&m_CS);
+
+	// Finish the split frame first. Whole frames after it are read in place.
+	if(!m_Partial.empty())
+	{
+		m_Partial.insert(m_Partial.end(), data, data + size);
+		data = &m_Partial[0];
+		size = static_cast<DWORD>(m_Partial.size());
+	}
+
+	DWORD offset = 0;
+	while(offset < size)
+	{
+		DWORD frameSize = GetFrameSize(data + offset, size - offset);
+		if(frameSize == 0)
+		{
+			break;
+		}
+
+		if(frameSize > Protocol::MAX_FRAME_SIZE)
+		{
+			ERROR_MSG("Frame too big : %d bytes", frameSize);
+			valid = false;
+			break;
+		}
+
+		if(frameSize > size - offset)
+		{
+			break;
+		}
+
+		OnFrame(data + offset, frameSize, now);
+		offset += frameSize;
+	}
+
+	if(valid)
+	{
+		// Keep the rest for the next recv. data may point into m_Partial itself.
+		if(!m_Partial.empty())
+		{
+			m_Partial.erase(m_Partial.begin(), m_Partial.begin() + offset);
+		}
+		else
+		{
+			m_Partial.assign(data + offset, data + size);
+		}
+
+		MakeCalls(now, frames);
+	}
+
+	LeaveCriticalSection(&m_CS);
+
+	return valid;
+}
+
+
+/* static */ DWORD RpcStub::GetFrameSize(const BYTE* data, DWORD size)
+{
+	if(size < Protocol::HEADER_SIZE)
+	{
+		return 0;
+	}
+
+	Protocol::Header header;
+	CopyMemory(&header, data, sizeof(header));
+
+	// Compared before adding, so that a huge size can't overflow.
+	if(header.size > Protocol::MAX_PAYLOAD_SIZE)
+	{
+		return Protocol::MAX_FRAME_SIZE + 1;
+	}
+
+	return Protocol::HEADER_SIZE + header.size;
+}
+
+
+void RpcStub::OnFrame(const BYTE* frame, DWORD size, ULONGLONG now)
+{
+	Messages::RpcResponseView response;
+	if(!response.Init(frame, size))
+	{
+		// Not ours. Position updates and the like.
+		return;
+	}
+
+	CallMap::iterator itor = m_Calls.find(response.GetId());
+	if(itor == m_Calls.end())
+	{
+		++m_Stats.unexpected;
+		return;
+	}
+
+	m_Latencies->Record(now - itor->second);
+	m_Calls.erase(itor);
+
+	switch(response.GetStatus())
+	{
+	case Protocol::RPC_OK:					++m_Stats.succeeded; break;
+	case Protocol::RPC_DEADLINE_EXCEEDED:	++m_Stats.expired; break;
+	default:								++m_Stats.failed; break;
+	}
+
+	if(m_Running && m_Calls.empty() && m_NumCallsMade == m_Config.numCalls)
+	{
+		m_Running = false;
+
+		if(m_Done != NULL)
+		{
+			m_Done(m_DoneContext);
+		}
+	}
+}
+
+
+void RpcStub::MakeCalls(ULONGLONG now, vector<BYTE>& frames)
+{
+	if(!m_Running)
+	{
+		return;
+	}
+
+	DWORD argsSize = m_Config.argsSize;
+	if(m_Config.method == Protocol::RPC_METHOD_DELAY && argsSize < sizeof(DWORD))
+	{
+		argsSize = sizeof(DWORD);
+	}
+
+	DWORD frameSize = Messages::RpcRequestBuilder::GetFrameSize(argsSize);
+
+	while(m_Calls.size() < m_Config.depth && m_NumCallsMade < m_Config.numCalls)
+	{
+		size_t offset = frames.size();
+		frames.resize(offset + frameSize);
+
+		DWORD id = m_NextId++;
+
+		Messages::RpcRequestBuilder builder(&frames[offset], argsSize);
+		builder.SetId(id);
+		builder.SetMethod(m_Config.method);
+		builder.SetDeadlineMs(m_Config.deadlineMs);
+
+		// The builder zeroed the args.
+		if(m_Config.method == Protocol::RPC_METHOD_DELAY)
+		{
+			Schema::Store(builder.GetArgs(), m_Config.delayMs);
+		}
+
+		m_Calls[id] = now;
+		++m_NumCallsMade;
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <winsock2.h>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+class Histogram;
+
+// Client side of the server's RPC calls, for load. Keeps a number of calls in flight on one connection (the depth),
+// and every response is replaced with a new call until numCalls have been made.
+// Responses can come in any order. They are matched with their calls by id, and the round trips are recorded.
+// Once this has started, everything the connection receives has to be Protocol frames.
+class RpcStub
+{
+public:
+	enum
+	{
+		MAX_DEPTH = 256,
+	};
+
+	struct Config
+	{
+		DWORD depth;		// 1 ~ MAX_DEPTH
+		DWORD numCalls;
+		DWORD method;		// Protocol::RpcMethod
+		DWORD argsSize;
+		DWORD delayMs;		// for RPC_METHOD_DELAY. The first DWORD of the args.
+		DWORD deadlineMs;	// 0 for none.
+	};
+
+	struct Stats
+	{
+		DWORD succeeded;
+		DWORD failed;
+		DWORD expired;
+		DWORD unexpected;	// responses without a call in flight.
+	};
+
+	// Called once all the calls of a run are answered.
+	typedef void (*DoneFunc)(void* context);
+
+public:
+	RpcStub();
+	~RpcStub();
+
+	// Starts a run. frames gets the first calls to send. latencies are in microseconds and can be shared.
+	void Start(const Config& config, Histogram* latencies, DoneFunc done, void* context, std::vector<BYTE>& frames);
+	// Stops making calls and returns the stats of the run. Answers of the calls in flight are unexpected from now on.
+	Stats Stop();
+
+	// Takes received bytes. frames gets the calls that replace the answered ones.
+	// Returns false if the bytes aren't Protocol frames.
+	bool OnRecv(const BYTE* data, DWORD size, std::vector<BYTE>& frames);
+
+	bool HasStarted() { return m_Started; }
+
+private:
+	// Returns the size of the frame at data, or 0 if its header isn't all there yet.
+	static DWORD GetFrameSize(const BYTE* data, DWORD size);
+
+	void OnFrame(const BYTE* frame, DWORD size, ULONGLONG now);
+	void MakeCalls(ULONGLONG now, std::vector<BYTE>& frames);
+
+private:
+	RpcStub(const RpcStub& rhs);
+	RpcStub& operator=(const RpcStub& rhs);
+
+private:
+	// Everything is guarded by m_CS.
+	volatile bool m_Started;
+	bool m_Running;
+	Config m_Config;
+	DWORD m_NumCallsMade;
+	DWORD m_NextId;
+
+	// Id to the time the call was made.
+	typedef boost::unordered_map<DWORD, ULONGLONG> CallMap;
+	CallMap m_Calls;
+
+	// The start of a frame that was split across recvs.
+	std::vector<BYTE> m_Partial;
+
+	Histogram* m_Latencies;
+	DoneFunc m_Done;
+	void* m_DoneContext;
+	Stats m_Stats;
+
+	CRITICAL_SECTION m_CS;
+};
@@ -2,11 +2,29 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <sstream>
 using namespace std;
 
 #include "..\\Log.h"
 #include "..\\Network.h"
 #include "ClientMan.h"
+#include "..\\Protocol.h"
+
+namespace
+{
+	// How long a run of RPC calls may take before the calls still in flight are given up on.
+	const DWORD RPC_RUN_TIMEOUT_MS = 60 * 1000;
+
+	// [args bytes] [delay ms] [deadline ms] after the command. Echo calls unless there's a delay.
+	void ReadRpcOptions(istringstream& args, RpcStub::Config& config)
+	{
+		if(!(args >> config.argsSize)) config.argsSize = 64;
+		if(!(args >> config.delayMs)) config.delayMs = 0;
+		if(!(args >> config.deadlineMs)) config.deadlineMs = 0;
+
+		config.method = config.delayMs > 0 ? Protocol::RPC_METHOD_DELAY : Protocol::RPC_METHOD_ECHO;
+	}
+}
 
 void main(int argc, char* argv[])
 {
@@ -58,6 +76,84 @@ void main(int argc, char* argv[])
 		{
 			ClientMan::Instance()->RemoveClients();
 		}
+		else if(input.compare(0, 10, "`rpc_sweep") == 0)
+		{
+			// `rpc_sweep <calls per client> [args bytes] [delay ms] [deadline ms]
+			// Runs depth 1, 2, 4, ... RpcStub::MAX_DEPTH one after another. The server has to be in framed mode.
+			istringstream args(input.substr(10));
+			RpcStub::Config config;
+			ZeroMemory(&config, sizeof(config));
+			if(!(args >> config.numCalls) || config.numCalls == 0)
+			{
+				TRACE("`rpc_sweep <calls per client> [args bytes] [delay ms] [deadline ms]");
+			}
+			else
+			{
+				ReadRpcOptions(args, config);
+
+				for(config.depth = 1 ; config.depth <= RpcStub::MAX_DEPTH ; config.depth *= 2)
+				{
+					ClientMan::Instance()->RunRpc(config, RPC_RUN_TIMEOUT_MS);
+				}
+			}
+		}
+		else if(input.compare(0, 4, "`rpc") == 0)
+		{
+			// `rpc <depth> <calls per client> [args bytes] [delay ms] [deadline ms]
+			istringstream args(input.substr(4));
+			RpcStub::Config config;
+			ZeroMemory(&config, sizeof(config));
+			if(!(args >> config.depth >> config.numCalls) || config.depth == 0 || config.depth > RpcStub::MAX_DEPTH || config.numCalls == 0)
+			{
+				TRACE("`rpc <depth 1 ~ %d> <calls per client> [args bytes] [delay ms] [deadline ms]", RpcStub::MAX_DEPTH);
+			}
+			else
+			{
+				ReadRpcOptions(args, config);
+				ClientMan::Instance()->RunRpc(config, RPC_RUN_TIMEOUT_MS);
+			}
+		}
+		else if(input.compare(0, 7, "`stream") == 0)
+		{
+			// `stream <seconds> [bytes per send] [sends in flight]
+			// Against the server in raw mode for the echo baseline, then against a -proxy server in front of it.
+			istringstream args(input.substr(7));
+			DWORD seconds = 0, sendSize = 0, depth = 0;
+			if(!(args >> seconds) || seconds == 0)
+			{
+				TRACE("`stream <seconds> [bytes per send] [sends in flight]");
+			}
+			else
+			{
+				if(!(args >> sendSize) || sendSize == 0) sendSize = 16 * 1024;
+				if(!(args >> depth) || depth == 0) depth = 4;
+
+				ClientMan::Instance()->RunStream(sendSize, depth, seconds);
+			}
+		}
+		else if(input.compare(0, 9, "`overload") == 0)
+		{
+			// `overload <seconds> <echoes/s per client> [publishes/s per client] [channel]
+			// Find the echoes/s the server answers with a run it keeps up with, then run at twice that,
+			// with the server's `overload on and off, and compare the round trips.
+			istringstream args(input.substr(9));
+			DWORD seconds = 0;
+			LoadStub::Config config;
+			ZeroMemory(&config, sizeof(config));
+			if(!(args >> seconds >> config.echoRate) || seconds == 0)
+			{
+				TRACE("`overload <seconds> <echoes/s per client> [publishes/s per client] [channel]");
+			}
+			else
+			{
+				if(!(args >> config.publishRate)) config.publishRate = 0;
+				if(!(args >> config.channel)) config.channel = 1;
+				config.echoSize = 64;
+				config.publishSize = 64;
+
+				ClientMan::Instance()->RunLoad(config, seconds);
+			}
+		}
 		else if(input == "`enable_trace")
 		{
 			Log::EnableTrace(true);
@@ -0,0 +1,26 @@
+#include "Clock.h"
+
+namespace
+{
+	LONGLONG QueryFrequency()
+	{
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		return frequency.QuadPart;
+	}
+
+	const LONGLONG s_Frequency = QueryFrequency();
+}
+
+
+ULONGLONG Clock::GetMicroseconds()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	// Split to avoid overflowing on a long uptime.
+	ULONGLONG seconds = counter.QuadPart / s_Frequency;
+	ULONGLONG remainder = counter.QuadPart % s_Frequency;
+
+	return seconds * 1000000 + (remainder * 1000000) / s_Frequency;
+}
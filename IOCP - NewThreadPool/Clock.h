@@ -0,0 +1,9 @@
+#pragma once
+
+#include <windows.h>
+
+namespace Clock
+{
+	// Microseconds from an arbitrary point. Backed by QueryPerformanceCounter().
+	ULONGLONG GetMicroseconds();
+}
@@ -0,0 +1,147 @@
+#include "Histogram.h"
+#include "Log.h"
+
+#include <intrin.h>
+#include <cassert>
+
+
+Histogram::Histogram()
+{
+	Reset();
+}
+
+
+void Histogram::Record(ULONGLONG value)
+{
+	InterlockedIncrement(&m_Buckets[GetBucket(value)]);
+	InterlockedIncrement64(&m_Count);
+	InterlockedExchangeAdd64(&m_Sum, static_cast<LONGLONG>(value));
+
+	LONGLONG max = m_Max;
+	while(static_cast<ULONGLONG>(max) < value)
+	{
+		LONGLONG old = InterlockedCompareExchange64(&m_Max, static_cast<LONGLONG>(value), max);
+		if(old == max)
+		{
+			break;
+		}
+		max = old;
+	}
+}
+
+
+void Histogram::Reset()
+{
+	for(int i = 0 ; i < NUM_BUCKETS ; ++i)
+	{
+		m_Buckets[i] = 0;
+	}
+
+	m_Count = 0;
+	m_Sum = 0;
+	m_Max = 0;
+}
+
+
+void Histogram::Merge(const Histogram& other)
+{
+	for(int i = 0 ; i < NUM_BUCKETS ; ++i)
+	{
+		if(other.m_Buckets[i] != 0)
+		{
+			InterlockedExchangeAdd(&m_Buckets[i], other.m_Buckets[i]);
+		}
+	}
+
+	InterlockedExchangeAdd64(&m_Count, other.m_Count);
+	InterlockedExchangeAdd64(&m_Sum, other.m_Sum);
+	if(other.m_Max > m_Max)
+	{
+		m_Max = other.m_Max;
+	}
+}
+
+
+ULONGLONG Histogram::GetMean() const
+{
+	return m_Count > 0 ? m_Sum / m_Count : 0;
+}
+
+
+ULONGLONG Histogram::GetPercentile(double percentile) const
+{
+	if(m_Count == 0)
+	{
+		return 0;
+	}
+
+	// The rank of the value we want, 1-based.
+	ULONGLONG rank = static_cast<ULONGLONG>(percentile / 100.0 * m_Count + 0.5);
+	if(rank < 1) rank = 1;
+	if(rank > static_cast<ULONGLONG>(m_Count)) rank = m_Count;
+
+	ULONGLONG seen = 0;
+	for(DWORD i = 0 ; i < NUM_BUCKETS ; ++i)
+	{
+		seen += m_Buckets[i];
+		if(seen >= rank)
+		{
+			// Never report more than what was really recorded.
+			ULONGLONG bound = GetBucketUpperBound(i);
+			return bound < static_cast<ULONGLONG>(m_Max) ? bound : m_Max;
+		}
+	}
+
+	return m_Max;
+}
+
+
+void Histogram::Trace(const char* name, const char* unit) const
+{
+	TRACE(" %s : count %I64d, mean %I64d, p50 %I64d, p90 %I64d, p99 %I64d, p99.9 %I64d, max %I64d (%s)",
+		name, m_Count, GetMean(), GetPercentile(50.0), GetPercentile(90.0), GetPercentile(99.0), GetPercentile(99.9), m_Max, unit);
+}
+
+
+/* static */ DWORD Histogram::GetBucket(ULONGLONG value)
+{
+	if(value < SUB_BUCKETS)
+	{
+		return static_cast<DWORD>(value);
+	}
+
+	// _BitScanReverse64() is x64 only.
+	unsigned long msb = 0;
+	DWORD high = static_cast<DWORD>(value >> 32);
+	if(high != 0)
+	{
+		_BitScanReverse(&msb, high);
+		msb += 32;
+	}
+	else
+	{
+		_BitScanReverse(&msb, static_cast<DWORD>(value));
+	}
+
+	// The top SUB_BUCKET_BITS + 1 bits pick the bucket.
+	DWORD shift = msb - SUB_BUCKET_BITS;
+	DWORD sub = static_cast<DWORD>(value >> shift) - SUB_BUCKETS;
+
+	return (shift + 1) * SUB_BUCKETS + sub;
+}
+
+
+/* static */ ULONGLONG Histogram::GetBucketUpperBound(DWORD bucket)
+{
+	assert(bucket < NUM_BUCKETS);
+
+	if(bucket < SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	DWORD shift = bucket / SUB_BUCKETS - 1;
+	ULONGLONG lower = static_cast<ULONGLONG>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+
+	return lower + ((static_cast<ULONGLONG>(1) << shift) - 1);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <windows.h>
+
+// Counts of values, usually microseconds, in log-linear buckets.
+// Values below SUB_BUCKETS are exact. Above that every power of two is split into SUB_BUCKETS buckets,
+// so a percentile is off by less than 1/SUB_BUCKETS of its value. Record() is lock-free.
+class Histogram
+{
+public:
+	enum
+	{
+		SUB_BUCKET_BITS = 4,
+		SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+		NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS,
+	};
+
+public:
+	Histogram();
+
+	void Record(ULONGLONG value);
+	void Reset();
+
+	// Adds the counts of other to this.
+	void Merge(const Histogram& other);
+
+	ULONGLONG GetCount() const { return m_Count; }
+	ULONGLONG GetMax() const { return m_Max; }
+	ULONGLONG GetMean() const;
+
+	// The upper bound of the bucket the percentile falls in. percentile is 0 ~ 100.
+	ULONGLONG GetPercentile(double percentile) const;
+
+	// One line of count, mean, p50, p90, p99, p99.9 and max.
+	void Trace(const char* name, const char* unit) const;
+
+private:
+	static DWORD GetBucket(ULONGLONG value);
+	static ULONGLONG GetBucketUpperBound(DWORD bucket);
+
+private:
+	volatile LONG m_Buckets[NUM_BUCKETS];
+	volatile LONGLONG m_Count;
+	volatile LONGLONG m_Sum;
+	volatile LONGLONG m_Max;
+};
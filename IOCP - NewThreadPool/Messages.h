@@ -0,0 +1,1299 @@
+#pragma once
+
+// Generated by SchemaGen from Messages.schema. Don't edit.
+
+#include <windows.h>
+#include "Protocol.h"
+#include "Schema.h"
+
+namespace Messages
+{
+#pragma pack(push, 1)
+	struct EntityUpdate
+	{
+		DWORD id;
+		float x;
+		float y;
+	};
+#pragma pack(pop)
+
+	class SubscribeView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_SUBSCRIBE,
+			FIXED_SIZE = 4,
+		};
+
+	public:
+		SubscribeView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid Subscribe.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetChannel() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class SubscribeBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + SubscribeView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit SubscribeBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, SubscribeView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, SubscribeView::FIXED_SIZE);
+		}
+
+		void SetChannel(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class UnsubscribeView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_UNSUBSCRIBE,
+			FIXED_SIZE = 4,
+		};
+
+	public:
+		UnsubscribeView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid Unsubscribe.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetChannel() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class UnsubscribeBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + UnsubscribeView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit UnsubscribeBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, UnsubscribeView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, UnsubscribeView::FIXED_SIZE);
+		}
+
+		void SetChannel(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class PublishView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_PUBLISH,
+			FIXED_SIZE = 12,
+		};
+
+	public:
+		PublishView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid Publish.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 4, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_DataOffset = Schema::Load<DWORD>(m_Payload + 4);
+			m_DataCount = Schema::Load<DWORD>(m_Payload + 8);
+
+			return true;
+		}
+
+		DWORD GetChannel() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetDataCount() const { return m_DataCount; }
+		const BYTE* GetData() const { return m_Payload + m_DataOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_DataOffset;
+		DWORD m_DataCount;
+	};
+
+	class PublishBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD dataCount)
+		{
+			return Protocol::HEADER_SIZE + PublishView::FIXED_SIZE + dataCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		PublishBuilder(BYTE* frame, DWORD dataCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, PublishView::OPCODE, GetFrameSize(dataCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, PublishView::FIXED_SIZE);
+
+			m_DataOffset = PublishView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 4, m_DataOffset);
+			Schema::Store<DWORD>(m_Payload + 8, dataCount);
+		}
+
+		void SetChannel(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		// dataCount bytes to fill.
+		BYTE* GetData() { return m_Payload + m_DataOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_DataOffset;
+	};
+
+	class MoveView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_MOVE,
+			FIXED_SIZE = 8,
+		};
+
+	public:
+		MoveView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid Move.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		float GetX() const { return Schema::Load<float>(m_Payload + 0); }
+
+		float GetY() const { return Schema::Load<float>(m_Payload + 4); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class MoveBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + MoveView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit MoveBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, MoveView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, MoveView::FIXED_SIZE);
+		}
+
+		void SetX(float value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		void SetY(float value)
+		{
+			Schema::Store(m_Payload + 4, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class EntityUpdatesView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_ENTITY_UPDATES,
+			FIXED_SIZE = 16,
+		};
+
+	public:
+		EntityUpdatesView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid EntityUpdates.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 8, sizeof(EntityUpdate)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_EntitiesOffset = Schema::Load<DWORD>(m_Payload + 8);
+			m_EntitiesCount = Schema::Load<DWORD>(m_Payload + 12);
+
+			return true;
+		}
+
+		bool HasTick() const { return (Schema::Load<DWORD>(m_Payload) & 1) != 0; }
+		// 0 if it's not there.
+		DWORD GetTick() const { return Schema::Load<DWORD>(m_Payload + 4); }
+
+		DWORD GetEntitiesCount() const { return m_EntitiesCount; }
+		EntityUpdate GetEntities(DWORD index) const { return Schema::Load<EntityUpdate>(m_Payload + m_EntitiesOffset + index * sizeof(EntityUpdate)); }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_EntitiesOffset;
+		DWORD m_EntitiesCount;
+	};
+
+	class EntityUpdatesBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD entitiesCount)
+		{
+			return Protocol::HEADER_SIZE + EntityUpdatesView::FIXED_SIZE + entitiesCount * sizeof(EntityUpdate);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		EntityUpdatesBuilder(BYTE* frame, DWORD entitiesCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, EntityUpdatesView::OPCODE, GetFrameSize(entitiesCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, EntityUpdatesView::FIXED_SIZE);
+
+			m_EntitiesOffset = EntityUpdatesView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 8, m_EntitiesOffset);
+			Schema::Store<DWORD>(m_Payload + 12, entitiesCount);
+		}
+
+		void SetTick(DWORD value)
+		{
+			Schema::Store<DWORD>(m_Payload, Schema::Load<DWORD>(m_Payload) | 1);
+			Schema::Store(m_Payload + 4, value);
+		}
+
+		void SetEntities(DWORD index, const EntityUpdate& value) { Schema::Store(m_Payload + m_EntitiesOffset + index * sizeof(EntityUpdate), value); }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_EntitiesOffset;
+	};
+
+	class SnapshotAckView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_SNAPSHOT_ACK,
+			FIXED_SIZE = 4,
+		};
+
+	public:
+		SnapshotAckView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid SnapshotAck.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetSequence() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class SnapshotAckBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + SnapshotAckView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit SnapshotAckBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, SnapshotAckView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, SnapshotAckView::FIXED_SIZE);
+		}
+
+		void SetSequence(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class RpcRequestView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_RPC_REQUEST,
+			FIXED_SIZE = 20,
+		};
+
+	public:
+		RpcRequestView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RpcRequest.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 12, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_ArgsOffset = Schema::Load<DWORD>(m_Payload + 12);
+			m_ArgsCount = Schema::Load<DWORD>(m_Payload + 16);
+
+			return true;
+		}
+
+		DWORD GetId() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetMethod() const { return Schema::Load<DWORD>(m_Payload + 4); }
+
+		DWORD GetDeadlineMs() const { return Schema::Load<DWORD>(m_Payload + 8); }
+
+		DWORD GetArgsCount() const { return m_ArgsCount; }
+		const BYTE* GetArgs() const { return m_Payload + m_ArgsOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_ArgsOffset;
+		DWORD m_ArgsCount;
+	};
+
+	class RpcRequestBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD argsCount)
+		{
+			return Protocol::HEADER_SIZE + RpcRequestView::FIXED_SIZE + argsCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		RpcRequestBuilder(BYTE* frame, DWORD argsCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, RpcRequestView::OPCODE, GetFrameSize(argsCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RpcRequestView::FIXED_SIZE);
+
+			m_ArgsOffset = RpcRequestView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 12, m_ArgsOffset);
+			Schema::Store<DWORD>(m_Payload + 16, argsCount);
+		}
+
+		void SetId(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		void SetMethod(DWORD value)
+		{
+			Schema::Store(m_Payload + 4, value);
+		}
+
+		void SetDeadlineMs(DWORD value)
+		{
+			Schema::Store(m_Payload + 8, value);
+		}
+
+		// argsCount bytes to fill.
+		BYTE* GetArgs() { return m_Payload + m_ArgsOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_ArgsOffset;
+	};
+
+	class RpcResponseView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_RPC_RESPONSE,
+			FIXED_SIZE = 16,
+		};
+
+	public:
+		RpcResponseView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RpcResponse.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 8, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_ResultOffset = Schema::Load<DWORD>(m_Payload + 8);
+			m_ResultCount = Schema::Load<DWORD>(m_Payload + 12);
+
+			return true;
+		}
+
+		DWORD GetId() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetStatus() const { return Schema::Load<DWORD>(m_Payload + 4); }
+
+		DWORD GetResultCount() const { return m_ResultCount; }
+		const BYTE* GetResult() const { return m_Payload + m_ResultOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_ResultOffset;
+		DWORD m_ResultCount;
+	};
+
+	class RpcResponseBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD resultCount)
+		{
+			return Protocol::HEADER_SIZE + RpcResponseView::FIXED_SIZE + resultCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		RpcResponseBuilder(BYTE* frame, DWORD resultCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, RpcResponseView::OPCODE, GetFrameSize(resultCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RpcResponseView::FIXED_SIZE);
+
+			m_ResultOffset = RpcResponseView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 8, m_ResultOffset);
+			Schema::Store<DWORD>(m_Payload + 12, resultCount);
+		}
+
+		void SetId(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		void SetStatus(DWORD value)
+		{
+			Schema::Store(m_Payload + 4, value);
+		}
+
+		// resultCount bytes to fill.
+		BYTE* GetResult() { return m_Payload + m_ResultOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_ResultOffset;
+	};
+
+	class LoginView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_LOGIN,
+			FIXED_SIZE = 4,
+		};
+
+	public:
+		LoginView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid Login.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetUser() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class LoginBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + LoginView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit LoginBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, LoginView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, LoginView::FIXED_SIZE);
+		}
+
+		void SetUser(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class LoginResultView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_LOGIN_RESULT,
+			FIXED_SIZE = 20,
+		};
+
+	public:
+		LoginResultView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid LoginResult.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 12, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_AddressOffset = Schema::Load<DWORD>(m_Payload + 12);
+			m_AddressCount = Schema::Load<DWORD>(m_Payload + 16);
+
+			return true;
+		}
+
+		DWORD GetUser() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetStatus() const { return Schema::Load<DWORD>(m_Payload + 4); }
+
+		DWORD GetNode() const { return Schema::Load<DWORD>(m_Payload + 8); }
+
+		DWORD GetAddressCount() const { return m_AddressCount; }
+		const BYTE* GetAddress() const { return m_Payload + m_AddressOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_AddressOffset;
+		DWORD m_AddressCount;
+	};
+
+	class LoginResultBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD addressCount)
+		{
+			return Protocol::HEADER_SIZE + LoginResultView::FIXED_SIZE + addressCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		LoginResultBuilder(BYTE* frame, DWORD addressCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, LoginResultView::OPCODE, GetFrameSize(addressCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, LoginResultView::FIXED_SIZE);
+
+			m_AddressOffset = LoginResultView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 12, m_AddressOffset);
+			Schema::Store<DWORD>(m_Payload + 16, addressCount);
+		}
+
+		void SetUser(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		void SetStatus(DWORD value)
+		{
+			Schema::Store(m_Payload + 4, value);
+		}
+
+		void SetNode(DWORD value)
+		{
+			Schema::Store(m_Payload + 8, value);
+		}
+
+		// addressCount bytes to fill.
+		BYTE* GetAddress() { return m_Payload + m_AddressOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_AddressOffset;
+	};
+
+	class SendToUserView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_SEND_TO_USER,
+			FIXED_SIZE = 12,
+		};
+
+	public:
+		SendToUserView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid SendToUser.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 4, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_DataOffset = Schema::Load<DWORD>(m_Payload + 4);
+			m_DataCount = Schema::Load<DWORD>(m_Payload + 8);
+
+			return true;
+		}
+
+		DWORD GetUser() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetDataCount() const { return m_DataCount; }
+		const BYTE* GetData() const { return m_Payload + m_DataOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_DataOffset;
+		DWORD m_DataCount;
+	};
+
+	class SendToUserBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD dataCount)
+		{
+			return Protocol::HEADER_SIZE + SendToUserView::FIXED_SIZE + dataCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		SendToUserBuilder(BYTE* frame, DWORD dataCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, SendToUserView::OPCODE, GetFrameSize(dataCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, SendToUserView::FIXED_SIZE);
+
+			m_DataOffset = SendToUserView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 4, m_DataOffset);
+			Schema::Store<DWORD>(m_Payload + 8, dataCount);
+		}
+
+		void SetUser(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		// dataCount bytes to fill.
+		BYTE* GetData() { return m_Payload + m_DataOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_DataOffset;
+	};
+
+	class UserMessageView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_USER_MESSAGE,
+			FIXED_SIZE = 12,
+		};
+
+	public:
+		UserMessageView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid UserMessage.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 4, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_DataOffset = Schema::Load<DWORD>(m_Payload + 4);
+			m_DataCount = Schema::Load<DWORD>(m_Payload + 8);
+
+			return true;
+		}
+
+		DWORD GetFrom() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetDataCount() const { return m_DataCount; }
+		const BYTE* GetData() const { return m_Payload + m_DataOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_DataOffset;
+		DWORD m_DataCount;
+	};
+
+	class UserMessageBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD dataCount)
+		{
+			return Protocol::HEADER_SIZE + UserMessageView::FIXED_SIZE + dataCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		UserMessageBuilder(BYTE* frame, DWORD dataCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, UserMessageView::OPCODE, GetFrameSize(dataCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, UserMessageView::FIXED_SIZE);
+
+			m_DataOffset = UserMessageView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 4, m_DataOffset);
+			Schema::Store<DWORD>(m_Payload + 8, dataCount);
+		}
+
+		void SetFrom(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		// dataCount bytes to fill.
+		BYTE* GetData() { return m_Payload + m_DataOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_DataOffset;
+	};
+
+	class NodeHelloView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_NODE_HELLO,
+			FIXED_SIZE = 4,
+		};
+
+	public:
+		NodeHelloView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid NodeHello.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetNode() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class NodeHelloBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + NodeHelloView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit NodeHelloBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, NodeHelloView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, NodeHelloView::FIXED_SIZE);
+		}
+
+		void SetNode(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class RouteToUserView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_ROUTE_TO_USER,
+			FIXED_SIZE = 16,
+		};
+
+	public:
+		RouteToUserView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RouteToUser.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 8, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_DataOffset = Schema::Load<DWORD>(m_Payload + 8);
+			m_DataCount = Schema::Load<DWORD>(m_Payload + 12);
+
+			return true;
+		}
+
+		DWORD GetUser() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetFrom() const { return Schema::Load<DWORD>(m_Payload + 4); }
+
+		DWORD GetDataCount() const { return m_DataCount; }
+		const BYTE* GetData() const { return m_Payload + m_DataOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_DataOffset;
+		DWORD m_DataCount;
+	};
+
+	class RouteToUserBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD dataCount)
+		{
+			return Protocol::HEADER_SIZE + RouteToUserView::FIXED_SIZE + dataCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		RouteToUserBuilder(BYTE* frame, DWORD dataCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, RouteToUserView::OPCODE, GetFrameSize(dataCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RouteToUserView::FIXED_SIZE);
+
+			m_DataOffset = RouteToUserView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 8, m_DataOffset);
+			Schema::Store<DWORD>(m_Payload + 12, dataCount);
+		}
+
+		void SetUser(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		void SetFrom(DWORD value)
+		{
+			Schema::Store(m_Payload + 4, value);
+		}
+
+		// dataCount bytes to fill.
+		BYTE* GetData() { return m_Payload + m_DataOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_DataOffset;
+	};
+
+	class RoutePublishView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_ROUTE_PUBLISH,
+			FIXED_SIZE = 12,
+		};
+
+	public:
+		RoutePublishView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RoutePublish.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			if(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, 4, sizeof(BYTE)))
+			{
+				m_Payload = NULL;
+				return false;
+			}
+			m_FrameOffset = Schema::Load<DWORD>(m_Payload + 4);
+			m_FrameCount = Schema::Load<DWORD>(m_Payload + 8);
+
+			return true;
+		}
+
+		DWORD GetChannel() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		DWORD GetFrameCount() const { return m_FrameCount; }
+		const BYTE* GetFrame() const { return m_Payload + m_FrameOffset; }
+
+	private:
+		const BYTE* m_Payload;
+		DWORD m_FrameOffset;
+		DWORD m_FrameCount;
+	};
+
+	class RoutePublishBuilder
+	{
+	public:
+		static DWORD GetFrameSize(DWORD frameCount)
+		{
+			return Protocol::HEADER_SIZE + RoutePublishView::FIXED_SIZE + frameCount * sizeof(BYTE);
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		RoutePublishBuilder(BYTE* frame, DWORD frameCount)
+		{
+			m_Payload = Schema::WriteHeader(frame, RoutePublishView::OPCODE, GetFrameSize(frameCount) - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RoutePublishView::FIXED_SIZE);
+
+			m_FrameOffset = RoutePublishView::FIXED_SIZE;
+			Schema::Store<DWORD>(m_Payload + 4, m_FrameOffset);
+			Schema::Store<DWORD>(m_Payload + 8, frameCount);
+		}
+
+		void SetChannel(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		// frameCount bytes to fill.
+		BYTE* GetFrame() { return m_Payload + m_FrameOffset; }
+
+	private:
+		BYTE* m_Payload;
+		DWORD m_FrameOffset;
+	};
+
+	class RouteSubscribeView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_ROUTE_SUBSCRIBE,
+			FIXED_SIZE = 4,
+		};
+
+	public:
+		RouteSubscribeView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RouteSubscribe.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetChannel() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class RouteSubscribeBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + RouteSubscribeView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit RouteSubscribeBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, RouteSubscribeView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RouteSubscribeView::FIXED_SIZE);
+		}
+
+		void SetChannel(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class RouteUnsubscribeView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_ROUTE_UNSUBSCRIBE,
+			FIXED_SIZE = 4,
+		};
+
+	public:
+		RouteUnsubscribeView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RouteUnsubscribe.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetChannel() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class RouteUnsubscribeBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + RouteUnsubscribeView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit RouteUnsubscribeBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, RouteUnsubscribeView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RouteUnsubscribeView::FIXED_SIZE);
+		}
+
+		void SetChannel(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class RoutePingView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_ROUTE_PING,
+			FIXED_SIZE = 12,
+		};
+
+	public:
+		RoutePingView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RoutePing.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetSequence() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		ULONGLONG GetSendTime() const { return Schema::Load<ULONGLONG>(m_Payload + 4); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class RoutePingBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + RoutePingView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit RoutePingBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, RoutePingView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RoutePingView::FIXED_SIZE);
+		}
+
+		void SetSequence(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		void SetSendTime(ULONGLONG value)
+		{
+			Schema::Store(m_Payload + 4, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+
+	class RoutePongView
+	{
+	public:
+		enum
+		{
+			OPCODE = Protocol::OP_ROUTE_PONG,
+			FIXED_SIZE = 12,
+		};
+
+	public:
+		RoutePongView() : m_Payload(NULL) {}
+
+		// frame is the whole frame, header included. Returns false if it's not a valid RoutePong.
+		bool Init(const BYTE* frame, DWORD size)
+		{
+			m_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);
+			if(m_Payload == NULL)
+			{
+				return false;
+			}
+
+			return true;
+		}
+
+		DWORD GetSequence() const { return Schema::Load<DWORD>(m_Payload + 0); }
+
+		ULONGLONG GetSendTime() const { return Schema::Load<ULONGLONG>(m_Payload + 4); }
+
+	private:
+		const BYTE* m_Payload;
+	};
+
+	class RoutePongBuilder
+	{
+	public:
+		static DWORD GetFrameSize()
+		{
+			return Protocol::HEADER_SIZE + RoutePongView::FIXED_SIZE;
+		}
+
+		// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.
+		explicit RoutePongBuilder(BYTE* frame)
+		{
+			m_Payload = Schema::WriteHeader(frame, RoutePongView::OPCODE, GetFrameSize() - Protocol::HEADER_SIZE);
+			ZeroMemory(m_Payload, RoutePongView::FIXED_SIZE);
+		}
+
+		void SetSequence(DWORD value)
+		{
+			Schema::Store(m_Payload + 0, value);
+		}
+
+		void SetSendTime(ULONGLONG value)
+		{
+			Schema::Store(m_Payload + 4, value);
+		}
+
+	private:
+		BYTE* m_Payload;
+	};
+}
@@ -1,6 +1,7 @@
 #include "Network.h"
 #include "Log.h"
 #include <cassert>
+#include <cstdio>
 #include <sstream>
 #include <string>
 #include <iostream>
@@ -102,6 +103,32 @@ SOCKET Network::CreateSocket(bool bind, u_short port)
 }
 
 
+SOCKET Network::CreateConnectSocket(int family)
+{
+	SOCKET socket = WSASocket(family, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_OVERLAPPED);
+	if(socket == INVALID_SOCKET)
+	{
+		ERROR_CODE(WSAGetLastError(), "WSASocket() failed. family : %d", family);
+		return INVALID_SOCKET;
+	}
+
+	// All zero but the family is the any address and port of either family.
+	sockaddr_storage addr;
+	ZeroMemory(&addr, sizeof(addr));
+	addr.ss_family = static_cast<ADDRESS_FAMILY>(family);
+
+	int addrlen = family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+	if(bind(socket, reinterpret_cast<sockaddr*>(&addr), addrlen) == SOCKET_ERROR)
+	{
+		ERROR_CODE(WSAGetLastError(), "bind() failed. family : %d", family);
+		CloseSocket(socket);
+		return INVALID_SOCKET;
+	}
+
+	return socket;
+}
+
+
 void Network::CloseSocket(SOCKET socket)
 {
 	if(closesocket(socket) == SOCKET_ERROR)
@@ -111,6 +138,49 @@ void Network::CloseSocket(SOCKET socket)
 }
 
 
+void Network::ResetOnClose(SOCKET socket)
+{
+	linger option;
+	option.l_onoff = 1;
+	option.l_linger = 0;
+
+	if(setsockopt(socket, SOL_SOCKET, SO_LINGER, reinterpret_cast<const char*>(&option), sizeof(option)) == SOCKET_ERROR)
+	{
+		ERROR_CODE(WSAGetLastError(), "setsockopt() for SO_LINGER failed.");
+	}
+}
+
+
+bool Network::ResolveAddress(const char* host, u_short port, SOCKADDR_STORAGE& address, int& size)
+{
+	assert(host);
+
+	addrinfo hints;
+	ZeroMemory(&hints, sizeof(addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	char portStr[32] = "";
+	sprintf_s(portStr, sizeof(portStr), "%d", port);
+
+	addrinfo* infoList = NULL;
+	if(getaddrinfo(host, portStr, &hints, &infoList) != 0)
+	{
+		ERROR_CODE(WSAGetLastError(), "getaddrinfo() failed. address : %s:%d", host, port);
+		return false;
+	}
+
+	ZeroMemory(&address, sizeof(address));
+	CopyMemory(&address, infoList->ai_addr, infoList->ai_addrlen);
+	size = static_cast<int>(infoList->ai_addrlen);
+
+	freeaddrinfo(infoList);
+
+	return true;
+}
+
+
 BOOL Network::AcceptEx(SOCKET listenSocket, SOCKET newSocket, LPOVERLAPPED overlapped)
 {
 	if(s_AcceptEx == NULL)
@@ -133,7 +203,7 @@ BOOL Network::AcceptEx(SOCKET listenSocket, SOCKET newSocket, LPOVERLAPPED overl
 }
 
 
-BOOL Network::ConnectEx(SOCKET socket, sockaddr* addr, int addrlen, LPOVERLAPPED overlapped)
+BOOL Network::ConnectEx(SOCKET socket, const sockaddr* addr, int addrlen, LPOVERLAPPED overlapped)
 {
 	if(s_ConnectEx == NULL)
 	{
@@ -223,3 +293,57 @@ bool Network::GetRemoteAddress(SOCKET socket, std::string& ip, u_short& port)
 
 	return false;
 }
+
+
+bool Network::GetRemoteIp(SOCKET socket, IN6_ADDR& ip)
+{
+	sockaddr_in6 addr6; 
+	ZeroMemory(&addr6, sizeof(addr6)); 
+	int size = sizeof(addr6);
+
+	if( 0 != getpeername(socket, reinterpret_cast<sockaddr*>(&addr6), &size) )
+	{
+		return false;
+	}
+
+	if( size == sizeof(sockaddr_in6) )
+	{
+		ip = addr6.sin6_addr;
+	}
+	else if ( size == sizeof(sockaddr_in) )
+	{
+		sockaddr_in* pAddr4 = reinterpret_cast<sockaddr_in*>(&addr6);
+
+		ZeroMemory(&ip, sizeof(ip));
+		ip.s6_addr[10] = 0xFF;
+		ip.s6_addr[11] = 0xFF;
+		CopyMemory(&ip.s6_addr[12], &pAddr4->sin_addr, sizeof(pAddr4->sin_addr));
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Network::ParseIp(const char* text, IN6_ADDR& ip)
+{
+	if( inet_pton(AF_INET6, text, &ip) == 1 )
+	{
+		return true;
+	}
+
+	in_addr addr4;
+	if( inet_pton(AF_INET, text, &addr4) == 1 )
+	{
+		ZeroMemory(&ip, sizeof(ip));
+		ip.s6_addr[10] = 0xFF;
+		ip.s6_addr[11] = 0xFF;
+		CopyMemory(&ip.s6_addr[12], &addr4, sizeof(addr4));
+		return true;
+	}
+
+	return false;
+}
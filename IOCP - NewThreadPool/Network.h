@@ -13,11 +13,22 @@ namespace Network
 	void Deinitialize();
 
 	SOCKET CreateSocket(bool bind, u_short port);
+	// An overlapped socket of the family bound to any address and port, as ConnectEx() needs.
+	SOCKET CreateConnectSocket(int family);
 	void CloseSocket(SOCKET socket);
+	// The socket is reset when it's closed, instead of going through TIME_WAIT. For connections turned away.
+	void ResetOnClose(SOCKET socket);
+
+	// The first address of host for TCP, as ConnectEx() takes it. Returns false if it can't be resolved.
+	bool ResolveAddress(const char* host, u_short port, SOCKADDR_STORAGE& address, int& size);
 
 	BOOL AcceptEx(SOCKET listenSocket, SOCKET newSocket, LPOVERLAPPED overlapped);
-	BOOL ConnectEx(SOCKET socket, sockaddr* addr, int addrlen, LPOVERLAPPED overlapped);
+	BOOL ConnectEx(SOCKET socket, const sockaddr* addr, int addrlen, LPOVERLAPPED overlapped);
 
 	bool GetLocalAddress(SOCKET socket, std::string& ip, u_short& port);
 	bool GetRemoteAddress(SOCKET socket, std::string& ip, u_short& port);
+	// The peer's address as 16 bytes. IPv4 ones are mapped, as in ::ffff:a.b.c.d.
+	bool GetRemoteIp(SOCKET socket, IN6_ADDR& ip);
+	// An address in text, IPv4 or IPv6, as GetRemoteIp() gives it. Returns false if it's not one.
+	bool ParseIp(const char* text, IN6_ADDR& ip);
 };
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <windows.h>
+
+// Framed messages shared by the server and the client.
+// Every message is a Header followed by Header::size bytes of payload. Little-endian on the wire.
+// Payloads named after a message are laid out as in Messages.schema, and read and written with Messages.h.
+namespace Protocol
+{
+#pragma pack(push, 1)
+	struct Header
+	{
+		DWORD size;		// payload bytes, not including the header.
+		WORD opcode;
+		WORD flags;
+	};
+#pragma pack(pop)
+
+	enum
+	{
+		HEADER_SIZE = sizeof(Header),
+
+		// A whole frame has to fit in the biggest BufferPool class.
+		MAX_FRAME_SIZE = 1024 * 1024,
+		MAX_PAYLOAD_SIZE = MAX_FRAME_SIZE - HEADER_SIZE,
+	};
+
+	enum Opcode
+	{
+		OP_ECHO = 1,
+		// Sent back as it is, right from the I/O thread. For round-trip times.
+		OP_PING = 2,
+
+		// Payload : Subscribe, Unsubscribe, Publish.
+		OP_SUBSCRIBE = 10,
+		OP_UNSUBSCRIBE = 11,
+		OP_PUBLISH = 12,
+
+		// Payload : Move.
+		OP_MOVE = 20,
+		// Server to client. Payload : EntityUpdates.
+		OP_ENTITY_UPDATES = 21,
+		// Server to client in snapshot mode. Payload : bits of SnapshotCodec.
+		OP_SNAPSHOT = 22,
+		// Payload : SnapshotAck.
+		OP_SNAPSHOT_ACK = 23,
+
+		// Payload : RpcRequest.
+		OP_RPC_REQUEST = 30,
+		// Server to client. Payload : RpcResponse.
+		OP_RPC_RESPONSE = 31,
+
+		// Payload : Login.
+		OP_LOGIN = 40,
+		// Server to client. Payload : LoginResult.
+		OP_LOGIN_RESULT = 41,
+		// Payload : SendToUser.
+		OP_SEND_TO_USER = 42,
+		// Server to client. Payload : UserMessage.
+		OP_USER_MESSAGE = 43,
+
+		// Between nodes of a cluster. See Cluster.
+		// The first frame on a link. Payload : NodeHello.
+		OP_NODE_HELLO = 50,
+		// Payload : the frames below back to back, each with its own header.
+		OP_NODE_BATCH = 51,
+		// Payload : RouteToUser, RoutePublish, RouteSubscribe, RouteUnsubscribe, RoutePing, RoutePong.
+		OP_ROUTE_TO_USER = 52,
+		OP_ROUTE_PUBLISH = 53,
+		OP_ROUTE_SUBSCRIBE = 54,
+		OP_ROUTE_UNSUBSCRIBE = 55,
+		OP_ROUTE_PING = 56,
+		OP_ROUTE_PONG = 57,
+	};
+
+	enum RpcMethod
+	{
+		// Returns the args.
+		RPC_METHOD_ECHO = 1,
+		// Returns the args after as many milliseconds as their first DWORD. Stands in for a slow service.
+		RPC_METHOD_DELAY = 2,
+	};
+
+	enum RpcStatus
+	{
+		RPC_OK,
+		RPC_UNKNOWN_METHOD,
+		RPC_BAD_ARGS,
+		// The responses below have no result.
+		RPC_DEADLINE_EXCEEDED,
+		RPC_OVERLOADED,		// too many calls in progress on the server.
+		RPC_UNAVAILABLE,	// no backend to forward it to, or its connection was lost. See UpstreamPool.
+	};
+
+	enum LoginStatus
+	{
+		LOGIN_OK,
+		LOGIN_WRONG_NODE,	// another node of the cluster owns the user. LoginResult names it.
+		LOGIN_IN_USE,		// the user is logged in on another connection, or this one has a user already.
+	};
+}
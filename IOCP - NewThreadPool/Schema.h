@@ -0,0 +1,73 @@
+#pragma once
+
+#include <windows.h>
+#include "Protocol.h"
+
+// What the views and builders of Messages.h are made of.
+// Fields are read and written in place with CopyMemory because they aren't aligned.
+// The wire is little-endian, like every machine this runs on.
+namespace Schema
+{
+	template<class T>
+	inline T Load(const BYTE* data)
+	{
+		T value;
+		CopyMemory(&value, data, sizeof(T));
+		return value;
+	}
+
+	template<class T>
+	inline void Store(BYTE* data, const T& value)
+	{
+		CopyMemory(data, &value, sizeof(T));
+	}
+
+	// A vector is stored as its offset from the start of the payload and the number of elements.
+	enum
+	{
+		VECTOR_SIZE = 2 * sizeof(DWORD),
+	};
+
+	// Whether the vector at fieldOffset is in the payload. Its elements can't overlap the fixed part.
+	inline bool IsVectorValid(const BYTE* payload, DWORD payloadSize, DWORD fixedSize, DWORD fieldOffset, DWORD elementSize)
+	{
+		DWORD offset = Load<DWORD>(payload + fieldOffset);
+		DWORD count = Load<DWORD>(payload + fieldOffset + sizeof(DWORD));
+
+		if(offset < fixedSize || offset > payloadSize)
+		{
+			return false;
+		}
+
+		// Divided, so that a huge count can't overflow.
+		return count <= (payloadSize - offset) / elementSize;
+	}
+
+	// Checks the header of a frame and returns its payload, or NULL.
+	inline const BYTE* GetPayload(const BYTE* frame, DWORD frameSize, WORD opcode, DWORD fixedSize)
+	{
+		if(frameSize < Protocol::HEADER_SIZE + fixedSize)
+		{
+			return NULL;
+		}
+
+		const Protocol::Header* header = reinterpret_cast<const Protocol::Header*>(frame);
+		if(header->opcode != opcode || header->size != frameSize - Protocol::HEADER_SIZE)
+		{
+			return NULL;
+		}
+
+		return frame + Protocol::HEADER_SIZE;
+	}
+
+	inline BYTE* WriteHeader(BYTE* frame, WORD opcode, DWORD payloadSize)
+	{
+		Protocol::Header header;
+		header.size = payloadSize;
+		header.opcode = opcode;
+		header.flags = 0;
+		Store(frame, header);
+
+		return frame + Protocol::HEADER_SIZE;
+	}
+}
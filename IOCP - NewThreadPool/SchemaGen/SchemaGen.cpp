@@ -0,0 +1,698 @@
+// Generates the accessor views and builders of Messages.h from Messages.schema.
+// usage : SchemaGen <input.schema> <output.h>
+// See Messages.schema for the language and the layout.
+
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace
+{
+	struct Token
+	{
+		string text;
+		int line;
+	};
+
+	struct Scalar
+	{
+		const char* name;
+		const char* cppType;
+		int size;
+	};
+
+	const Scalar SCALARS[] =
+	{
+		{ "u8", "BYTE", 1 },
+		{ "u16", "WORD", 2 },
+		{ "u32", "DWORD", 4 },
+		{ "u64", "ULONGLONG", 8 },
+		{ "i32", "LONG", 4 },
+		{ "i64", "LONGLONG", 8 },
+		{ "f32", "float", 4 },
+		{ "f64", "double", 8 },
+	};
+
+	enum FieldKind
+	{
+		FIELD_SCALAR,
+		FIELD_VECTOR,
+		FIELD_BYTES,
+	};
+
+	struct Field
+	{
+		string name;
+		FieldKind kind;
+		bool optional;
+		string cppType;		// of the field, or of an element of the vector.
+		int size;			// of the field, or of an element of the vector.
+		int offset;			// in the payload.
+		int presenceBit;	// of optional fields.
+	};
+
+	struct Type
+	{
+		bool isMessage;
+		string name;
+		string opcode;
+		vector<Field> fields;
+		int fixedSize;
+		bool hasOptional;
+		int line;
+	};
+
+	// The sizes of the structs declared so far, and the names of all the types.
+	map<string, int> s_StructSizes;
+	set<string> s_TypeNames;
+
+
+	bool Fail(const string& file, int line, const string& message)
+	{
+		fprintf(stderr, "%s(%d) : error : %s\n", file.c_str(), line, message.c_str());
+		return false;
+	}
+
+
+	bool Tokenize(const string& file, const string& text, vector<Token>& tokens)
+	{
+		int line = 1;
+		size_t i = 0;
+		while(i < text.size())
+		{
+			char c = text[i];
+
+			if(c == '\n')
+			{
+				++line;
+				++i;
+			}
+			else if(isspace(static_cast<unsigned char>(c)))
+			{
+				++i;
+			}
+			else if(c == '/' && i + 1 < text.size() && text[i + 1] == '/')
+			{
+				while(i < text.size() && text[i] != '\n') ++i;
+			}
+			else if(isalnum(static_cast<unsigned char>(c)) || c == '_')
+			{
+				Token token;
+				token.line = line;
+				while(i < text.size() && (isalnum(static_cast<unsigned char>(text[i])) || text[i] == '_'))
+				{
+					token.text += text[i++];
+				}
+				tokens.push_back(token);
+			}
+			else if(c == '{' || c == '}' || c == ';' || c == '=' || c == '<' || c == '>')
+			{
+				Token token;
+				token.line = line;
+				token.text = c;
+				tokens.push_back(token);
+				++i;
+			}
+			else
+			{
+				return Fail(file, line, string("unexpected character '") + c + "'");
+			}
+		}
+
+		return true;
+	}
+
+
+	const Scalar* FindScalar(const string& name)
+	{
+		for(size_t i = 0 ; i < sizeof(SCALARS) / sizeof(SCALARS[0]) ; ++i)
+		{
+			if(name == SCALARS[i].name)
+			{
+				return &SCALARS[i];
+			}
+		}
+		return NULL;
+	}
+
+
+	bool IsIdentifier(const string& text)
+	{
+		return !text.empty() && (isalpha(static_cast<unsigned char>(text[0])) || text[0] == '_');
+	}
+
+
+	class Parser
+	{
+	public:
+		Parser(const string& file, const vector<Token>& tokens) : m_File(file), m_Tokens(tokens), m_Pos(0) {}
+
+		bool Parse(vector<Type>& types)
+		{
+			while(m_Pos < m_Tokens.size())
+			{
+				Type type;
+				if(!ParseType(type))
+				{
+					return false;
+				}
+				types.push_back(type);
+			}
+			return true;
+		}
+
+	private:
+		bool ParseType(Type& type)
+		{
+			type.line = Peek().line;
+			string keyword = Next();
+
+			if(keyword != "struct" && keyword != "message")
+			{
+				return Fail(m_File, type.line, "'struct' or 'message' expected, not '" + keyword + "'");
+			}
+
+			type.isMessage = keyword == "message";
+			type.name = Next();
+			if(!IsIdentifier(type.name) || FindScalar(type.name) != NULL)
+			{
+				return Fail(m_File, type.line, "bad name '" + type.name + "'");
+			}
+			if(!s_TypeNames.insert(type.name).second)
+			{
+				return Fail(m_File, type.line, "'" + type.name + "' is already declared");
+			}
+
+			if(type.isMessage)
+			{
+				if(!Expect("="))
+				{
+					return false;
+				}
+				type.opcode = Next();
+				if(!IsIdentifier(type.opcode))
+				{
+					return Fail(m_File, type.line, "the opcode of '" + type.name + "' has to be a Protocol::Opcode");
+				}
+			}
+
+			if(!Expect("{"))
+			{
+				return false;
+			}
+
+			while(m_Pos < m_Tokens.size() && Peek().text != "}")
+			{
+				Field field;
+				if(!ParseField(type, field))
+				{
+					return false;
+				}
+				type.fields.push_back(field);
+			}
+
+			if(!Expect("}"))
+			{
+				return false;
+			}
+
+			Layout(type);
+
+			if(!type.isMessage)
+			{
+				s_StructSizes[type.name] = type.fixedSize;
+			}
+
+			return true;
+		}
+
+		bool ParseField(const Type& type, Field& field)
+		{
+			int line = Peek().line;
+
+			field.optional = false;
+			field.presenceBit = -1;
+
+			string typeName = Next();
+			if(typeName == "optional")
+			{
+				field.optional = true;
+				typeName = Next();
+			}
+
+			if(typeName == "bytes")
+			{
+				field.kind = FIELD_BYTES;
+				field.cppType = "BYTE";
+				field.size = 1;
+			}
+			else if(typeName == "vector")
+			{
+				field.kind = FIELD_VECTOR;
+				if(!Expect("<"))
+				{
+					return false;
+				}
+
+				string elementName = Next();
+				if(!ResolveType(elementName, field))
+				{
+					return Fail(m_File, line, "unknown type '" + elementName + "'");
+				}
+
+				if(!Expect(">"))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				field.kind = FIELD_SCALAR;
+				const Scalar* scalar = FindScalar(typeName);
+				if(scalar == NULL)
+				{
+					return Fail(m_File, line, "'" + typeName + "' can't be a field. Structs only go in vectors.");
+				}
+				field.cppType = scalar->cppType;
+				field.size = scalar->size;
+			}
+
+			if(!type.isMessage && field.kind != FIELD_SCALAR)
+			{
+				return Fail(m_File, line, "struct members can only be scalars");
+			}
+			if(field.optional && (!type.isMessage || field.kind != FIELD_SCALAR))
+			{
+				return Fail(m_File, line, "only scalars of messages can be optional");
+			}
+
+			int numOptional = 0;
+			for(size_t i = 0 ; i < type.fields.size() ; ++i)
+			{
+				numOptional += type.fields[i].optional ? 1 : 0;
+			}
+			if(field.optional && numOptional == 32)
+			{
+				return Fail(m_File, line, "a message can have up to 32 optional fields");
+			}
+
+			field.name = Next();
+			if(!IsIdentifier(field.name))
+			{
+				return Fail(m_File, line, "bad field name '" + field.name + "'");
+			}
+			for(size_t i = 0 ; i < type.fields.size() ; ++i)
+			{
+				if(type.fields[i].name == field.name)
+				{
+					return Fail(m_File, line, "'" + field.name + "' is already a field");
+				}
+			}
+
+			return Expect(";");
+		}
+
+		bool ResolveType(const string& name, Field& field)
+		{
+			const Scalar* scalar = FindScalar(name);
+			if(scalar != NULL)
+			{
+				field.cppType = scalar->cppType;
+				field.size = scalar->size;
+				return true;
+			}
+
+			map<string, int>::const_iterator itor = s_StructSizes.find(name);
+			if(itor != s_StructSizes.end())
+			{
+				field.cppType = name;
+				field.size = itor->second;
+				return true;
+			}
+
+			return false;
+		}
+
+		// Presence bits first, then the fields in order.
+		void Layout(Type& type)
+		{
+			int numOptional = 0;
+			for(size_t i = 0 ; i < type.fields.size() ; ++i)
+			{
+				if(type.fields[i].optional)
+				{
+					type.fields[i].presenceBit = numOptional++;
+				}
+			}
+
+			type.hasOptional = numOptional > 0;
+
+			int offset = type.hasOptional ? 4 : 0;
+			for(size_t i = 0 ; i < type.fields.size() ; ++i)
+			{
+				Field& field = type.fields[i];
+				field.offset = offset;
+				offset += field.kind == FIELD_SCALAR ? field.size : 8;
+			}
+
+			type.fixedSize = offset;
+		}
+
+		const Token& Peek()
+		{
+			static Token s_End = { "end of file", 0 };
+			if(m_Pos < m_Tokens.size())
+			{
+				return m_Tokens[m_Pos];
+			}
+			s_End.line = m_Tokens.empty() ? 1 : m_Tokens.back().line;
+			return s_End;
+		}
+
+		string Next()
+		{
+			string text = Peek().text;
+			if(m_Pos < m_Tokens.size())
+			{
+				++m_Pos;
+			}
+			return text;
+		}
+
+		bool Expect(const string& text)
+		{
+			int line = Peek().line;
+			string actual = Next();
+			if(actual != text)
+			{
+				return Fail(m_File, line, "'" + text + "' expected, not '" + actual + "'");
+			}
+			return true;
+		}
+
+	private:
+		const string& m_File;
+		const vector<Token>& m_Tokens;
+		size_t m_Pos;
+	};
+
+
+	string Capitalize(const string& name)
+	{
+		string result = name;
+		result[0] = static_cast<char>(toupper(static_cast<unsigned char>(result[0])));
+		return result;
+	}
+
+
+	// The parameters of GetFrameSize() and of the builder, one count per vector.
+	string CountParams(const Type& type, bool withTypes)
+	{
+		string params;
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			if(field.kind == FIELD_SCALAR)
+			{
+				continue;
+			}
+
+			if(!params.empty()) params += ", ";
+			params += (withTypes ? "DWORD " : "") + field.name + "Count";
+		}
+		return params;
+	}
+
+
+	void WriteStruct(ostream& out, const Type& type)
+	{
+		out << "#pragma pack(push, 1)\n";
+		out << "\tstruct " << type.name << "\n\t{\n";
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			out << "\t\t" << type.fields[i].cppType << " " << type.fields[i].name << ";\n";
+		}
+		out << "\t};\n";
+		out << "#pragma pack(pop)\n";
+	}
+
+
+	void WriteView(ostream& out, const Type& type)
+	{
+		const string view = type.name + "View";
+
+		out << "\tclass " << view << "\n\t{\n\tpublic:\n";
+		out << "\t\tenum\n\t\t{\n";
+		out << "\t\t\tOPCODE = Protocol::" << type.opcode << ",\n";
+		out << "\t\t\tFIXED_SIZE = " << type.fixedSize << ",\n";
+		out << "\t\t};\n\n\tpublic:\n";
+
+		out << "\t\t" << view << "() : m_Payload(NULL) {}\n\n";
+
+		// Init
+		out << "\t\t// frame is the whole frame, header included. Returns false if it's not a valid " << type.name << ".\n";
+		out << "\t\tbool Init(const BYTE* frame, DWORD size)\n\t\t{\n";
+		out << "\t\t\tm_Payload = Schema::GetPayload(frame, size, OPCODE, FIXED_SIZE);\n";
+		out << "\t\t\tif(m_Payload == NULL)\n\t\t\t{\n\t\t\t\treturn false;\n\t\t\t}\n";
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			if(field.kind == FIELD_SCALAR)
+			{
+				continue;
+			}
+
+			out << "\n\t\t\tif(!Schema::IsVectorValid(m_Payload, size - Protocol::HEADER_SIZE, FIXED_SIZE, " << field.offset << ", sizeof(" << field.cppType << ")))\n";
+			out << "\t\t\t{\n\t\t\t\tm_Payload = NULL;\n\t\t\t\treturn false;\n\t\t\t}\n";
+			out << "\t\t\tm_" << Capitalize(field.name) << "Offset = Schema::Load<DWORD>(m_Payload + " << field.offset << ");\n";
+			out << "\t\t\tm_" << Capitalize(field.name) << "Count = Schema::Load<DWORD>(m_Payload + " << field.offset + 4 << ");\n";
+		}
+		out << "\n\t\t\treturn true;\n\t\t}\n";
+
+		// Getters
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			const string name = Capitalize(field.name);
+
+			out << "\n";
+			if(field.kind == FIELD_SCALAR)
+			{
+				if(field.optional)
+				{
+					out << "\t\tbool Has" << name << "() const { return (Schema::Load<DWORD>(m_Payload) & " << (1u << field.presenceBit) << ") != 0; }\n";
+					out << "\t\t// 0 if it's not there.\n";
+				}
+				out << "\t\t" << field.cppType << " Get" << name << "() const { return Schema::Load<" << field.cppType << ">(m_Payload + " << field.offset << "); }\n";
+			}
+			else if(field.kind == FIELD_BYTES)
+			{
+				out << "\t\tDWORD Get" << name << "Count() const { return m_" << name << "Count; }\n";
+				out << "\t\tconst BYTE* Get" << name << "() const { return m_Payload + m_" << name << "Offset; }\n";
+			}
+			else
+			{
+				out << "\t\tDWORD Get" << name << "Count() const { return m_" << name << "Count; }\n";
+				out << "\t\t" << field.cppType << " Get" << name << "(DWORD index) const { return Schema::Load<" << field.cppType << ">(m_Payload + m_" << name << "Offset + index * sizeof(" << field.cppType << ")); }\n";
+			}
+		}
+
+		out << "\n\tprivate:\n";
+		out << "\t\tconst BYTE* m_Payload;\n";
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			if(field.kind != FIELD_SCALAR)
+			{
+				out << "\t\tDWORD m_" << Capitalize(field.name) << "Offset;\n";
+				out << "\t\tDWORD m_" << Capitalize(field.name) << "Count;\n";
+			}
+		}
+		out << "\t};\n";
+	}
+
+
+	void WriteBuilder(ostream& out, const Type& type)
+	{
+		const string view = type.name + "View";
+		const string builder = type.name + "Builder";
+		const string params = CountParams(type, true);
+
+		out << "\tclass " << builder << "\n\t{\n\tpublic:\n";
+
+		// GetFrameSize
+		out << "\t\tstatic DWORD GetFrameSize(" << params << ")\n\t\t{\n";
+		out << "\t\t\treturn Protocol::HEADER_SIZE + " << view << "::FIXED_SIZE";
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			if(field.kind != FIELD_SCALAR)
+			{
+				out << " + " << field.name << "Count * sizeof(" << field.cppType << ")";
+			}
+		}
+		out << ";\n\t\t}\n\n";
+
+		// Constructor
+		out << "\t\t// frame has to have GetFrameSize() bytes, a pooled send buffer usually. The header is written and the rest is 0.\n";
+		out << "\t\t" << (params.empty() ? "explicit " : "") << builder << "(BYTE* frame" << (params.empty() ? "" : ", ") << params << ")\n";
+		out << "\t\t{\n";
+		out << "\t\t\tm_Payload = Schema::WriteHeader(frame, " << view << "::OPCODE, GetFrameSize(" << CountParams(type, false) << ") - Protocol::HEADER_SIZE);\n";
+		out << "\t\t\tZeroMemory(m_Payload, " << view << "::FIXED_SIZE);\n";
+
+		// Elements of the vectors follow the fixed part in order.
+		string offset = view + "::FIXED_SIZE";
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			if(field.kind == FIELD_SCALAR)
+			{
+				continue;
+			}
+
+			const string name = Capitalize(field.name);
+			out << "\n";
+			out << "\t\t\tm_" << name << "Offset = " << offset << ";\n";
+			out << "\t\t\tSchema::Store<DWORD>(m_Payload + " << field.offset << ", m_" << name << "Offset);\n";
+			out << "\t\t\tSchema::Store<DWORD>(m_Payload + " << field.offset + 4 << ", " << field.name << "Count);\n";
+
+			offset = "m_" + name + "Offset + " + field.name + "Count * sizeof(" + field.cppType + ")";
+		}
+		out << "\t\t}\n";
+
+		// Setters
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			const string name = Capitalize(field.name);
+
+			out << "\n";
+			if(field.kind == FIELD_SCALAR)
+			{
+				out << "\t\tvoid Set" << name << "(" << field.cppType << " value)\n\t\t{\n";
+				if(field.optional)
+				{
+					out << "\t\t\tSchema::Store<DWORD>(m_Payload, Schema::Load<DWORD>(m_Payload) | " << (1u << field.presenceBit) << ");\n";
+				}
+				out << "\t\t\tSchema::Store(m_Payload + " << field.offset << ", value);\n";
+				out << "\t\t}\n";
+			}
+			else if(field.kind == FIELD_BYTES)
+			{
+				out << "\t\t// " << field.name << "Count bytes to fill.\n";
+				out << "\t\tBYTE* Get" << name << "() { return m_Payload + m_" << name << "Offset; }\n";
+			}
+			else
+			{
+				out << "\t\tvoid Set" << name << "(DWORD index, const " << field.cppType << "& value) { Schema::Store(m_Payload + m_" << name << "Offset + index * sizeof(" << field.cppType << "), value); }\n";
+			}
+		}
+
+		out << "\n\tprivate:\n";
+		out << "\t\tBYTE* m_Payload;\n";
+		for(size_t i = 0 ; i < type.fields.size() ; ++i)
+		{
+			const Field& field = type.fields[i];
+			if(field.kind != FIELD_SCALAR)
+			{
+				out << "\t\tDWORD m_" << Capitalize(field.name) << "Offset;\n";
+			}
+		}
+		out << "\t};\n";
+	}
+
+
+	void Generate(ostream& out, const string& input, const vector<Type>& types)
+	{
+		out << "#pragma once\n\n";
+		out << "// Generated by SchemaGen from " << input << ". Don't edit.\n\n";
+		out << "#include <windows.h>\n";
+		out << "#include \"Protocol.h\"\n";
+		out << "#include \"Schema.h\"\n\n";
+		out << "namespace Messages\n{\n";
+
+		// Structs first. Messages can only use them in vectors.
+		bool first = true;
+		for(size_t i = 0 ; i < types.size() ; ++i)
+		{
+			if(!types[i].isMessage)
+			{
+				out << (first ? "" : "\n");
+				WriteStruct(out, types[i]);
+				first = false;
+			}
+		}
+
+		for(size_t i = 0 ; i < types.size() ; ++i)
+		{
+			if(types[i].isMessage)
+			{
+				out << (first ? "" : "\n");
+				WriteView(out, types[i]);
+				out << "\n";
+				WriteBuilder(out, types[i]);
+				first = false;
+			}
+		}
+
+		out << "}\n";
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "usage : SchemaGen <input.schema> <output.h>\n");
+		return 1;
+	}
+
+	string input = argv[1];
+
+	ifstream in(input.c_str(), ios::in | ios::binary);
+	if(!in)
+	{
+		fprintf(stderr, "Could not open %s\n", input.c_str());
+		return 1;
+	}
+
+	stringstream text;
+	text << in.rdbuf();
+
+	vector<Token> tokens;
+	vector<Type> types;
+	if(!Tokenize(input, text.str(), tokens) || !Parser(input, tokens).Parse(types))
+	{
+		return 1;
+	}
+
+	// Only the file name goes in the header, so that it's the same from any directory.
+	string name = input;
+	size_t slash = name.find_last_of("\\/");
+	if(slash != string::npos)
+	{
+		name = name.substr(slash + 1);
+	}
+
+	stringstream header;
+	Generate(header, name, types);
+
+	// Binary, so that the line endings are the same on every machine.
+	ofstream out(argv[2], ios::out | ios::binary);
+	if(!out || !(out << header.str()))
+	{
+		fprintf(stderr, "Could not write %s\n", argv[2]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include "AddressCounter.h"
+
+#include <cassert>
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+AddressCounter::AddressCounter()
+{
+	m_Stripes = static_cast<Stripe*>(_aligned_malloc(NUM_STRIPES * sizeof(Stripe), CACHE_LINE_SIZE));
+	assert(m_Stripes);
+
+	for(DWORD i = 0 ; i < NUM_STRIPES ; ++i)
+	{
+		InitializeCriticalSection(&m_Stripes[i].lock);
+		m_Stripes[i].entries = new Entry[INITIAL_STRIPE_SIZE];
+		ZeroMemory(m_Stripes[i].entries, INITIAL_STRIPE_SIZE * sizeof(Entry));
+		m_Stripes[i].capacity = INITIAL_STRIPE_SIZE;
+		m_Stripes[i].size = 0;
+	}
+}
+
+
+AddressCounter::~AddressCounter()
+{
+	for(DWORD i = 0 ; i < NUM_STRIPES ; ++i)
+	{
+		delete [] m_Stripes[i].entries;
+		DeleteCriticalSection(&m_Stripes[i].lock);
+	}
+
+	_aligned_free(m_Stripes);
+}
+
+
+bool AddressCounter::Acquire(const IN6_ADDR& address, DWORD limit)
+{
+	ULONGLONG high, low;
+	CopyMemory(&high, &address.s6_addr[0], sizeof(high));
+	CopyMemory(&low, &address.s6_addr[8], sizeof(low));
+
+	ULONGLONG hash = Hash(high, low);
+	Stripe& stripe = m_Stripes[hash >> 58];
+
+	EnterCriticalSection(&stripe.lock);
+
+	Entry* entry = &stripe.entries[Find(stripe.entries, stripe.capacity, high, low, hash)];
+
+	bool acquired = true;
+	if(entry->count > 0)
+	{
+		if(limit > 0 && entry->count >= limit)
+		{
+			acquired = false;
+		}
+		else
+		{
+			++entry->count;
+		}
+	}
+	else
+	{
+		if((stripe.size + 1) * 2 > stripe.capacity)
+		{
+			Grow(stripe);
+			entry = &stripe.entries[Find(stripe.entries, stripe.capacity, high, low, hash)];
+		}
+
+		entry->high = high;
+		entry->low = low;
+		entry->count = 1;
+		++stripe.size;
+	}
+
+	LeaveCriticalSection(&stripe.lock);
+
+	return acquired;
+}
+
+
+void AddressCounter::Release(const IN6_ADDR& address)
+{
+	ULONGLONG high, low;
+	CopyMemory(&high, &address.s6_addr[0], sizeof(high));
+	CopyMemory(&low, &address.s6_addr[8], sizeof(low));
+
+	ULONGLONG hash = Hash(high, low);
+	Stripe& stripe = m_Stripes[hash >> 58];
+
+	EnterCriticalSection(&stripe.lock);
+
+	Entry* entries = stripe.entries;
+	DWORD mask = stripe.capacity - 1;
+
+	DWORD index = Find(entries, stripe.capacity, high, low, hash);
+	assert(entries[index].count > 0);
+
+	if(--entries[index].count == 0)
+	{
+		// Entries after it that would be found before it, had it been empty when they went in, are moved back,
+		// so that every entry stays reachable from its home without marks for removed ones.
+		DWORD hole = index;
+		for(DWORD next = (hole + 1) & mask ; entries[next].count > 0 ; next = (next + 1) & mask)
+		{
+			DWORD home = static_cast<DWORD>(Hash(entries[next].high, entries[next].low)) & mask;
+			if(((next - home) & mask) >= ((next - hole) & mask))
+			{
+				entries[hole] = entries[next];
+				hole = next;
+			}
+		}
+
+		entries[hole].count = 0;
+		--stripe.size;
+	}
+
+	LeaveCriticalSection(&stripe.lock);
+}
+
+
+DWORD AddressCounter::GetCount(const IN6_ADDR& address)
+{
+	ULONGLONG high, low;
+	CopyMemory(&high, &address.s6_addr[0], sizeof(high));
+	CopyMemory(&low, &address.s6_addr[8], sizeof(low));
+
+	ULONGLONG hash = Hash(high, low);
+	Stripe& stripe = m_Stripes[hash >> 58];
+
+	EnterCriticalSection(&stripe.lock);
+	DWORD count = stripe.entries[Find(stripe.entries, stripe.capacity, high, low, hash)].count;
+	LeaveCriticalSection(&stripe.lock);
+
+	return count;
+}
+
+
+DWORD AddressCounter::GetNumAddresses()
+{
+	DWORD num = 0;
+	for(DWORD i = 0 ; i < NUM_STRIPES ; ++i)
+	{
+		EnterCriticalSection(&m_Stripes[i].lock);
+		num += m_Stripes[i].size;
+		LeaveCriticalSection(&m_Stripes[i].lock);
+	}
+
+	return num;
+}
+
+
+/* static */ ULONGLONG AddressCounter::Hash(ULONGLONG high, ULONGLONG low)
+{
+	// The stripe is from the top bits and the entry from the bottom ones, so both halves are mixed into all of them.
+	ULONGLONG hash = (high ^ (low * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+	return hash ^ (hash >> 29);
+}
+
+
+/* static */ DWORD AddressCounter::Find(const Entry* entries, DWORD capacity, ULONGLONG high, ULONGLONG low, ULONGLONG hash)
+{
+	DWORD mask = capacity - 1;
+
+	// Never more than half full, so there's always an empty entry to stop at.
+	DWORD index = static_cast<DWORD>(hash) & mask;
+	while(entries[index].count > 0 && (entries[index].high != high || entries[index].low != low))
+	{
+		index = (index + 1) & mask;
+	}
+
+	return index;
+}
+
+
+/* static */ void AddressCounter::Grow(Stripe& stripe)
+{
+	DWORD capacity = stripe.capacity * 2;
+	Entry* entries = new Entry[capacity];
+	ZeroMemory(entries, capacity * sizeof(Entry));
+
+	for(DWORD i = 0 ; i < stripe.capacity ; ++i)
+	{
+		const Entry& entry = stripe.entries[i];
+		if(entry.count > 0)
+		{
+			entries[Find(entries, capacity, entry.high, entry.low, Hash(entry.high, entry.low))] = entry;
+		}
+	}
+
+	delete [] stripe.entries;
+	stripe.entries = entries;
+	stripe.capacity = capacity;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <winsock2.h>
+#include <Ws2tcpip.h>
+
+#include "CacheLine.h"
+
+// Connections open from each address, checked against a limit as they come in.
+// Addresses are spread over stripes, each an open-addressing table with a lock of its own on a line of its own,
+// so that accepts from different addresses rarely wait for each other. An entry is 24 bytes and nothing is
+// allocated per address; a stripe only grows when it's half full. Thread-safe.
+class AddressCounter
+{
+public:
+	enum
+	{
+		NUM_STRIPES = 64,
+		INITIAL_STRIPE_SIZE = 64,	// entries, a power of 2.
+	};
+
+public:
+	AddressCounter();
+	~AddressCounter();
+
+	// Counts a connection from the address, unless limit of them are open already. Returns false then.
+	// 0 is no limit.
+	bool Acquire(const IN6_ADDR& address, DWORD limit);
+	// For every Acquire() that returned true, once the connection is gone.
+	void Release(const IN6_ADDR& address);
+
+	DWORD GetCount(const IN6_ADDR& address);
+	DWORD GetNumAddresses();
+
+private:
+	// count is 0 in empty entries.
+	struct Entry
+	{
+		ULONGLONG high;
+		ULONGLONG low;
+		DWORD count;
+	};
+
+	struct __declspec(align(CACHE_LINE_SIZE)) Stripe
+	{
+		CRITICAL_SECTION lock;
+		Entry* entries;
+		DWORD capacity;	// a power of 2.
+		DWORD size;
+	};
+
+private:
+	AddressCounter(const AddressCounter& rhs);
+	AddressCounter& operator=(const AddressCounter& rhs);
+
+	static ULONGLONG Hash(ULONGLONG high, ULONGLONG low);
+	// The entry of the address, or the empty one where it goes. Call with the stripe locked.
+	static DWORD Find(const Entry* entries, DWORD capacity, ULONGLONG high, ULONGLONG low, ULONGLONG hash);
+	static void Grow(Stripe& stripe);
+
+private:
+	// Allocated on lines of their own, as new doesn't align what it allocates.
+	Stripe* m_Stripes;
+};
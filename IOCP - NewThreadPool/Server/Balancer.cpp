@@ -0,0 +1,201 @@
+#include "Balancer.h"
+
+#include <cassert>
+
+using namespace std;
+
+
+Balancer::Balancer(Policy policy)
+: m_Policy(policy),
+  m_Next(0)
+{
+}
+
+
+DWORD Balancer::AddBackend()
+{
+	Backend backend;
+	ZeroMemory(&backend, sizeof(backend));
+	backend.retryMs = RETRY_MS;
+
+	m_Backends.push_back(backend);
+
+	return static_cast<DWORD>(m_Backends.size() - 1);
+}
+
+
+void Balancer::OnConnected(DWORD backend)
+{
+	assert(backend < m_Backends.size());
+
+	++m_Backends[backend].connections;
+}
+
+
+void Balancer::OnDisconnected(DWORD backend)
+{
+	assert(backend < m_Backends.size());
+	assert(m_Backends[backend].connections > 0);
+
+	--m_Backends[backend].connections;
+}
+
+
+DWORD Balancer::Pick(ULONGLONG now)
+{
+	DWORD numBackends = static_cast<DWORD>(m_Backends.size());
+
+	DWORD picked = NO_BACKEND;
+	ULONGLONG pickedScore = 0;
+
+	// Starting past the last pick, so that the first of equal ones isn't always the same.
+	for(DWORD n = 0 ; n < numBackends ; ++n)
+	{
+		DWORD i = (m_Next + n) % numBackends;
+
+		Backend& backend = m_Backends[i];
+		if(!IsAvailable(backend, now))
+		{
+			continue;
+		}
+
+		ULONGLONG score = 0;
+		switch(m_Policy)
+		{
+		case POLICY_LEAST_OUTSTANDING:
+			score = backend.outstanding;
+			break;
+
+		case POLICY_EWMA:
+			// A backend that hasn't answered yet counts as 1 us. It gets calls until it has a latency of its own.
+			score = (backend.ewmaLatency + 1) * (backend.outstanding + 1);
+			break;
+
+		default:
+			// The first one available.
+			break;
+		}
+
+		if(picked == NO_BACKEND || score < pickedScore)
+		{
+			picked = i;
+			pickedScore = score;
+
+			if(m_Policy == POLICY_ROUND_ROBIN)
+			{
+				break;
+			}
+		}
+	}
+
+	if(picked != NO_BACKEND)
+	{
+		++m_Backends[picked].outstanding;
+		++m_Backends[picked].calls;
+
+		m_Next = (picked + 1) % numBackends;
+	}
+
+	return picked;
+}
+
+
+void Balancer::OnDone(DWORD backend, Outcome outcome, ULONGLONG latency, ULONGLONG now)
+{
+	assert(backend < m_Backends.size());
+
+	Backend& b = m_Backends[backend];
+	assert(b.outstanding > 0);
+
+	--b.outstanding;
+
+	// A call that failed or was cancelled took at least this long, and the average should know.
+	UpdateLatency(b, latency);
+
+	if(outcome == SUCCEEDED)
+	{
+		// Back in full.
+		b.failuresInRow = 0;
+		b.retryMs = RETRY_MS;
+	}
+	else if(outcome == FAILED)
+	{
+		CountFailure(b, now);
+	}
+}
+
+
+void Balancer::OnConnectionFailure(DWORD backend, ULONGLONG now)
+{
+	assert(backend < m_Backends.size());
+
+	CountFailure(m_Backends[backend], now);
+}
+
+
+bool Balancer::IsEjected(DWORD backend, ULONGLONG now)
+{
+	assert(backend < m_Backends.size());
+
+	return now < m_Backends[backend].retryTime;
+}
+
+
+Balancer::BackendStats Balancer::GetStats(DWORD backend, ULONGLONG now)
+{
+	assert(backend < m_Backends.size());
+
+	const Backend& b = m_Backends[backend];
+
+	BackendStats stats;
+	stats.outstanding = b.outstanding;
+	stats.connections = b.connections;
+	stats.ewmaLatency = b.ewmaLatency;
+	stats.calls = b.calls;
+	stats.failures = b.failures;
+	stats.ejections = b.ejections;
+	stats.ejected = now < b.retryTime;
+
+	return stats;
+}
+
+
+void Balancer::UpdateLatency(Backend& backend, ULONGLONG latency)
+{
+	if(backend.ewmaLatency == 0)
+	{
+		backend.ewmaLatency = latency;
+	}
+	else if(latency >= backend.ewmaLatency)
+	{
+		backend.ewmaLatency += (latency - backend.ewmaLatency) >> EWMA_SHIFT;
+	}
+	else
+	{
+		backend.ewmaLatency -= (backend.ewmaLatency - latency) >> EWMA_SHIFT;
+	}
+}
+
+
+void Balancer::CountFailure(Backend& backend, ULONGLONG now)
+{
+	++backend.failures;
+
+	// Already out. Its calls from before keep failing, and they don't make it any longer.
+	if(now < backend.retryTime)
+	{
+		return;
+	}
+
+	if(++backend.failuresInRow < EJECT_AFTER_FAILURES)
+	{
+		return;
+	}
+
+	backend.retryTime = now + static_cast<ULONGLONG>(backend.retryMs) * 1000;
+	backend.retryMs = backend.retryMs * 2 < MAX_RETRY_MS ? backend.retryMs * 2 : MAX_RETRY_MS;
+	++backend.ejections;
+
+	// On probation when it's back. One more failure ejects it again.
+	backend.failuresInRow = EJECT_AFTER_FAILURES - 1;
+}
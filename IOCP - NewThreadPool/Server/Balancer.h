@@ -0,0 +1,105 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+// Picks the backend for each call forwarded by UpstreamPool, and keeps the ones that fail out of the way for a while.
+// A backend is ejected after EJECT_AFTER_FAILURES failures in a row, and gets calls again once its retry time has passed.
+// A failure on its first calls back ejects it again, for twice as long each time up to MAX_RETRY_MS.
+// Not thread-safe. Times are Clock::GetMicroseconds().
+class Balancer
+{
+public:
+	enum Policy
+	{
+		POLICY_ROUND_ROBIN,			// every backend in turn, as long as it's not ejected. To compare with.
+		POLICY_LEAST_OUTSTANDING,	// the one with the fewest calls in progress.
+		POLICY_EWMA,				// the least EWMA latency times calls in progress plus one.
+	};
+
+	enum
+	{
+		NO_BACKEND = 0xFFFFFFFF,
+
+		EJECT_AFTER_FAILURES = 3,
+		RETRY_MS = 1000,
+		MAX_RETRY_MS = 30 * 1000,
+
+		// Each latency is 1/2^EWMA_SHIFT of the average.
+		EWMA_SHIFT = 3,
+	};
+
+	// How a picked call ended.
+	enum Outcome
+	{
+		SUCCEEDED,		// answered by the backend.
+		FAILED,			// not answered in time, or answered that it's overloaded. Counts toward ejection.
+		CANCELLED,		// ended here without a word on the backend's health, like at a deadline of the caller's own.
+	};
+
+	struct BackendStats
+	{
+		DWORD outstanding;
+		DWORD connections;		// ready to take calls.
+		ULONGLONG ewmaLatency;	// microseconds.
+		ULONGLONG calls;
+		ULONGLONG failures;
+		DWORD ejections;
+		bool ejected;
+	};
+
+public:
+	explicit Balancer(Policy policy = POLICY_EWMA);
+
+	void SetPolicy(Policy policy) { m_Policy = policy; }
+	Policy GetPolicy() { return m_Policy; }
+
+	// Returns the index of the backend. They are numbered from 0 in the order they are added.
+	DWORD AddBackend();
+	DWORD GetNumBackends() { return static_cast<DWORD>(m_Backends.size()); }
+
+	// A backend without connections is skipped. Both count connections that are ready to take calls.
+	void OnConnected(DWORD backend);
+	void OnDisconnected(DWORD backend);
+
+	// Returns NO_BACKEND if every backend is ejected or has no connection. The call counts as outstanding until it's done.
+	DWORD Pick(ULONGLONG now);
+
+	// Every picked call ends with this once. latency is from Pick() to now.
+	void OnDone(DWORD backend, Outcome outcome, ULONGLONG latency, ULONGLONG now);
+
+	// A failure outside of a call, like a connection that couldn't be made or was lost.
+	void OnConnectionFailure(DWORD backend, ULONGLONG now);
+
+	bool IsEjected(DWORD backend, ULONGLONG now);
+
+	BackendStats GetStats(DWORD backend, ULONGLONG now);
+
+private:
+	struct Backend
+	{
+		DWORD outstanding;
+		DWORD connections;
+		ULONGLONG ewmaLatency;
+		ULONGLONG calls;
+		ULONGLONG failures;
+		DWORD ejections;
+
+		DWORD failuresInRow;
+		ULONGLONG retryTime;	// ejected until then.
+		DWORD retryMs;			// of the next ejection.
+	};
+
+	bool IsAvailable(const Backend& backend, ULONGLONG now) { return backend.connections > 0 && now >= backend.retryTime; }
+
+	void UpdateLatency(Backend& backend, ULONGLONG latency);
+	void CountFailure(Backend& backend, ULONGLONG now);
+
+private:
+	Balancer(const Balancer& rhs);
+	Balancer& operator=(const Balancer& rhs);
+
+private:
+	Policy m_Policy;
+	std::vector<Backend> m_Backends;
+	DWORD m_Next;	// of round robin, and where the others start looking so that ties are spread.
+};
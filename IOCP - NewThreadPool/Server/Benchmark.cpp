@@ -0,0 +1,1835 @@
+#include "Benchmark.h"
+#include "PubSub.h"
+#include "InterestGrid.h"
+#include "Snapshot.h"
+#include "Packet.h"
+#include "OpcodeTable.h"
+#include "KeyValueStore.h"
+#include "RespSession.h"
+#include "Balancer.h"
+#include "SharedChannel.h"
+#include "Server.h"
+#include "Client.h"
+#include "IOEvent.h"
+#include "CacheLine.h"
+#include "ConnectionTable.h"
+#include "RateLimiter.h"
+#include "AddressCounter.h"
+#include "Blocklist.h"
+#include "OverloadControl.h"
+#include "PacketLanes.h"
+
+#include "..\Log.h"
+#include "..\Clock.h"
+#include "..\Protocol.h"
+#include "..\Messages.h"
+#include "..\Histogram.h"
+#include "..\Network.h"
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cmath>
+#include <boost/unordered_map.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+
+using namespace std;
+
+
+namespace
+{
+	// What Server::DeliverToClient() does to the shared packet, without the socket.
+	void CountDelivery(void* context, Client* /* client */, Packet* packet)
+	{
+		++*static_cast<ULONGLONG*>(context);
+
+		packet->AddRef();
+		Packet::Destroy(packet);
+	}
+
+	Packet* CreatePublishPacket(DWORD channel, DWORD dataSize)
+	{
+		Packet* packet = Packet::Create(NULL, NULL, Messages::PublishBuilder::GetFrameSize(dataSize));
+		if(packet == NULL)
+		{
+			return NULL;
+		}
+
+		Messages::PublishBuilder builder(packet->GetData(), dataSize);
+		builder.SetChannel(channel);
+		FillMemory(builder.GetData(), dataSize, 'x');
+
+		return packet;
+	}
+
+	// Same numbers on every run so that runs can be compared. rand() is only 15 bits with MSVC.
+	class Random
+	{
+	public:
+		explicit Random(DWORD seed) : m_State(seed) {}
+
+		// [0, 1)
+		float Next()
+		{
+			m_State = m_State * 1664525 + 1013904223;
+			return (m_State >> 8) * (1.0f / 16777216.0f);
+		}
+
+		// [0, range)
+		DWORD Next(DWORD range)
+		{
+			return static_cast<DWORD>(Next() * range);
+		}
+
+	private:
+		DWORD m_State;
+	};
+
+	// Handlers for the opcodes of Server that only add up something of the packet.
+	class DispatchTarget
+	{
+	public:
+		DispatchTarget() : m_Sum(0) {}
+
+		void Echo(Packet* packet) { m_Sum += packet->GetSize(); }
+		void Ping(Packet* packet) { m_Sum += packet->GetSize() * 2; }
+		void Subscribe(Packet* packet) { m_Sum += packet->GetData()[0]; }
+		void Unsubscribe(Packet* packet) { m_Sum -= packet->GetData()[0]; }
+		void Publish(Packet* packet) { m_Sum += packet->GetSize() * 3; }
+		void Move(Packet* packet) { m_Sum ^= packet->GetSize(); }
+		void AckSnapshot(Packet* packet) { m_Sum += 7; }
+		void OnUnknownOpcode(Packet* packet) { m_Sum += 11; }
+
+		ULONGLONG GetSum() { return m_Sum; }
+
+	private:
+		ULONGLONG m_Sum;
+	};
+}
+
+OPCODE_HANDLER(DispatchTarget, Protocol::OP_ECHO, Echo, false, PRIORITY_INTERACTIVE)
+OPCODE_HANDLER(DispatchTarget, Protocol::OP_PING, Ping, true, PRIORITY_CONTROL)
+OPCODE_HANDLER(DispatchTarget, Protocol::OP_SUBSCRIBE, Subscribe, false, PRIORITY_CONTROL)
+OPCODE_HANDLER(DispatchTarget, Protocol::OP_UNSUBSCRIBE, Unsubscribe, false, PRIORITY_CONTROL)
+OPCODE_HANDLER(DispatchTarget, Protocol::OP_PUBLISH, Publish, false, PRIORITY_BULK)
+OPCODE_HANDLER(DispatchTarget, Protocol::OP_MOVE, Move, false, PRIORITY_INTERACTIVE)
+OPCODE_HANDLER(DispatchTarget, Protocol::OP_SNAPSHOT_ACK, AckSnapshot, false, PRIORITY_CONTROL)
+
+namespace
+{
+	const OpcodeTable::Entry<DispatchTarget> s_DispatchTable[OpcodeTable::NUM_SLOTS] = OPCODE_TABLE(DispatchTarget);
+
+	// A command as redis-benchmark sends it : an array of bulk strings.
+	void AppendRespCommand(vector<BYTE>& buffer, const char* name, const char* key, const char* value)
+	{
+		const char* args[] = { name, key, value };
+		DWORD numArgs = value != NULL ? 3 : 2;
+
+		char line[32];
+		int size = sprintf_s(line, sizeof(line), "*%d\r\n", numArgs);
+		buffer.insert(buffer.end(), line, line + size);
+
+		for(DWORD i = 0 ; i < numArgs ; ++i)
+		{
+			DWORD argSize = static_cast<DWORD>(strlen(args[i]));
+			size = sprintf_s(line, sizeof(line), "$%d\r\n", argSize);
+			buffer.insert(buffer.end(), line, line + size);
+			buffer.insert(buffer.end(), args[i], args[i] + argSize);
+			buffer.push_back('\r');
+			buffer.push_back('\n');
+		}
+	}
+
+	// A backend of RunBalancerMix(). Calls wait for the first of its workers to be free, and take serviceUs on average.
+	struct SimBackend
+	{
+		ULONGLONG serviceUs;
+		bool failing;					// answers every call with a failure after serviceUs.
+		vector<ULONGLONG> freeTimes;	// of each worker.
+	};
+
+	// A call of RunBalancerMix() that is done at time.
+	struct SimCall
+	{
+		ULONGLONG time;
+		ULONGLONG startTime;
+		DWORD backend;
+
+		bool operator>(const SimCall& rhs) const { return time > rhs.time; }
+	};
+
+	// Callers that each make a call as soon as their last one is done, against the backends in simulated time.
+	void RunBalancerMix(const char* name, Balancer::Policy policy, vector<SimBackend> backends, DWORD numCallers, DWORD numCalls)
+	{
+		Balancer balancer(policy);
+		for(size_t i = 0 ; i < backends.size() ; ++i)
+		{
+			balancer.AddBackend();
+			balancer.OnConnected(static_cast<DWORD>(i));
+		}
+
+		Random random(12345);
+		Histogram latencies;
+		vector<ULONGLONG> callsPerBackend(backends.size(), 0);
+		ULONGLONG failed = 0;
+		ULONGLONG unavailable = 0;
+
+		priority_queue< SimCall, vector<SimCall>, greater<SimCall> > done;
+
+		// Starts with every caller at time 0. A caller with no backend to go to tries again 1 ms later.
+		ULONGLONG now = 0;
+		DWORD numStarted = 0;
+		DWORD idle = numCallers;
+
+		while(numStarted < numCalls || !done.empty())
+		{
+			for( ; idle > 0 && numStarted < numCalls ; --idle, ++numStarted)
+			{
+				SimCall call;
+				call.startTime = now;
+				call.backend = balancer.Pick(now);
+
+				if(call.backend == Balancer::NO_BACKEND)
+				{
+					++unavailable;
+					call.time = now + 1000;
+				}
+				else
+				{
+					SimBackend& backend = backends[call.backend];
+
+					// Exponential service time.
+					ULONGLONG service = static_cast<ULONGLONG>(-log(1.0f - random.Next()) * backend.serviceUs) + 1;
+
+					vector<ULONGLONG>::iterator worker = min_element(backend.freeTimes.begin(), backend.freeTimes.end());
+					ULONGLONG start = *worker > now ? *worker : now;
+					*worker = start + service;
+
+					call.time = *worker;
+					++callsPerBackend[call.backend];
+				}
+
+				done.push(call);
+			}
+
+			if(done.empty())
+			{
+				break;
+			}
+
+			SimCall call = done.top();
+			done.pop();
+
+			now = call.time;
+			++idle;
+
+			if(call.backend == Balancer::NO_BACKEND)
+			{
+				continue;
+			}
+
+			ULONGLONG latency = now - call.startTime;
+
+			if(backends[call.backend].failing)
+			{
+				balancer.OnDone(call.backend, Balancer::FAILED, latency, now);
+				++failed;
+			}
+			else
+			{
+				balancer.OnDone(call.backend, Balancer::SUCCEEDED, latency, now);
+				latencies.Record(latency);
+			}
+		}
+
+		DWORD ejections = 0;
+		for(DWORD i = 0 ; i < backends.size() ; ++i)
+		{
+			ejections += balancer.GetStats(i, now).ejections;
+		}
+
+		// The last backend is the odd one.
+		ULONGLONG total = numStarted - unavailable;
+		TRACE(" %-17s : %I64d calls/sec, p50 %5I64d us, p99 %6I64d us, p99.9 %6I64d us, max %6I64d us, last backend %2I64d%%, failed %I64d, ejections %d",
+			name, now > 0 ? static_cast<ULONGLONG>(numStarted) * 1000000 / now : 0,
+			latencies.GetPercentile(50), latencies.GetPercentile(99), latencies.GetPercentile(99.9), latencies.GetMax(),
+			total > 0 ? callsPerBackend.back() * 100 / total : 0, failed, ejections);
+	}
+
+	// How the messages were written before Messages.h. The count is followed by the entities.
+#pragma pack(push, 1)
+	struct HandEntityUpdates
+	{
+		Protocol::Header header;
+		DWORD count;
+	};
+
+	struct HandMove
+	{
+		Protocol::Header header;
+		float x;
+		float y;
+	};
+#pragma pack(pop)
+
+	// Nanoseconds from an arbitrary point, for round trips too short for Clock.
+	ULONGLONG GetNanoseconds()
+	{
+		static LARGE_INTEGER frequency = { 0 };
+		if(frequency.QuadPart == 0)
+		{
+			QueryPerformanceFrequency(&frequency);
+		}
+
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+
+		return counter.QuadPart / frequency.QuadPart * 1000000000 +
+			counter.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart;
+	}
+
+	// What LogicHost does to a ping : back to the front in the same block.
+	void EchoToFront(void* context, const SharedChannel::Message& message)
+	{
+		SharedChannel* logic = static_cast<SharedChannel*>(context);
+
+		if(!logic->Push(SharedChannel::OUTBOUND, message))
+		{
+			logic->FreeBlock(message.block);
+		}
+	}
+
+	// Benchmark::Echo()
+	const u_short ECHO_BENCH_PORT = 17999;
+	const int ECHO_BENCH_ACCEPTS = 16;
+	const DWORD ECHO_BENCH_CONNECTIONS = 64;
+	const DWORD ECHO_BENCH_MESSAGE_SIZE = 64;
+	const DWORD ECHO_BENCH_SERIAL = 20000;
+	const DWORD ECHO_BENCH_ROUNDS = 5000;		// a message in flight on each connection per round.
+
+	bool SendAll(SOCKET socket, const char* data, int size)
+	{
+		while(size > 0)
+		{
+			int sent = send(socket, data, size, 0);
+			if(sent <= 0)
+			{
+				return false;
+			}
+			data += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	bool RecvAll(SOCKET socket, char* data, int size)
+	{
+		while(size > 0)
+		{
+			int received = recv(socket, data, size, 0);
+			if(received <= 0)
+			{
+				return false;
+			}
+			data += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	// Echoes through the server listening on ECHO_BENCH_PORT, with blocking sockets of this thread.
+	void MeasureEcho(const char* name)
+	{
+		SOCKADDR_STORAGE address;
+		int addressSize = 0;
+		if(!Network::ResolveAddress("127.0.0.1", ECHO_BENCH_PORT, address, addressSize))
+		{
+			return;
+		}
+
+		vector<SOCKET> sockets;
+		for(DWORD i = 0 ; i < ECHO_BENCH_CONNECTIONS ; ++i)
+		{
+			SOCKET s = socket(address.ss_family, SOCK_STREAM, IPPROTO_TCP);
+			if(s == INVALID_SOCKET || connect(s, reinterpret_cast<const sockaddr*>(&address), addressSize) == SOCKET_ERROR)
+			{
+				ERROR_CODE(WSAGetLastError(), "Could not connect to the echo server.");
+				if(s != INVALID_SOCKET)
+				{
+					closesocket(s);
+				}
+				break;
+			}
+
+			BOOL noDelay = TRUE;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+			// A lost echo fails the run instead of hanging it.
+			DWORD timeoutMs = 1000;
+			setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeoutMs), sizeof(timeoutMs));
+
+			sockets.push_back(s);
+		}
+
+		char message[ECHO_BENCH_MESSAGE_SIZE] = { 0 };
+		char reply[ECHO_BENCH_MESSAGE_SIZE];
+
+		bool ok = sockets.size() == ECHO_BENCH_CONNECTIONS;
+
+		// One at a time.
+		Histogram roundTrips;
+		for(DWORD i = 0 ; ok && i < ECHO_BENCH_SERIAL ; ++i)
+		{
+			ULONGLONG start = GetNanoseconds();
+
+			ok = SendAll(sockets[0], message, sizeof(message)) && RecvAll(sockets[0], reply, sizeof(reply));
+
+			roundTrips.Record(GetNanoseconds() - start);
+		}
+
+		// One in flight on every connection.
+		ULONGLONG start = GetNanoseconds();
+		for(DWORD round = 0 ; ok && round < ECHO_BENCH_ROUNDS ; ++round)
+		{
+			for(size_t i = 0 ; ok && i < sockets.size() ; ++i)
+			{
+				ok = SendAll(sockets[i], message, sizeof(message));
+			}
+			for(size_t i = 0 ; ok && i < sockets.size() ; ++i)
+			{
+				ok = RecvAll(sockets[i], reply, sizeof(reply));
+			}
+		}
+		ULONGLONG elapsed = GetNanoseconds() - start;
+
+		for(size_t i = 0 ; i < sockets.size() ; ++i)
+		{
+			closesocket(sockets[i]);
+		}
+
+		if(!ok)
+		{
+			ERROR_MSG("%s : an echo was lost.", name);
+			return;
+		}
+
+		TRACE(" %-44s : round trip p50 %6I64d ns, p99 %7I64d ns, %d connections %7I64d round trips/sec",
+			name, roundTrips.GetPercentile(50), roundTrips.GetPercentile(99), ECHO_BENCH_CONNECTIONS,
+			static_cast<ULONGLONG>(ECHO_BENCH_ROUNDS) * ECHO_BENCH_CONNECTIONS * 1000000000 / elapsed);
+	}
+
+	void MeasureServer(const char* name, DWORD numThreads)
+	{
+		Server server;
+		server.SetThreadPool(numThreads);
+		if(!server.Create(ECHO_BENCH_PORT, ECHO_BENCH_ACCEPTS))
+		{
+			ERROR_MSG("%s : could not start.", name);
+			return;
+		}
+
+		MeasureEcho(name);
+	}
+
+	const DWORD LAYOUT_BENCH_MAX_THREADS = 8;
+	const DWORD LAYOUT_BENCH_ADDS = 10000000;
+
+	// Counters of connections next to each other, as Client had them, and each on its own line.
+	struct CounterRun
+	{
+		volatile LONG packed[LAYOUT_BENCH_MAX_THREADS];
+		PaddedLong padded[LAYOUT_BENCH_MAX_THREADS];
+		bool usePadded;
+		volatile LONG nextIndex;
+	};
+
+	// Static, so that it's on a line and the padded counters are on theirs.
+	CounterRun s_CounterRun;
+
+	// One thread of the pool adding to its own counter, like the recv and send completions of different clients.
+	void CALLBACK WorkerAddToCounter(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_WORK /* Work */)
+	{
+		CounterRun* run = static_cast<CounterRun*>(Context);
+		LONG index = InterlockedIncrement(&run->nextIndex) - 1;
+
+		volatile LONG* counter = run->usePadded ? &run->padded[index].value : &run->packed[index];
+		for(DWORD i = 0 ; i < LAYOUT_BENCH_ADDS ; ++i)
+		{
+			InterlockedIncrement(counter);
+		}
+	}
+
+	// ns per add with numThreads adding at once.
+	ULONGLONG MeasureCounters(DWORD numThreads, bool usePadded)
+	{
+		CounterRun& run = s_CounterRun;
+		ZeroMemory(&run, sizeof(run));
+		run.usePadded = usePadded;
+
+		PTP_POOL pool = CreateThreadpool(NULL);
+		SetThreadpoolThreadMaximum(pool, numThreads);
+		SetThreadpoolThreadMinimum(pool, numThreads);
+
+		TP_CALLBACK_ENVIRON environment;
+		InitializeThreadpoolEnvironment(&environment);
+		SetThreadpoolCallbackPool(&environment, pool);
+
+		PTP_WORK work = CreateThreadpoolWork(WorkerAddToCounter, &run, &environment);
+
+		ULONGLONG start = GetNanoseconds();
+		for(DWORD i = 0 ; i < numThreads ; ++i)
+		{
+			SubmitThreadpoolWork(work);
+		}
+		WaitForThreadpoolWorkCallbacks(work, false);
+		ULONGLONG elapsed = GetNanoseconds() - start;
+
+		CloseThreadpoolWork(work);
+		DestroyThreadpoolEnvironment(&environment);
+		CloseThreadpool(pool);
+
+		return elapsed / LAYOUT_BENCH_ADDS;
+	}
+
+	const DWORD SWEEP_BENCH_CONNECTIONS = 1000000;
+	const DWORD SWEEP_BENCH_IDLE_MS = 60000;
+	const DWORD SWEEP_BENCH_RUNS = 10;
+
+	const DWORD RATE_BENCH_CONNECTIONS = 1000000;
+	const DWORD RATE_BENCH_ADDRESSES = 1000;
+	const DWORD RATE_BENCH_CHARGES = 10000000;
+	const DWORD RATE_BENCH_RUNS = 10;
+	const DWORD RATE_BENCH_MESSAGES = 100; // a second per connection.
+	const DWORD RATE_BENCH_SECONDS = 10;
+
+	const DWORD ADMISSION_BENCH_BLOCKED = 1000000;
+	const DWORD ADMISSION_BENCH_CHECKS = 1000000;
+	const DWORD ADMISSION_BENCH_ADDRESSES = 100000;
+	const DWORD ADMISSION_BENCH_PER_ADDRESS = 4;
+
+	const DWORD OVERLOAD_BENCH_WORKERS = 4;
+	const DWORD OVERLOAD_BENCH_SERVICE_US = 100;	// mean, exponential.
+	const DWORD OVERLOAD_BENCH_SHED_US = 1;
+	const DWORD OVERLOAD_BENCH_SECONDS = 10;
+	const DWORD OVERLOAD_BENCH_CONNECT_MS = 10;		// a connection comes in this often.
+
+	const DWORD LANES_BENCH_WORKERS = 4;
+	const DWORD LANES_BENCH_SERVICE_US = 100;	// mean, exponential.
+	const DWORD LANES_BENCH_SECONDS = 10;
+	const double LANES_BENCH_CONTROL_LOAD = 0.02;		// of what the workers can handle.
+	const double LANES_BENCH_INTERACTIVE_LOAD = 0.1;
+	const DWORD LANES_BENCH_BULK_WINDOW = 256;		// bulk packets queued or being handled, all the time.
+
+	// A packet of RunOverloadMix().
+	struct SimPacket
+	{
+		ULONGLONG arrival;
+		OpcodeTable::Priority priority;
+	};
+
+	// Packets at load times what the workers can handle, a tenth control, 4 tenths interactive and half bulk,
+	// queued for the workers in the order they came, like PacketLanes::POLICY_FIFO does, in simulated time.
+	void RunOverloadMix(double load, bool control)
+	{
+		OverloadControl overload;
+		if(control)
+		{
+			overload.SetTarget(OverloadControl::DEFAULT_TARGET_MS, OverloadControl::DEFAULT_INTERVAL_MS);
+		}
+
+		Random random(12345);
+
+		// Poisson arrivals.
+		double meanGap = static_cast<double>(OVERLOAD_BENCH_SERVICE_US) / OVERLOAD_BENCH_WORKERS / load;
+		vector<SimPacket> packets;
+		for(double time = 1 ; time < OVERLOAD_BENCH_SECONDS * 1000000.0 ; time += -log(1.0f - random.Next()) * meanGap)
+		{
+			DWORD pick = random.Next(10);
+
+			SimPacket packet;
+			packet.arrival = static_cast<ULONGLONG>(time);
+			packet.priority = pick == 0 ? OpcodeTable::PRIORITY_CONTROL : pick < 5 ? OpcodeTable::PRIORITY_INTERACTIVE : OpcodeTable::PRIORITY_BULK;
+			packets.push_back(packet);
+		}
+
+		vector<ULONGLONG> freeTimes(OVERLOAD_BENCH_WORKERS, 0);
+		Histogram latencies[OpcodeTable::NUM_PRIORITIES];
+		ULONGLONG nextConnect = 0;
+		DWORD numConnects = 0;
+		DWORD numAdmitted = 0;
+		ULONGLONG end = 0;
+
+		// In order of arrival, each to the worker that is free first, and queued until then.
+		size_t queued = 0;
+		for(size_t i = 0 ; i < packets.size() ; ++i)
+		{
+			vector<ULONGLONG>::iterator worker = min_element(freeTimes.begin(), freeTimes.end());
+			ULONGLONG start = *worker > packets[i].arrival ? *worker : packets[i].arrival;
+
+			for( ; queued < packets.size() && packets[queued].arrival <= start ; ++queued)
+			{
+				// Connections that came in before this packet.
+				for( ; nextConnect <= packets[queued].arrival ; nextConnect += OVERLOAD_BENCH_CONNECT_MS * 1000)
+				{
+					++numConnects;
+					numAdmitted += overload.GetLevel() < OverloadControl::LEVEL_REJECTING ? 1 : 0;
+				}
+
+				overload.OnQueued();
+			}
+
+			ULONGLONG sojourn = start - packets[i].arrival;
+			if(overload.OnDequeue(packets[i].priority, sojourn, start))
+			{
+				*worker = start + OVERLOAD_BENCH_SHED_US;
+			}
+			else
+			{
+				ULONGLONG service = static_cast<ULONGLONG>(-log(1.0f - random.Next()) * OVERLOAD_BENCH_SERVICE_US) + 1;
+				*worker = start + service;
+
+				latencies[packets[i].priority].Record(sojourn + service);
+			}
+
+			end = *worker > end ? *worker : end;
+		}
+
+		OverloadControl::Stats stats;
+		overload.GetStats(stats);
+
+		ULONGLONG handled = 0;
+		for(int p = 0 ; p < OpcodeTable::NUM_PRIORITIES ; ++p)
+		{
+			handled += latencies[p].GetCount();
+		}
+
+		TRACE(" %.1fx, control %-3s : %I64d handled/sec, %d of %d connections let in, shed interactive %I64d, bulk %I64d, %I64d ms shedding",
+			load, control ? "on" : "off", end > 0 ? handled * 1000000 / end : 0, numAdmitted, numConnects,
+			stats.shed[OpcodeTable::PRIORITY_INTERACTIVE], stats.shed[OpcodeTable::PRIORITY_BULK],
+			stats.timeAtLevel[OverloadControl::LEVEL_SHEDDING] / 1000);
+		TRACE("   p99 latency : control %I64d us, interactive %I64d us, bulk %I64d us",
+			latencies[OpcodeTable::PRIORITY_CONTROL].GetPercentile(99), latencies[OpcodeTable::PRIORITY_INTERACTIVE].GetPercentile(99),
+			latencies[OpcodeTable::PRIORITY_BULK].GetPercentile(99));
+	}
+
+	// Control and interactive packets at their loads, and bulk senders that send another packet as soon as one of
+	// theirs is handled, like the reads of a bulk upload that backpressure holds to a window. That keeps the workers
+	// busy all the time. Bulk only if bulk is. Through PacketLanes to workers in simulated time, and traces p50 and
+	// p99 latency of each lane, from the queue to the end of the handler.
+	void RunLanes(PacketLanes::Policy policy, bool bulk)
+	{
+		static const char* const POLICY_NAMES[] = { "fifo", "strict", "weighted" };
+
+		PacketLanes lanes;
+		lanes.SetPolicy(policy);
+
+		Random random(12345);
+
+		// Poisson arrivals of control and interactive, merged in order of arrival.
+		const double LOADS[] = { LANES_BENCH_CONTROL_LOAD, LANES_BENCH_INTERACTIVE_LOAD };
+		vector< pair<ULONGLONG, OpcodeTable::Priority> > arrivals;
+		for(int p = 0 ; p < 2 ; ++p)
+		{
+			double meanGap = static_cast<double>(LANES_BENCH_SERVICE_US) / LANES_BENCH_WORKERS / LOADS[p];
+			for(double time = 1 ; time < LANES_BENCH_SECONDS * 1000000.0 ; time += -log(1.0f - random.Next()) * meanGap)
+			{
+				arrivals.push_back(make_pair(static_cast<ULONGLONG>(time), static_cast<OpcodeTable::Priority>(p)));
+			}
+		}
+		sort(arrivals.begin(), arrivals.end());
+
+		// Times bulk packets come, as the ones before them are handled.
+		priority_queue< ULONGLONG, vector<ULONGLONG>, greater<ULONGLONG> > bulkArrivals;
+		for(DWORD i = 0 ; bulk && i < LANES_BENCH_BULK_WINDOW ; ++i)
+		{
+			bulkArrivals.push(1);
+		}
+
+		vector<ULONGLONG> freeTimes(LANES_BENCH_WORKERS, 0);
+		Histogram latencies[OpcodeTable::NUM_PRIORITIES];
+		ULONGLONG end = static_cast<ULONGLONG>(LANES_BENCH_SECONDS) * 1000000;
+		ULONGLONG lastArrival = 0;
+		size_t next = 0;
+		bool empty = true;
+
+		// The worker that is free first pops once everything that came by then is pushed.
+		// A packet that comes to empty lanes is pushed whenever that is, and popped when it comes.
+		for(;;)
+		{
+			vector<ULONGLONG>::iterator worker = min_element(freeTimes.begin(), freeTimes.end());
+
+			bool poisson = next < arrivals.size();
+			bool bulkFirst = !bulkArrivals.empty() && (!poisson || bulkArrivals.top() < arrivals[next].first);
+			ULONGLONG arrival = bulkFirst ? bulkArrivals.top() : poisson ? arrivals[next].first : 0;
+
+			if((bulkFirst || poisson) && (arrival <= *worker || empty))
+			{
+				Packet* packet = Packet::Create(NULL, NULL, 16);
+				if(packet == NULL)
+				{
+					ERROR_MSG("Could not allocate a packet. BufferPool is exhausted.");
+					return;
+				}
+
+				packet->SetPriority(bulkFirst ? OpcodeTable::PRIORITY_BULK : arrivals[next].second);
+				packet->SetQueueTime(arrival);
+				lanes.Push(packet);
+
+				if(bulkFirst)
+				{
+					bulkArrivals.pop();
+				}
+				else
+				{
+					++next;
+				}
+
+				lastArrival = arrival;
+				empty = false;
+				continue;
+			}
+
+			ULONGLONG start = *worker > lastArrival ? *worker : lastArrival;
+			Packet* packet = lanes.Pop(start);
+			if(packet == NULL)
+			{
+				if(!bulkFirst && !poisson)
+				{
+					break;
+				}
+
+				empty = true;
+				continue;
+			}
+
+			ULONGLONG service = static_cast<ULONGLONG>(-log(1.0f - random.Next()) * LANES_BENCH_SERVICE_US) + 1;
+			*worker = start + service;
+
+			// Bulk senders stop with the others.
+			if(packet->GetPriority() == OpcodeTable::PRIORITY_BULK && *worker < end)
+			{
+				bulkArrivals.push(*worker);
+			}
+
+			latencies[packet->GetPriority()].Record(*worker - packet->GetQueueTime());
+			Packet::Destroy(packet);
+		}
+
+		PacketLanes::Stats stats;
+		lanes.GetStats(stats);
+
+		TRACE(" %-8s, bulk %-3s : control %I64d / %I64d us, interactive %I64d / %I64d us, bulk %I64d / %I64d us, %I64d bulk/sec, rescued bulk %I64d",
+			POLICY_NAMES[policy], bulk ? "on" : "off",
+			latencies[OpcodeTable::PRIORITY_CONTROL].GetPercentile(50), latencies[OpcodeTable::PRIORITY_CONTROL].GetPercentile(99),
+			latencies[OpcodeTable::PRIORITY_INTERACTIVE].GetPercentile(50), latencies[OpcodeTable::PRIORITY_INTERACTIVE].GetPercentile(99),
+			latencies[OpcodeTable::PRIORITY_BULK].GetPercentile(50), latencies[OpcodeTable::PRIORITY_BULK].GetPercentile(99),
+			latencies[OpcodeTable::PRIORITY_BULK].GetCount() / LANES_BENCH_SECONDS, stats.rescued[OpcodeTable::PRIORITY_BULK]);
+	}
+
+	// An IPv4 address picked at random, mapped like Network::GetRemoteIp() does it.
+	IN6_ADDR RandomAddress(Random& random)
+	{
+		IN6_ADDR address;
+		ZeroMemory(&address, sizeof(address));
+		address.s6_addr[10] = 0xFF;
+		address.s6_addr[11] = 0xFF;
+		for(int i = 12 ; i < 16 ; ++i)
+		{
+			address.s6_addr[i] = static_cast<BYTE>(random.Next(256));
+		}
+		return address;
+	}
+
+	// What a sweep reads of a client, on a line of its own like the first one of Client, for walking the clients instead.
+	struct ScatteredConnection
+	{
+		DWORD lastActivity;
+		DWORD inUse;
+		ULONGLONG recvBytes;
+		ULONGLONG sentBytes;
+		BYTE rest[CACHE_LINE_SIZE - 2 * sizeof(DWORD) - 2 * sizeof(ULONGLONG)];
+	};
+
+	// What Server::ForwardToLogic() does with a ping frame of a client.
+	bool PushPing(SharedChannel& front)
+	{
+		DWORD block = front.AllocBlock();
+		if(block == SharedChannel::NO_BLOCK)
+		{
+			return false;
+		}
+
+		Protocol::Header* header = reinterpret_cast<Protocol::Header*>(front.GetBlock(block));
+		header->size = sizeof(ULONGLONG);
+		header->opcode = Protocol::OP_PING;
+		header->flags = 0;
+
+		SharedChannel::Message message;
+		message.type = SharedChannel::MESSAGE_FRAME;
+		message.reserved = 0;
+		message.handle = 1;
+		message.block = block;
+		message.size = Protocol::HEADER_SIZE + sizeof(ULONGLONG);
+
+		if(!front.Push(SharedChannel::INBOUND, message))
+		{
+			front.FreeBlock(block);
+			return false;
+		}
+
+		return true;
+	}
+}
+
+
+void Benchmark::PubSubFanOut()
+{
+	const DWORD CHANNEL = 1;
+	const DWORD FAN_OUTS[] = { 10, 1000, 50000 };
+	const ULONGLONG DELIVERIES_PER_RUN = 10000000;
+
+	for(size_t i = 0 ; i < sizeof(FAN_OUTS) / sizeof(FAN_OUTS[0]) ; ++i)
+	{
+		DWORD fanOut = FAN_OUTS[i];
+
+		// PubSub never dereferences clients, so any distinct addresses will do.
+		vector<ULONG_PTR> fakeClients(fanOut);
+
+		PubSub pubSub;
+		for(DWORD c = 0 ; c < fanOut ; ++c)
+		{
+			pubSub.Subscribe(CHANNEL, reinterpret_cast<Client*>(&fakeClients[c]));
+		}
+		pubSub.Flush();
+
+		Packet* packet = CreatePublishPacket(CHANNEL, 64);
+		if(packet == NULL)
+		{
+			ERROR_MSG("Could not create a packet.");
+			return;
+		}
+
+		ULONGLONG publishes = DELIVERIES_PER_RUN / fanOut;
+		ULONGLONG deliveries = 0;
+
+		ULONGLONG start = Clock::GetMicroseconds();
+		for(ULONGLONG p = 0 ; p < publishes ; ++p)
+		{
+			pubSub.Publish(CHANNEL, packet, CountDelivery, &deliveries);
+		}
+		ULONGLONG elapsed = Clock::GetMicroseconds() - start;
+		if(elapsed == 0) elapsed = 1;
+
+		Packet::Destroy(packet);
+
+		TRACE(" fan-out %6d : %I64d publishes, %I64d deliveries in %I64d us, %I64d deliveries/sec, %I64d ns/delivery",
+			fanOut, publishes, deliveries, elapsed, deliveries * 1000000 / elapsed, elapsed * 1000 / (deliveries > 0 ? deliveries : 1));
+	}
+}
+
+
+void Benchmark::InterestTick()
+{
+	const float WORLD_SIZE = 2500.0f;
+	const float CELL_SIZE = 100.0f;
+	const float VIEW_RADIUS = 100.0f;
+	const float MAX_SPEED = 5.0f;
+	const DWORD NUM_ENTITIES = 50000;
+	const DWORD OBSERVERS[] = { 5000, 50000 };
+	const DWORD TICKS = 20;
+
+	for(size_t o = 0 ; o < sizeof(OBSERVERS) / sizeof(OBSERVERS[0]) ; ++o)
+	{
+		for(int simd = 1 ; simd >= 0 ; --simd)
+		{
+			DWORD numObservers = OBSERVERS[o];
+
+			InterestGrid grid(WORLD_SIZE, CELL_SIZE, VIEW_RADIUS);
+			grid.EnableSimd(simd != 0);
+
+			// The grid never dereferences clients.
+			vector<ULONG_PTR> fakeClients(numObservers);
+
+			Random random(12345);
+			vector<DWORD> ids(NUM_ENTITIES);
+			vector<float> x(NUM_ENTITIES), y(NUM_ENTITIES), vx(NUM_ENTITIES), vy(NUM_ENTITIES);
+			for(DWORD i = 0 ; i < NUM_ENTITIES ; ++i)
+			{
+				x[i] = random.Next() * WORLD_SIZE;
+				y[i] = random.Next() * WORLD_SIZE;
+				vx[i] = (random.Next() * 2.0f - 1.0f) * MAX_SPEED;
+				vy[i] = (random.Next() * 2.0f - 1.0f) * MAX_SPEED;
+
+				Client* owner = i < numObservers ? reinterpret_cast<Client*>(&fakeClients[i]) : NULL;
+				ids[i] = grid.AddEntity(x[i], y[i], owner);
+			}
+
+			ULONGLONG moveTime = 0, sortTime = 0, interestTime = 0;
+			ULONGLONG deliveries = 0, cellPackets = 0, packetBytes = 0, sentBytes = 0;
+
+			for(DWORD t = 0 ; t < TICKS ; ++t)
+			{
+				ULONGLONG start = Clock::GetMicroseconds();
+
+				// Bounce off the edges.
+				for(DWORD i = 0 ; i < NUM_ENTITIES ; ++i)
+				{
+					x[i] += vx[i];
+					y[i] += vy[i];
+					if(x[i] < 0.0f || x[i] > WORLD_SIZE) { vx[i] = -vx[i]; x[i] += 2.0f * vx[i]; }
+					if(y[i] < 0.0f || y[i] > WORLD_SIZE) { vy[i] = -vy[i]; y[i] += 2.0f * vy[i]; }
+
+					grid.MoveEntity(ids[i], x[i], y[i]);
+				}
+
+				moveTime += Clock::GetMicroseconds() - start;
+
+				ULONGLONG delivered = 0;
+				InterestGrid::TickStats stats;
+				grid.Tick(CountDelivery, &delivered, &stats);
+
+				sortTime += stats.sortTime;
+				interestTime += stats.interestTime;
+				deliveries += delivered;
+				cellPackets += stats.cellPackets;
+				packetBytes += stats.packetBytes;
+				sentBytes += stats.sentBytes;
+			}
+
+			TRACE(" %d entities, %d observers, %s : move %I64d us, sort %I64d us, interest %I64d us per tick",
+				NUM_ENTITIES, numObservers, simd ? "SSE2" : "scalar", moveTime / TICKS, sortTime / TICKS, interestTime / TICKS);
+			TRACE("   per tick : %I64d deliveries of %I64d cell packets, %I64d KB built for %I64d KB sent",
+				deliveries / TICKS, cellPackets / TICKS, packetBytes / TICKS / 1024, sentBytes / TICKS / 1024);
+		}
+	}
+
+	// Range queries on the last layout.
+	{
+		InterestGrid grid(WORLD_SIZE, CELL_SIZE, VIEW_RADIUS);
+
+		Random random(6789);
+		for(DWORD i = 0 ; i < NUM_ENTITIES ; ++i)
+		{
+			grid.AddEntity(random.Next() * WORLD_SIZE, random.Next() * WORLD_SIZE, NULL);
+		}
+		ULONGLONG delivered = 0;
+		grid.Tick(CountDelivery, &delivered, NULL);
+
+		const DWORD QUERIES = 50000;
+		vector<DWORD> found;
+
+		for(int simd = 1 ; simd >= 0 ; --simd)
+		{
+			grid.EnableSimd(simd != 0);
+
+			Random queries(42);
+			ULONGLONG hits = 0;
+
+			ULONGLONG start = Clock::GetMicroseconds();
+			for(DWORD q = 0 ; q < QUERIES ; ++q)
+			{
+				grid.Query(queries.Next() * WORLD_SIZE, queries.Next() * WORLD_SIZE, VIEW_RADIUS, found);
+				hits += found.size();
+			}
+			ULONGLONG elapsed = Clock::GetMicroseconds() - start;
+			if(elapsed == 0) elapsed = 1;
+
+			TRACE(" %d queries, %s : %I64d us, %I64d ns/query, %I64d entities found",
+				QUERIES, simd ? "SSE2" : "scalar", elapsed, elapsed * 1000 / QUERIES, hits);
+		}
+	}
+}
+
+
+void Benchmark::SnapshotDelta()
+{
+	const DWORD NUM_CLIENTS = 100;
+	const DWORD NUM_VISIBLE = 200;
+	const DWORD TICKS = 300;
+	const DWORD ACK_DELAY = 3;		// ticks for a snapshot to get there and its ack to come back.
+	const float ACK_LOSS = 0.05f;
+	const DWORD CHURN = 2;			// entities that leave and enter the view per tick.
+	const float MOVING[] = { 0.1f, 0.5f, 1.0f };
+
+	for(size_t m = 0 ; m < sizeof(MOVING) / sizeof(MOVING[0]) ; ++m)
+	{
+		Random random(777);
+
+		// Everybody sees the same entities. Sorted by id.
+		vector<EntityState> world(NUM_VISIBLE);
+		DWORD nextId = 0;
+		for(DWORD i = 0 ; i < NUM_VISIBLE ; ++i)
+		{
+			world[i].id = nextId++;
+			world[i].x = SnapshotCodec::Quantize(random.Next() * 1000.0f);
+			world[i].y = SnapshotCodec::Quantize(random.Next() * 1000.0f);
+		}
+
+		vector<SnapshotHistory*> histories(NUM_CLIENTS);
+		for(DWORD c = 0 ; c < NUM_CLIENTS ; ++c)
+		{
+			histories[c] = new SnapshotHistory;
+		}
+
+		// What client 0 decoded, to check the encoder.
+		vector<Snapshot> decoded(SnapshotHistory::RING_SIZE);
+		bool correct = true;
+
+		vector<BYTE> buffer;
+		ULONGLONG encodeTime = 0, entities = 0, deltaBytes = 0, fullBytes = 0;
+
+		for(DWORD t = 0 ; t < TICKS ; ++t)
+		{
+			for(DWORD i = 0 ; i < NUM_VISIBLE ; ++i)
+			{
+				if(random.Next() < MOVING[m])
+				{
+					// Walking speed, up to a unit per tick.
+					float x = SnapshotCodec::Dequantize(world[i].x) + random.Next() * 2.0f - 1.0f;
+					float y = SnapshotCodec::Dequantize(world[i].y) + random.Next() * 2.0f - 1.0f;
+					world[i].x = SnapshotCodec::Quantize(x);
+					world[i].y = SnapshotCodec::Quantize(y);
+				}
+			}
+
+			for(DWORD k = 0 ; k < CHURN ; ++k)
+			{
+				world.erase(world.begin() + static_cast<size_t>(random.Next() * world.size()));
+
+				EntityState entered;
+				entered.id = nextId++;
+				entered.x = SnapshotCodec::Quantize(random.Next() * 1000.0f);
+				entered.y = SnapshotCodec::Quantize(random.Next() * 1000.0f);
+				world.push_back(entered);
+			}
+
+			for(DWORD c = 0 ; c < NUM_CLIENTS ; ++c)
+			{
+				SnapshotHistory* history = histories[c];
+
+				ULONGLONG start = Clock::GetMicroseconds();
+
+				Snapshot& snapshot = history->Push();
+				snapshot.entities = world;
+				const Snapshot* baseline = history->GetBaseline();
+
+				buffer.clear();
+				SnapshotCodec::Encode(snapshot, baseline, buffer);
+
+				encodeTime += Clock::GetMicroseconds() - start;
+				entities += world.size();
+				deltaBytes += Protocol::HEADER_SIZE + buffer.size();
+				fullBytes += Messages::EntityUpdatesBuilder::GetFrameSize(static_cast<DWORD>(world.size()));
+
+				if(c == 0)
+				{
+					DWORD sequence = 0, baselineSequence = 0;
+					SnapshotCodec::ReadSequences(&buffer[0], static_cast<DWORD>(buffer.size()), sequence, baselineSequence);
+
+					Snapshot& out = decoded[sequence % SnapshotHistory::RING_SIZE];
+					const Snapshot* clientBaseline = baselineSequence != SnapshotCodec::NO_BASELINE ? &decoded[baselineSequence % SnapshotHistory::RING_SIZE] : NULL;
+
+					Snapshot result;
+					if(!SnapshotCodec::Decode(&buffer[0], static_cast<DWORD>(buffer.size()), clientBaseline, result) || result.entities.size() != world.size())
+					{
+						correct = false;
+					}
+					else
+					{
+						for(size_t i = 0 ; i < world.size() ; ++i)
+						{
+							if(result.entities[i].id != world[i].id || result.entities[i].x != world[i].x || result.entities[i].y != world[i].y)
+							{
+								correct = false;
+							}
+						}
+					}
+
+					out.sequence = result.sequence;
+					out.entities.swap(result.entities);
+				}
+
+				// The ack of what was sent ACK_DELAY ticks ago arrives, unless it's lost.
+				if(t >= ACK_DELAY && random.Next() >= ACK_LOSS)
+				{
+					history->Ack(snapshot.sequence - ACK_DELAY);
+				}
+			}
+		}
+
+		for(DWORD c = 0 ; c < NUM_CLIENTS ; ++c)
+		{
+			delete histories[c];
+		}
+
+		if(encodeTime == 0) encodeTime = 1;
+
+		TRACE(" %d%% moving : %I64d bytes/snapshot against %I64d full (%I64d%%), encode %I64d ns/entity, decoded %s",
+			static_cast<int>(MOVING[m] * 100), deltaBytes / (TICKS * NUM_CLIENTS), fullBytes / (TICKS * NUM_CLIENTS),
+			deltaBytes * 100 / fullBytes, encodeTime * 1000 / entities, correct ? "correctly" : "WRONG");
+	}
+}
+
+
+void Benchmark::OpcodeDispatch()
+{
+	const WORD OPCODES[] =
+	{
+		Protocol::OP_ECHO, Protocol::OP_PING, Protocol::OP_SUBSCRIBE, Protocol::OP_UNSUBSCRIBE,
+		Protocol::OP_PUBLISH, Protocol::OP_MOVE, Protocol::OP_SNAPSHOT_ACK,
+	};
+	const DWORD NUM_OPCODES = sizeof(OPCODES) / sizeof(OPCODES[0]);
+	const DWORD NUM_PACKETS = 4096;
+	const DWORD ROUNDS = 2000;
+
+	// Random opcodes so that the branch predictor can't learn the order. A few unknown ones too.
+	Random random(31337);
+	vector<Packet*> packets(NUM_PACKETS);
+	for(DWORD i = 0 ; i < NUM_PACKETS ; ++i)
+	{
+		Protocol::Header header;
+		header.size = 0;
+		header.opcode = random.Next() < 0.01f ? 999 : OPCODES[static_cast<DWORD>(random.Next() * NUM_OPCODES)];
+		header.flags = 0;
+
+		packets[i] = Packet::Create(NULL, reinterpret_cast<BYTE*>(&header), sizeof(header));
+	}
+
+	typedef boost::unordered_map<int, boost::function<void (Packet*)> > HandlerMap;
+
+	DispatchTarget mapTarget;
+	HandlerMap handlers;
+	handlers[Protocol::OP_ECHO] = boost::bind(&DispatchTarget::Echo, &mapTarget, _1);
+	handlers[Protocol::OP_PING] = boost::bind(&DispatchTarget::Ping, &mapTarget, _1);
+	handlers[Protocol::OP_SUBSCRIBE] = boost::bind(&DispatchTarget::Subscribe, &mapTarget, _1);
+	handlers[Protocol::OP_UNSUBSCRIBE] = boost::bind(&DispatchTarget::Unsubscribe, &mapTarget, _1);
+	handlers[Protocol::OP_PUBLISH] = boost::bind(&DispatchTarget::Publish, &mapTarget, _1);
+	handlers[Protocol::OP_MOVE] = boost::bind(&DispatchTarget::Move, &mapTarget, _1);
+	handlers[Protocol::OP_SNAPSHOT_ACK] = boost::bind(&DispatchTarget::AckSnapshot, &mapTarget, _1);
+
+	ULONGLONG start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < ROUNDS ; ++round)
+	{
+		for(DWORD i = 0 ; i < NUM_PACKETS ; ++i)
+		{
+			Packet* packet = packets[i];
+			WORD opcode = reinterpret_cast<const Protocol::Header*>(packet->GetData())->opcode;
+
+			HandlerMap::const_iterator itor = handlers.find(opcode);
+			if(itor != handlers.end())
+			{
+				itor->second(packet);
+			}
+			else
+			{
+				mapTarget.OnUnknownOpcode(packet);
+			}
+		}
+	}
+	ULONGLONG mapTime = Clock::GetMicroseconds() - start;
+
+	DispatchTarget tableTarget;
+
+	start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < ROUNDS ; ++round)
+	{
+		for(DWORD i = 0 ; i < NUM_PACKETS ; ++i)
+		{
+			Packet* packet = packets[i];
+			WORD opcode = reinterpret_cast<const Protocol::Header*>(packet->GetData())->opcode;
+
+			OpcodeTable::Dispatch(s_DispatchTable, &tableTarget, opcode, packet);
+		}
+	}
+	ULONGLONG tableTime = Clock::GetMicroseconds() - start;
+
+	for(DWORD i = 0 ; i < NUM_PACKETS ; ++i)
+	{
+		Packet::Destroy(packets[i]);
+	}
+
+	ULONGLONG messages = static_cast<ULONGLONG>(NUM_PACKETS) * ROUNDS;
+
+	// The sums have to be the same or one of them called the wrong handlers.
+	TRACE(" unordered_map + function : %I64d ns/message", mapTime * 1000 / messages);
+	TRACE(" OpcodeTable : %I64d ns/message, same handlers : %s", tableTime * 1000 / messages,
+		mapTarget.GetSum() == tableTarget.GetSum() ? "yes" : "NO");
+}
+
+
+void Benchmark::SchemaCodec()
+{
+	const DWORD NUM_ENTITIES = 64;
+	const DWORD ROUNDS = 200000;
+
+	vector<BYTE> frame(Messages::EntityUpdatesBuilder::GetFrameSize(NUM_ENTITIES));
+	ULONGLONG handSum = 0, schemaSum = 0;
+
+	// EntityUpdates, hand-written
+	ULONGLONG start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < ROUNDS ; ++round)
+	{
+		HandEntityUpdates* message = reinterpret_cast<HandEntityUpdates*>(&frame[0]);
+		message->header.size = sizeof(DWORD) + NUM_ENTITIES * sizeof(Messages::EntityUpdate);
+		message->header.opcode = Protocol::OP_ENTITY_UPDATES;
+		message->header.flags = 0;
+		message->count = NUM_ENTITIES;
+
+		Messages::EntityUpdate* updates = reinterpret_cast<Messages::EntityUpdate*>(message + 1);
+		for(DWORD i = 0 ; i < NUM_ENTITIES ; ++i)
+		{
+			updates[i].id = round + i;
+			updates[i].x = static_cast<float>(i);
+			updates[i].y = static_cast<float>(round);
+		}
+	}
+	ULONGLONG handEncode = Clock::GetMicroseconds() - start;
+
+	start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < ROUNDS ; ++round)
+	{
+		const HandEntityUpdates* message = reinterpret_cast<const HandEntityUpdates*>(&frame[0]);
+		if(message->header.opcode != Protocol::OP_ENTITY_UPDATES || frame.size() < sizeof(HandEntityUpdates) + message->count * sizeof(Messages::EntityUpdate))
+		{
+			continue;
+		}
+
+		const Messages::EntityUpdate* updates = reinterpret_cast<const Messages::EntityUpdate*>(message + 1);
+		for(DWORD i = 0 ; i < message->count ; ++i)
+		{
+			handSum += updates[i].id + static_cast<DWORD>(updates[i].x + updates[i].y);
+		}
+	}
+	ULONGLONG handDecode = Clock::GetMicroseconds() - start;
+
+	// EntityUpdates, Messages.h
+	start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < ROUNDS ; ++round)
+	{
+		Messages::EntityUpdatesBuilder builder(&frame[0], NUM_ENTITIES);
+		for(DWORD i = 0 ; i < NUM_ENTITIES ; ++i)
+		{
+			Messages::EntityUpdate update;
+			update.id = round + i;
+			update.x = static_cast<float>(i);
+			update.y = static_cast<float>(round);
+			builder.SetEntities(i, update);
+		}
+	}
+	ULONGLONG schemaEncode = Clock::GetMicroseconds() - start;
+
+	start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < ROUNDS ; ++round)
+	{
+		Messages::EntityUpdatesView view;
+		if(!view.Init(&frame[0], static_cast<DWORD>(frame.size())))
+		{
+			continue;
+		}
+
+		for(DWORD i = 0 ; i < view.GetEntitiesCount() ; ++i)
+		{
+			Messages::EntityUpdate update = view.GetEntities(i);
+			schemaSum += update.id + static_cast<DWORD>(update.x + update.y);
+		}
+	}
+	ULONGLONG schemaDecode = Clock::GetMicroseconds() - start;
+
+	TRACE(" EntityUpdates of %d : hand-written encode %I64d ns, decode %I64d ns / Messages.h encode %I64d ns, decode %I64d ns, same values : %s",
+		NUM_ENTITIES, handEncode * 1000 / ROUNDS, handDecode * 1000 / ROUNDS, schemaEncode * 1000 / ROUNDS, schemaDecode * 1000 / ROUNDS,
+		handSum == schemaSum ? "yes" : "NO");
+
+	// Move. Small messages are mostly header checks.
+	const DWORD MOVE_ROUNDS = ROUNDS * 50;
+	BYTE move[Protocol::HEADER_SIZE + Messages::MoveView::FIXED_SIZE];
+	float handTotal = 0.0f, schemaTotal = 0.0f;
+
+	start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < MOVE_ROUNDS ; ++round)
+	{
+		HandMove* message = reinterpret_cast<HandMove*>(move);
+		message->header.size = sizeof(float) * 2;
+		message->header.opcode = Protocol::OP_MOVE;
+		message->header.flags = 0;
+		message->x = static_cast<float>(round & 0xFF);
+		message->y = 1.0f;
+
+		const HandMove* read = reinterpret_cast<const HandMove*>(move);
+		if(read->header.opcode == Protocol::OP_MOVE && read->header.size == sizeof(float) * 2)
+		{
+			handTotal += read->x + read->y;
+		}
+	}
+	ULONGLONG handMove = Clock::GetMicroseconds() - start;
+
+	start = Clock::GetMicroseconds();
+	for(DWORD round = 0 ; round < MOVE_ROUNDS ; ++round)
+	{
+		Messages::MoveBuilder builder(move);
+		builder.SetX(static_cast<float>(round & 0xFF));
+		builder.SetY(1.0f);
+
+		Messages::MoveView view;
+		if(view.Init(move, sizeof(move)))
+		{
+			schemaTotal += view.GetX() + view.GetY();
+		}
+	}
+	ULONGLONG schemaMove = Clock::GetMicroseconds() - start;
+
+	TRACE(" Move encode + decode : hand-written %I64d ns, Messages.h %I64d ns, same values : %s",
+		handMove * 1000 / MOVE_ROUNDS, schemaMove * 1000 / MOVE_ROUNDS, handTotal == schemaTotal ? "yes" : "NO");
+}
+
+
+void Benchmark::RespPipeline()
+{
+	const DWORD NUM_KEYS = 100000;
+	const DWORD COMMANDS_PER_RUN = 2000000;
+	const DWORD DEPTHS[] = { 1, 16 };
+	const char* COMMANDS[] = { "SET", "GET", "INCR" };
+
+	KeyValueStore store;
+
+	for(size_t c = 0 ; c < sizeof(COMMANDS) / sizeof(COMMANDS[0]) ; ++c)
+	{
+		for(size_t d = 0 ; d < sizeof(DEPTHS) / sizeof(DEPTHS[0]) ; ++d)
+		{
+			DWORD depth = DEPTHS[d];
+
+			// Recvs of depth commands each, on random keys. Made up front so that only the server side is timed.
+			const DWORD NUM_RECVS = 1024;
+			vector< vector<BYTE> > recvs(NUM_RECVS);
+
+			Random random(12345);
+			char key[32];
+			for(DWORD r = 0 ; r < NUM_RECVS ; ++r)
+			{
+				for(DWORD i = 0 ; i < depth ; ++i)
+				{
+					sprintf_s(key, sizeof(key), "key:%06d", random.Next(NUM_KEYS));
+
+					// SET a 3 byte value like redis-benchmark. INCR counts on keys of its own.
+					if(c == 0) AppendRespCommand(recvs[r], "SET", key, "xxx");
+					else if(c == 1) AppendRespCommand(recvs[r], "GET", key, NULL);
+					else AppendRespCommand(recvs[r], "INCR", key + 4, NULL);
+				}
+			}
+
+			RespSession session;
+			ULONGLONG commands = 0;
+			ULONGLONG replyBytes = 0;
+
+			ULONGLONG start = Clock::GetMicroseconds();
+			for(DWORD r = 0 ; commands < COMMANDS_PER_RUN ; r = (r + 1) % NUM_RECVS)
+			{
+				DWORD numCommands = 0;
+				if(session.Feed(&recvs[r][0], static_cast<DWORD>(recvs[r].size()), store, numCommands) != RespSession::OK)
+				{
+					ERROR_MSG("RESP protocol error.");
+					return;
+				}
+
+				commands += numCommands;
+				replyBytes += session.GetReply().size();
+				session.ClearReply();
+			}
+			ULONGLONG elapsed = Clock::GetMicroseconds() - start;
+			if(elapsed == 0) elapsed = 1;
+
+			TRACE(" %-4s -P %2d : %I64d commands in %I64d us, %I64d commands/sec, %I64d ns/command, %I64d reply bytes",
+				COMMANDS[c], depth, commands, elapsed, commands * 1000000 / elapsed, elapsed * 1000 / commands, replyBytes);
+		}
+	}
+
+	KeyValueStore::Stats stats;
+	store.GetStats(stats);
+	TRACE(" %I64d keys, keys and values : %I64d bytes, arenas : %I64d bytes", stats.keys, stats.recordBytes, stats.arenaBytes);
+}
+
+
+void Benchmark::BalancerMix()
+{
+	const DWORD NUM_CALLS = 500000;
+	const DWORD NUM_CALLERS = 64;
+	const DWORD WORKERS_PER_BACKEND = 8;
+
+	const Balancer::Policy POLICIES[] = { Balancer::POLICY_ROUND_ROBIN, Balancer::POLICY_LEAST_OUTSTANDING, Balancer::POLICY_EWMA };
+	const char* POLICY_NAMES[] = { "round robin", "least outstanding", "ewma" };
+
+	SimBackend fast;
+	fast.serviceUs = 1000;
+	fast.failing = false;
+	fast.freeTimes.resize(WORKERS_PER_BACKEND, 0);
+
+	SimBackend slow = fast;
+	slow.serviceUs = 10000;
+
+	SimBackend failing = fast;
+	failing.failing = true;
+
+	// 3 backends at 1 ms a call and one at 10 ms. Then the odd one fails every call.
+	for(int mix = 0 ; mix < 2 ; ++mix)
+	{
+		TRACE(" 3 backends of 1 ms and 1 %s, %d workers each, %d callers :",
+			mix == 0 ? "of 10 ms" : "failing every call in 1 ms", WORKERS_PER_BACKEND, NUM_CALLERS);
+
+		vector<SimBackend> backends(3, fast);
+		backends.push_back(mix == 0 ? slow : failing);
+
+		for(size_t p = 0 ; p < sizeof(POLICIES) / sizeof(POLICIES[0]) ; ++p)
+		{
+			RunBalancerMix(POLICY_NAMES[p], POLICIES[p], backends, NUM_CALLERS, NUM_CALLS);
+		}
+	}
+}
+
+
+void Benchmark::SharedChannelRoundTrip()
+{
+	const DWORD NUM_ROUND_TRIPS = 200000;
+	const DWORD NUM_IDLE_ROUND_TRIPS = 500;
+	const DWORD NUM_PIPELINED = 2000000;
+	const DWORD WINDOW = 1024;
+
+	// Both ends in this process, each with a view of its own like the front and the logic would have.
+	char name[64];
+	sprintf_s(name, sizeof(name), "Benchmark_%d", GetCurrentProcessId());
+
+	SharedChannel front;
+	SharedChannel logic;
+	if(!front.Create(name) || !logic.Open(name) || !logic.StartReading(SharedChannel::INBOUND, EchoToFront, &logic, NULL))
+	{
+		ERROR_MSG("Could not set up the channel.");
+		return;
+	}
+
+	// One ping at a time. Back to back, the readers are still spinning when the next one comes.
+	// 1 ms apart, both are asleep and every message is a wakeup.
+	for(int idle = 0 ; idle < 2 ; ++idle)
+	{
+		DWORD numRoundTrips = idle ? NUM_IDLE_ROUND_TRIPS : NUM_ROUND_TRIPS;
+
+		ULONGLONG wakeups = front.GetStats(SharedChannel::INBOUND).wakeups + front.GetStats(SharedChannel::OUTBOUND).wakeups;
+
+		Histogram roundTrips;
+		for(DWORD i = 0 ; i < numRoundTrips ; ++i)
+		{
+			if(idle)
+			{
+				Sleep(1);
+			}
+
+			ULONGLONG start = GetNanoseconds();
+
+			SharedChannel::Message message;
+			if(!PushPing(front) || !front.Pop(SharedChannel::OUTBOUND, message, 1000))
+			{
+				ERROR_MSG("A ping was lost.");
+				return;
+			}
+
+			roundTrips.Record(GetNanoseconds() - start);
+			front.FreeBlock(message.block);
+		}
+
+		wakeups = front.GetStats(SharedChannel::INBOUND).wakeups + front.GetStats(SharedChannel::OUTBOUND).wakeups - wakeups;
+
+		TRACE(" %-13s : round trip p50 %6I64d ns, p99 %6I64d ns, p99.9 %7I64d ns, max %8I64d ns, %I64d wakeups per 100 round trips",
+			idle ? "1 ms apart" : "back to back", roundTrips.GetPercentile(50), roundTrips.GetPercentile(99),
+			roundTrips.GetPercentile(99.9), roundTrips.GetMax(), wakeups * 100 / numRoundTrips);
+	}
+
+	// WINDOW pings in flight, as the front would have with many clients.
+	ULONGLONG start = GetNanoseconds();
+	DWORD sent = 0;
+	DWORD received = 0;
+	while(received < NUM_PIPELINED)
+	{
+		while(sent < NUM_PIPELINED && sent - received < WINDOW && PushPing(front))
+		{
+			++sent;
+		}
+
+		SharedChannel::Message message;
+		if(!front.Pop(SharedChannel::OUTBOUND, message, 1000))
+		{
+			ERROR_MSG("A ping was lost.");
+			return;
+		}
+
+		front.FreeBlock(message.block);
+		++received;
+	}
+	ULONGLONG elapsed = GetNanoseconds() - start;
+
+	TRACE(" %d in flight : %I64d round trips/sec, %I64d messages/sec both ways, %I64d ns per round trip",
+		WINDOW, static_cast<ULONGLONG>(NUM_PIPELINED) * 1000000000 / elapsed,
+		static_cast<ULONGLONG>(NUM_PIPELINED) * 2 * 1000000000 / elapsed, elapsed / NUM_PIPELINED);
+
+	logic.Close();
+	front.Close();
+}
+
+
+void Benchmark::Echo()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	MeasureServer("Server, MODE_RAW", info.dwNumberOfProcessors);
+	MeasureServer("Server, MODE_RAW, 1 thread", 1);
+}
+
+
+void Benchmark::ConnectionLayout()
+{
+	TRACE(" Client : %d bytes, %d lines. IOEvent : %d bytes, %d lines.",
+		sizeof(Client), (sizeof(Client) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE,
+		sizeof(IOEvent), (sizeof(IOEvent) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE);
+
+	// Events taken one after another, like the recvs and sends of busy clients.
+	const DWORD NUM_EVENTS = 64;
+	IOEvent* events[NUM_EVENTS];
+	for(DWORD i = 0 ; i < NUM_EVENTS ; ++i)
+	{
+		events[i] = IOEvent::Create(IOEvent::RECV, NULL);
+	}
+
+	DWORD sharing = 0;
+	for(DWORD i = 0 ; i < NUM_EVENTS ; ++i)
+	{
+		ULONG_PTR first = reinterpret_cast<ULONG_PTR>(events[i]) / CACHE_LINE_SIZE;
+		ULONG_PTR last = (reinterpret_cast<ULONG_PTR>(events[i]) + sizeof(IOEvent) - 1) / CACHE_LINE_SIZE;
+		for(DWORD j = 0 ; j < NUM_EVENTS ; ++j)
+		{
+			ULONG_PTR other = reinterpret_cast<ULONG_PTR>(events[j]);
+			if(j != i && other / CACHE_LINE_SIZE <= last && (other + sizeof(IOEvent) - 1) / CACHE_LINE_SIZE >= first)
+			{
+				++sharing;
+				break;
+			}
+		}
+	}
+
+	for(DWORD i = 0 ; i < NUM_EVENTS ; ++i)
+	{
+		IOEvent::Destroy(events[i]);
+	}
+
+	TRACE(" %d of %d events from the pool share a line with another.", sharing, NUM_EVENTS);
+
+	// What false sharing of the counters costs.
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	DWORD maxThreads = info.dwNumberOfProcessors < LAYOUT_BENCH_MAX_THREADS ? info.dwNumberOfProcessors : LAYOUT_BENCH_MAX_THREADS;
+
+	for(DWORD numThreads = 1 ; numThreads <= maxThreads ; numThreads *= 2)
+	{
+		ULONGLONG packed = MeasureCounters(numThreads, false);
+		ULONGLONG padded = MeasureCounters(numThreads, true);
+
+		TRACE(" %d threads, a counter each : %4I64d ns per add next to each other, %4I64d ns per add on lines of their own",
+			numThreads, packed, padded);
+	}
+}
+
+
+void Benchmark::ConnectionSweep()
+{
+	DWORD now = GetTickCount();
+
+	// The table never dereferences clients.
+	vector<ULONG_PTR> fakeClients(SWEEP_BENCH_CONNECTIONS);
+
+	ConnectionTable table;
+	vector<ScatteredConnection*> scattered(SWEEP_BENCH_CONNECTIONS);
+
+	// A client in 100 is idle.
+	Random random(12345);
+	for(DWORD i = 0 ; i < SWEEP_BENCH_CONNECTIONS ; ++i)
+	{
+		DWORD age = random.Next(100) == 0 ? SWEEP_BENCH_IDLE_MS + random.Next(SWEEP_BENCH_IDLE_MS) : random.Next(SWEEP_BENCH_IDLE_MS);
+		DWORD bytes = random.Next(1 << 20);
+
+		DWORD slot = table.Add(reinterpret_cast<Client*>(&fakeClients[i]), now - age);
+		table.OnRecv(slot, now - age, bytes);
+
+		scattered[i] = new ScatteredConnection;
+		scattered[i]->lastActivity = now - age;
+		scattered[i]->inUse = 0xFFFFFFFF;
+		scattered[i]->recvBytes = bytes;
+		scattered[i]->sentBytes = 0;
+	}
+
+	// In the order of a pool that has been handing out and taking back clients for a while.
+	for(DWORD i = SWEEP_BENCH_CONNECTIONS - 1 ; i > 0 ; --i)
+	{
+		swap(scattered[i], scattered[random.Next(i + 1)]);
+	}
+
+	vector<Client*> idle;
+	idle.reserve(SWEEP_BENCH_CONNECTIONS);
+
+	for(int simd = 1 ; simd >= 0 ; --simd)
+	{
+		table.EnableSimd(simd != 0);
+
+		ULONGLONG idleTime = 0, sumTime = 0;
+		ConnectionTable::Totals totals;
+		for(DWORD run = 0 ; run < SWEEP_BENCH_RUNS ; ++run)
+		{
+			idle.clear();
+
+			ULONGLONG start = GetNanoseconds();
+			table.FindIdle(now, SWEEP_BENCH_IDLE_MS, idle);
+			ULONGLONG found = GetNanoseconds();
+			table.Sum(totals);
+			ULONGLONG summed = GetNanoseconds();
+
+			idleTime += found - start;
+			sumTime += summed - found;
+		}
+
+		TRACE(" ConnectionTable, %-7s : %d connections, idle check %5I64d us (%d idle), sum %5I64d us (%I64d bytes)",
+			simd ? "SSE2" : "scalar", SWEEP_BENCH_CONNECTIONS, idleTime / SWEEP_BENCH_RUNS / 1000, idle.size(),
+			sumTime / SWEEP_BENCH_RUNS / 1000, totals.recvBytes);
+	}
+
+	// The same over the clients, one line each.
+	ULONGLONG idleTime = 0, sumTime = 0;
+	ULONGLONG recvBytes = 0;
+	size_t numIdle = 0;
+	for(DWORD run = 0 ; run < SWEEP_BENCH_RUNS ; ++run)
+	{
+		idle.clear();
+
+		ULONGLONG start = GetNanoseconds();
+		for(DWORD i = 0 ; i < SWEEP_BENCH_CONNECTIONS ; ++i)
+		{
+			if(scattered[i]->inUse != 0 && now - scattered[i]->lastActivity > SWEEP_BENCH_IDLE_MS)
+			{
+				idle.push_back(reinterpret_cast<Client*>(scattered[i]));
+			}
+		}
+		ULONGLONG found = GetNanoseconds();
+
+		recvBytes = 0;
+		for(DWORD i = 0 ; i < SWEEP_BENCH_CONNECTIONS ; ++i)
+		{
+			recvBytes += scattered[i]->recvBytes;
+		}
+		ULONGLONG summed = GetNanoseconds();
+
+		idleTime += found - start;
+		sumTime += summed - found;
+		numIdle = idle.size();
+	}
+
+	TRACE(" Client pointers           : %d connections, idle check %5I64d us (%d idle), sum %5I64d us (%I64d bytes)",
+		SWEEP_BENCH_CONNECTIONS, idleTime / SWEEP_BENCH_RUNS / 1000, numIdle, sumTime / SWEEP_BENCH_RUNS / 1000, recvBytes);
+
+	for(DWORD i = 0 ; i < SWEEP_BENCH_CONNECTIONS ; ++i)
+	{
+		delete scattered[i];
+	}
+}
+
+
+void Benchmark::RateLimit()
+{
+	RateLimiter::Limits connection = { RATE_BENCH_MESSAGES, RATE_BENCH_MESSAGES * 1024 };
+	RateLimiter::Limits address = { RATE_BENCH_MESSAGES * 100, RATE_BENCH_MESSAGES * 1024 * 100 };
+
+	RateLimiter limiter;
+	limiter.SetLimits(connection, address);
+
+	vector<DWORD> addressSlots(RATE_BENCH_CONNECTIONS);
+	for(DWORD i = 0 ; i < RATE_BENCH_CONNECTIONS ; ++i)
+	{
+		IN6_ADDR ip;
+		ZeroMemory(&ip, sizeof(ip));
+		DWORD host = i % RATE_BENCH_ADDRESSES;
+		CopyMemory(&ip.s6_addr[12], &host, sizeof(host));
+
+		limiter.AddConnection(i, ip, addressSlots[i]);
+	}
+
+	// Recvs of connections picked at random, as they come in from a busy server.
+	Random random(12345);
+	vector<DWORD> order(RATE_BENCH_CHARGES / 100);
+	for(size_t i = 0 ; i < order.size() ; ++i)
+	{
+		order[i] = random.Next(RATE_BENCH_CONNECTIONS);
+	}
+
+	ULONGLONG start = GetNanoseconds();
+	for(DWORD i = 0 ; i < RATE_BENCH_CHARGES ; ++i)
+	{
+		DWORD slot = order[i % order.size()];
+		limiter.Charge(slot, addressSlots[slot], 1, 64);
+	}
+	ULONGLONG chargeTime = GetNanoseconds() - start;
+
+	TRACE(" Charge : %d connections from %d addresses, %I64d ns each", RATE_BENCH_CONNECTIONS, RATE_BENCH_ADDRESSES,
+		chargeTime / RATE_BENCH_CHARGES);
+
+	for(int simd = 1 ; simd >= 0 ; --simd)
+	{
+		limiter.EnableSimd(simd != 0);
+
+		ULONGLONG refillTime = 0;
+		for(DWORD run = 0 ; run < RATE_BENCH_RUNS ; ++run)
+		{
+			start = GetNanoseconds();
+			limiter.Refill(Server::RATE_REFILL_MS);
+			refillTime += GetNanoseconds() - start;
+		}
+
+		TRACE(" Refill, %-7s : %d connections, %5I64d us", simd ? "SSE2" : "scalar", RATE_BENCH_CONNECTIONS,
+			refillTime / RATE_BENCH_RUNS / 1000);
+	}
+
+	// A connection that sends twice its rate for a while, a message every 5 ms, and is read from only when it's within it.
+	RateLimiter one;
+	RateLimiter::Limits none = { 0, 0 };
+	one.SetLimits(connection, none);
+
+	IN6_ADDR ip;
+	ZeroMemory(&ip, sizeof(ip));
+	DWORD addressSlot = RateLimiter::NO_ADDRESS;
+	one.AddConnection(0, ip, addressSlot);
+
+	DWORD accepted = 0;
+	bool limited = false;
+	for(DWORD ms = 0 ; ms < RATE_BENCH_SECONDS * 1000 ; ms += 5)
+	{
+		if(ms % Server::RATE_REFILL_MS == 0)
+		{
+			one.Refill(Server::RATE_REFILL_MS);
+			limited = limited && !one.IsUnderRate(0, addressSlot);
+		}
+
+		if(!limited)
+		{
+			++accepted;
+			limited = !one.Charge(0, addressSlot, 1, 64);
+		}
+	}
+
+	TRACE(" Sent at %d messages/s for %d s against a rate of %d : %d read, %d/s",
+		2 * RATE_BENCH_MESSAGES, RATE_BENCH_SECONDS, RATE_BENCH_MESSAGES, accepted, accepted / RATE_BENCH_SECONDS);
+}
+
+
+void Benchmark::Admission()
+{
+	Random random(12345);
+
+	vector<IN6_ADDR> blocked(ADMISSION_BENCH_BLOCKED);
+	for(DWORD i = 0 ; i < ADMISSION_BENCH_BLOCKED ; ++i)
+	{
+		blocked[i] = RandomAddress(random);
+	}
+
+	// Most of what connects isn't on the list. A few are.
+	vector<IN6_ADDR> connecting(ADMISSION_BENCH_CHECKS);
+	for(DWORD i = 0 ; i < ADMISSION_BENCH_CHECKS ; ++i)
+	{
+		connecting[i] = i % 100 == 0 ? blocked[random.Next(ADMISSION_BENCH_BLOCKED)] : RandomAddress(random);
+	}
+
+	Blocklist blocklist;
+	if(!blocklist.Assign(blocked))
+	{
+		ERROR_MSG("Could not allocate the blocklist.");
+		return;
+	}
+
+	for(int filter = 1 ; filter >= 0 ; --filter)
+	{
+		blocklist.EnableFilter(filter != 0);
+
+		Blocklist::Stats before;
+		blocklist.GetStats(before);
+
+		DWORD numBlocked = 0;
+		ULONGLONG start = GetNanoseconds();
+		for(DWORD i = 0 ; i < ADMISSION_BENCH_CHECKS ; ++i)
+		{
+			numBlocked += blocklist.Contains(connecting[i]) ? 1 : 0;
+		}
+		ULONGLONG elapsed = GetNanoseconds() - start;
+
+		Blocklist::Stats after;
+		blocklist.GetStats(after);
+
+		TRACE(" Blocklist, %-9s : %d addresses, %I64d ns per check, %d blocked, %I64d past the filter",
+			filter ? "filter" : "no filter", after.addresses, elapsed / ADMISSION_BENCH_CHECKS, numBlocked,
+			after.filterPasses - before.filterPasses);
+	}
+
+	// Every address connects a few times, then they all go.
+	AddressCounter counter;
+	vector<IN6_ADDR> addresses(ADMISSION_BENCH_ADDRESSES);
+	for(DWORD i = 0 ; i < ADMISSION_BENCH_ADDRESSES ; ++i)
+	{
+		addresses[i] = RandomAddress(random);
+	}
+
+	DWORD rejected = 0;
+	ULONGLONG start = GetNanoseconds();
+	for(DWORD round = 0 ; round <= ADMISSION_BENCH_PER_ADDRESS ; ++round)
+	{
+		for(DWORD i = 0 ; i < ADMISSION_BENCH_ADDRESSES ; ++i)
+		{
+			rejected += counter.Acquire(addresses[i], ADMISSION_BENCH_PER_ADDRESS) ? 0 : 1;
+		}
+	}
+	ULONGLONG acquired = GetNanoseconds();
+	DWORD numAddresses = counter.GetNumAddresses();
+	for(DWORD round = 0 ; round < ADMISSION_BENCH_PER_ADDRESS ; ++round)
+	{
+		for(DWORD i = 0 ; i < ADMISSION_BENCH_ADDRESSES ; ++i)
+		{
+			counter.Release(addresses[i]);
+		}
+	}
+	ULONGLONG released = GetNanoseconds();
+
+	TRACE(" AddressCounter : %d addresses, %I64d ns per acquire, %I64d ns per release, %d over the limit of %d, %d left",
+		numAddresses, (acquired - start) / (ADMISSION_BENCH_ADDRESSES * (ADMISSION_BENCH_PER_ADDRESS + 1)),
+		(released - acquired) / (ADMISSION_BENCH_ADDRESSES * ADMISSION_BENCH_PER_ADDRESS), rejected, ADMISSION_BENCH_PER_ADDRESS,
+		counter.GetNumAddresses());
+}
+
+
+void Benchmark::Overload()
+{
+	TRACE(" %d workers of %d us a packet, for %d s :", OVERLOAD_BENCH_WORKERS, OVERLOAD_BENCH_SERVICE_US, OVERLOAD_BENCH_SECONDS);
+
+	// Under capacity it should stay out of the way. Over it, the queue grows without end unless something is turned away.
+	const double LOADS[] = { 0.8, 2.0 };
+	for(size_t i = 0 ; i < sizeof(LOADS) / sizeof(LOADS[0]) ; ++i)
+	{
+		RunOverloadMix(LOADS[i], false);
+		RunOverloadMix(LOADS[i], true);
+	}
+}
+
+
+void Benchmark::Lanes()
+{
+	TRACE(" %d workers of %d us a packet, for %d s, control at %.2fx, interactive at %.2fx, bulk %d packets deep, p50 / p99 :",
+		LANES_BENCH_WORKERS, LANES_BENCH_SERVICE_US, LANES_BENCH_SECONDS, LANES_BENCH_CONTROL_LOAD, LANES_BENCH_INTERACTIVE_LOAD,
+		LANES_BENCH_BULK_WINDOW);
+
+	// Without bulk first, for what control and interactive get when nothing is in their way.
+	RunLanes(PacketLanes::POLICY_FIFO, false);
+	RunLanes(PacketLanes::POLICY_FIFO, true);
+	RunLanes(PacketLanes::POLICY_STRICT, true);
+	RunLanes(PacketLanes::POLICY_WEIGHTED, true);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+// In-process micro benchmarks, run from the server console. Results are printed with TRACE.
+namespace Benchmark
+{
+	// Deliveries/sec of PubSub::Publish() at fan-outs of 10, 1k and 50k. No sockets involved.
+	void PubSubFanOut();
+
+	// Ticks of InterestGrid with 50k moving entities, with and without SSE2, and its range query.
+	void InterestTick();
+
+	// Bytes of delta snapshots against full updates, and encoder ns/entity, for 100 clients seeing 200 entities each.
+	void SnapshotDelta();
+
+	// ns/message of OpcodeTable dispatch against boost::unordered_map<int, boost::function>, for the opcodes of Server.
+	void OpcodeDispatch();
+
+	// ns/message to encode and decode EntityUpdates and Move with Messages.h, against hand-written packed structs.
+	void SchemaCodec();
+
+	// Commands/sec of RespSession on KeyValueStore for SET, GET and INCR of 100k keys, pipelined 1 and 16 deep
+	// like redis-benchmark -P. Parsing and running only. No sockets involved.
+	void RespPipeline();
+
+	// Calls/sec and p50, p99 and p99.9 latency of the policies of Balancer, for 3 backends and a 10x slower one,
+	// then one that fails every call. Backends and callers are simulated, so the numbers are the same on every run.
+	void BalancerMix();
+
+	// Round-trip latency of pings over SharedChannel to an echoing reader and back, one at a time and 1 ms apart,
+	// and round trips/sec with 1024 in flight. Both ends are in this process, each with its own view of the mapping.
+	void SharedChannelRoundTrip();
+
+	// Round-trip latency of 64-byte echoes over loopback on one connection, and round trips/sec on 64 connections,
+	// for Server in MODE_RAW on a thread per processor and on one thread.
+	void Echo();
+
+	// Sizes of Client and IOEvent, whether events from the pool share cache lines, and ns per interlocked add
+	// of counters of different connections on 1 to 8 threads, next to each other and padded apart.
+	// Cache misses themselves are counted with a profiler, over `bench_echo.
+	void ConnectionLayout();
+
+	// us per idle check and byte sum over 1M connections in ConnectionTable, with and without SSE2,
+	// against walking as many clients scattered over the heap.
+	void ConnectionSweep();
+
+	// ns per charge of RateLimiter, and us per refill of 1M connections with and without SSE2. Then how many
+	// messages a connection sending twice its rate gets read, which should be about its rate.
+	void RateLimit();
+
+	// ns per check of a blocklist of 1M addresses with and without its Bloom filter, and per acquire and release
+	// of AddressCounter for 100k addresses with a few connections each.
+	void Admission();
+
+	// Packets handled/sec, connections let in, packets shed and p99 latency of each priority, for workers at
+	// 0.8x and 2x their capacity, with OverloadControl off and on. Workers and packets are simulated, like BalancerMix().
+	void Overload();
+
+	// p50 and p99 latency of each lane of PacketLanes under each policy, with bulk senders that keep the workers
+	// busy and a little control and interactive, and without bulk for comparison. Simulated like Overload().
+	void Lanes();
+}
@@ -0,0 +1,110 @@
+#include "BitStream.h"
+
+#include <cassert>
+
+namespace
+{
+	const DWORD VAR_WIDTHS[4] = { 4, 8, 16, 32 };
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+BitWriter::BitWriter(std::vector<BYTE>& buffer)
+: m_Buffer(buffer),
+  m_Scratch(0),
+  m_ScratchBits(0),
+  m_BitCount(0)
+{
+}
+
+
+void BitWriter::Write(DWORD value, DWORD bits)
+{
+	assert(bits >= 1 && bits <= 32);
+	assert(bits == 32 || value < (static_cast<DWORD>(1) << bits));
+
+	m_Scratch |= static_cast<ULONGLONG>(value) << m_ScratchBits;
+	m_ScratchBits += bits;
+	m_BitCount += bits;
+
+	while(m_ScratchBits >= 8)
+	{
+		m_Buffer.push_back(static_cast<BYTE>(m_Scratch));
+		m_Scratch >>= 8;
+		m_ScratchBits -= 8;
+	}
+}
+
+
+void BitWriter::WriteVar(DWORD value)
+{
+	DWORD selector = 0;
+	while(selector < 3 && value >= (static_cast<DWORD>(1) << VAR_WIDTHS[selector]))
+	{
+		++selector;
+	}
+
+	Write(selector, 2);
+	Write(value, VAR_WIDTHS[selector]);
+}
+
+
+void BitWriter::Flush()
+{
+	if(m_ScratchBits > 0)
+	{
+		m_Buffer.push_back(static_cast<BYTE>(m_Scratch));
+		m_Scratch = 0;
+		m_BitCount += 8 - m_ScratchBits;
+		m_ScratchBits = 0;
+	}
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+BitReader::BitReader(const BYTE* data, DWORD size)
+: m_Data(data),
+  m_Size(size),
+  m_BitPos(0),
+  m_Overrun(false)
+{
+}
+
+
+DWORD BitReader::Read(DWORD bits)
+{
+	assert(bits >= 1 && bits <= 32);
+
+	if(m_Overrun || m_BitPos + bits > m_Size * 8)
+	{
+		m_Overrun = true;
+		return 0;
+	}
+
+	// At most 5 bytes are touched.
+	ULONGLONG scratch = 0;
+	DWORD firstByte = m_BitPos / 8;
+	DWORD lastByte = (m_BitPos + bits - 1) / 8;
+	for(DWORD i = lastByte + 1 ; i > firstByte ; --i)
+	{
+		scratch = (scratch << 8) | m_Data[i - 1];
+	}
+
+	DWORD value = static_cast<DWORD>(scratch >> (m_BitPos % 8));
+	if(bits < 32)
+	{
+		value &= (static_cast<DWORD>(1) << bits) - 1;
+	}
+
+	m_BitPos += bits;
+	return value;
+}
+
+
+DWORD BitReader::ReadVar()
+{
+	DWORD selector = Read(2);
+	return Read(VAR_WIDTHS[selector]);
+}
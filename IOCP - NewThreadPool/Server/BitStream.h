@@ -0,0 +1,57 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+// Packs values of any bit width, least significant bit first.
+class BitWriter
+{
+public:
+	// Appends to buffer.
+	explicit BitWriter(std::vector<BYTE>& buffer);
+
+	// bits is 1 ~ 32.
+	void Write(DWORD value, DWORD bits);
+	void WriteBool(bool value) { Write(value ? 1 : 0, 1); }
+
+	// 2 bits of width (4, 8, 16 or 32) and the value. Small counts and gaps take 6 bits.
+	void WriteVar(DWORD value);
+
+	// Pads to a whole byte. Call once after the last Write().
+	void Flush();
+
+	DWORD GetBitCount() { return m_BitCount; }
+
+private:
+	BitWriter(const BitWriter& rhs);
+	BitWriter& operator=(const BitWriter& rhs);
+
+private:
+	std::vector<BYTE>& m_Buffer;
+	ULONGLONG m_Scratch;
+	DWORD m_ScratchBits;
+	DWORD m_BitCount;
+};
+
+
+class BitReader
+{
+public:
+	BitReader(const BYTE* data, DWORD size);
+
+	// Reading past the end returns 0 and makes IsValid() false.
+	DWORD Read(DWORD bits);
+	bool ReadBool() { return Read(1) != 0; }
+	DWORD ReadVar();
+
+	bool IsValid() { return !m_Overrun; }
+
+private:
+	BitReader(const BitReader& rhs);
+	BitReader& operator=(const BitReader& rhs);
+
+private:
+	const BYTE* m_Data;
+	DWORD m_Size;
+	DWORD m_BitPos;
+	bool m_Overrun;
+};
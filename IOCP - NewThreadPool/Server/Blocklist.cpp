@@ -0,0 +1,218 @@
+#include "Blocklist.h"
+
+#include "..\Log.h"
+#include "..\Network.h"
+#include <cassert>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+Blocklist::Blocklist()
+: m_Blocks(NULL),
+  m_NumBlocks(0),
+  m_NumAddresses(0),
+  m_UseFilter(true),
+  m_NumChecks(0),
+  m_NumFilterPasses(0),
+  m_NumBlocked(0)
+{
+	InitializeCriticalSection(&m_Lock);
+}
+
+
+Blocklist::~Blocklist()
+{
+	_aligned_free(m_Blocks);
+	DeleteCriticalSection(&m_Lock);
+}
+
+
+bool Blocklist::Load(const char* path)
+{
+	assert(path);
+
+	ifstream file(path);
+	if(!file)
+	{
+		ERROR_MSG("Could not open the blocklist : %s", path);
+		return false;
+	}
+
+	vector<AddressKey> keys;
+
+	string line;
+	for(int lineNumber = 1 ; getline(file, line) ; ++lineNumber)
+	{
+		istringstream fields(line);
+
+		string text;
+		if(!(fields >> text) || text[0] == '#')
+		{
+			continue;
+		}
+
+		IN6_ADDR address;
+		if(!Network::ParseIp(text.c_str(), address))
+		{
+			ERROR_MSG("%s(%d) : %s is not an address.", path, lineNumber, text.c_str());
+			return false;
+		}
+
+		keys.push_back(ToKey(address));
+	}
+
+	if(!Replace(keys))
+	{
+		ERROR_MSG("Could not allocate the blocklist of %d addresses.", keys.size());
+		return false;
+	}
+
+	TRACE("Blocklist : %d addresses from %s", m_NumAddresses, path);
+	return true;
+}
+
+
+bool Blocklist::Assign(const vector<IN6_ADDR>& addresses)
+{
+	vector<AddressKey> keys(addresses.size());
+	for(size_t i = 0 ; i < addresses.size() ; ++i)
+	{
+		keys[i] = ToKey(addresses[i]);
+	}
+
+	return Replace(keys);
+}
+
+
+void Blocklist::Clear()
+{
+	vector<AddressKey> keys;
+	Replace(keys);
+}
+
+
+bool Blocklist::Replace(vector<AddressKey>& keys)
+{
+	sort(keys.begin(), keys.end());
+	keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+	DWORD numBlocks = 1;
+	while(numBlocks * BITS_PER_BLOCK < keys.size() * BITS_PER_ADDRESS)
+	{
+		numBlocks *= 2;
+	}
+
+	Block* blocks = NULL;
+	if(!keys.empty())
+	{
+		blocks = static_cast<Block*>(_aligned_malloc(numBlocks * sizeof(Block), CACHE_LINE_SIZE));
+		if(blocks == NULL)
+		{
+			return false;
+		}
+		ZeroMemory(blocks, numBlocks * sizeof(Block));
+
+		for(size_t i = 0 ; i < keys.size() ; ++i)
+		{
+			ULONGLONG hash = Hash(keys[i]);
+			Block& block = blocks[static_cast<DWORD>(hash >> 32) & (numBlocks - 1)];
+
+			DWORD bit = static_cast<DWORD>(hash);
+			DWORD step = (bit >> 16) | 1;
+			for(DWORD probe = 0 ; probe < NUM_PROBES ; ++probe, bit += step)
+			{
+				block.bits[(bit % BITS_PER_BLOCK) / 32] |= 1u << (bit % 32);
+			}
+		}
+	}
+
+	EnterCriticalSection(&m_Lock);
+
+	swap(m_Blocks, blocks);
+	m_NumBlocks = numBlocks;
+	m_Keys.swap(keys);
+	m_NumAddresses = static_cast<DWORD>(m_Keys.size());
+
+	LeaveCriticalSection(&m_Lock);
+
+	// The old ones.
+	_aligned_free(blocks);
+
+	return true;
+}
+
+
+bool Blocklist::Contains(const IN6_ADDR& address)
+{
+	if(m_NumAddresses == 0)
+	{
+		return false;
+	}
+
+	AddressKey key = ToKey(address);
+	ULONGLONG hash = Hash(key);
+
+	InterlockedIncrement64(&m_NumChecks);
+
+	EnterCriticalSection(&m_Lock);
+
+	bool maybe = m_Blocks != NULL;
+	if(maybe && m_UseFilter)
+	{
+		const Block& block = m_Blocks[static_cast<DWORD>(hash >> 32) & (m_NumBlocks - 1)];
+
+		DWORD bit = static_cast<DWORD>(hash);
+		DWORD step = (bit >> 16) | 1;
+		for(DWORD probe = 0 ; maybe && probe < NUM_PROBES ; ++probe, bit += step)
+		{
+			maybe = (block.bits[(bit % BITS_PER_BLOCK) / 32] & (1u << (bit % 32))) != 0;
+		}
+	}
+
+	bool blocked = maybe && binary_search(m_Keys.begin(), m_Keys.end(), key);
+
+	LeaveCriticalSection(&m_Lock);
+
+	if(maybe)
+	{
+		InterlockedIncrement64(&m_NumFilterPasses);
+	}
+	if(blocked)
+	{
+		InterlockedIncrement64(&m_NumBlocked);
+	}
+
+	return blocked;
+}
+
+
+void Blocklist::GetStats(Stats& stats)
+{
+	stats.addresses = m_NumAddresses;
+	stats.checks = m_NumChecks;
+	stats.filterPasses = m_NumFilterPasses;
+	stats.blocked = m_NumBlocked;
+}
+
+
+/* static */ Blocklist::AddressKey Blocklist::ToKey(const IN6_ADDR& address)
+{
+	AddressKey key;
+	CopyMemory(&key.first, &address.s6_addr[0], sizeof(key.first));
+	CopyMemory(&key.second, &address.s6_addr[8], sizeof(key.second));
+	return key;
+}
+
+
+/* static */ ULONGLONG Blocklist::Hash(const AddressKey& key)
+{
+	// The block is from the top half and the probes from the bottom one, so both halves are mixed into all of them.
+	ULONGLONG hash = (key.first ^ (key.second * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL;
+	return hash ^ (hash >> 29);
+}
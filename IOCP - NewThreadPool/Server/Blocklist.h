@@ -0,0 +1,85 @@
+#pragma once
+#include <winsock2.h>
+#include <Ws2tcpip.h>
+#include <vector>
+#include <utility>
+
+#include "CacheLine.h"
+
+// Addresses turned away as they connect, loaded from a file.
+// Most connections are from addresses that aren't on the list, so a check goes to a Bloom filter first.
+// Its probes all fall in one cache line, a block picked by the address, so a check that isn't on the list
+// costs one miss at most. The few the filter lets through are looked up in the sorted addresses, so a false
+// positive never turns anyone away. Thread-safe. Load() replaces the list while checks go on.
+class Blocklist
+{
+public:
+	enum
+	{
+		BITS_PER_ADDRESS = 16,	// about 0.5% false positives with NUM_PROBES in a block.
+		NUM_PROBES = 8,
+	};
+
+	struct Stats
+	{
+		DWORD addresses;
+		ULONGLONG checks;
+		ULONGLONG filterPasses;	// checks the filter couldn't answer.
+		ULONGLONG blocked;
+	};
+
+public:
+	Blocklist();
+	~Blocklist();
+
+	// One address a line, IPv4 or IPv6. Blank lines and the ones that start with # are skipped.
+	// Returns false if the file can't be read or has a line that isn't an address, and the list is left as it was then.
+	bool Load(const char* path);
+	void Clear();
+
+	bool Contains(const IN6_ADDR& address);
+
+	void GetStats(Stats& stats);
+
+	// The filter is on by default. Off is for comparing in benchmarks, with every check going to the sorted addresses.
+	void EnableFilter(bool enable) { m_UseFilter = enable; }
+
+	// For the benchmarks. Replaces the list. Returns false if memory ran out.
+	bool Assign(const std::vector<IN6_ADDR>& addresses);
+
+private:
+	// 16 bytes of IN6_ADDR.
+	typedef std::pair<ULONGLONG, ULONGLONG> AddressKey;
+
+	struct __declspec(align(CACHE_LINE_SIZE)) Block
+	{
+		DWORD bits[CACHE_LINE_SIZE / sizeof(DWORD)];
+	};
+
+	enum
+	{
+		BITS_PER_BLOCK = CACHE_LINE_SIZE * 8,
+	};
+
+private:
+	Blocklist(const Blocklist& rhs);
+	Blocklist& operator=(const Blocklist& rhs);
+
+	static AddressKey ToKey(const IN6_ADDR& address);
+	static ULONGLONG Hash(const AddressKey& key);
+
+	// Takes the sorted keys and a filter made for them. Returns false if memory ran out.
+	bool Replace(std::vector<AddressKey>& keys);
+
+private:
+	CRITICAL_SECTION m_Lock;
+	Block* m_Blocks;
+	DWORD m_NumBlocks;	// a power of 2.
+	std::vector<AddressKey> m_Keys;	// sorted.
+	volatile DWORD m_NumAddresses;	// read without the lock, so that an empty list costs nothing.
+	bool m_UseFilter;
+
+	volatile LONGLONG m_NumChecks;
+	volatile LONGLONG m_NumFilterPasses;
+	volatile LONGLONG m_NumBlocked;
+};
@@ -0,0 +1,319 @@
+#include "BufferPool.h"
+#include "..\Log.h"
+
+#include <malloc.h>
+#include <intrin.h>
+#include <cassert>
+
+namespace
+{
+	// Sits right in front of every buffer. SLIST_ENTRY needs MEMORY_ALLOCATION_ALIGNMENT.
+	struct __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) BufferHeader
+	{
+		SLIST_ENTRY entry;
+		DWORD classIndex;
+		DWORD requested;
+	};
+
+	SLIST_HEADER s_Depot[BufferPool::NUM_CLASSES];
+
+	volatile LONG s_InUse[BufferPool::NUM_CLASSES];
+	volatile LONGLONG s_Requested[BufferPool::NUM_CLASSES];
+
+	volatile LONG s_ThreadCached[BufferPool::NUM_CLASSES];	// in the caches of all threads.
+
+	volatile LONGLONG s_ReservedBytes = 0;
+	volatile LONG s_FailedAllocs = 0;
+	LONGLONG s_HighWaterMark = 0;
+
+	// Buffers cached by a thread are returned to the depot when the cache is full, and all of them when the
+	// thread exits, as pools retire idle threads and each server closes its own pool. The cache is in an FLS slot
+	// for that, whose callback runs on thread exit, and for every thread still there when Cleanup() frees the slot.
+	struct ThreadCache
+	{
+		BufferHeader* heads[BufferPool::NUM_CLASSES];
+		DWORD counts[BufferPool::NUM_CLASSES];
+	};
+
+	DWORD s_FlsIndex = FLS_OUT_OF_INDEXES;
+
+
+	DWORD GetClassIndex(DWORD size)
+	{
+		if(size <= BufferPool::MIN_BUFFER_SIZE)
+		{
+			return 0;
+		}
+
+		unsigned long msb = 0;
+		_BitScanReverse(&msb, size - 1);
+		return msb + 1 - BufferPool::MIN_CLASS_SHIFT;
+	}
+
+	DWORD GetClassSizeByIndex(DWORD index)
+	{
+		return 1 << (index + BufferPool::MIN_CLASS_SHIFT);
+	}
+
+	DWORD GetThreadCacheLimit(DWORD index)
+	{
+		DWORD limit = BufferPool::THREAD_CACHE_BYTES / GetClassSizeByIndex(index);
+		return limit > 0 ? limit : 1;
+	}
+
+	BufferHeader* GetHeader(const BYTE* buffer)
+	{
+		return reinterpret_cast<BufferHeader*>(const_cast<BYTE*>(buffer) - sizeof(BufferHeader));
+	}
+
+	BufferHeader* NewBuffer(DWORD index)
+	{
+		LONGLONG total = sizeof(BufferHeader) + GetClassSizeByIndex(index);
+
+		if(InterlockedExchangeAdd64(&s_ReservedBytes, total) + total > s_HighWaterMark)
+		{
+			InterlockedExchangeAdd64(&s_ReservedBytes, -total);
+			return NULL;
+		}
+
+		BufferHeader* header = static_cast<BufferHeader*>(_aligned_malloc(static_cast<size_t>(total), MEMORY_ALLOCATION_ALIGNMENT));
+		if(header == NULL)
+		{
+			InterlockedExchangeAdd64(&s_ReservedBytes, -total);
+			return NULL;
+		}
+
+		header->classIndex = index;
+		return header;
+	}
+
+	void DeleteBuffer(BufferHeader* header)
+	{
+		LONGLONG total = sizeof(BufferHeader) + GetClassSizeByIndex(header->classIndex);
+		_aligned_free(header);
+		InterlockedExchangeAdd64(&s_ReservedBytes, -total);
+	}
+
+	// The FLS callback. Gives the buffers of the cache back to the depot.
+	VOID WINAPI FlushThreadCache(PVOID data)
+	{
+		ThreadCache* cache = static_cast<ThreadCache*>(data);
+
+		for(int i = 0 ; i < BufferPool::NUM_CLASSES ; ++i)
+		{
+			while(cache->heads[i] != NULL)
+			{
+				BufferHeader* header = cache->heads[i];
+				cache->heads[i] = reinterpret_cast<BufferHeader*>(header->entry.Next);
+				InterlockedPushEntrySList(&s_Depot[i], &header->entry);
+			}
+
+			InterlockedExchangeAdd(&s_ThreadCached[i], -static_cast<LONG>(cache->counts[i]));
+			cache->counts[i] = 0;
+		}
+
+		delete cache;
+	}
+
+	// The calling thread's cache, made on its first use. NULL if it can't be, and the depot is used alone then.
+	ThreadCache* GetThreadCache()
+	{
+		if(s_FlsIndex == FLS_OUT_OF_INDEXES)
+		{
+			return NULL;
+		}
+
+		ThreadCache* cache = static_cast<ThreadCache*>(FlsGetValue(s_FlsIndex));
+		if(cache != NULL)
+		{
+			return cache;
+		}
+
+		cache = new ThreadCache;
+		ZeroMemory(cache, sizeof(ThreadCache));
+
+		if(!FlsSetValue(s_FlsIndex, cache))
+		{
+			delete cache;
+			return NULL;
+		}
+
+		return cache;
+	}
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+/* static */ void BufferPool::Setup(LONGLONG highWaterMark)
+{
+	for(int i = 0 ; i < NUM_CLASSES ; ++i)
+	{
+		InitializeSListHead(&s_Depot[i]);
+		s_InUse[i] = 0;
+		s_Requested[i] = 0;
+		s_ThreadCached[i] = 0;
+	}
+
+	s_HighWaterMark = highWaterMark;
+
+	s_FlsIndex = FlsAlloc(FlushThreadCache);
+	if(s_FlsIndex == FLS_OUT_OF_INDEXES)
+	{
+		ERROR_CODE(GetLastError(), "FlsAlloc() failed. Buffers are not cached by threads.");
+	}
+}
+
+
+/* static */ void BufferPool::Cleanup()
+{
+	// The callback flushes the caches of every thread still there into the depot. None of them may use the pool any more.
+	if(s_FlsIndex != FLS_OUT_OF_INDEXES)
+	{
+		FlsFree(s_FlsIndex);
+		s_FlsIndex = FLS_OUT_OF_INDEXES;
+	}
+
+	for(int i = 0 ; i < NUM_CLASSES ; ++i)
+	{
+		PSLIST_ENTRY entry = InterlockedFlushSList(&s_Depot[i]);
+		while(entry != NULL)
+		{
+			PSLIST_ENTRY next = entry->Next;
+			DeleteBuffer(CONTAINING_RECORD(entry, BufferHeader, entry));
+			entry = next;
+		}
+	}
+}
+
+
+/* static */ BYTE* BufferPool::Alloc(DWORD size)
+{
+	if(size > MAX_BUFFER_SIZE)
+	{
+		InterlockedIncrement(&s_FailedAllocs);
+		return NULL;
+	}
+
+	DWORD index = GetClassIndex(size);
+
+	ThreadCache* cache = GetThreadCache();
+
+	BufferHeader* header = cache != NULL ? cache->heads[index] : NULL;
+	if(header != NULL)
+	{
+		cache->heads[index] = reinterpret_cast<BufferHeader*>(header->entry.Next);
+		--cache->counts[index];
+		InterlockedDecrement(&s_ThreadCached[index]);
+	}
+	else
+	{
+		PSLIST_ENTRY entry = InterlockedPopEntrySList(&s_Depot[index]);
+		if(entry != NULL)
+		{
+			header = CONTAINING_RECORD(entry, BufferHeader, entry);
+		}
+		else
+		{
+			header = NewBuffer(index);
+			if(header == NULL)
+			{
+				InterlockedIncrement(&s_FailedAllocs);
+				return NULL;
+			}
+		}
+	}
+
+	assert(header->classIndex == index);
+	header->requested = size;
+
+	InterlockedIncrement(&s_InUse[index]);
+	InterlockedExchangeAdd64(&s_Requested[index], size);
+
+	return reinterpret_cast<BYTE*>(header) + sizeof(BufferHeader);
+}
+
+
+/* static */ void BufferPool::Free(BYTE* buffer)
+{
+	if(buffer == NULL)
+	{
+		return;
+	}
+
+	BufferHeader* header = GetHeader(buffer);
+	DWORD index = header->classIndex;
+	assert(index < NUM_CLASSES);
+
+	InterlockedDecrement(&s_InUse[index]);
+	InterlockedExchangeAdd64(&s_Requested[index], -static_cast<LONGLONG>(header->requested));
+
+	ThreadCache* cache = GetThreadCache();
+	if(cache != NULL && cache->counts[index] < GetThreadCacheLimit(index))
+	{
+		header->entry.Next = reinterpret_cast<PSLIST_ENTRY>(cache->heads[index]);
+		cache->heads[index] = header;
+		++cache->counts[index];
+		InterlockedIncrement(&s_ThreadCached[index]);
+	}
+	else
+	{
+		InterlockedPushEntrySList(&s_Depot[index], &header->entry);
+	}
+}
+
+
+/* static */ DWORD BufferPool::GetCapacity(const BYTE* buffer)
+{
+	assert(buffer);
+	return GetClassSizeByIndex(GetHeader(buffer)->classIndex);
+}
+
+
+/* static */ DWORD BufferPool::GetClassSize(DWORD size)
+{
+	assert(size <= MAX_BUFFER_SIZE);
+	return GetClassSizeByIndex(GetClassIndex(size));
+}
+
+
+/* static */ void BufferPool::GetStats(Stats& stats)
+{
+	for(int i = 0 ; i < NUM_CLASSES ; ++i)
+	{
+		stats.classes[i].size = GetClassSizeByIndex(i);
+		stats.classes[i].inUse = s_InUse[i];
+		stats.classes[i].cached = QueryDepthSList(&s_Depot[i]);
+		stats.classes[i].threadCached = s_ThreadCached[i];
+		stats.classes[i].requestedBytes = s_Requested[i];
+	}
+
+	stats.reservedBytes = s_ReservedBytes;
+	stats.highWaterMark = s_HighWaterMark;
+	stats.failedAllocs = s_FailedAllocs;
+}
+
+
+/* static */ void BufferPool::TraceStats()
+{
+	Stats stats;
+	GetStats(stats);
+
+	TRACE(" Reserved : %I64d / %I64d bytes, failed allocs : %d", stats.reservedBytes, stats.highWaterMark, stats.failedAllocs);
+
+	for(int i = 0 ; i < NUM_CLASSES ; ++i)
+	{
+		const ClassStats& cs = stats.classes[i];
+		if(cs.inUse == 0 && cs.cached == 0 && cs.threadCached == 0)
+		{
+			continue;
+		}
+
+		// Internal fragmentation is the part of in-use buffers nobody asked for.
+		LONGLONG occupied = static_cast<LONGLONG>(cs.inUse) * cs.size;
+		int fragmentation = occupied > 0 ? static_cast<int>(100 - (cs.requestedBytes * 100) / occupied) : 0;
+
+		TRACE(" [%7d] in use : %d, cached : %d, in threads : %d, occupied : %I64d bytes, fragmentation : %d%%",
+			cs.size, cs.inUse, cs.cached, cs.threadCached, occupied, fragmentation);
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <Windows.h>
+
+// Variable-length buffers in power-of-two size classes (64B .. 1MB).
+// Each thread keeps a small cache per class and spills to a lock-free global depot, and all of it on thread exit.
+// The total amount of memory taken from the OS is capped by a high-water mark.
+class BufferPool
+{
+public:
+	enum
+	{
+		MIN_CLASS_SHIFT = 6,	// 64 B
+		MAX_CLASS_SHIFT = 20,	// 1 MB
+		NUM_CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1,
+
+		MIN_BUFFER_SIZE = 1 << MIN_CLASS_SHIFT,
+		MAX_BUFFER_SIZE = 1 << MAX_CLASS_SHIFT,
+
+		// How many bytes of each class a thread keeps for itself before returning buffers to the depot.
+		THREAD_CACHE_BYTES = 64 * 1024,
+	};
+
+	struct ClassStats
+	{
+		DWORD size;
+		LONG inUse;
+		LONG cached;		// in the global depot.
+		LONG threadCached;	// in the caches of threads.
+		LONGLONG requestedBytes;	// sum of the sizes asked for by buffers in use.
+	};
+
+	struct Stats
+	{
+		ClassStats classes[NUM_CLASSES];
+		LONGLONG reservedBytes;		// taken from the OS.
+		LONGLONG highWaterMark;
+		LONG failedAllocs;
+	};
+
+public:
+	static void Setup(LONGLONG highWaterMark);
+	// Once no thread uses the pool any more. Frees what's cached by threads that are still there as well.
+	static void Cleanup();
+
+	// Returns NULL when the high-water mark would be exceeded or size is bigger than MAX_BUFFER_SIZE.
+	static BYTE* Alloc(DWORD size);
+	static void Free(BYTE* buffer);
+
+	// Usable bytes of the buffer, which is the size of its class.
+	static DWORD GetCapacity(const BYTE* buffer);
+	static DWORD GetClassSize(DWORD size);
+
+	static void GetStats(Stats& stats);
+	static void TraceStats();
+
+private:
+	BufferPool();
+	~BufferPool();
+	BufferPool(const BufferPool& rhs);
+	BufferPool& operator=(const BufferPool& rhs);
+};
@@ -0,0 +1,24 @@
+#pragma once
+#include <Windows.h>
+#include <malloc.h>
+#include <cstddef>
+
+// Of every x86 and x64 processor we run on. A macro because __declspec(align()) only takes a literal.
+#define CACHE_LINE_SIZE 64
+
+// A counter alone on its cache line, for the ones different threads write.
+struct __declspec(align(CACHE_LINE_SIZE)) PaddedLong
+{
+	volatile LONG value;
+};
+
+// A UserAllocator of boost::pool for the blocks of cache-line-aligned objects. With it, and the size of the
+// object a multiple of a line, every chunk starts on a line of its own and neighbours in the pool never share one.
+struct CacheLineAllocator
+{
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	static char* malloc(const size_type bytes) { return static_cast<char*>(_aligned_malloc(bytes, CACHE_LINE_SIZE)); }
+	static void free(char* const block) { _aligned_free(block); }
+};
@@ -1,22 +1,93 @@
 #include "Client.h"
+#include "BufferPool.h"
+#include "InterestGrid.h"
+#include "Snapshot.h"
+#include "RespSession.h"
+#include "IOEvent.h"
+#include "ClientHandles.h"
+#include "Cluster.h"
+#include "ConnectionTable.h"
+#include "RateLimiter.h"
+#include "Packet.h"
+#include "CacheLine.h"
 #include "..\Log.h"
 #include "..\Network.h"
 
+#include <cassert>
 #include <boost/pool/singleton_pool.hpp>
 
-// use thread-safe memory pool
-typedef boost::singleton_pool<Client, sizeof(Client)> ClientPool;
+// use thread-safe memory pool, with each client on lines of its own.
+typedef boost::singleton_pool<Client, sizeof(Client), CacheLineAllocator> ClientPool;
 
-/* static */ Client* Client::Create()
+/* static */ DWORD Client::s_MinRecvBuffer = Client::MIN_RECV_BUFFER;
+/* static */ DWORD Client::s_MaxRecvBuffer = Client::MAX_RECV_BUFFER;
+
+/* static */ Client* Client::Create(Server* server, SOCKET socket)
 {
+	assert(server);
+
+	// What the recv path touches has to stay in the first line.
+	typedef char HotFieldsFitInALine[offsetof(Client, m_InboundBytes) == CACHE_LINE_SIZE ? 1 : -1];
+
 	Client* client = static_cast<Client*>(ClientPool::malloc());
 
+	client->m_Server = server;
 	client->m_State = WAIT;
+	client->m_pTPIO = NULL;
+
+	DWORD recvSize = INITIAL_RECV_BUFFER;
+	if(recvSize < s_MinRecvBuffer) recvSize = s_MinRecvBuffer;
+	if(recvSize > s_MaxRecvBuffer) recvSize = s_MaxRecvBuffer;
 
-	client->m_Socket = Network::CreateSocket(false, 0);
+	client->m_recvBuffer = BufferPool::Alloc(recvSize);
+	if(client->m_recvBuffer == NULL)
+	{
+		ERROR_MSG("Could not allocate recv buffer.");
+		if(socket != INVALID_SOCKET)
+		{
+			Network::CloseSocket(socket);
+		}
+		ClientPool::free(client);
+		return NULL;
+	}
+	client->m_recvBufferSize = recvSize;
+	client->m_numSmallRecvs = 0;
+
+	client->m_InboundBytes.value = 0;
+	client->m_OutboundBytes.value = 0;
+	client->m_RecvPaused = 0;
+
+	InitializeCriticalSection(&client->m_CSForSend);
+	client->m_SendHead = NULL;
+	client->m_SendTail = NULL;
+	client->m_SendInFlight = NULL;
+	client->m_SendInFlightBytes = 0;
+	client->m_QueuedSendBytes = 0;
+	client->m_KeyedSends = NULL;
+	ZeroMemory(&client->m_SendStats, sizeof(client->m_SendStats));
+
+	client->m_FrameDecoder.Init();
+	client->m_NumSubscriptions.value = 0;
+	client->m_EntityId = InterestGrid::INVALID_ENTITY;
+	client->m_SnapshotHistory = NULL;
+	client->m_RespSession = NULL;
+	client->m_Handle = ClientHandles::INVALID_HANDLE;
+	client->m_ProxyLink = NULL;
+	client->m_Upstream = false;
+	client->m_LogicHandle = ClientHandles::INVALID_HANDLE;
+	client->m_ClusterNode = Cluster::NO_NODE;
+	client->m_OutboundLink = false;
+	client->m_UserId = 0;
+	client->m_TableSlot = ConnectionTable::NO_SLOT;
+	client->m_AddressSlot = RateLimiter::NO_ADDRESS;
+	client->m_Admitted = false;
+
+	client->m_Socket = socket != INVALID_SOCKET ? socket : Network::CreateSocket(false, 0);
 	if(client->m_Socket == INVALID_SOCKET)
 	{
 		ERROR_MSG("Could not create socket.");		
+		DeleteCriticalSection(&client->m_CSForSend);
+		BufferPool::Free(client->m_recvBuffer);
 		ClientPool::free(client);
 		return NULL;
 	}
@@ -26,20 +97,231 @@ typedef boost::singleton_pool<Client, sizeof(Client)> ClientPool;
 
 /* static */ void Client::Destroy(Client* client)
 {
-	if( client->m_Socket != INVALID_SOCKET )
-	{
-		Network::CloseSocket(client->m_Socket);
-		CancelIoEx(reinterpret_cast<HANDLE>(client->m_Socket), NULL);
-		client->m_Socket = INVALID_SOCKET;
-		client->m_State = DISCONNECTED;
-	}
+	client->Close();
 
 	if( client->m_pTPIO != NULL )
 	{
-		WaitForThreadpoolIoCallbacks( client->m_pTPIO, true );
+		client->WaitForCallbacks();
 		CloseThreadpoolIo( client->m_pTPIO );
 		client->m_pTPIO = NULL;
 	}
 
+	BufferPool::Free(client->m_recvBuffer);
+	client->m_recvBuffer = NULL;
+
+	client->m_FrameDecoder.Reset();
+
+	delete client->m_SnapshotHistory;
+	client->m_SnapshotHistory = NULL;
+
+	delete client->m_RespSession;
+	client->m_RespSession = NULL;
+
+	// The link belongs to the server.
+	client->m_ProxyLink = NULL;
+
+	// The server drops the queued sends and the batch in flight before destroying a client.
+	assert(client->m_SendHead == NULL);
+	assert(client->m_SendInFlight == NULL);
+	DeleteCriticalSection(&client->m_CSForSend);
+
+	delete client->m_KeyedSends;
+	client->m_KeyedSends = NULL;
+
 	ClientPool::free(client);
-}
\ No newline at end of file
+}
+
+
+void Client::Close()
+{
+	if( m_Socket != INVALID_SOCKET )
+	{
+		Network::CloseSocket(m_Socket);
+		CancelIoEx(reinterpret_cast<HANDLE>(m_Socket), NULL);
+		m_Socket = INVALID_SOCKET;
+		m_State = DISCONNECTED;
+	}
+}
+
+
+void Client::WaitForCallbacks()
+{
+	if( m_pTPIO != NULL )
+	{
+		WaitForThreadpoolIoCallbacks( m_pTPIO, true );
+	}
+}
+
+
+/* static */ void Client::SetRecvBuffBounds(DWORD minSize, DWORD maxSize)
+{
+	assert(minSize > 0);
+	assert(minSize <= maxSize);
+	assert(maxSize <= BufferPool::MAX_BUFFER_SIZE);
+
+	s_MinRecvBuffer = minSize;
+	s_MaxRecvBuffer = maxSize;
+}
+
+
+void Client::AdaptRecvBuff(DWORD bytesReceived)
+{
+	DWORD newSize = GetNextRecvBuffSize(bytesReceived);
+	if(newSize == m_recvBufferSize)
+	{
+		return;
+	}
+
+	// Only one recv is posted at a time and its data has been copied out already, so the old buffer is free to go.
+	BYTE* newBuffer = BufferPool::Alloc(newSize);
+	if(newBuffer == NULL)
+	{
+		// Keep using the current buffer. It's still valid.
+		return;
+	}
+
+	BufferPool::Free(m_recvBuffer);
+	m_recvBuffer = newBuffer;
+	m_recvBufferSize = newSize;
+}
+
+
+BYTE* Client::DetachRecvBuff(DWORD bytesReceived)
+{
+	DWORD newSize = GetNextRecvBuffSize(bytesReceived);
+
+	BYTE* newBuffer = BufferPool::Alloc(newSize);
+	if(newBuffer == NULL)
+	{
+		return NULL;
+	}
+
+	BYTE* buffer = m_recvBuffer;
+	m_recvBuffer = newBuffer;
+	m_recvBufferSize = newSize;
+
+	return buffer;
+}
+
+
+DWORD Client::GetNextRecvBuffSize(DWORD bytesReceived)
+{
+	DWORD newSize = m_recvBufferSize;
+
+	if(bytesReceived == m_recvBufferSize)
+	{
+		// The socket had more to give. Double up so a bulk stream needs fewer recvs.
+		m_numSmallRecvs = 0;
+		newSize = m_recvBufferSize * 2;
+		if(newSize > s_MaxRecvBuffer) newSize = s_MaxRecvBuffer;
+	}
+	else if(bytesReceived < m_recvBufferSize / 4)
+	{
+		// Heartbeats and small inputs. Give memory back after a run of them.
+		if(++m_numSmallRecvs >= SHRINK_AFTER_SMALL_RECVS)
+		{
+			m_numSmallRecvs = 0;
+			newSize = m_recvBufferSize / 2;
+			if(newSize < s_MinRecvBuffer) newSize = s_MinRecvBuffer;
+		}
+	}
+	else
+	{
+		m_numSmallRecvs = 0;
+	}
+
+	return newSize;
+}
+
+
+void Client::PushSend(IOEvent* event, bool keyed)
+{
+	assert(event);
+	assert(event->GetPacket());
+
+	event->SetNext(NULL);
+
+	DWORD key = event->GetPacket()->GetCoalesceKey();
+	if(keyed && key != Packet::COALESCE_NONE)
+	{
+		if(m_KeyedSends == NULL)
+		{
+			m_KeyedSends = new KeyedSendMap;
+		}
+
+		assert(m_KeyedSends->find(key) == m_KeyedSends->end());
+		(*m_KeyedSends)[key] = event;
+	}
+
+	if(m_SendTail == NULL)
+	{
+		m_SendHead = event;
+	}
+	else
+	{
+		m_SendTail->SetNext(event);
+	}
+	m_SendTail = event;
+
+	m_QueuedSendBytes += event->GetPacket()->GetSize();
+}
+
+
+IOEvent* Client::PopSend()
+{
+	IOEvent* event = m_SendHead;
+	if(event == NULL)
+	{
+		return NULL;
+	}
+
+	m_SendHead = event->GetNext();
+	if(m_SendHead == NULL)
+	{
+		m_SendTail = NULL;
+	}
+	event->SetNext(NULL);
+
+	m_QueuedSendBytes -= event->GetPacket()->GetSize();
+
+	// Popped ones are on their way and can't be replaced any more.
+	DWORD key = event->GetPacket()->GetCoalesceKey();
+	if(key != Packet::COALESCE_NONE && m_KeyedSends != NULL)
+	{
+		KeyedSendMap::iterator itor = m_KeyedSends->find(key);
+		if(itor != m_KeyedSends->end() && itor->second == event)
+		{
+			m_KeyedSends->erase(itor);
+		}
+	}
+
+	return event;
+}
+
+
+Packet* Client::ReplaceQueuedSend(Packet* packet)
+{
+	assert(packet);
+
+	DWORD key = packet->GetCoalesceKey();
+	if(key == Packet::COALESCE_NONE || m_KeyedSends == NULL)
+	{
+		return NULL;
+	}
+
+	KeyedSendMap::iterator itor = m_KeyedSends->find(key);
+	if(itor == m_KeyedSends->end())
+	{
+		return NULL;
+	}
+
+	// It keeps the place of the old one in the queue, so a busy key isn't pushed back behind the others.
+	IOEvent* event = itor->second;
+	Packet* replaced = event->GetPacket();
+	event->SetPacket(packet);
+
+	m_QueuedSendBytes -= replaced->GetSize();
+	m_QueuedSendBytes += packet->GetSize();
+
+	return replaced;
+}
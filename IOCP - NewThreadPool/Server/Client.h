@@ -1,13 +1,31 @@
 #pragma once
 
 #include <winsock2.h>
+#include <Ws2tcpip.h>
+#include <boost/unordered_map.hpp>
+#include "FrameDecoder.h"
+#include "CacheLine.h"
 
-class Client
+class IOEvent;
+class Packet;
+class SnapshotHistory;
+class RespSession;
+class ProxyLink;
+class Server;
+
+// Laid out by who touches what. See the members.
+class __declspec(align(CACHE_LINE_SIZE)) Client
 {
 public:
 	enum
 	{
-		MAX_RECV_BUFFER = 1024,
+		// Default bounds of the adaptive recv buffer.
+		MIN_RECV_BUFFER = 256,
+		INITIAL_RECV_BUFFER = 1024,
+		MAX_RECV_BUFFER = 64 * 1024,
+
+		// The recv buffer shrinks after this many reads in a row used less than a quarter of it.
+		SHRINK_AFTER_SMALL_RECVS = 8,
 	};
 
 	enum State
@@ -17,11 +35,33 @@ public:
 		DISCONNECTED,
 	};
 
+	struct SendStats
+	{
+		DWORD sentPackets;
+		DWORD sentBatches;		// WSASend() calls.
+		ULONGLONG sentBytes;
+		DWORD droppedPackets;
+		ULONGLONG droppedBytes;
+		DWORD coalescedPackets;		// replaced while queued by a newer one with the same key.
+		ULONGLONG coalescedBytes;
+		DWORD slowDetections;
+
+		// Microseconds from WSASend() to its completion, per batch.
+		ULONGLONG totalLatency;
+		ULONGLONG maxLatency;
+	};
+
 public:
-	static Client* Create();
+	// Creates a socket for AcceptEx(), unless one is given. A given one is closed with the client, or right away if this fails.
+	static Client* Create(Server* server, SOCKET socket = INVALID_SOCKET);
 	static void Destroy(Client* client);
 
+	static void SetRecvBuffBounds(DWORD minSize, DWORD maxSize);
+
 public:
+	// The server the client is on, for the callbacks that are only given the client.
+	Server* GetServer() { return m_Server; }
+
 	void SetTPIO(TP_IO* pTPIO) { m_pTPIO = pTPIO; }
 	TP_IO* GetTPIO() { return m_pTPIO; }
 
@@ -29,7 +69,111 @@ public:
 	State GetState() { return m_State; }
 
 	SOCKET GetSocket() { return m_Socket; }
+
+	// Closes the socket and cancels its I/O. Destroy() does it too, along with waiting for the I/O callbacks.
+	void Close();
+	// Call after Close().
+	void WaitForCallbacks();
+
 	BYTE* GetRecvBuff() { return m_recvBuffer; }
+	DWORD GetRecvBuffSize() { return m_recvBufferSize; }
+
+	// Picks the size of the next recv from how much the last one filled.
+	void AdaptRecvBuff(DWORD bytesReceived);
+
+	// Hands the buffer over with the bytes of the last recv in it, instead of them being copied out,
+	// and takes a new one for the next recv, sized as AdaptRecvBuff() would. Returns NULL if BufferPool is exhausted.
+	BYTE* DetachRecvBuff(DWORD bytesReceived);
+
+	// Bytes of packets from this client waiting for processing, and to this client waiting for sending.
+	void AddInboundBytes(LONG bytes) { InterlockedExchangeAdd(&m_InboundBytes.value, bytes); }
+	void AddOutboundBytes(LONG bytes) { InterlockedExchangeAdd(&m_OutboundBytes.value, bytes); }
+	LONG GetInboundBytes() { return m_InboundBytes.value; }
+	LONG GetOutboundBytes() { return m_OutboundBytes.value; }
+	LONG GetBufferedBytes() { return m_InboundBytes.value + m_OutboundBytes.value; }
+
+	// No recv is posted while paused. Returns the previous state.
+	bool SetRecvPaused(bool paused) { return InterlockedExchange(&m_RecvPaused, paused ? 1 : 0) != 0; }
+	bool IsRecvPaused() { return m_RecvPaused != 0; }
+
+	// Send queue. Only one WSASend() is outstanding per client and the rest wait here.
+	// The one in flight can be a batch of sends linked by IOEvent::GetNext().
+	// Everything below must be called between LockSendQueue() and UnlockSendQueue().
+	void LockSendQueue() { EnterCriticalSection(&m_CSForSend); }
+	void UnlockSendQueue() { LeaveCriticalSection(&m_CSForSend); }
+
+	// With keyed, the send can be replaced by a later one with the same coalescing key until it's popped.
+	void PushSend(IOEvent* event, bool keyed = false);
+	IOEvent* PopSend();
+	bool HasQueuedSends() { return m_SendHead != NULL; }
+
+	// Latest value wins. If a keyed send with the packet's coalescing key is queued, the packet takes its place.
+	// Returns the packet it replaced, or NULL if there was none.
+	Packet* ReplaceQueuedSend(Packet* packet);
+	DWORD GetQueuedSendBytes() { return m_QueuedSendBytes; }
+
+	IOEvent* GetSendInFlight() { return m_SendInFlight; }
+	DWORD GetSendInFlightBytes() { return m_SendInFlightBytes; }
+	void SetSendInFlight(IOEvent* event, DWORD bytes) { m_SendInFlight = event; m_SendInFlightBytes = bytes; }
+
+	SendStats& GetSendStats() { return m_SendStats; }
+
+	FrameDecoder& GetFrameDecoder() { return m_FrameDecoder; }
+
+	// Number of PubSub channels this client is in.
+	void AddSubscriptions(LONG count) { InterlockedExchangeAdd(&m_NumSubscriptions.value, count); }
+	LONG GetNumSubscriptions() { return m_NumSubscriptions.value; }
+
+	// This client's entity in the server's InterestGrid. InterestGrid::INVALID_ENTITY until it first moves.
+	void SetEntityId(DWORD id) { m_EntityId = id; }
+	DWORD GetEntityId() { return m_EntityId; }
+
+	// Snapshots sent to this client in snapshot mode. Created on the first one and deleted with the client.
+	void SetSnapshotHistory(SnapshotHistory* history) { m_SnapshotHistory = history; }
+	SnapshotHistory* GetSnapshotHistory() { return m_SnapshotHistory; }
+
+	// Parser state and replies in MODE_RESP. Created on the first recv and deleted with the client.
+	void SetRespSession(RespSession* session) { m_RespSession = session; }
+	RespSession* GetRespSession() { return m_RespSession; }
+
+	// The client's handle in the server's m_Handles while it's in m_Clients. ClientHandles::INVALID_HANDLE otherwise.
+	void SetHandle(DWORD handle) { m_Handle = handle; }
+	DWORD GetHandle() { return m_Handle; }
+
+	// The other end of the client in MODE_PROXY. Shared with the peer and deleted by the server with the pair.
+	void SetProxyLink(ProxyLink* link) { m_ProxyLink = link; }
+	ProxyLink* GetProxyLink() { return m_ProxyLink; }
+
+	// A connection of UpstreamPool to a backend, instead of a client.
+	void SetUpstream(bool upstream) { m_Upstream = upstream; }
+	bool IsUpstream() { return m_Upstream; }
+
+	// The client's handle on the server's SharedChannel. ClientHandles::INVALID_HANDLE if there's no channel.
+	void SetLogicHandle(DWORD handle) { m_LogicHandle = handle; }
+	DWORD GetLogicHandle() { return m_LogicHandle; }
+
+	// A link to another node of the server's Cluster, instead of a client. Cluster::NO_NODE if it's not one.
+	// The server sends on the outbound links, the ones it made, and receives on the others.
+	void SetClusterLink(DWORD node, bool outbound) { m_ClusterNode = node; m_OutboundLink = outbound; }
+	DWORD GetClusterNode() { return m_ClusterNode; }
+	bool IsOutboundLink() { return m_OutboundLink; }
+
+	// The client's slot in the server's ConnectionTable. ConnectionTable::NO_SLOT if it has none.
+	void SetTableSlot(DWORD slot) { m_TableSlot = slot; }
+	DWORD GetTableSlot() { return m_TableSlot; }
+
+	// The client's address in the server's RateLimiter. RateLimiter::NO_ADDRESS if it has none.
+	void SetAddressSlot(DWORD slot) { m_AddressSlot = slot; }
+	DWORD GetAddressSlot() { return m_AddressSlot; }
+
+	// Set by the server once an accepted client is let in, and counted in its AddressCounter. Never for the connections it makes.
+	void SetAdmitted(const IN6_ADDR& address) { m_RemoteIp = address; m_Admitted = true; }
+	bool IsAdmitted() { return m_Admitted; }
+	const IN6_ADDR& GetRemoteIp() { return m_RemoteIp; }
+
+	// The user logged in on this client. 0 if none has.
+	void SetUserId(DWORD user) { m_UserId = user; }
+	DWORD GetUserId() { return m_UserId; }
 
 private:
 	Client(void);
@@ -37,9 +181,57 @@ private:
 	Client& operator=(Client& rhs);
 	Client(const Client& rhs);
 
+	DWORD GetNextRecvBuffSize(DWORD bytesReceived);
+
 private:
+	// What every recv and its completion touch, in the first line. Only the thread of the recv writes it,
+	// apart from m_RecvPaused and m_State when the client goes away.
 	TP_IO* m_pTPIO;
-	State m_State;
 	SOCKET m_Socket;
-	BYTE m_recvBuffer[MAX_RECV_BUFFER];
+	BYTE* m_recvBuffer; // from BufferPool.
+	DWORD m_TableSlot;
+	State m_State;
+	DWORD m_recvBufferSize;
+	DWORD m_numSmallRecvs;
+	volatile LONG m_RecvPaused;
+	FrameDecoder m_FrameDecoder; // its buffer is out of line.
+
+	// Written by the threads that recv, process and send, each on a line of its own.
+	PaddedLong m_InboundBytes;
+	PaddedLong m_OutboundBytes;
+
+	// Written by whoever holds m_CSForSend.
+	CRITICAL_SECTION m_CSForSend;
+	IOEvent* m_SendHead;
+	IOEvent* m_SendTail;
+	IOEvent* m_SendInFlight;
+	DWORD m_SendInFlightBytes;
+	DWORD m_QueuedSendBytes;
+
+	// Keyed sends in the queue by coalescing key. Created on the first one.
+	typedef boost::unordered_map<DWORD, IOEvent*> KeyedSendMap;
+	KeyedSendMap* m_KeyedSends;
+	SendStats m_SendStats;
+
+	// Written by PubSub.
+	PaddedLong m_NumSubscriptions;
+
+	// Set once or rarely, and read off the recv path but for m_ProxyLink in MODE_PROXY.
+	Server* m_Server;
+	ProxyLink* m_ProxyLink;
+	DWORD m_EntityId;
+	SnapshotHistory* m_SnapshotHistory;
+	RespSession* m_RespSession;
+	bool m_Upstream;
+	DWORD m_Handle;
+	DWORD m_LogicHandle;
+	DWORD m_ClusterNode;
+	bool m_OutboundLink;
+	DWORD m_UserId;
+	DWORD m_AddressSlot;
+	bool m_Admitted;
+	IN6_ADDR m_RemoteIp;
+
+	static DWORD s_MinRecvBuffer;
+	static DWORD s_MaxRecvBuffer;
 };
@@ -0,0 +1,72 @@
+#include "ClientHandles.h"
+
+#include <cassert>
+
+using namespace std;
+
+
+ClientHandles::ClientHandles()
+: m_NumClients(0)
+{
+}
+
+
+DWORD ClientHandles::Add(Client* client)
+{
+	assert(client);
+
+	DWORD slot = 0;
+	if(!m_FreeSlots.empty())
+	{
+		slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+
+		m_Generations[slot] = m_Generations[slot] < MAX_GENERATION ? m_Generations[slot] + 1 : 1;
+	}
+	else if(m_Clients.size() < MAX_CLIENTS)
+	{
+		slot = static_cast<DWORD>(m_Clients.size());
+
+		m_Clients.push_back(NULL);
+		m_Generations.push_back(1);
+	}
+	else
+	{
+		return INVALID_HANDLE;
+	}
+
+	m_Clients[slot] = client;
+	++m_NumClients;
+
+	return (m_Generations[slot] << SLOT_BITS) | slot;
+}
+
+
+void ClientHandles::Remove(DWORD handle)
+{
+	Client* client = Find(handle);
+	assert(client);
+
+	if(client == NULL)
+	{
+		return;
+	}
+
+	DWORD slot = handle & (MAX_CLIENTS - 1);
+
+	m_Clients[slot] = NULL;
+	m_FreeSlots.push_back(slot);
+	--m_NumClients;
+}
+
+
+Client* ClientHandles::Find(DWORD handle)
+{
+	DWORD slot = handle & (MAX_CLIENTS - 1);
+	if(slot >= m_Clients.size() || m_Generations[slot] != (handle >> SLOT_BITS))
+	{
+		return NULL;
+	}
+
+	return m_Clients[slot];
+}
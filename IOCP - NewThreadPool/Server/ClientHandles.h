@@ -0,0 +1,43 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+class Client;
+
+// Handles of clients, for what may outlive a client and can't trust its pointer, like a packet still queued after its sender left.
+// A handle is a slot and the generation of the slot, so a handle still in flight when its client goes away
+// never finds the client that gets the slot next. Not thread-safe.
+class ClientHandles
+{
+public:
+	enum
+	{
+		INVALID_HANDLE = 0,
+
+		SLOT_BITS = 20,
+		MAX_CLIENTS = 1 << SLOT_BITS,
+		MAX_GENERATION = (1 << (32 - SLOT_BITS)) - 1,
+	};
+
+public:
+	ClientHandles();
+
+	// Returns INVALID_HANDLE if there are MAX_CLIENTS already.
+	DWORD Add(Client* client);
+	void Remove(DWORD handle);
+
+	// NULL if its client is gone.
+	Client* Find(DWORD handle);
+
+	DWORD GetNumClients() { return m_NumClients; }
+
+private:
+	ClientHandles(const ClientHandles& rhs);
+	ClientHandles& operator=(const ClientHandles& rhs);
+
+private:
+	std::vector<Client*> m_Clients;
+	std::vector<DWORD> m_Generations;	// of the handle given last, per slot. Never 0, so no handle is INVALID_HANDLE.
+	std::vector<DWORD> m_FreeSlots;
+	DWORD m_NumClients;
+};
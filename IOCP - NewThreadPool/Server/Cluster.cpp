@@ -0,0 +1,693 @@
+#include "Cluster.h"
+#include "Packet.h"
+
+#include "..\Log.h"
+#include "..\Network.h"
+#include "..\Protocol.h"
+#include "..\Messages.h"
+
+#include <fstream>
+#include <sstream>
+#include <cassert>
+#include <cstdio>
+
+using namespace std;
+
+
+Cluster::Cluster()
+: m_Self(NO_NODE)
+{
+	InitializeCriticalSection(&m_CS);
+}
+
+
+Cluster::~Cluster()
+{
+	Clear();
+
+	DeleteCriticalSection(&m_CS);
+}
+
+
+bool Cluster::Load(const char* path, DWORD self)
+{
+	assert(path);
+	assert(!IsEnabled());
+
+	ifstream file(path);
+	if(!file)
+	{
+		ERROR_MSG("Could not open the cluster file : %s", path);
+		return false;
+	}
+
+	string line;
+	for(int lineNumber = 1 ; getline(file, line) ; ++lineNumber)
+	{
+		istringstream fields(line);
+
+		string keyword;
+		if(!(fields >> keyword) || keyword[0] == '#')
+		{
+			continue;
+		}
+
+		DWORD id = 0;
+		string host;
+		DWORD port = 0;
+		if(keyword != "node" || !(fields >> id >> host >> port) || id == NO_NODE || port == 0 || port > 0xFFFF)
+		{
+			ERROR_MSG("%s(%d) : expected node <id> <host> <port>", path, lineNumber);
+			return false;
+		}
+
+		if(FindNode(id) != NULL)
+		{
+			ERROR_MSG("%s(%d) : node %d is there already.", path, lineNumber, id);
+			return false;
+		}
+
+		if(m_Nodes.size() == MAX_NODES)
+		{
+			ERROR_MSG("%s(%d) : more than %d nodes.", path, lineNumber, MAX_NODES);
+			return false;
+		}
+
+		Node node;
+		node.id = id;
+		node.bit = 1 << m_Nodes.size();
+		node.port = static_cast<u_short>(port);
+		node.link = NULL;
+		node.connected = false;
+		node.retryTime = 0;
+		node.inboundLink = NULL;
+		ZeroMemory(&node.stats, sizeof(node.stats));
+
+		if(!Network::ResolveAddress(host.c_str(), node.port, node.address, node.addressSize))
+		{
+			ERROR_MSG("%s(%d) : could not resolve %s.", path, lineNumber, host.c_str());
+			return false;
+		}
+
+		// IPv4 ones are mapped, so that it compares with the address of a link in.
+		ZeroMemory(&node.ip, sizeof(node.ip));
+		if(node.address.ss_family == AF_INET6)
+		{
+			node.ip = reinterpret_cast<const sockaddr_in6*>(&node.address)->sin6_addr;
+		}
+		else
+		{
+			node.ip.s6_addr[10] = 0xFF;
+			node.ip.s6_addr[11] = 0xFF;
+			CopyMemory(&node.ip.s6_addr[12], &reinterpret_cast<const sockaddr_in*>(&node.address)->sin_addr, sizeof(in_addr));
+		}
+
+		char name[300] = "";
+		sprintf_s(name, sizeof(name), "%s:%d", host.c_str(), port);
+		node.name = name;
+
+		m_Nodes.push_back(node);
+	}
+
+	if(FindNode(self) == NULL)
+	{
+		ERROR_MSG("Node %d isn't in %s.", self, path);
+		m_Nodes.clear();
+		return false;
+	}
+
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		m_Ring.AddNode(m_Nodes[i].id);
+	}
+
+	m_Self = self;
+
+	return true;
+}
+
+
+u_short Cluster::GetPort(DWORD node)
+{
+	Node* n = FindNode(node);
+	assert(n);
+
+	return n->port;
+}
+
+
+const string& Cluster::GetName(DWORD node)
+{
+	Node* n = FindNode(node);
+	assert(n);
+
+	return n->name;
+}
+
+
+const SOCKADDR_STORAGE& Cluster::GetAddress(DWORD node, int& size)
+{
+	Node* n = FindNode(node);
+	assert(n);
+
+	size = n->addressSize;
+	return n->address;
+}
+
+
+void Cluster::AddLink(DWORD node, Client* link)
+{
+	assert(link);
+
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+	assert(n && n->id != m_Self && n->link == NULL);
+
+	n->link = link;
+	n->connected = false;
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::OnLinkConnected(Client* link, SendFunc send, void* context)
+{
+	assert(link);
+
+	EnterCriticalSection(&m_CS);
+
+	Node* node = FindLink(link);
+	if(node != NULL)
+	{
+		Packet* hello = Packet::Create(NULL, NULL, Messages::NodeHelloBuilder::GetFrameSize());
+		if(hello == NULL)
+		{
+			ERROR_MSG("Could not allocate the hello of a link.");
+		}
+		else
+		{
+			Messages::NodeHelloBuilder builder(hello->GetData());
+			builder.SetNode(m_Self);
+
+			send(context, link, hello);
+		}
+
+		node->connected = true;
+
+		TRACE("[%d] Linked to node %d, %s", GetCurrentThreadId(), node->id, node->name.c_str());
+
+		// The node forgot them when the last link went.
+		for(SubscriberCountMap::iterator itor = m_LocalSubscribers.begin() ; itor != m_LocalSubscribers.end() ; ++itor)
+		{
+			if(GetOwner(itor->first) == node->id)
+			{
+				Subscribe(*node, itor->first, true);
+			}
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+bool Cluster::AcceptLink(DWORD node, Client* link, const IN6_ADDR& from)
+{
+	assert(link);
+
+	if(node == m_Self || FindNode(node) == NULL)
+	{
+		return false;
+	}
+
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+
+	// Anyone can connect and say it's a node. Only the node's own address is believed.
+	if(memcmp(&from, &n->ip, sizeof(from)) != 0)
+	{
+		LeaveCriticalSection(&m_CS);
+		ERROR_MSG("A link for node %d from an address that isn't its own.", node);
+		return false;
+	}
+
+	// Nor is one that would take over the link of the node. Once that one is gone, the node's next try gets in.
+	if(n->inboundLink != NULL)
+	{
+		LeaveCriticalSection(&m_CS);
+		ERROR_MSG("A link for node %d, which has one in already.", node);
+		return false;
+	}
+
+	n->inboundLink = link;
+
+	// What came on the link before is stale. The node sends its subscriptions again on this one.
+	for(NodeMaskMap::iterator itor = m_SubscriberNodes.begin() ; itor != m_SubscriberNodes.end() ; )
+	{
+		itor->second &= ~n->bit;
+		itor = itor->second == 0 ? m_SubscriberNodes.erase(itor) : ++itor;
+	}
+
+	LeaveCriticalSection(&m_CS);
+
+	TRACE("[%d] Node %d linked in.", GetCurrentThreadId(), node);
+
+	return true;
+}
+
+
+void Cluster::RemoveLink(Client* link, ULONGLONG now)
+{
+	assert(link);
+
+	EnterCriticalSection(&m_CS);
+
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		Node& node = m_Nodes[i];
+
+		if(node.link == link)
+		{
+			node.link = NULL;
+			node.connected = false;
+			node.retryTime = now + static_cast<ULONGLONG>(RETRY_MS) * 1000;
+
+			node.batch.clear();
+			for(size_t j = 0 ; j < node.sealed.size() ; ++j)
+			{
+				Packet::Destroy(node.sealed[j]);
+			}
+			node.sealed.clear();
+		}
+
+		if(node.inboundLink == link)
+		{
+			node.inboundLink = NULL;
+
+			for(NodeMaskMap::iterator itor = m_SubscriberNodes.begin() ; itor != m_SubscriberNodes.end() ; )
+			{
+				itor->second &= ~node.bit;
+				itor = itor->second == 0 ? m_SubscriberNodes.erase(itor) : ++itor;
+			}
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::GetMissingLinks(ULONGLONG now, vector<DWORD>& nodes)
+{
+	EnterCriticalSection(&m_CS);
+
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		if(m_Nodes[i].id != m_Self && m_Nodes[i].link == NULL && now >= m_Nodes[i].retryTime)
+		{
+			nodes.push_back(m_Nodes[i].id);
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::RouteToUser(DWORD node, DWORD user, DWORD from, const BYTE* data, DWORD size)
+{
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+	assert(n && n->id != m_Self);
+
+	BYTE* frame = Append(*n, Messages::RouteToUserBuilder::GetFrameSize(size));
+	if(frame != NULL)
+	{
+		Messages::RouteToUserBuilder builder(frame, size);
+		builder.SetUser(user);
+		builder.SetFrom(from);
+		CopyMemory(builder.GetData(), data, size);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+DWORD Cluster::Publish(DWORD channel, const BYTE* frame, DWORD size, DWORD from)
+{
+	DWORD owner = GetOwner(channel);
+
+	// Only the owner knows the nodes to send it to.
+	if(owner != m_Self && from != m_Self)
+	{
+		return 0;
+	}
+
+	EnterCriticalSection(&m_CS);
+
+	DWORD numNodes = 0;
+
+	DWORD mask = 0;
+	if(owner == m_Self)
+	{
+		NodeMaskMap::iterator itor = m_SubscriberNodes.find(channel);
+		mask = itor != m_SubscriberNodes.end() ? itor->second : 0;
+	}
+
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		Node& node = m_Nodes[i];
+
+		bool to = (owner == m_Self) ? (node.bit & mask) != 0 : node.id == owner;
+		if(!to || node.id == from || node.id == m_Self)
+		{
+			continue;
+		}
+
+		BYTE* record = Append(node, Messages::RoutePublishBuilder::GetFrameSize(size));
+		if(record != NULL)
+		{
+			Messages::RoutePublishBuilder builder(record, size);
+			builder.SetChannel(channel);
+			CopyMemory(builder.GetFrame(), frame, size);
+
+			++numNodes;
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+
+	return numNodes;
+}
+
+
+void Cluster::Ping(DWORD node, DWORD sequence, ULONGLONG sendTime)
+{
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+	assert(n && n->id != m_Self);
+
+	BYTE* frame = Append(*n, Messages::RoutePingBuilder::GetFrameSize());
+	if(frame != NULL)
+	{
+		Messages::RoutePingBuilder builder(frame);
+		builder.SetSequence(sequence);
+		builder.SetSendTime(sendTime);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::Pong(DWORD node, DWORD sequence, ULONGLONG sendTime)
+{
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+	assert(n && n->id != m_Self);
+
+	BYTE* frame = Append(*n, Messages::RoutePongBuilder::GetFrameSize());
+	if(frame != NULL)
+	{
+		Messages::RoutePongBuilder builder(frame);
+		builder.SetSequence(sequence);
+		builder.SetSendTime(sendTime);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::AddLocalSubscriber(DWORD channel)
+{
+	EnterCriticalSection(&m_CS);
+
+	DWORD owner = GetOwner(channel);
+	if(++m_LocalSubscribers[channel] == 1 && owner != m_Self)
+	{
+		Subscribe(*FindNode(owner), channel, true);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::RemoveLocalSubscriber(DWORD channel)
+{
+	EnterCriticalSection(&m_CS);
+
+	SubscriberCountMap::iterator itor = m_LocalSubscribers.find(channel);
+	assert(itor != m_LocalSubscribers.end());
+
+	if(--itor->second == 0)
+	{
+		m_LocalSubscribers.erase(itor);
+
+		DWORD owner = GetOwner(channel);
+		if(owner != m_Self)
+		{
+			Subscribe(*FindNode(owner), channel, false);
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::OnRemoteSubscriber(DWORD node, DWORD channel, bool subscribe)
+{
+	if(GetOwner(channel) != m_Self)
+	{
+		ERROR_MSG("Node %d subscribed to channel %d, which node %d owns.", node, channel, GetOwner(channel));
+		return;
+	}
+
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+	assert(n);
+
+	if(subscribe)
+	{
+		m_SubscriberNodes[channel] |= n->bit;
+	}
+	else
+	{
+		NodeMaskMap::iterator itor = m_SubscriberNodes.find(channel);
+		if(itor != m_SubscriberNodes.end() && (itor->second &= ~n->bit) == 0)
+		{
+			m_SubscriberNodes.erase(itor);
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::OnReceived(DWORD node, DWORD records)
+{
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+	assert(n);
+
+	n->stats.received += records;
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::Flush(SendFunc send, void* context)
+{
+	EnterCriticalSection(&m_CS);
+
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		Node& node = m_Nodes[i];
+
+		// Batches are only appended to while there's a link.
+		if(!node.connected)
+		{
+			continue;
+		}
+
+		if(!node.batch.empty())
+		{
+			Packet* packet = Seal(node);
+			if(packet != NULL)
+			{
+				node.sealed.push_back(packet);
+			}
+		}
+
+		for(size_t j = 0 ; j < node.sealed.size() ; ++j)
+		{
+			++node.stats.batches;
+			node.stats.bytes += node.sealed[j]->GetSize();
+
+			send(context, node.link, node.sealed[j]);
+		}
+		node.sealed.clear();
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void Cluster::Clear()
+{
+	EnterCriticalSection(&m_CS);
+
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		Node& node = m_Nodes[i];
+
+		node.link = NULL;
+		node.connected = false;
+		node.retryTime = 0;
+		node.inboundLink = NULL;
+
+		node.batch.clear();
+		for(size_t j = 0 ; j < node.sealed.size() ; ++j)
+		{
+			Packet::Destroy(node.sealed[j]);
+		}
+		node.sealed.clear();
+	}
+
+	m_LocalSubscribers.clear();
+	m_SubscriberNodes.clear();
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+Cluster::NodeStats Cluster::GetStats(DWORD node)
+{
+	EnterCriticalSection(&m_CS);
+
+	Node* n = FindNode(node);
+	assert(n);
+
+	NodeStats stats = n->stats;
+	stats.connected = n->connected;
+
+	LeaveCriticalSection(&m_CS);
+
+	return stats;
+}
+
+
+Cluster::Node* Cluster::FindNode(DWORD node)
+{
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		if(m_Nodes[i].id == node)
+		{
+			return &m_Nodes[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+Cluster::Node* Cluster::FindLink(Client* link)
+{
+	for(size_t i = 0 ; i < m_Nodes.size() ; ++i)
+	{
+		if(m_Nodes[i].link == link)
+		{
+			return &m_Nodes[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+BYTE* Cluster::Append(Node& node, DWORD size)
+{
+	if(!node.connected || Protocol::HEADER_SIZE + size > Protocol::MAX_FRAME_SIZE)
+	{
+		++node.stats.dropped;
+		return NULL;
+	}
+
+	// The one that doesn't fit goes in the next batch, unless it's bigger than a batch anyway.
+	if(!node.batch.empty() && node.batch.size() + size > MAX_BATCH_BYTES)
+	{
+		if(node.sealed.size() == MAX_SEALED_BATCHES)
+		{
+			++node.stats.dropped;
+			return NULL;
+		}
+
+		Packet* packet = Seal(node);
+		if(packet == NULL)
+		{
+			++node.stats.dropped;
+			return NULL;
+		}
+
+		node.sealed.push_back(packet);
+	}
+
+	if(node.batch.empty())
+	{
+		node.batch.resize(Protocol::HEADER_SIZE);
+	}
+
+	size_t offset = node.batch.size();
+	node.batch.resize(offset + size);
+
+	++node.stats.records;
+
+	return &node.batch[offset];
+}
+
+
+Packet* Cluster::Seal(Node& node)
+{
+	assert(!node.batch.empty());
+
+	Protocol::Header* header = reinterpret_cast<Protocol::Header*>(&node.batch[0]);
+	header->size = static_cast<DWORD>(node.batch.size() - Protocol::HEADER_SIZE);
+	header->opcode = Protocol::OP_NODE_BATCH;
+	header->flags = 0;
+
+	Packet* packet = Packet::Create(NULL, &node.batch[0], static_cast<DWORD>(node.batch.size()));
+	if(packet == NULL)
+	{
+		ERROR_MSG("Could not allocate a batch of %d bytes for node %d.", node.batch.size(), node.id);
+	}
+
+	// Its capacity stays for the next one.
+	node.batch.clear();
+
+	return packet;
+}
+
+
+void Cluster::Subscribe(Node& node, DWORD channel, bool subscribe)
+{
+	if(subscribe)
+	{
+		BYTE* frame = Append(node, Messages::RouteSubscribeBuilder::GetFrameSize());
+		if(frame != NULL)
+		{
+			Messages::RouteSubscribeBuilder builder(frame);
+			builder.SetChannel(channel);
+		}
+	}
+	else
+	{
+		BYTE* frame = Append(node, Messages::RouteUnsubscribeBuilder::GetFrameSize());
+		if(frame != NULL)
+		{
+			Messages::RouteUnsubscribeBuilder builder(frame);
+			builder.SetChannel(channel);
+		}
+	}
+}
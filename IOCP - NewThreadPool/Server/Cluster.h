@@ -0,0 +1,170 @@
+#pragma once
+#include <winsock2.h>
+#include <vector>
+#include <string>
+#include <boost/unordered_map.hpp>
+
+#include "HashRing.h"
+
+class Client;
+class Packet;
+
+// Servers that share their users and channels. Every node is started with the same config file, which lists them all :
+//
+//   # node <id> <host> <port>
+//   node 1 127.0.0.1 17000
+//   node 2 127.0.0.1 17001
+//
+// HashRing says which node owns a user and a channel, and a user logs in on its owner only.
+// Each node makes one link to every other node and sends on it. It receives on the links the others made to it.
+// A link carries the messages of every client to the node at the other end.
+// Messages to a node are appended to its batch and go out together as one OP_NODE_BATCH frame, when the flush
+// after the first of them runs or the batch has MAX_BATCH_BYTES. A burst goes in one send however many clients it came from.
+// The owner of a channel knows which nodes have subscribers to it. A publish goes to the owner, and the owner sends it on to them.
+// Messages to a node without a link are dropped. Once a link is back, subscriptions are sent again.
+// A link in is only taken from the address its node is listed at, and only while the node has no other.
+// Nodes on one host share an address, so any local process can pass for them. Give each node a host of its own if that matters.
+// Links are only compared and handed to the send function. They are never dereferenced here.
+class Cluster
+{
+public:
+	enum
+	{
+		NO_NODE = HashRing::NO_NODE,
+
+		// Each node is a bit in the masks of channel subscribers.
+		MAX_NODES = 32,
+
+		// A full batch waits for the flush with the ones sealed before it, up to MAX_SEALED_BATCHES.
+		MAX_BATCH_BYTES = 64 * 1024,
+		MAX_SEALED_BATCHES = 64,
+
+		// Before a lost link, or one that couldn't be made, is made again.
+		RETRY_MS = 1000,
+	};
+
+	// send takes over the packet.
+	typedef void (*SendFunc)(void* context, Client* link, Packet* packet);
+
+	struct NodeStats
+	{
+		bool connected;
+		ULONGLONG records;		// messages sent to the node.
+		ULONGLONG batches;
+		ULONGLONG bytes;
+		ULONGLONG dropped;		// messages for the node while it had no link, or too many batches waited.
+		ULONGLONG received;		// messages from the node.
+	};
+
+public:
+	Cluster();
+	~Cluster();
+
+	// Call before the server starts. Returns false if the file can't be read, or self isn't in it.
+	bool Load(const char* path, DWORD self);
+	bool IsEnabled() { return m_Self != NO_NODE; }
+
+	DWORD GetSelf() { return m_Self; }
+	u_short GetPort(DWORD node);
+	// host:port as it is in the file.
+	const std::string& GetName(DWORD node);
+	const SOCKADDR_STORAGE& GetAddress(DWORD node, int& size);
+	bool IsNode(DWORD node) { return FindNode(node) != NULL; }
+
+	// The owner of a user or a channel.
+	DWORD GetOwner(DWORD key) { return m_Ring.GetNode(key); }
+
+	// A link to the node that is being made.
+	void AddLink(DWORD node, Client* link);
+	// It's made. Sends the hello and the subscriptions of this node to the channels of the other.
+	void OnLinkConnected(Client* link, SendFunc send, void* context);
+	// A link the node made to this one, from the address from. Subscribers of the node are forgotten until it sends them again on it.
+	// Returns false if the node isn't another one of the cluster, from isn't its address, or it has a link in already.
+	bool AcceptLink(DWORD node, Client* link, const IN6_ADDR& from);
+	// Lost, or couldn't be made. Nothing is sent on it once this returns.
+	void RemoveLink(Client* link, ULONGLONG now);
+
+	// One node per link that should be made now.
+	void GetMissingLinks(ULONGLONG now, std::vector<DWORD>& nodes);
+
+	// Messages. Each goes in the batch of its node, so call Flush() soon after.
+	void RouteToUser(DWORD node, DWORD user, DWORD from, const BYTE* data, DWORD size);
+	// The Publish frame of a channel, from a client of the node from. Sent on to the owner, or from it to the nodes with subscribers.
+	// Returns how many nodes it goes to.
+	DWORD Publish(DWORD channel, const BYTE* frame, DWORD size, DWORD from);
+	void Ping(DWORD node, DWORD sequence, ULONGLONG sendTime);
+	void Pong(DWORD node, DWORD sequence, ULONGLONG sendTime);
+
+	// Local subscribers of a channel, counted so that its owner hears of the first and the last only.
+	// Call in the order they are subscribed and unsubscribed, under the same lock.
+	void AddLocalSubscriber(DWORD channel);
+	void RemoveLocalSubscriber(DWORD channel);
+
+	// RouteSubscribe and RouteUnsubscribe from the node, for a channel this one owns.
+	void OnRemoteSubscriber(DWORD node, DWORD channel, bool subscribe);
+	// Counts the messages of a batch from the node.
+	void OnReceived(DWORD node, DWORD records);
+
+	// Sends every batch that has something to a node with a link.
+	void Flush(SendFunc send, void* context);
+
+	// Forgets every link without sending anything. The server is going away.
+	void Clear();
+
+	DWORD GetNumNodes() { return static_cast<DWORD>(m_Nodes.size()); }
+	DWORD GetNodeId(DWORD index) { return m_Nodes[index].id; }
+	NodeStats GetStats(DWORD node);
+
+private:
+	struct Node
+	{
+		DWORD id;
+		DWORD bit;
+		std::string name;
+		u_short port;
+		SOCKADDR_STORAGE address;
+		int addressSize;
+		IN6_ADDR ip;			// of address, as Network::GetRemoteIp() gives it.
+
+		Client* link;			// the one this node made. NULL if there's none.
+		bool connected;
+		ULONGLONG retryTime;
+		Client* inboundLink;	// the one the node made to this one. Another isn't taken until it's gone.
+
+		std::vector<BYTE> batch;		// a header and the frames after it. Empty if there's nothing.
+		std::vector<Packet*> sealed;	// full batches waiting for the flush.
+
+		NodeStats stats;
+	};
+
+	Node* FindNode(DWORD node);
+	Node* FindLink(Client* link);
+
+	// Room for a frame of size bytes at the end of the node's batch. NULL if it's dropped.
+	BYTE* Append(Node& node, DWORD size);
+	// The batch as one frame. NULL if it couldn't be allocated.
+	Packet* Seal(Node& node);
+	void Subscribe(Node& node, DWORD channel, bool subscribe);
+
+private:
+	Cluster(const Cluster& rhs);
+	Cluster& operator=(const Cluster& rhs);
+
+private:
+	// Set up before the server starts, and only read after.
+	DWORD m_Self;
+	HashRing m_Ring;
+
+	// All guarded by m_CS, which is also held while sending.
+	std::vector<Node> m_Nodes;
+
+	// Of this node.
+	typedef boost::unordered_map<DWORD, DWORD> SubscriberCountMap;
+	SubscriberCountMap m_LocalSubscribers;
+
+	// Of the channels this node owns, the bits of the other nodes with subscribers to them.
+	typedef boost::unordered_map<DWORD, DWORD> NodeMaskMap;
+	NodeMaskMap m_SubscriberNodes;
+
+	CRITICAL_SECTION m_CS;
+};
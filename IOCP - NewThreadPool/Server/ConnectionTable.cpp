@@ -0,0 +1,240 @@
+#include "ConnectionTable.h"
+#include "CacheLine.h"
+
+#include <cassert>
+#include <emmintrin.h>
+
+using namespace std;
+
+
+ConnectionTable::ConnectionTable()
+: m_NumPages(0),
+  m_NumSlots(0),
+  m_NumConnections(0),
+  m_UseSimd(true)
+{
+	ZeroMemory(m_Pages, sizeof(m_Pages));
+}
+
+
+ConnectionTable::~ConnectionTable()
+{
+	for(DWORD i = 0 ; i < m_NumPages ; ++i)
+	{
+		_aligned_free(m_Pages[i]);
+	}
+}
+
+
+DWORD ConnectionTable::Add(Client* client, DWORD now)
+{
+	assert(client);
+
+	DWORD slot = NO_SLOT;
+	if(!m_FreeSlots.empty())
+	{
+		slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+	}
+	else
+	{
+		if(m_NumSlots == m_NumPages * PAGE_SIZE)
+		{
+			if(m_NumPages == MAX_PAGES)
+			{
+				return NO_SLOT;
+			}
+
+			Page* page = static_cast<Page*>(_aligned_malloc(sizeof(Page), CACHE_LINE_SIZE));
+			if(page == NULL)
+			{
+				return NO_SLOT;
+			}
+			ZeroMemory(page, sizeof(Page));
+
+			m_Pages[m_NumPages++] = page;
+		}
+
+		slot = m_NumSlots++;
+	}
+
+	Page* page = m_Pages[slot / PAGE_SIZE];
+	DWORD index = slot % PAGE_SIZE;
+
+	page->lastActivity[index] = now;
+	page->inUse[index] = 0xFFFFFFFF;
+	page->limited[index] = 0;
+	page->bulk[index] = 0;
+	page->recvBytes[index] = 0;
+	page->sentBytes[index] = 0;
+	page->sweptRecvBytes[index] = 0;
+	page->clients[index] = client;
+
+	++m_NumConnections;
+
+	return slot;
+}
+
+
+void ConnectionTable::Remove(DWORD slot)
+{
+	assert(slot < m_NumSlots);
+
+	Page* page = m_Pages[slot / PAGE_SIZE];
+	DWORD index = slot % PAGE_SIZE;
+	assert(page->inUse[index] != 0);
+
+	page->inUse[index] = 0;
+	page->limited[index] = 0;
+	page->bulk[index] = 0;
+	page->recvBytes[index] = 0;
+	page->sentBytes[index] = 0;
+	page->sweptRecvBytes[index] = 0;
+	page->clients[index] = NULL;
+
+	m_FreeSlots.push_back(slot);
+	--m_NumConnections;
+}
+
+
+void ConnectionTable::FindLimited(vector<Client*>& limited)
+{
+	for(DWORD p = 0 ; p < m_NumPages ; ++p)
+	{
+		Page* page = m_Pages[p];
+
+		// Few are, so it's mostly telling 4 at a time that none of them is.
+		DWORD i = 0;
+		if(m_UseSimd)
+		{
+			for( ; i + 4 <= PAGE_SIZE ; i += 4)
+			{
+				__m128i flags = _mm_load_si128(reinterpret_cast<const __m128i*>(const_cast<DWORD*>(page->limited + i)));
+
+				int mask = _mm_movemask_ps(_mm_castsi128_ps(flags));
+				for(int bit = 0 ; mask != 0 ; ++bit, mask >>= 1)
+				{
+					if(mask & 1)
+					{
+						limited.push_back(page->clients[i + bit]);
+					}
+				}
+			}
+		}
+
+		for( ; i < PAGE_SIZE ; ++i)
+		{
+			if(page->limited[i] != 0)
+			{
+				limited.push_back(page->clients[i]);
+			}
+		}
+	}
+}
+
+
+DWORD ConnectionTable::ClassifyBulk(ULONGLONG bytesPerSweep)
+{
+	DWORD numBulk = 0;
+
+	// Free slots are 0 in both, so whole pages are run through.
+	for(DWORD p = 0 ; p < m_NumPages ; ++p)
+	{
+		Page* page = m_Pages[p];
+
+		for(DWORD i = 0 ; i < PAGE_SIZE ; ++i)
+		{
+			ULONGLONG recvBytes = page->recvBytes[i];
+			bool bulk = recvBytes - page->sweptRecvBytes[i] > bytesPerSweep;
+
+			page->bulk[i] = bulk ? 0xFFFFFFFF : 0;
+			page->sweptRecvBytes[i] = recvBytes;
+			numBulk += bulk ? 1 : 0;
+		}
+	}
+
+	return numBulk;
+}
+
+
+void ConnectionTable::FindIdle(DWORD now, DWORD idleMs, vector<Client*>& idle)
+{
+	// Unsigned compares of SSE2 are signed ones with the sign bits flipped.
+	const __m128i sign = _mm_set1_epi32(0x80000000);
+	const __m128i nows = _mm_set1_epi32(static_cast<int>(now));
+	const __m128i limit = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(idleMs)), sign);
+
+	for(DWORD p = 0 ; p < m_NumPages ; ++p)
+	{
+		Page* page = m_Pages[p];
+
+		// Slots never given out are 0 in inUse, so whole pages are scanned.
+		DWORD i = 0;
+		if(m_UseSimd)
+		{
+			for( ; i + 4 <= PAGE_SIZE ; i += 4)
+			{
+				__m128i age = _mm_sub_epi32(nows, _mm_load_si128(reinterpret_cast<const __m128i*>(page->lastActivity + i)));
+				__m128i over = _mm_cmpgt_epi32(_mm_xor_si128(age, sign), limit);
+				over = _mm_and_si128(over, _mm_load_si128(reinterpret_cast<const __m128i*>(page->inUse + i)));
+
+				int mask = _mm_movemask_ps(_mm_castsi128_ps(over));
+				for(int bit = 0 ; mask != 0 ; ++bit, mask >>= 1)
+				{
+					if(mask & 1)
+					{
+						idle.push_back(page->clients[i + bit]);
+					}
+				}
+			}
+		}
+
+		for( ; i < PAGE_SIZE ; ++i)
+		{
+			if(page->inUse[i] != 0 && now - page->lastActivity[i] > idleMs)
+			{
+				idle.push_back(page->clients[i]);
+			}
+		}
+	}
+}
+
+
+void ConnectionTable::Sum(Totals& totals)
+{
+	totals.connections = m_NumConnections;
+	totals.recvBytes = 0;
+	totals.sentBytes = 0;
+
+	// Free slots are 0, so everything is added up.
+	for(DWORD p = 0 ; p < m_NumPages ; ++p)
+	{
+		Page* page = m_Pages[p];
+
+		DWORD i = 0;
+		if(m_UseSimd)
+		{
+			__m128i recvSum = _mm_setzero_si128();
+			__m128i sentSum = _mm_setzero_si128();
+
+			for( ; i + 2 <= PAGE_SIZE ; i += 2)
+			{
+				recvSum = _mm_add_epi64(recvSum, _mm_load_si128(reinterpret_cast<const __m128i*>(page->recvBytes + i)));
+				sentSum = _mm_add_epi64(sentSum, _mm_load_si128(reinterpret_cast<const __m128i*>(page->sentBytes + i)));
+			}
+
+			ULONGLONG lanes[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), recvSum);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 2), sentSum);
+
+			totals.recvBytes += lanes[0] + lanes[1];
+			totals.sentBytes += lanes[2] + lanes[3];
+		}
+
+		for( ; i < PAGE_SIZE ; ++i)
+		{
+			totals.recvBytes += page->recvBytes[i];
+			totals.sentBytes += page->sentBytes[i];
+		}
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+class Client;
+
+// What the periodic sweeps read of every client, as arrays indexed by slot (SoA), so that a sweep runs
+// through contiguous memory instead of chasing pointers into the client pool.
+// Slots are in pages of PAGE_SIZE that are never moved or freed until the table goes, so the I/O threads
+// can write the slots of their clients while pages are added.
+// Add(), Remove() and the sweeps are not thread-safe. Server calls them with m_CSForClients held.
+// OnRecv() and OnSend() are for the I/O callbacks of the slot's client. A sweep can see what they wrote a little late.
+class ConnectionTable
+{
+public:
+	enum
+	{
+		NO_SLOT = 0xFFFFFFFF,
+
+		PAGE_SIZE = 4096,
+		MAX_PAGES = 256, // 1M slots.
+	};
+
+	struct Totals
+	{
+		DWORD connections;
+		ULONGLONG recvBytes;
+		ULONGLONG sentBytes;
+	};
+
+public:
+	ConnectionTable();
+	~ConnectionTable();
+
+	// now is GetTickCount(). Returns NO_SLOT if all the slots are taken.
+	DWORD Add(Client* client, DWORD now);
+	void Remove(DWORD slot);
+
+	DWORD GetNumConnections() { return m_NumConnections; }
+
+	void OnRecv(DWORD slot, DWORD now, DWORD bytes)
+	{
+		Page* page = m_Pages[slot / PAGE_SIZE];
+		page->lastActivity[slot % PAGE_SIZE] = now;
+		page->recvBytes[slot % PAGE_SIZE] += bytes;
+	}
+
+	void OnSend(DWORD slot, DWORD now, DWORD bytes)
+	{
+		Page* page = m_Pages[slot / PAGE_SIZE];
+		page->lastActivity[slot % PAGE_SIZE] = now;
+		page->sentBytes[slot % PAGE_SIZE] += bytes;
+	}
+
+	// A client over its rate isn't read from. Set by its I/O callback, and cleared by the sweep that resumes it.
+	void SetLimited(DWORD slot, bool limited) { m_Pages[slot / PAGE_SIZE]->limited[slot % PAGE_SIZE] = limited ? 0xFFFFFFFF : 0; }
+	bool IsLimited(DWORD slot) { return m_Pages[slot / PAGE_SIZE]->limited[slot % PAGE_SIZE] != 0; }
+	void FindLimited(std::vector<Client*>& limited);
+
+	// Marks the clients that received more than bytesPerSweep since the last sweep as bulk senders, and unmarks
+	// the others. Returns how many are. Their packets wait in the bulk lane, whatever the opcode. See PacketLanes.
+	DWORD ClassifyBulk(ULONGLONG bytesPerSweep);
+	bool IsBulk(DWORD slot) { return m_Pages[slot / PAGE_SIZE]->bulk[slot % PAGE_SIZE] != 0; }
+
+	// Clients that have received and sent nothing for longer than idleMs.
+	// The ticks of GetTickCount() wrap around every 49 days, and that's allowed for.
+	void FindIdle(DWORD now, DWORD idleMs, std::vector<Client*>& idle);
+
+	// Bytes of the connections in the table.
+	void Sum(Totals& totals);
+
+	// SSE2 is on by default. Off is for comparing in benchmarks.
+	void EnableSimd(bool enable) { m_UseSimd = enable; }
+
+private:
+	// Arrays of a DWORD per slot come first so that they're 16-byte aligned for SSE2, like the page.
+	struct Page
+	{
+		DWORD lastActivity[PAGE_SIZE];	// GetTickCount() of the last recv or send.
+		DWORD inUse[PAGE_SIZE];			// all ones or 0, to mask a compare with.
+		volatile DWORD limited[PAGE_SIZE];	// all ones or 0.
+		volatile DWORD bulk[PAGE_SIZE];		// all ones or 0.
+		ULONGLONG recvBytes[PAGE_SIZE];
+		ULONGLONG sentBytes[PAGE_SIZE];
+		ULONGLONG sweptRecvBytes[PAGE_SIZE];	// recvBytes at the last ClassifyBulk().
+		Client* clients[PAGE_SIZE];
+	};
+
+private:
+	ConnectionTable(const ConnectionTable& rhs);
+	ConnectionTable& operator=(const ConnectionTable& rhs);
+
+private:
+	Page* m_Pages[MAX_PAGES];
+	DWORD m_NumPages;
+	DWORD m_NumSlots;	// given out so far, free or not.
+	std::vector<DWORD> m_FreeSlots;
+	DWORD m_NumConnections;
+	bool m_UseSimd;
+};
@@ -0,0 +1,155 @@
+#include "FrameDecoder.h"
+#include "BufferPool.h"
+
+#include "..\Protocol.h"
+
+#include <cassert>
+
+namespace
+{
+	DWORD GetFrameSize(const BYTE* header)
+	{
+		return reinterpret_cast<const Protocol::Header*>(header)->size + Protocol::HEADER_SIZE;
+	}
+}
+
+
+void FrameDecoder::Init()
+{
+	m_Buffer = NULL;
+	m_Capacity = 0;
+	m_Filled = 0;
+}
+
+
+void FrameDecoder::Reset()
+{
+	BufferPool::Free(m_Buffer);
+	Init();
+}
+
+
+FrameDecoder::Result FrameDecoder::Feed(const BYTE* data, DWORD size, FrameHandler handler, void* context)
+{
+	assert(handler);
+
+	while(size > 0)
+	{
+		if(m_Filled == 0)
+		{
+			// Fast path. Whole frames straight from the recv buffer.
+			if(size >= Protocol::HEADER_SIZE)
+			{
+				if(reinterpret_cast<const Protocol::Header*>(data)->size > Protocol::MAX_PAYLOAD_SIZE)
+				{
+					return FRAME_TOO_BIG;
+				}
+
+				DWORD frameSize = GetFrameSize(data);
+				if(size >= frameSize)
+				{
+					if(!handler(context, data, frameSize))
+					{
+						return ABORTED;
+					}
+
+					data += frameSize;
+					size -= frameSize;
+					continue;
+				}
+			}
+
+			// The rest waits for the next recv.
+			if(!Reserve(size < Protocol::HEADER_SIZE ? Protocol::HEADER_SIZE : GetFrameSize(data)))
+			{
+				return OUT_OF_MEMORY;
+			}
+
+			CopyMemory(m_Buffer, data, size);
+			m_Filled = size;
+			return OK;
+		}
+
+		// Complete the header first.
+		if(m_Filled < Protocol::HEADER_SIZE)
+		{
+			DWORD copy = Protocol::HEADER_SIZE - m_Filled;
+			if(copy > size) copy = size;
+
+			CopyMemory(m_Buffer + m_Filled, data, copy);
+			m_Filled += copy;
+			data += copy;
+			size -= copy;
+
+			if(m_Filled < Protocol::HEADER_SIZE)
+			{
+				return OK;
+			}
+
+			if(reinterpret_cast<const Protocol::Header*>(m_Buffer)->size > Protocol::MAX_PAYLOAD_SIZE)
+			{
+				return FRAME_TOO_BIG;
+			}
+
+			if(!Reserve(GetFrameSize(m_Buffer)))
+			{
+				return OUT_OF_MEMORY;
+			}
+		}
+
+		DWORD frameSize = GetFrameSize(m_Buffer);
+		DWORD copy = frameSize - m_Filled;
+		if(copy > size) copy = size;
+
+		CopyMemory(m_Buffer + m_Filled, data, copy);
+		m_Filled += copy;
+		data += copy;
+		size -= copy;
+
+		if(m_Filled == frameSize)
+		{
+			m_Filled = 0;
+
+			bool handled = handler(context, m_Buffer, frameSize);
+
+			// Don't let one big message pin its buffer for the life of the connection.
+			if(m_Capacity > KEEP_BUFFER_SIZE)
+			{
+				Reset();
+			}
+
+			if(!handled)
+			{
+				return ABORTED;
+			}
+		}
+	}
+
+	return OK;
+}
+
+
+bool FrameDecoder::Reserve(DWORD size)
+{
+	if(size <= m_Capacity)
+	{
+		return true;
+	}
+
+	BYTE* buffer = BufferPool::Alloc(size);
+	if(buffer == NULL)
+	{
+		return false;
+	}
+
+	if(m_Filled > 0)
+	{
+		CopyMemory(buffer, m_Buffer, m_Filled);
+	}
+
+	BufferPool::Free(m_Buffer);
+	m_Buffer = buffer;
+	m_Capacity = BufferPool::GetCapacity(buffer);
+
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <Windows.h>
+
+// Splits a TCP byte stream into Protocol frames.
+// Frames that arrive whole are handed out straight from the recv buffer.
+// A frame split across recvs is gathered in a buffer from BufferPool first.
+class FrameDecoder
+{
+public:
+	enum
+	{
+		// A gathering buffer bigger than this is given back after its frame is done.
+		KEEP_BUFFER_SIZE = 4 * 1024,
+	};
+
+	enum Result
+	{
+		OK,
+		FRAME_TOO_BIG,
+		OUT_OF_MEMORY,
+		ABORTED,		// the handler returned false.
+	};
+
+	// frame points at the Header. size includes the header.
+	typedef bool (*FrameHandler)(void* context, const BYTE* frame, DWORD size);
+
+public:
+	// No constructor so that it can live in pooled objects. Call Init() before use.
+	void Init();
+	void Reset();
+
+	Result Feed(const BYTE* data, DWORD size, FrameHandler handler, void* context);
+
+	DWORD GetPendingBytes() { return m_Filled; }
+
+private:
+	bool Reserve(DWORD size);
+
+private:
+	BYTE* m_Buffer;
+	DWORD m_Capacity;
+	DWORD m_Filled;
+};
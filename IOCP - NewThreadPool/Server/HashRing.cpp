@@ -0,0 +1,76 @@
+#include "HashRing.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+
+HashRing::HashRing()
+{
+}
+
+
+void HashRing::AddNode(DWORD node)
+{
+	assert(node != NO_NODE);
+
+	RemoveNode(node);
+
+	for(DWORD i = 0 ; i < VIRTUAL_NODES ; ++i)
+	{
+		Point point;
+		point.hash = Hash(Hash(node) + i);
+		point.node = node;
+
+		m_Points.push_back(point);
+	}
+
+	sort(m_Points.begin(), m_Points.end());
+}
+
+
+void HashRing::RemoveNode(DWORD node)
+{
+	vector<Point>::iterator end = m_Points.begin();
+	for(vector<Point>::iterator itor = m_Points.begin() ; itor != m_Points.end() ; ++itor)
+	{
+		if(itor->node != node)
+		{
+			*end++ = *itor;
+		}
+	}
+
+	m_Points.erase(end, m_Points.end());
+}
+
+
+DWORD HashRing::GetNode(DWORD key) const
+{
+	if(m_Points.empty())
+	{
+		return NO_NODE;
+	}
+
+	Point point;
+	point.hash = Hash(key);
+	point.node = 0;
+
+	vector<Point>::const_iterator itor = lower_bound(m_Points.begin(), m_Points.end(), point);
+
+	// Past the last point is the first one again.
+	return itor != m_Points.end() ? itor->node : m_Points.front().node;
+}
+
+
+/* static */ DWORD HashRing::Hash(DWORD value)
+{
+	// The finalizer of MurmurHash3.
+	value ^= value >> 16;
+	value *= 0x85EBCA6B;
+	value ^= value >> 13;
+	value *= 0xC2B2AE35;
+	value ^= value >> 16;
+
+	return value;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+// Consistent hashing of keys to nodes. Each node has VIRTUAL_NODES points on a ring of 32-bit hashes,
+// and a key belongs to the node of the first point at or after the key's hash.
+// When a node comes or goes, only the keys next to its points move, about 1/N of them.
+// Every process that builds a ring of the same nodes agrees on every key. Not thread-safe.
+class HashRing
+{
+public:
+	enum
+	{
+		VIRTUAL_NODES = 128,
+		NO_NODE = 0xFFFFFFFF,
+	};
+
+public:
+	HashRing();
+
+	void AddNode(DWORD node);
+	void RemoveNode(DWORD node);
+
+	// NO_NODE if there are no nodes.
+	DWORD GetNode(DWORD key) const;
+
+	bool IsEmpty() const { return m_Points.empty(); }
+
+	// A 32-bit mix in which every bit of value changes about half of the bits.
+	static DWORD Hash(DWORD value);
+
+private:
+	struct Point
+	{
+		DWORD hash;
+		DWORD node;
+
+		// Points of two nodes on the same hash are ordered by node, so that every process picks the same one.
+		bool operator<(const Point& rhs) const { return hash < rhs.hash || (hash == rhs.hash && node < rhs.node); }
+	};
+
+private:
+	std::vector<Point> m_Points; // by hash.
+};
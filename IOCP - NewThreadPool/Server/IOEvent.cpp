@@ -1,10 +1,11 @@
 #include "IOEvent.h"
 #include "Client.h"
 #include "Packet.h"
+#include "CacheLine.h"
 
 #include <boost/pool/singleton_pool.hpp>
 
-typedef boost::singleton_pool<IOEvent, sizeof(IOEvent)> IOEventPool;
+typedef boost::singleton_pool<IOEvent, sizeof(IOEvent), CacheLineAllocator> IOEventPool;
 
 /* static */ IOEvent* IOEvent::Create(Type type, Client* client, Packet* packet)
 {
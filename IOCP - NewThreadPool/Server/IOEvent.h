@@ -1,15 +1,18 @@
 #pragma once
 #include <winsock2.h>
+#include "CacheLine.h"
 
 class Client;
 class Packet;
 
-class IOEvent
+// On lines of its own, so that the completions of neighbours in the pool on other threads don't take them from each other.
+class __declspec(align(CACHE_LINE_SIZE)) IOEvent
 {
 public:
 	enum Type
 	{
 		ACCEPT,
+		CONNECT,	// to the backend in MODE_PROXY.
 		RECV,
 		SEND,
 	};
@@ -22,8 +25,18 @@ public:
 	Type GetType() { return m_Type; }
 	Client* GetClient() { return m_Client; }
 	Packet* GetPacket() { return m_Packet; }
+	// Only for swapping the packet of a queued send.
+	void SetPacket(Packet* packet) { m_Packet = packet; }
 	OVERLAPPED& GetOverlapped() { return m_Overlapped; }
 
+	// Links sends waiting in a client's send queue.
+	IOEvent* GetNext() { return m_Next; }
+	void SetNext(IOEvent* next) { m_Next = next; }
+
+	// When the operation was posted, in microseconds.
+	ULONGLONG GetPostTime() { return m_PostTime; }
+	void SetPostTime(ULONGLONG time) { m_PostTime = time; }
+
 private:
 	IOEvent();
 	~IOEvent();
@@ -31,8 +44,11 @@ private:
 	IOEvent(const IOEvent& rhs);
 
 private:
+	// What every completion reads, right after the OVERLAPPED. The rest is for sends.
 	OVERLAPPED m_Overlapped;
 	Client* m_Client;
-	Packet* m_Packet; // only for sending.
 	Type m_Type;
-};
\ No newline at end of file
+	Packet* m_Packet;
+	IOEvent* m_Next;
+	ULONGLONG m_PostTime;
+};
@@ -0,0 +1,432 @@
+#include "InterestGrid.h"
+#include "Packet.h"
+
+#include "..\Log.h"
+#include "..\Clock.h"
+#include "..\Protocol.h"
+#include "..\Messages.h"
+
+#include <emmintrin.h>
+#include <cassert>
+
+using namespace std;
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+InterestGrid::InterestGrid(float worldSize, float cellSize, float viewRadius)
+: m_WorldSize(worldSize),
+  m_CellSize(cellSize),
+  m_InvCellSize(1.0f / cellSize),
+  m_ViewRadius(viewRadius),
+  m_UseSimd(true)
+{
+	assert(worldSize > 0.0f);
+	assert(cellSize > 0.0f);
+
+	m_CellsPerSide = static_cast<DWORD>(worldSize / cellSize);
+	if(m_CellsPerSide * cellSize < worldSize)
+	{
+		++m_CellsPerSide;
+	}
+
+	m_CellStart.assign(m_CellsPerSide * m_CellsPerSide + 1, 0);
+	m_CellPackets.assign(m_CellsPerSide * m_CellsPerSide, static_cast<Packet*>(NULL));
+}
+
+
+InterestGrid::~InterestGrid()
+{
+}
+
+
+DWORD InterestGrid::AddEntity(float x, float y, Client* observer)
+{
+	Clamp(x, y);
+
+	DWORD id = 0;
+	if(!m_FreeIds.empty())
+	{
+		id = m_FreeIds.back();
+		m_FreeIds.pop_back();
+	}
+	else
+	{
+		id = static_cast<DWORD>(m_IndexOfId.size());
+		m_IndexOfId.push_back(INVALID_ENTITY);
+	}
+
+	m_IndexOfId[id] = static_cast<DWORD>(m_X.size());
+
+	m_X.push_back(x);
+	m_Y.push_back(y);
+	m_Ids.push_back(id);
+	m_Owners.push_back(observer);
+
+	return id;
+}
+
+
+void InterestGrid::RemoveEntity(DWORD id)
+{
+	assert(id < m_IndexOfId.size());
+
+	DWORD index = m_IndexOfId[id];
+	assert(index != INVALID_ENTITY);
+
+	// Fill the hole with the last one.
+	DWORD last = static_cast<DWORD>(m_X.size()) - 1;
+	if(index != last)
+	{
+		m_X[index] = m_X[last];
+		m_Y[index] = m_Y[last];
+		m_Ids[index] = m_Ids[last];
+		m_Owners[index] = m_Owners[last];
+		m_IndexOfId[m_Ids[index]] = index;
+	}
+
+	m_X.pop_back();
+	m_Y.pop_back();
+	m_Ids.pop_back();
+	m_Owners.pop_back();
+
+	m_IndexOfId[id] = INVALID_ENTITY;
+	m_FreeIds.push_back(id);
+}
+
+
+void InterestGrid::MoveEntity(DWORD id, float x, float y)
+{
+	assert(id < m_IndexOfId.size());
+
+	DWORD index = m_IndexOfId[id];
+	assert(index != INVALID_ENTITY);
+
+	Clamp(x, y);
+
+	m_X[index] = x;
+	m_Y[index] = y;
+}
+
+
+void InterestGrid::GetPosition(DWORD id, float& x, float& y)
+{
+	assert(id < m_IndexOfId.size());
+
+	DWORD index = m_IndexOfId[id];
+	assert(index != INVALID_ENTITY);
+
+	x = m_X[index];
+	y = m_Y[index];
+}
+
+
+void InterestGrid::Query(float x, float y, float radius, vector<DWORD>& ids)
+{
+	ids.clear();
+
+	if(m_SortedX.empty())
+	{
+		return;
+	}
+
+	float radiusSq = radius * radius;
+
+	DWORD minCell = GetCell(x - radius, y - radius);
+	DWORD maxCell = GetCell(x + radius, y + radius);
+
+	const float* xs = &m_SortedX[0];
+	const float* ys = &m_SortedY[0];
+
+	for(DWORD cy = minCell / m_CellsPerSide ; cy <= maxCell / m_CellsPerSide ; ++cy)
+	{
+		for(DWORD cx = minCell % m_CellsPerSide ; cx <= maxCell % m_CellsPerSide ; ++cx)
+		{
+			DWORD cell = cy * m_CellsPerSide + cx;
+			DWORD i = m_CellStart[cell];
+			DWORD end = m_CellStart[cell + 1];
+
+			if(m_UseSimd)
+			{
+				__m128 px = _mm_set1_ps(x);
+				__m128 py = _mm_set1_ps(y);
+				__m128 r = _mm_set1_ps(radiusSq);
+
+				for( ; i + 4 <= end ; i += 4)
+				{
+					__m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), px);
+					__m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), py);
+					__m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+					int mask = _mm_movemask_ps(_mm_cmple_ps(distSq, r));
+					for(int bit = 0 ; mask != 0 ; ++bit, mask >>= 1)
+					{
+						if(mask & 1)
+						{
+							ids.push_back(m_SortedIds[i + bit]);
+						}
+					}
+				}
+			}
+
+			for( ; i < end ; ++i)
+			{
+				float dx = xs[i] - x;
+				float dy = ys[i] - y;
+				if(dx * dx + dy * dy <= radiusSq)
+				{
+					ids.push_back(m_SortedIds[i]);
+				}
+			}
+		}
+	}
+}
+
+
+void InterestGrid::Tick(DeliverFunc deliver, void* context, TickStats* stats, DWORD tick)
+{
+	assert(deliver);
+
+	TickStats local;
+	ZeroMemory(&local, sizeof(local));
+
+	ULONGLONG start = Clock::GetMicroseconds();
+
+	SortIntoCells();
+
+	ULONGLONG sorted = Clock::GetMicroseconds();
+
+	float radius = m_ViewRadius;
+	float radiusSq = radius * radius;
+
+	DWORD numEntities = static_cast<DWORD>(m_X.size());
+	for(DWORD i = 0 ; i < numEntities ; ++i)
+	{
+		Client* observer = m_Owners[i];
+		if(observer == NULL)
+		{
+			continue;
+		}
+
+		++local.observers;
+
+		float x = m_X[i];
+		float y = m_Y[i];
+
+		DWORD minCell = GetCell(x - radius, y - radius);
+		DWORD maxCell = GetCell(x + radius, y + radius);
+
+		for(DWORD cy = minCell / m_CellsPerSide ; cy <= maxCell / m_CellsPerSide ; ++cy)
+		{
+			for(DWORD cx = minCell % m_CellsPerSide ; cx <= maxCell % m_CellsPerSide ; ++cx)
+			{
+				DWORD cell = cy * m_CellsPerSide + cx;
+				if(m_CellStart[cell] == m_CellStart[cell + 1])
+				{
+					continue;
+				}
+
+				float minX = cx * m_CellSize - x;
+				float maxX = minX + m_CellSize;
+				float minY = cy * m_CellSize - y;
+				float maxY = minY + m_CellSize;
+
+				// The nearest point of the cell decides if it can be seen at all,
+				// and the farthest one if all of its entities are seen without looking at them.
+				float nearX = minX > 0.0f ? minX : (maxX < 0.0f ? -maxX : 0.0f);
+				float nearY = minY > 0.0f ? minY : (maxY < 0.0f ? -maxY : 0.0f);
+				if(nearX * nearX + nearY * nearY > radiusSq)
+				{
+					continue;
+				}
+
+				float farX = -minX > maxX ? -minX : maxX;
+				float farY = -minY > maxY ? -minY : maxY;
+				if(farX * farX + farY * farY > radiusSq && !AnyInRange(cell, x, y, radiusSq))
+				{
+					continue;
+				}
+
+				Packet* packet = GetCellPacket(cell, tick, local);
+				if(packet == NULL)
+				{
+					continue;
+				}
+
+				deliver(context, observer, packet);
+
+				++local.deliveries;
+				local.sentBytes += packet->GetSize();
+			}
+		}
+	}
+
+	// Observers hold their own references now.
+	for(size_t cell = 0 ; cell < m_CellPackets.size() ; ++cell)
+	{
+		if(m_CellPackets[cell] != NULL)
+		{
+			Packet::Destroy(m_CellPackets[cell]);
+			m_CellPackets[cell] = NULL;
+		}
+	}
+
+	local.entities = numEntities;
+	local.sortTime = sorted - start;
+	local.interestTime = Clock::GetMicroseconds() - sorted;
+
+	if(stats != NULL)
+	{
+		*stats = local;
+	}
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+DWORD InterestGrid::GetCell(float x, float y)
+{
+	DWORD cx = x > 0.0f ? static_cast<DWORD>(x * m_InvCellSize) : 0;
+	DWORD cy = y > 0.0f ? static_cast<DWORD>(y * m_InvCellSize) : 0;
+
+	if(cx >= m_CellsPerSide) cx = m_CellsPerSide - 1;
+	if(cy >= m_CellsPerSide) cy = m_CellsPerSide - 1;
+
+	return cy * m_CellsPerSide + cx;
+}
+
+
+void InterestGrid::Clamp(float& x, float& y)
+{
+	if(!(x > 0.0f)) x = 0.0f;	// NaN too.
+	if(!(y > 0.0f)) y = 0.0f;
+	if(x > m_WorldSize) x = m_WorldSize;
+	if(y > m_WorldSize) y = m_WorldSize;
+}
+
+
+void InterestGrid::SortIntoCells()
+{
+	DWORD numCells = m_CellsPerSide * m_CellsPerSide;
+	DWORD numEntities = static_cast<DWORD>(m_X.size());
+
+	m_CellStart.assign(numCells + 1, 0);
+	m_CellOfEntity.resize(numEntities);
+
+	for(DWORD i = 0 ; i < numEntities ; ++i)
+	{
+		DWORD cell = GetCell(m_X[i], m_Y[i]);
+		m_CellOfEntity[i] = cell;
+		++m_CellStart[cell + 1];
+	}
+
+	for(DWORD cell = 0 ; cell < numCells ; ++cell)
+	{
+		m_CellStart[cell + 1] += m_CellStart[cell];
+	}
+
+	m_SortedX.resize(numEntities);
+	m_SortedY.resize(numEntities);
+	m_SortedIds.resize(numEntities);
+
+	// m_CellStart[cell] walks to the end of the cell here, which is where the next cell starts.
+	for(DWORD i = 0 ; i < numEntities ; ++i)
+	{
+		DWORD pos = m_CellStart[m_CellOfEntity[i]]++;
+		m_SortedX[pos] = m_X[i];
+		m_SortedY[pos] = m_Y[i];
+		m_SortedIds[pos] = m_Ids[i];
+	}
+
+	for(DWORD cell = numCells ; cell > 0 ; --cell)
+	{
+		m_CellStart[cell] = m_CellStart[cell - 1];
+	}
+	m_CellStart[0] = 0;
+}
+
+
+bool InterestGrid::AnyInRange(DWORD cell, float x, float y, float radiusSq)
+{
+	DWORD i = m_CellStart[cell];
+	DWORD end = m_CellStart[cell + 1];
+
+	const float* xs = &m_SortedX[0];
+	const float* ys = &m_SortedY[0];
+
+	if(m_UseSimd)
+	{
+		__m128 px = _mm_set1_ps(x);
+		__m128 py = _mm_set1_ps(y);
+		__m128 r = _mm_set1_ps(radiusSq);
+
+		for( ; i + 4 <= end ; i += 4)
+		{
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), px);
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), py);
+			__m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+			if(_mm_movemask_ps(_mm_cmple_ps(distSq, r)) != 0)
+			{
+				return true;
+			}
+		}
+	}
+
+	for( ; i < end ; ++i)
+	{
+		float dx = xs[i] - x;
+		float dy = ys[i] - y;
+		if(dx * dx + dy * dy <= radiusSq)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+Packet* InterestGrid::GetCellPacket(DWORD cell, DWORD tick, TickStats& stats)
+{
+	if(m_CellPackets[cell] != NULL)
+	{
+		return m_CellPackets[cell];
+	}
+
+	DWORD begin = m_CellStart[cell];
+	DWORD count = m_CellStart[cell + 1] - begin;
+	DWORD size = Messages::EntityUpdatesBuilder::GetFrameSize(count);
+
+	Packet* packet = Packet::Create(NULL, NULL, size);
+	if(packet == NULL)
+	{
+		ERROR_MSG("Could not allocate a packet of %d bytes for cell %d.", size, cell);
+		return NULL;
+	}
+
+	Messages::EntityUpdatesBuilder builder(packet->GetData(), count);
+	if(tick != NO_TICK)
+	{
+		builder.SetTick(tick);
+	}
+
+	for(DWORD i = 0 ; i < count ; ++i)
+	{
+		Messages::EntityUpdate update;
+		update.id = m_SortedIds[begin + i];
+		update.x = m_SortedX[begin + i];
+		update.y = m_SortedY[begin + i];
+		builder.SetEntities(i, update);
+	}
+
+	// A newer update of the cell has every entity of the older one that's still in it.
+	packet->SetCoalesceKey(Packet::MakeCoalesceKey(Packet::COALESCE_CELL, cell));
+
+	m_CellPackets[cell] = packet;
+
+	++stats.cellPackets;
+	stats.packetBytes += size;
+
+	return packet;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+class Client;
+class Packet;
+
+// Area of interest for position updates.
+// The world is a square split into square cells. Entities are kept as arrays of x, y, id and owner (SoA),
+// and every tick they are sorted into their cells so that the positions of a cell are contiguous.
+// An entity owned by a client is an observer. It is sent the updates of every cell that has an entity in its view radius.
+// All the observers of a cell share one packet of its updates.
+class InterestGrid
+{
+public:
+	enum
+	{
+		INVALID_ENTITY = 0xFFFFFFFF,
+		NO_TICK = 0xFFFFFFFF,
+	};
+
+	// Same as PubSub. deliver has to take its own reference of the packet.
+	typedef void (*DeliverFunc)(void* context, Client* client, Packet* packet);
+
+	struct TickStats
+	{
+		DWORD entities;
+		DWORD observers;
+		DWORD cellPackets;		// packets built, one per visible cell.
+		DWORD deliveries;		// packets handed to deliver.
+		ULONGLONG packetBytes;	// bytes of the packets built.
+		ULONGLONG sentBytes;	// bytes of the packets delivered.
+
+		// Microseconds
+		ULONGLONG sortTime;
+		ULONGLONG interestTime;
+	};
+
+public:
+	InterestGrid(float worldSize, float cellSize, float viewRadius);
+	~InterestGrid();
+
+	// Positions are clamped into the world. observer can be NULL for entities nobody owns.
+	DWORD AddEntity(float x, float y, Client* observer);
+	void RemoveEntity(DWORD id);
+	void MoveEntity(DWORD id, float x, float y);
+	void GetPosition(DWORD id, float& x, float& y);
+
+	// Ids of the entities within radius of (x, y), as of the last Tick().
+	void Query(float x, float y, float radius, std::vector<DWORD>& ids);
+
+	// Sorts the entities into cells and delivers the cell updates to the observers.
+	// tick goes in the updates unless it's NO_TICK.
+	void Tick(DeliverFunc deliver, void* context, TickStats* stats, DWORD tick = NO_TICK);
+
+	// Only sorts the entities into cells, for Query().
+	void Update() { SortIntoCells(); }
+
+	DWORD GetNumEntities() { return static_cast<DWORD>(m_X.size()); }
+
+	// SSE2 is on by default. Off is for comparing in benchmarks.
+	void EnableSimd(bool enable) { m_UseSimd = enable; }
+
+private:
+	DWORD GetCell(float x, float y);
+	void Clamp(float& x, float& y);
+
+	// Sorts entity indices by cell (counting sort) and copies their positions in that order.
+	void SortIntoCells();
+
+	// Whether any entity of the cell is within radius. Entities of a cell are [m_CellStart[cell], m_CellStart[cell + 1]).
+	bool AnyInRange(DWORD cell, float x, float y, float radiusSq);
+	Packet* GetCellPacket(DWORD cell, DWORD tick, TickStats& stats);
+
+private:
+	InterestGrid(const InterestGrid& rhs);
+	InterestGrid& operator=(const InterestGrid& rhs);
+
+private:
+	float m_WorldSize;
+	float m_CellSize;
+	float m_InvCellSize;
+	float m_ViewRadius;
+	DWORD m_CellsPerSide;
+	bool m_UseSimd;
+
+	// Entities, densely packed. An entity is moved into the hole when another is removed.
+	std::vector<float> m_X;
+	std::vector<float> m_Y;
+	std::vector<DWORD> m_Ids;
+	std::vector<Client*> m_Owners;
+
+	// Id to index into the arrays above. Free ids are reused.
+	std::vector<DWORD> m_IndexOfId;
+	std::vector<DWORD> m_FreeIds;
+
+	// Built by SortIntoCells(). Sorted by cell.
+	std::vector<DWORD> m_CellStart;		// m_CellsPerSide^2 + 1 entries
+	std::vector<float> m_SortedX;
+	std::vector<float> m_SortedY;
+	std::vector<DWORD> m_SortedIds;
+	std::vector<DWORD> m_CellOfEntity;
+
+	// Built on demand in Tick(). NULL for cells nobody sees.
+	std::vector<Packet*> m_CellPackets;
+};
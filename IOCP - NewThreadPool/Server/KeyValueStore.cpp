@@ -0,0 +1,474 @@
+#include "KeyValueStore.h"
+
+#include "..\Log.h"
+
+#include <cassert>
+#include <new>
+
+using namespace std;
+
+
+namespace
+{
+	const LONGLONG MAX_INTEGER = 0x7FFFFFFFFFFFFFFFLL;
+	const ULONGLONG MAX_NEGATIVE_MAGNITUDE = 0x8000000000000000ULL;
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+KeyValueStore::Arena::Arena()
+: m_Cursor(NULL),
+  m_Left(0)
+{
+	ZeroMemory(m_FreeLists, sizeof(m_FreeLists));
+}
+
+
+KeyValueStore::Arena::~Arena()
+{
+	for(size_t i = 0 ; i < m_Chunks.size() ; ++i)
+	{
+		VirtualFree(m_Chunks[i], 0, MEM_RELEASE);
+	}
+}
+
+
+BYTE* KeyValueStore::Arena::Alloc(DWORD size, DWORD& sizeClass)
+{
+	if(size > CHUNK_SIZE)
+	{
+		return NULL;
+	}
+
+	sizeClass = 0;
+	while(GetClassSize(sizeClass) < size)
+	{
+		++sizeClass;
+	}
+
+	if(m_FreeLists[sizeClass] != NULL)
+	{
+		BYTE* block = m_FreeLists[sizeClass];
+		m_FreeLists[sizeClass] = *reinterpret_cast<BYTE**>(block);
+		return block;
+	}
+
+	DWORD classSize = GetClassSize(sizeClass);
+	if(m_Left < classSize)
+	{
+		BYTE* chunk = static_cast<BYTE*>(VirtualAlloc(NULL, CHUNK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+		if(chunk == NULL)
+		{
+			return NULL;
+		}
+		m_Chunks.push_back(chunk);
+
+		// The rest of the last chunk isn't wasted. It's cut into the biggest blocks that fit.
+		for(int c = NUM_CLASSES - 1 ; c >= 0 && m_Left > 0 ; --c)
+		{
+			while(m_Left >= GetClassSize(c))
+			{
+				Free(m_Cursor, c);
+				m_Cursor += GetClassSize(c);
+				m_Left -= GetClassSize(c);
+			}
+		}
+
+		m_Cursor = chunk;
+		m_Left = CHUNK_SIZE;
+	}
+
+	BYTE* block = m_Cursor;
+	m_Cursor += classSize;
+	m_Left -= classSize;
+
+	return block;
+}
+
+
+void KeyValueStore::Arena::Free(BYTE* block, DWORD sizeClass)
+{
+	assert(sizeClass < NUM_CLASSES);
+
+	*reinterpret_cast<BYTE**>(block) = m_FreeLists[sizeClass];
+	m_FreeLists[sizeClass] = block;
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+KeyValueStore::KeyValueStore()
+{
+	for(DWORD i = 0 ; i < NUM_SHARDS ; ++i)
+	{
+		Shard* shard = new Shard;
+		InitializeCriticalSection(&shard->cs);
+		shard->slots = new Slot[INITIAL_SLOTS];
+		ZeroMemory(shard->slots, sizeof(Slot) * INITIAL_SLOTS);
+		shard->mask = INITIAL_SLOTS - 1;
+		shard->count = 0;
+		shard->recordBytes = 0;
+
+		m_Shards[i] = shard;
+	}
+}
+
+
+KeyValueStore::~KeyValueStore()
+{
+	// Records go with the arenas.
+	for(DWORD i = 0 ; i < NUM_SHARDS ; ++i)
+	{
+		DeleteCriticalSection(&m_Shards[i]->cs);
+		delete [] m_Shards[i]->slots;
+		delete m_Shards[i];
+	}
+}
+
+
+bool KeyValueStore::Get(const BYTE* key, DWORD keySize, ValueFunc func, void* context)
+{
+	DWORD hash = Hash(key, keySize);
+	Shard& shard = GetShard(hash);
+
+	EnterCriticalSection(&shard.cs);
+
+	Record* record = shard.slots[Find(shard, hash, key, keySize)].record;
+	if(record != NULL)
+	{
+		func(context, GetValue(record), record->valueSize);
+	}
+
+	LeaveCriticalSection(&shard.cs);
+
+	return record != NULL;
+}
+
+
+bool KeyValueStore::Set(const BYTE* key, DWORD keySize, const BYTE* value, DWORD valueSize)
+{
+	DWORD hash = Hash(key, keySize);
+	Shard& shard = GetShard(hash);
+
+	EnterCriticalSection(&shard.cs);
+
+	bool stored = Store(shard, Find(shard, hash, key, keySize), hash, key, keySize, value, valueSize);
+
+	LeaveCriticalSection(&shard.cs);
+
+	return stored;
+}
+
+
+bool KeyValueStore::Delete(const BYTE* key, DWORD keySize)
+{
+	DWORD hash = Hash(key, keySize);
+	Shard& shard = GetShard(hash);
+
+	EnterCriticalSection(&shard.cs);
+
+	DWORD index = Find(shard, hash, key, keySize);
+	bool found = shard.slots[index].record != NULL;
+	if(found)
+	{
+		Remove(shard, index);
+	}
+
+	LeaveCriticalSection(&shard.cs);
+
+	return found;
+}
+
+
+KeyValueStore::IncrementResult KeyValueStore::Increment(const BYTE* key, DWORD keySize, LONGLONG delta, LONGLONG& result)
+{
+	DWORD hash = Hash(key, keySize);
+	Shard& shard = GetShard(hash);
+
+	EnterCriticalSection(&shard.cs);
+
+	IncrementResult incrementResult = INCREMENT_OK;
+
+	DWORD index = Find(shard, hash, key, keySize);
+	Record* record = shard.slots[index].record;
+
+	LONGLONG value = 0;
+	if(record != NULL && !ParseInteger(GetValue(record), record->valueSize, value))
+	{
+		incrementResult = INCREMENT_NOT_INTEGER;
+	}
+	else if((delta > 0 && value > MAX_INTEGER - delta) || (delta < 0 && value < -MAX_INTEGER - 1 - delta))
+	{
+		incrementResult = INCREMENT_OVERFLOW;
+	}
+	else
+	{
+		result = value + delta;
+
+		char text[21];
+		DWORD size = FormatInteger(result, text);
+		if(!Store(shard, index, hash, key, keySize, reinterpret_cast<const BYTE*>(text), size))
+		{
+			incrementResult = INCREMENT_OUT_OF_MEMORY;
+		}
+	}
+
+	LeaveCriticalSection(&shard.cs);
+
+	return incrementResult;
+}
+
+
+void KeyValueStore::GetStats(Stats& stats)
+{
+	ZeroMemory(&stats, sizeof(stats));
+
+	for(DWORD i = 0 ; i < NUM_SHARDS ; ++i)
+	{
+		Shard& shard = *m_Shards[i];
+
+		EnterCriticalSection(&shard.cs);
+		stats.keys += shard.count;
+		stats.recordBytes += shard.recordBytes;
+		stats.arenaBytes += shard.arena.GetReservedBytes();
+		LeaveCriticalSection(&shard.cs);
+	}
+}
+
+
+/* static */ bool KeyValueStore::ParseInteger(const BYTE* text, DWORD size, LONGLONG& value)
+{
+	// Same as Redis : no sign but '-', no spaces, and no leading zeros.
+	if(size == 0 || size > 20)
+	{
+		return false;
+	}
+
+	bool negative = text[0] == '-';
+	DWORD i = negative ? 1 : 0;
+	if(i == size || text[i] < '0' || text[i] > '9' || (text[i] == '0' && size > i + 1))
+	{
+		return false;
+	}
+
+	ULONGLONG magnitude = 0;
+	for( ; i < size ; ++i)
+	{
+		if(text[i] < '0' || text[i] > '9')
+		{
+			return false;
+		}
+
+		DWORD digit = text[i] - '0';
+		if(magnitude > (MAX_NEGATIVE_MAGNITUDE - digit) / 10)
+		{
+			return false;
+		}
+		magnitude = magnitude * 10 + digit;
+	}
+
+	if(negative)
+	{
+		value = static_cast<LONGLONG>(0 - magnitude);
+		return true;
+	}
+
+	if(magnitude > static_cast<ULONGLONG>(MAX_INTEGER))
+	{
+		return false;
+	}
+
+	value = static_cast<LONGLONG>(magnitude);
+	return true;
+}
+
+
+/* static */ DWORD KeyValueStore::FormatInteger(LONGLONG value, char* buffer)
+{
+	// Unsigned, so that the most negative value has a magnitude too.
+	ULONGLONG magnitude = value < 0 ? 0 - static_cast<ULONGLONG>(value) : static_cast<ULONGLONG>(value);
+
+	char digits[20];
+	DWORD numDigits = 0;
+	do
+	{
+		digits[numDigits++] = static_cast<char>('0' + magnitude % 10);
+		magnitude /= 10;
+	}
+	while(magnitude > 0);
+
+	DWORD size = 0;
+	if(value < 0)
+	{
+		buffer[size++] = '-';
+	}
+	while(numDigits > 0)
+	{
+		buffer[size++] = digits[--numDigits];
+	}
+
+	return size;
+}
+
+
+/* static */ DWORD KeyValueStore::Hash(const BYTE* key, DWORD keySize)
+{
+	// FNV-1a, then the finalizer of MurmurHash3 so that the high bits that pick the shard are mixed too.
+	DWORD hash = 2166136261U;
+	for(DWORD i = 0 ; i < keySize ; ++i)
+	{
+		hash = (hash ^ key[i]) * 16777619U;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6B;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+
+/* static */ DWORD KeyValueStore::Find(Shard& shard, DWORD hash, const BYTE* key, DWORD keySize)
+{
+	// The table is never full, so there's always an empty slot to stop at.
+	DWORD index = hash & shard.mask;
+	for(;;)
+	{
+		const Slot& slot = shard.slots[index];
+		if(slot.record == NULL)
+		{
+			return index;
+		}
+
+		if(slot.hash == hash && slot.record->keySize == keySize && memcmp(GetKey(slot.record), key, keySize) == 0)
+		{
+			return index;
+		}
+
+		index = (index + 1) & shard.mask;
+	}
+}
+
+
+/* static */ bool KeyValueStore::Store(Shard& shard, DWORD index, DWORD hash, const BYTE* key, DWORD keySize, const BYTE* value, DWORD valueSize)
+{
+	Slot& slot = shard.slots[index];
+	DWORD size = sizeof(Record) + keySize + valueSize;
+
+	// The block of the old value may have room for the new one.
+	if(slot.record != NULL && size <= Arena::GetClassSize(slot.record->sizeClass))
+	{
+		shard.recordBytes -= slot.record->keySize + slot.record->valueSize;
+		shard.recordBytes += keySize + valueSize;
+
+		slot.record->valueSize = valueSize;
+		CopyMemory(GetValue(slot.record), value, valueSize);
+		return true;
+	}
+
+	DWORD sizeClass = 0;
+	Record* record = reinterpret_cast<Record*>(shard.arena.Alloc(size, sizeClass));
+	if(record == NULL)
+	{
+		return false;
+	}
+
+	record->keySize = keySize;
+	record->valueSize = valueSize;
+	record->sizeClass = sizeClass;
+	CopyMemory(GetKey(record), key, keySize);
+	CopyMemory(GetValue(record), value, valueSize);
+
+	if(slot.record != NULL)
+	{
+		shard.recordBytes -= slot.record->keySize + slot.record->valueSize;
+		shard.arena.Free(reinterpret_cast<BYTE*>(slot.record), slot.record->sizeClass);
+
+		slot.record = record;
+		shard.recordBytes += keySize + valueSize;
+		return true;
+	}
+
+	slot.hash = hash;
+	slot.record = record;
+	++shard.count;
+	shard.recordBytes += keySize + valueSize;
+
+	if((shard.count + 1) * 4 > (shard.mask + 1) * 3 && !Grow(shard))
+	{
+		// It can't stay without a bigger table. A full one would never stop Find().
+		ERROR_MSG("Could not grow a shard of %d keys.", shard.count);
+		Remove(shard, index);
+		return false;
+	}
+
+	return true;
+}
+
+
+/* static */ void KeyValueStore::Remove(Shard& shard, DWORD index)
+{
+	Slot* slots = shard.slots;
+	Record* record = slots[index].record;
+
+	shard.recordBytes -= record->keySize + record->valueSize;
+	shard.arena.Free(reinterpret_cast<BYTE*>(record), record->sizeClass);
+	slots[index].record = NULL;
+	--shard.count;
+
+	// Backward shift instead of tombstones : later records of the run move up if the hole is between them and their home slot.
+	DWORD hole = index;
+	DWORD next = (index + 1) & shard.mask;
+	while(slots[next].record != NULL)
+	{
+		DWORD home = slots[next].hash & shard.mask;
+
+		bool homeAfterHole = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+		if(!homeAfterHole)
+		{
+			slots[hole] = slots[next];
+			slots[next].record = NULL;
+			hole = next;
+		}
+
+		next = (next + 1) & shard.mask;
+	}
+}
+
+
+/* static */ bool KeyValueStore::Grow(Shard& shard)
+{
+	DWORD numSlots = (shard.mask + 1) * 2;
+
+	Slot* slots = new(nothrow) Slot[numSlots];
+	if(slots == NULL)
+	{
+		return false;
+	}
+	ZeroMemory(slots, sizeof(Slot) * numSlots);
+
+	DWORD mask = numSlots - 1;
+	for(DWORD i = 0 ; i <= shard.mask ; ++i)
+	{
+		if(shard.slots[i].record == NULL)
+		{
+			continue;
+		}
+
+		DWORD index = shard.slots[i].hash & mask;
+		while(slots[index].record != NULL)
+		{
+			index = (index + 1) & mask;
+		}
+		slots[index] = shard.slots[i];
+	}
+
+	delete [] shard.slots;
+	shard.slots = slots;
+	shard.mask = mask;
+
+	return true;
+}
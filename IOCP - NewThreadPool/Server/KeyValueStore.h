@@ -0,0 +1,139 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+// Binary-safe keys and values for MODE_RESP.
+// Keys are hashed into NUM_SHARDS shards. Each is an open-addressing hash table (linear probing) under a lock of its own,
+// so commands on different shards never wait for each other.
+// A key and its value are one record, allocated from the shard's arena : blocks in power-of-two size classes
+// carved out of big chunks, and recycled through a free list per class. Nothing goes back to the OS until the store is gone.
+class KeyValueStore
+{
+public:
+	enum
+	{
+		SHARD_BITS = 6,
+		NUM_SHARDS = 1 << SHARD_BITS,
+
+		// Slots of a shard to start with. A power of two. The table doubles when it's 3/4 full.
+		INITIAL_SLOTS = 1024,
+
+		MIN_CLASS_SHIFT = 5,		// 32 B
+		CHUNK_SHIFT = 20,			// 1 MB
+		NUM_CLASSES = CHUNK_SHIFT - MIN_CLASS_SHIFT + 1,
+		CHUNK_SIZE = 1 << CHUNK_SHIFT,
+	};
+
+	enum IncrementResult
+	{
+		INCREMENT_OK,
+		INCREMENT_NOT_INTEGER,
+		INCREMENT_OVERFLOW,
+		INCREMENT_OUT_OF_MEMORY,
+	};
+
+	// Gets the value while the shard is locked. It can't be kept.
+	typedef void (*ValueFunc)(void* context, const BYTE* value, DWORD size);
+
+	struct Stats
+	{
+		ULONGLONG keys;
+		ULONGLONG recordBytes;		// keys and values.
+		ULONGLONG arenaBytes;		// taken for chunks.
+	};
+
+public:
+	KeyValueStore();
+	~KeyValueStore();
+
+	// Returns false if there's no such key.
+	bool Get(const BYTE* key, DWORD keySize, ValueFunc func, void* context);
+
+	// Returns false if the key and the value don't fit in a chunk, or memory ran out.
+	bool Set(const BYTE* key, DWORD keySize, const BYTE* value, DWORD valueSize);
+
+	// Returns false if there was no such key.
+	bool Delete(const BYTE* key, DWORD keySize);
+
+	// A missing key counts as 0. result is the new value.
+	IncrementResult Increment(const BYTE* key, DWORD keySize, LONGLONG delta, LONGLONG& result);
+
+	void GetStats(Stats& stats);
+
+	// Decimal, as Redis reads and writes integers. Returns false if it's not all an integer that fits.
+	static bool ParseInteger(const BYTE* text, DWORD size, LONGLONG& value);
+	// Returns the number of characters written. buffer needs 21 bytes.
+	static DWORD FormatInteger(LONGLONG value, char* buffer);
+
+private:
+	// Followed by the key and then the value.
+	struct Record
+	{
+		DWORD keySize;
+		DWORD valueSize;
+		DWORD sizeClass;
+	};
+
+	struct Slot
+	{
+		DWORD hash;
+		Record* record;		// NULL if the slot is empty.
+	};
+
+	class Arena
+	{
+	public:
+		Arena();
+		~Arena();
+
+		// Returns NULL if size is bigger than CHUNK_SIZE or memory ran out.
+		BYTE* Alloc(DWORD size, DWORD& sizeClass);
+		void Free(BYTE* block, DWORD sizeClass);
+
+		ULONGLONG GetReservedBytes() { return static_cast<ULONGLONG>(m_Chunks.size()) * CHUNK_SIZE; }
+
+		static DWORD GetClassSize(DWORD sizeClass) { return 1 << (MIN_CLASS_SHIFT + sizeClass); }
+
+	private:
+		Arena(const Arena& rhs);
+		Arena& operator=(const Arena& rhs);
+
+	private:
+		std::vector<BYTE*> m_Chunks;
+		BYTE* m_Cursor;			// the unused rest of the last chunk.
+		DWORD m_Left;
+		BYTE* m_FreeLists[NUM_CLASSES];		// linked through their first bytes.
+	};
+
+	struct Shard
+	{
+		CRITICAL_SECTION cs;
+		Slot* slots;
+		DWORD mask;			// number of slots - 1.
+		DWORD count;
+		ULONGLONG recordBytes;
+		Arena arena;
+	};
+
+	static DWORD Hash(const BYTE* key, DWORD keySize);
+	Shard& GetShard(DWORD hash) { return *m_Shards[hash >> (32 - SHARD_BITS)]; }
+
+	static BYTE* GetKey(Record* record) { return reinterpret_cast<BYTE*>(record + 1); }
+	static BYTE* GetValue(Record* record) { return GetKey(record) + record->keySize; }
+
+	// All with the shard locked.
+	// Returns the slot of the key, or the empty slot where it would go.
+	static DWORD Find(Shard& shard, DWORD hash, const BYTE* key, DWORD keySize);
+	// Stores the value in the record of the slot, in place if it fits. Returns false if memory ran out.
+	static bool Store(Shard& shard, DWORD index, DWORD hash, const BYTE* key, DWORD keySize, const BYTE* value, DWORD valueSize);
+	static void Remove(Shard& shard, DWORD index);
+	static bool Grow(Shard& shard);
+
+private:
+	KeyValueStore(const KeyValueStore& rhs);
+	KeyValueStore& operator=(const KeyValueStore& rhs);
+
+private:
+	// Apart from each other so that their locks don't share cache lines.
+	Shard* m_Shards[NUM_SHARDS];
+};
@@ -0,0 +1,129 @@
+#include "LogicHost.h"
+
+#include "..\Log.h"
+#include "..\Protocol.h"
+#include <cassert>
+
+
+/* static */ void LogicHost::OnMessage(void* context, const SharedChannel::Message& message)
+{
+	LogicHost* host = static_cast<LogicHost*>(context);
+	assert(host);
+
+	switch(message.type)
+	{
+	case SharedChannel::MESSAGE_CONNECT:
+		++host->m_Stats.connects;
+		break;
+
+	case SharedChannel::MESSAGE_DISCONNECT:
+		++host->m_Stats.disconnects;
+		break;
+
+	case SharedChannel::MESSAGE_FRAME:
+		host->OnFrame(message);
+		break;
+
+	default:
+		ERROR_MSG("Unknown message from the front : %d", message.type);
+		if(message.block < SharedChannel::NUM_BLOCKS)
+		{
+			host->m_Channel.FreeBlock(message.block);
+		}
+		break;
+	}
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+LogicHost::LogicHost()
+{
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+
+LogicHost::~LogicHost()
+{
+	Stop();
+}
+
+
+bool LogicHost::Start(const char* name)
+{
+	if(!m_Channel.Open(name))
+	{
+		return false;
+	}
+
+	// Clients of a logic that went before are still there, and their frames are answered all the same.
+	if(!m_Channel.StartReading(SharedChannel::INBOUND, LogicHost::OnMessage, this, NULL))
+	{
+		m_Channel.Close();
+		return false;
+	}
+
+	TRACE("Logic %d is on the channel %s.", GetCurrentProcessId(), name);
+
+	return true;
+}
+
+
+void LogicHost::Stop()
+{
+	m_Channel.Close();
+}
+
+
+void LogicHost::TraceStats()
+{
+	Stats stats = GetStats();
+
+	TRACE(" connects %I64d, disconnects %I64d, frames %I64d, sent %I64d, dropped %I64d",
+		stats.connects, stats.disconnects, stats.frames, stats.sent, stats.dropped);
+
+	if(!m_Channel.IsOpen())
+	{
+		return;
+	}
+
+	SharedChannel::Stats inbound = m_Channel.GetStats(SharedChannel::INBOUND);
+	SharedChannel::Stats outbound = m_Channel.GetStats(SharedChannel::OUTBOUND);
+
+	TRACE(" inbound : queued %d, full %I64d, wakeups %I64d / outbound : queued %d, full %I64d, wakeups %I64d / blocks in use %d",
+		inbound.queued, inbound.full, inbound.wakeups, outbound.queued, outbound.full, outbound.wakeups, inbound.blocksInUse);
+}
+
+
+void LogicHost::OnFrame(const SharedChannel::Message& message)
+{
+	++m_Stats.frames;
+
+	if(message.block >= SharedChannel::NUM_BLOCKS || message.size > SharedChannel::MAX_MESSAGE_SIZE)
+	{
+		// Not a block that can be freed either.
+		ERROR_MSG("Bad message from the front. block : %d, size : %d", message.block, message.size);
+		++m_Stats.dropped;
+		return;
+	}
+
+	const Protocol::Header* header = reinterpret_cast<const Protocol::Header*>(m_Channel.GetBlock(message.block));
+
+	bool answered = false;
+	if(message.size >= Protocol::HEADER_SIZE && header->size == message.size - Protocol::HEADER_SIZE &&
+		(header->opcode == Protocol::OP_ECHO || header->opcode == Protocol::OP_PING))
+	{
+		// Back in the same blocks, with the same handle. The header is in the first one.
+		answered = m_Channel.Push(SharedChannel::OUTBOUND, message);
+	}
+
+	if(answered)
+	{
+		++m_Stats.sent;
+	}
+	else
+	{
+		++m_Stats.dropped;
+		m_Channel.FreeBlock(message.block);
+	}
+}
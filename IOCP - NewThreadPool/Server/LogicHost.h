@@ -0,0 +1,49 @@
+#pragma once
+#include <Windows.h>
+
+#include "SharedChannel.h"
+
+// The logic process of a front-end that runs with a channel. See SharedChannel.
+// It stands in for the game logic : echoes and pings go back to their client in the block they came in, so nothing is copied,
+// and other opcodes are dropped. It can be stopped and started again while the front keeps its clients.
+class LogicHost
+{
+public:
+	struct Stats
+	{
+		ULONGLONG connects;
+		ULONGLONG disconnects;
+		ULONGLONG frames;
+		ULONGLONG sent;
+		ULONGLONG dropped;		// unknown opcodes, bad frames and frames that found OUTBOUND full.
+	};
+
+private:
+	// SharedChannel callback
+	static void OnMessage(void* context, const SharedChannel::Message& message);
+
+public:
+	LogicHost();
+	~LogicHost();
+
+	// Returns false if the channel isn't there. The front has to be up first.
+	bool Start(const char* name);
+	void Stop();
+
+	// Not exact while messages are being read.
+	Stats GetStats() { return m_Stats; }
+	void TraceStats();
+
+private:
+	void OnFrame(const SharedChannel::Message& message);
+
+private:
+	LogicHost(const LogicHost& rhs);
+	LogicHost& operator=(const LogicHost& rhs);
+
+private:
+	SharedChannel m_Channel;
+
+	// Only touched by the reader.
+	Stats m_Stats;
+};
@@ -0,0 +1,110 @@
+#include "MemoryBudget.h"
+#include "Client.h"
+
+#include "..\Log.h"
+#include <cassert>
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+MemoryBudget::MemoryBudget()
+: m_GlobalHigh(DEFAULT_GLOBAL_HIGH_WATERMARK),
+  m_GlobalLow(DEFAULT_GLOBAL_LOW_WATERMARK),
+  m_ClientHigh(DEFAULT_CLIENT_HIGH_WATERMARK),
+  m_ClientLow(DEFAULT_CLIENT_LOW_WATERMARK),
+  m_InboundBytes(0),
+  m_OutboundBytes(0)
+{
+}
+
+
+MemoryBudget::~MemoryBudget()
+{
+}
+
+
+void MemoryBudget::SetGlobalWatermarks(LONGLONG high, LONGLONG low)
+{
+	assert(low <= high);
+
+	m_GlobalHigh = high;
+	m_GlobalLow = low;
+}
+
+
+void MemoryBudget::SetClientWatermarks(LONG high, LONG low)
+{
+	assert(low <= high);
+
+	m_ClientHigh = high;
+	m_ClientLow = low;
+}
+
+
+void MemoryBudget::ChargeInbound(Client* client, DWORD bytes)
+{
+	if(client)
+	{
+		client->AddInboundBytes(static_cast<LONG>(bytes));
+	}
+	InterlockedExchangeAdd64(&m_InboundBytes, bytes);
+}
+
+
+void MemoryBudget::ReleaseInbound(Client* client, DWORD bytes)
+{
+	if(client)
+	{
+		client->AddInboundBytes(-static_cast<LONG>(bytes));
+	}
+	InterlockedExchangeAdd64(&m_InboundBytes, -static_cast<LONGLONG>(bytes));
+}
+
+
+void MemoryBudget::ChargeOutbound(Client* client, DWORD bytes)
+{
+	if(client)
+	{
+		client->AddOutboundBytes(static_cast<LONG>(bytes));
+	}
+	InterlockedExchangeAdd64(&m_OutboundBytes, bytes);
+}
+
+
+void MemoryBudget::ReleaseOutbound(Client* client, DWORD bytes)
+{
+	if(client)
+	{
+		client->AddOutboundBytes(-static_cast<LONG>(bytes));
+	}
+	InterlockedExchangeAdd64(&m_OutboundBytes, -static_cast<LONGLONG>(bytes));
+}
+
+
+bool MemoryBudget::IsOverHigh(Client* client) const
+{
+	assert(client);
+
+	return client->GetBufferedBytes() > m_ClientHigh || m_InboundBytes + m_OutboundBytes > m_GlobalHigh;
+}
+
+
+bool MemoryBudget::IsUnderLow(Client* client) const
+{
+	assert(client);
+
+	return client->GetBufferedBytes() <= m_ClientLow && IsGlobalUnderLow();
+}
+
+
+bool MemoryBudget::IsGlobalUnderLow() const
+{
+	return m_InboundBytes + m_OutboundBytes <= m_GlobalLow;
+}
+
+
+void MemoryBudget::TraceStats() const
+{
+	TRACE(" Buffered : inbound %I64d, outbound %I64d bytes (high %I64d, low %I64d)", m_InboundBytes, m_OutboundBytes, m_GlobalHigh, m_GlobalLow);
+	TRACE(" Per client : high %d, low %d bytes", m_ClientHigh, m_ClientLow);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <Windows.h>
+#include "CacheLine.h"
+
+class Client;
+
+// Accounts bytes held by packets that are waiting to be processed (inbound) or sent (outbound),
+// per connection and for the whole server. Reads are paused above the high watermark and resumed below the low one.
+class MemoryBudget
+{
+public:
+	enum
+	{
+		DEFAULT_CLIENT_HIGH_WATERMARK = 1024 * 1024,
+		DEFAULT_CLIENT_LOW_WATERMARK = 256 * 1024,
+	};
+
+	static const LONGLONG DEFAULT_GLOBAL_HIGH_WATERMARK = 256 * 1024 * 1024;
+	static const LONGLONG DEFAULT_GLOBAL_LOW_WATERMARK = 128 * 1024 * 1024;
+
+public:
+	MemoryBudget();
+	~MemoryBudget();
+
+	void SetGlobalWatermarks(LONGLONG high, LONGLONG low);
+	void SetClientWatermarks(LONG high, LONG low);
+
+	// client can be NULL when it has gone already. Then only the global counters are touched.
+	void ChargeInbound(Client* client, DWORD bytes);
+	void ReleaseInbound(Client* client, DWORD bytes);
+	void ChargeOutbound(Client* client, DWORD bytes);
+	void ReleaseOutbound(Client* client, DWORD bytes);
+
+	// Over the high watermark of either the client or the whole server.
+	bool IsOverHigh(Client* client) const;
+	// Under the low watermarks of both the client and the whole server.
+	bool IsUnderLow(Client* client) const;
+	bool IsGlobalUnderLow() const;
+
+	LONGLONG GetInboundBytes() const { return m_InboundBytes; }
+	LONGLONG GetOutboundBytes() const { return m_OutboundBytes; }
+
+	void TraceStats() const;
+
+private:
+	MemoryBudget(const MemoryBudget& rhs);
+	MemoryBudget& operator=(const MemoryBudget& rhs);
+
+private:
+	// Read by every charge.
+	LONGLONG m_GlobalHigh;
+	LONGLONG m_GlobalLow;
+	LONG m_ClientHigh;
+	LONG m_ClientLow;
+
+	// Charged on recvs and sends, and released by other threads when they are processed and completed.
+	// Padded apart from each other and from the watermarks, since the server isn't allocated on a line.
+	BYTE m_Pad0[CACHE_LINE_SIZE];
+	volatile LONGLONG m_InboundBytes;
+	BYTE m_Pad1[CACHE_LINE_SIZE];
+	volatile LONGLONG m_OutboundBytes;
+	BYTE m_Pad2[CACHE_LINE_SIZE];
+};
@@ -0,0 +1,119 @@
+#pragma once
+#include <Windows.h>
+
+class Packet;
+
+// Dispatch of frames by opcode with one indexed call. No maps, no virtual calls.
+// Opcodes are sparse, so they are hashed into a small table by a multiplicative hash that has no collisions
+// for the opcodes in use. The table is filled at compile time from specializations made by OPCODE_HANDLER().
+// Two opcodes in the same slot are a redefinition of OpcodeTable::Slot and don't compile.
+// Then try other HASH_MULTIPLIERs, odd ones, until they all get a slot of their own.
+namespace OpcodeTable
+{
+	enum
+	{
+		HASH_BITS = 5,
+		NUM_SLOTS = 1 << HASH_BITS,
+		HASH_MULTIPLIER = 1195,
+	};
+
+	// What is dropped first when the server is overloaded. See OverloadControl.
+	enum Priority
+	{
+		PRIORITY_CONTROL,		// session state, never dropped.
+		PRIORITY_INTERACTIVE,	// someone waits for the answer.
+		PRIORITY_BULK,			// fan-out and the like, that the next one makes up for.
+		NUM_PRIORITIES,
+	};
+
+	template<class T>
+	struct Entry
+	{
+		WORD opcode;
+		void (*call)(T* owner, Packet* packet);
+		bool runInline;
+		Priority priority;
+	};
+
+	// Opcodes without a handler go to T::OnUnknownOpcode(), and are bulk.
+	template<class T, int OPCODE>
+	struct Handler
+	{
+		enum { RUN_INLINE = 0, PRIORITY = PRIORITY_BULK };
+		static void Call(T* owner, Packet* packet) { owner->OnUnknownOpcode(packet); }
+	};
+
+	// Empty slots hold opcode 0, which never has a handler.
+	template<class T, int SLOT>
+	struct Slot
+	{
+		enum { OPCODE = 0 };
+	};
+}
+
+#define OPCODE_SLOT(opcode) ((((opcode) * static_cast<DWORD>(OpcodeTable::HASH_MULTIPLIER)) & 0xFFFF) >> (16 - OpcodeTable::HASH_BITS))
+
+// Registers T::handler(Packet*) for opcode, at global scope in the .cpp of T.
+// runInline is true when the handler may run on the I/O thread that received the frame:
+// it must be quick and must not take locks that are held while waiting for I/O callbacks.
+// The sender is alive for as long as the handler runs there.
+// priority is a PRIORITY_ of OpcodeTable::Priority, without the namespace.
+#define OPCODE_HANDLER(T, opcode, handler, runInline, priority) \
+	namespace OpcodeTable \
+	{ \
+		template<> struct Handler<T, opcode> \
+		{ \
+			enum { RUN_INLINE = runInline, PRIORITY = OpcodeTable::priority }; \
+			static void Call(T* owner, Packet* packet) { owner->handler(packet); } \
+		}; \
+		template<> struct Slot<T, OPCODE_SLOT(opcode)> \
+		{ \
+			enum { OPCODE = opcode }; \
+		}; \
+	}
+
+#define OPCODE_ENTRY(T, slot) \
+	{ \
+		static_cast<WORD>(OpcodeTable::Slot<T, slot>::OPCODE), \
+		&OpcodeTable::Handler<T, OpcodeTable::Slot<T, slot>::OPCODE>::Call, \
+		OpcodeTable::Handler<T, OpcodeTable::Slot<T, slot>::OPCODE>::RUN_INLINE != 0, \
+		static_cast<OpcodeTable::Priority>(OpcodeTable::Handler<T, OpcodeTable::Slot<T, slot>::OPCODE>::PRIORITY) \
+	}
+
+#define OPCODE_ENTRIES_8(T, base) \
+	OPCODE_ENTRY(T, base + 0), OPCODE_ENTRY(T, base + 1), OPCODE_ENTRY(T, base + 2), OPCODE_ENTRY(T, base + 3), \
+	OPCODE_ENTRY(T, base + 4), OPCODE_ENTRY(T, base + 5), OPCODE_ENTRY(T, base + 6), OPCODE_ENTRY(T, base + 7)
+
+// Initializer of a const OpcodeTable::Entry<T>[NUM_SLOTS], after all the OPCODE_HANDLER()s of T.
+#define OPCODE_TABLE(T) \
+	{ \
+		OPCODE_ENTRIES_8(T, 0), OPCODE_ENTRIES_8(T, 8), OPCODE_ENTRIES_8(T, 16), OPCODE_ENTRIES_8(T, 24) \
+	}
+
+namespace OpcodeTable
+{
+	// OPCODE_TABLE() is written out for this many slots.
+	typedef char NumSlotsMatchesTable[NUM_SLOTS == 32 ? 1 : -1];
+
+	// The entry of the opcode's slot. It's only the opcode's if entry.opcode is the same.
+	template<class T>
+	inline const Entry<T>& Lookup(const Entry<T>* table, WORD opcode)
+	{
+		return table[OPCODE_SLOT(opcode)];
+	}
+
+	// Calls the handler of the opcode.
+	template<class T>
+	inline void Dispatch(const Entry<T>* table, T* owner, WORD opcode, Packet* packet)
+	{
+		const Entry<T>& entry = table[OPCODE_SLOT(opcode)];
+		if(entry.opcode == opcode)
+		{
+			entry.call(owner, packet);
+		}
+		else
+		{
+			Handler<T, 0>::Call(owner, packet);
+		}
+	}
+}
@@ -0,0 +1,160 @@
+#include "OverloadControl.h"
+
+#include <cassert>
+
+
+OverloadControl::OverloadControl()
+: m_Target(0),
+  m_Interval(DEFAULT_INTERVAL_MS * 1000),
+  m_Queued(0),
+  m_Level(LEVEL_NORMAL),
+  m_IntervalEnd(0),
+  m_NumIntervals(0),
+  m_NumOverloadedIntervals(0)
+{
+	for(int i = 0 ; i < NUM_LEVELS ; ++i)
+	{
+		m_TimeAtLevel[i] = 0;
+	}
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		m_MinSojourn[i] = MAXLONGLONG;
+		m_NumShed[i] = 0;
+	}
+}
+
+
+void OverloadControl::SetTarget(DWORD targetMs, DWORD intervalMs)
+{
+	assert(targetMs == 0 || targetMs < intervalMs);
+
+	// Off first, so that no dequeue sees the new interval with the old target.
+	InterlockedExchange64(&m_Target, 0);
+	InterlockedExchange64(&m_Interval, static_cast<LONGLONG>(intervalMs) * 1000);
+
+	InterlockedExchange(&m_Level, LEVEL_NORMAL);
+	InterlockedExchange64(&m_IntervalEnd, 0);
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		InterlockedExchange64(&m_MinSojourn[i], MAXLONGLONG);
+	}
+	m_Sojourns.Reset();
+
+	InterlockedExchange64(&m_Target, static_cast<LONGLONG>(targetMs) * 1000);
+}
+
+
+bool OverloadControl::OnDequeue(OpcodeTable::Priority priority, ULONGLONG sojourn, ULONGLONG now)
+{
+	InterlockedDecrement(&m_Queued);
+
+	LONGLONG target = m_Target;
+	LONGLONG interval = m_Interval;
+	if(target == 0)
+	{
+		return false;
+	}
+
+	m_Sojourns.Record(sojourn);
+
+	// Most packets didn't wait less than the least so far, and only read it.
+	LONGLONG wait = static_cast<LONGLONG>(sojourn);
+	LONGLONG min = m_MinSojourn[priority];
+	while(wait < min)
+	{
+		LONGLONG seen = InterlockedCompareExchange64(&m_MinSojourn[priority], wait, min);
+		if(seen == min)
+		{
+			break;
+		}
+		min = seen;
+	}
+
+	// The worker that moves the end on is the one that ends the interval.
+	LONGLONG end = m_IntervalEnd;
+	if(static_cast<LONGLONG>(now) >= end && InterlockedCompareExchange64(&m_IntervalEnd, now + interval, end) == end)
+	{
+		EndInterval(now, end);
+	}
+
+	if(m_Level != LEVEL_SHEDDING)
+	{
+		return false;
+	}
+
+	bool shed = false;
+	switch(priority)
+	{
+	case OpcodeTable::PRIORITY_CONTROL:		shed = false; break;
+	case OpcodeTable::PRIORITY_INTERACTIVE:	shed = wait > interval; break;
+	default:								shed = wait > target; break;
+	}
+
+	if(shed)
+	{
+		InterlockedIncrement64(&m_NumShed[priority]);
+	}
+
+	return shed;
+}
+
+
+void OverloadControl::EndInterval(ULONGLONG now, ULONGLONG end)
+{
+	// Priorities nothing was dequeued of are MAXLONGLONG, and don't count.
+	bool standing = false;
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		LONGLONG min = InterlockedExchange64(&m_MinSojourn[i], MAXLONGLONG);
+		standing = standing || (min != MAXLONGLONG && min > m_Target);
+	}
+
+	// The first dequeue only starts one.
+	if(end == 0)
+	{
+		return;
+	}
+
+	LONGLONG interval = m_Interval;
+	LONG level = m_Level;
+
+	InterlockedIncrement64(&m_NumIntervals);
+	InterlockedExchangeAdd64(&m_TimeAtLevel[level], interval);
+
+	if(static_cast<LONGLONG>(now - end) > interval)
+	{
+		// Nothing was dequeued for a whole interval, so there was nothing queued.
+		level = LEVEL_NORMAL;
+	}
+	else if(standing)
+	{
+		InterlockedIncrement64(&m_NumOverloadedIntervals);
+		level = level + 1 < NUM_LEVELS ? level + 1 : level;
+	}
+	else
+	{
+		level = level > LEVEL_NORMAL ? level - 1 : level;
+	}
+
+	InterlockedExchange(&m_Level, level);
+}
+
+
+void OverloadControl::GetStats(Stats& stats)
+{
+	stats.level = GetLevel();
+	stats.queued = m_Queued;
+	stats.intervals = m_NumIntervals;
+	stats.overloadedIntervals = m_NumOverloadedIntervals;
+
+	for(int i = 0 ; i < NUM_LEVELS ; ++i)
+	{
+		stats.timeAtLevel[i] = m_TimeAtLevel[i];
+	}
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		stats.shed[i] = m_NumShed[i];
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <Windows.h>
+
+#include "OpcodeTable.h"
+#include "..\Histogram.h"
+
+// Admission control driven by how long packets wait in the thread pool's queue before a worker takes them,
+// their sojourn, like CoDel does it for routers. A burst drains within an interval, and some packet of the
+// interval waits less than the target then. When even the packet that waited least in an interval waited longer,
+// the queue is standing and the workers won't catch up on their own. The least is taken for each priority, as
+// PacketLanes can keep control and interactive packets moving while bulk ones stand. An interval in which any
+// of them stood steps the level up, and each good one steps it down. Lock-free. OnQueued() and OnDequeue() are
+// called for every packet.
+class OverloadControl
+{
+public:
+	enum Level
+	{
+		LEVEL_NORMAL,
+		LEVEL_REJECTING,	// new connections are turned away.
+		LEVEL_SHEDDING,		// and packets that waited too long for their priority are dropped. See OnDequeue().
+		NUM_LEVELS,
+	};
+
+	enum
+	{
+		DEFAULT_TARGET_MS = 5,
+		DEFAULT_INTERVAL_MS = 100,
+	};
+
+	struct Stats
+	{
+		Level level;
+		LONG queued;
+		ULONGLONG intervals;
+		ULONGLONG overloadedIntervals;
+		ULONGLONG timeAtLevel[NUM_LEVELS];	// microseconds, in whole intervals.
+		ULONGLONG shed[OpcodeTable::NUM_PRIORITIES];
+	};
+
+public:
+	OverloadControl();
+
+	// Any time. A target of 0 is off, the default. The interval is a little over the longest
+	// a burst should take to drain, and the level starts over from LEVEL_NORMAL.
+	void SetTarget(DWORD targetMs, DWORD intervalMs);
+	bool IsEnabled() { return m_Target != 0; }
+	DWORD GetTargetMs() { return static_cast<DWORD>(m_Target / 1000); }
+	DWORD GetIntervalMs() { return static_cast<DWORD>(m_Interval / 1000); }
+
+	// A packet is queued for a worker.
+	void OnQueued() { InterlockedIncrement(&m_Queued); }
+
+	// A worker took a packet that waited sojourn, now being Clock::GetMicroseconds(). Returns true if it's to be shed.
+	// At LEVEL_SHEDDING bulk packets are shed once they waited longer than the target, and interactive ones
+	// once they waited longer than the interval, as the answer is too late to be of use by then. Control is never shed.
+	bool OnDequeue(OpcodeTable::Priority priority, ULONGLONG sojourn, ULONGLONG now);
+
+	// LEVEL_NORMAL whenever the queue is empty, whatever the last interval was.
+	Level GetLevel() { return m_Queued > 0 ? static_cast<Level>(m_Level) : LEVEL_NORMAL; }
+
+	void GetStats(Stats& stats);
+	// Of every packet dequeued while on, in microseconds.
+	const Histogram& GetSojourns() { return m_Sojourns; }
+
+private:
+	OverloadControl(const OverloadControl& rhs);
+	OverloadControl& operator=(const OverloadControl& rhs);
+
+	// By the one worker whose dequeue ended the interval.
+	void EndInterval(ULONGLONG now, ULONGLONG end);
+
+private:
+	volatile LONGLONG m_Target;		// microseconds
+	volatile LONGLONG m_Interval;	// microseconds
+
+	volatile LONG m_Queued;
+	volatile LONG m_Level;
+	volatile LONGLONG m_IntervalEnd;	// 0 until the first dequeue.
+	volatile LONGLONG m_MinSojourn[OpcodeTable::NUM_PRIORITIES];	// of the interval so far.
+
+	volatile LONGLONG m_NumIntervals;
+	volatile LONGLONG m_NumOverloadedIntervals;
+	volatile LONGLONG m_TimeAtLevel[NUM_LEVELS];
+	volatile LONGLONG m_NumShed[OpcodeTable::NUM_PRIORITIES];
+
+	Histogram m_Sojourns;
+};
@@ -1,21 +1,56 @@
 #include "Packet.h"
+#include "BufferPool.h"
+#include "Client.h"
+#include "ClientHandles.h"
 
+#include <cassert>
 #include <boost/pool/singleton_pool.hpp>
 
 typedef boost::singleton_pool<Packet, sizeof(Packet)> PacketPool;
 
 /* static */ Packet* Packet::Create(Client* sender, const BYTE* buff, DWORD size)
 {
+	BYTE* data = BufferPool::Alloc(size);
+	if(data == NULL)
+	{
+		return NULL;
+	}
+
+	Packet* packet = Attach(sender, data, size);
+	if(buff != NULL)
+	{
+		CopyMemory(packet->m_Data, buff, size);
+	}
+
+	return packet;
+}
+
+/* static */ Packet* Packet::Attach(Client* sender, BYTE* data, DWORD size)
+{
+	assert(data);
+	assert(size <= BufferPool::GetCapacity(data));
+
 	Packet* packet = static_cast<Packet*>(PacketPool::malloc());
 	packet->m_Sender = sender; 
+	packet->m_SenderHandle = sender != NULL ? sender->GetHandle() : ClientHandles::INVALID_HANDLE;
 	packet->m_Size = size;
-	CopyMemory(packet->m_Data, buff, size);
+	packet->m_Data = data;
+	packet->m_RefCount = 1;
+	packet->m_CoalesceKey = COALESCE_NONE;
+	packet->m_QueueTime = 0;
+	packet->m_Priority = OpcodeTable::PRIORITY_BULK;
 
 	return packet;
 }
 
 /* static */ void Packet::Destroy(Packet* packet)
 {
+	if(InterlockedDecrement(&packet->m_RefCount) > 0)
+	{
+		return;
+	}
+
+	BufferPool::Free(packet->m_Data);
 	PacketPool::free(packet);
 }
 
@@ -1,24 +1,53 @@
 #pragma once
 #include <Windows.h>
 
+#include "OpcodeTable.h"
+
 class Client;
 class Packet
 {
-private:
-	enum
+public:
+	// Kinds of coalescing keys. The kind goes in the top 8 bits and its own id in the rest.
+	enum CoalesceKind
 	{
-		MAX_BUFF_SIZE = 1024,
+		COALESCE_NONE,
+		COALESCE_CELL,		// InterestGrid cell updates, by cell.
+		COALESCE_SNAPSHOT,	// there's one stream of snapshots per client.
 	};
-	
+
+	static DWORD MakeCoalesceKey(CoalesceKind kind, DWORD id) { return (static_cast<DWORD>(kind) << 24) | (id & 0x00FFFFFF); }
+
 public:
+	// buff can be NULL to fill GetData() afterwards.
 	static Packet* Create(Client* sender, const BYTE* buff, DWORD size);
+	// Takes data, a buffer from BufferPool, instead of copying it. It's freed with the packet.
+	static Packet* Attach(Client* sender, BYTE* data, DWORD size);
+	// Drops a reference. The packet is freed with the last one.
 	static void Destroy(Packet* packet);
 
 public:
+	// One packet can be queued to many clients. Each of them holds a reference.
+	void AddRef() { InterlockedIncrement(&m_RefCount); }
+
 	Client* GetSender() { return m_Sender; }
+	// The sender's handle when the packet was made, to tell whether the sender is still there. See Server::FindSender().
+	DWORD GetSenderHandle() { return m_SenderHandle; }
 	DWORD GetSize() { return m_Size; }
 	BYTE* GetData() { return m_Data; }
 
+	// A queued send of this packet can be replaced by a newer packet with the same key. 0 is for none.
+	// See Server::SetSendCoalescing().
+	void SetCoalesceKey(DWORD key) { m_CoalesceKey = key; }
+	DWORD GetCoalesceKey() { return m_CoalesceKey; }
+
+	// Clock::GetMicroseconds() when it was queued for a worker, 0 if it wasn't. See OverloadControl.
+	void SetQueueTime(ULONGLONG time) { m_QueueTime = time; }
+	ULONGLONG GetQueueTime() { return m_QueueTime; }
+
+	// The lane it waits in for a worker, PRIORITY_BULK until it's set. See PacketLanes.
+	void SetPriority(OpcodeTable::Priority priority) { m_Priority = priority; }
+	OpcodeTable::Priority GetPriority() { return m_Priority; }
+
 private:
 	Packet();
 	~Packet();
@@ -27,6 +56,11 @@ private:
 
 private:
 	Client* m_Sender;
+	DWORD m_SenderHandle;
 	DWORD m_Size;
-	BYTE m_Data[MAX_BUFF_SIZE];
+	BYTE* m_Data; // from BufferPool, sized by m_Size.
+	volatile LONG m_RefCount;
+	DWORD m_CoalesceKey;
+	ULONGLONG m_QueueTime;
+	OpcodeTable::Priority m_Priority;
 };
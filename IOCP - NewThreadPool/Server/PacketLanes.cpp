@@ -0,0 +1,214 @@
+#include "PacketLanes.h"
+#include "Packet.h"
+
+#include <cassert>
+
+
+PacketLanes::PacketLanes()
+: m_Policy(POLICY_FIFO),
+  m_StarvationMs(DEFAULT_STARVATION_MS)
+{
+	m_Weights[OpcodeTable::PRIORITY_CONTROL] = 8;
+	m_Weights[OpcodeTable::PRIORITY_INTERACTIVE] = 4;
+	m_Weights[OpcodeTable::PRIORITY_BULK] = 1;
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		m_Turns[i] = m_Weights[i];
+		m_LastPop[i] = 0;
+	}
+
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	InitializeCriticalSection(&m_CS);
+}
+
+
+PacketLanes::~PacketLanes()
+{
+	Clear();
+
+	DeleteCriticalSection(&m_CS);
+}
+
+
+void PacketLanes::SetPolicy(Policy policy)
+{
+	EnterCriticalSection(&m_CS);
+	m_Policy = policy;
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void PacketLanes::SetWeights(const DWORD weights[OpcodeTable::NUM_PRIORITIES])
+{
+	EnterCriticalSection(&m_CS);
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		assert(weights[i] > 0);
+
+		m_Weights[i] = weights[i];
+		m_Turns[i] = weights[i];
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void PacketLanes::Push(Packet* packet)
+{
+	assert(packet);
+	assert(packet->GetPriority() < OpcodeTable::NUM_PRIORITIES);
+
+	EnterCriticalSection(&m_CS);
+	m_Lanes[packet->GetPriority()].push_back(packet);
+	LeaveCriticalSection(&m_CS);
+}
+
+
+Packet* PacketLanes::Pop(ULONGLONG now)
+{
+	EnterCriticalSection(&m_CS);
+
+	int lane = OpcodeTable::NUM_PRIORITIES;
+
+	if(m_Policy == POLICY_FIFO)
+	{
+		lane = FindOldest();
+	}
+	else
+	{
+		int first = 0;
+		while(first < OpcodeTable::NUM_PRIORITIES && m_Lanes[first].empty())
+		{
+			++first;
+		}
+
+		// A starving lane is only out of turn if it's not the first one with packets.
+		if(m_StarvationMs > 0)
+		{
+			lane = FindStarving(now, static_cast<ULONGLONG>(m_StarvationMs) * 1000);
+			if(lane != OpcodeTable::NUM_PRIORITIES && lane != first)
+			{
+				++m_Stats.rescued[lane];
+			}
+		}
+
+		if(lane == OpcodeTable::NUM_PRIORITIES)
+		{
+			lane = m_Policy == POLICY_STRICT ? first : PickWeighted();
+		}
+	}
+
+	Packet* packet = NULL;
+	if(lane != OpcodeTable::NUM_PRIORITIES)
+	{
+		packet = m_Lanes[lane].front();
+		m_Lanes[lane].pop_front();
+		m_LastPop[lane] = now;
+		++m_Stats.popped[lane];
+	}
+
+	LeaveCriticalSection(&m_CS);
+
+	return packet;
+}
+
+
+void PacketLanes::Clear()
+{
+	EnterCriticalSection(&m_CS);
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		for(Lane::iterator itor = m_Lanes[i].begin() ; itor != m_Lanes[i].end() ; ++itor)
+		{
+			Packet::Destroy(*itor);
+		}
+		m_Lanes[i].clear();
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void PacketLanes::GetStats(Stats& stats)
+{
+	EnterCriticalSection(&m_CS);
+
+	stats = m_Stats;
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		stats.queued[i] = static_cast<DWORD>(m_Lanes[i].size());
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+int PacketLanes::FindOldest()
+{
+	int oldest = OpcodeTable::NUM_PRIORITIES;
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		if(!m_Lanes[i].empty() && (oldest == OpcodeTable::NUM_PRIORITIES || m_Lanes[i].front()->GetQueueTime() < m_Lanes[oldest].front()->GetQueueTime()))
+		{
+			oldest = i;
+		}
+	}
+
+	return oldest;
+}
+
+
+int PacketLanes::FindStarving(ULONGLONG now, ULONGLONG limit)
+{
+	int oldest = OpcodeTable::NUM_PRIORITIES;
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		if(m_Lanes[i].empty())
+		{
+			continue;
+		}
+
+		// Workers pop with a now they took before the lock, so either can be a little ahead of it.
+		ULONGLONG queueTime = m_Lanes[i].front()->GetQueueTime();
+		ULONGLONG waited = now > queueTime ? now - queueTime : 0;
+		ULONGLONG sincePop = now > m_LastPop[i] ? now - m_LastPop[i] : 0;
+
+		// Only the age of the head would take every pop for a lane that stands, and the lanes above it would starve then.
+		if(waited >= limit && sincePop >= limit && (oldest == OpcodeTable::NUM_PRIORITIES || queueTime < m_Lanes[oldest].front()->GetQueueTime()))
+		{
+			oldest = i;
+		}
+	}
+
+	return oldest;
+}
+
+
+int PacketLanes::PickWeighted()
+{
+	// Lanes take their turns in the order of priority, and a round ends when every lane with packets has had them all.
+	for(int round = 0 ; round < 2 ; ++round)
+	{
+		for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+		{
+			if(!m_Lanes[i].empty() && m_Turns[i] > 0)
+			{
+				--m_Turns[i];
+				return i;
+			}
+		}
+
+		for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+		{
+			m_Turns[i] = m_Weights[i];
+		}
+	}
+
+	return OpcodeTable::NUM_PRIORITIES;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <Windows.h>
+#include <deque>
+
+#include "OpcodeTable.h"
+
+class Packet;
+
+// Packets waiting for workers, in a lane for each OpcodeTable::Priority. Every packet pushed is followed by one
+// worker callback, which pops whatever packet the policy picks then, so that a control or interactive packet
+// doesn't wait behind the bulk ones that came before it. Packets of a client were never handled in the order they
+// came anyway, with more than one worker. Thread-safe.
+class PacketLanes
+{
+public:
+	enum Policy
+	{
+		POLICY_FIFO,		// the oldest of all, as if there were one queue. The default.
+		POLICY_STRICT,		// the oldest of the highest priority.
+		POLICY_WEIGHTED,	// round robin, with as many turns in a round as the weight of the lane.
+	};
+
+	enum
+	{
+		DEFAULT_STARVATION_MS = 50,
+	};
+
+	struct Stats
+	{
+		DWORD queued[OpcodeTable::NUM_PRIORITIES];
+		ULONGLONG popped[OpcodeTable::NUM_PRIORITIES];
+		ULONGLONG rescued[OpcodeTable::NUM_PRIORITIES];	// popped out of turn for having starved.
+	};
+
+public:
+	PacketLanes();
+	~PacketLanes();
+
+	// Any time. Weights are of POLICY_WEIGHTED, 1 at least, and 8, 4 and 1 by default.
+	void SetPolicy(Policy policy);
+	void SetWeights(const DWORD weights[OpcodeTable::NUM_PRIORITIES]);
+	Policy GetPolicy() { return m_Policy; }
+
+	// Any time. Under POLICY_STRICT and POLICY_WEIGHTED, a lane whose head has waited this long and that hasn't
+	// been popped for as long is popped before the others, so that every lane moves at least once in the limit,
+	// even when the lanes above it keep the workers busy. 0 is no limit.
+	void SetStarvationLimit(DWORD ms) { m_StarvationMs = ms; }
+	DWORD GetStarvationLimit() { return m_StarvationMs; }
+
+	// Into the lane of packet->GetPriority(), with packet->GetQueueTime() set.
+	void Push(Packet* packet);
+	// The packet a worker takes next, now being Clock::GetMicroseconds(). NULL if there are none.
+	Packet* Pop(ULONGLONG now);
+	// Destroys the packets no worker took.
+	void Clear();
+
+	void GetStats(Stats& stats);
+
+private:
+	PacketLanes(const PacketLanes& rhs);
+	PacketLanes& operator=(const PacketLanes& rhs);
+
+	// The lane with the oldest packet at its head. NUM_PRIORITIES if they're all empty.
+	int FindOldest();
+	// The lane with the oldest head of those starving, as of SetStarvationLimit(). NUM_PRIORITIES if none is.
+	int FindStarving(ULONGLONG now, ULONGLONG limit);
+	int PickWeighted();
+
+private:
+	typedef std::deque<Packet*> Lane;
+
+	// Guarded by m_CS.
+	Lane m_Lanes[OpcodeTable::NUM_PRIORITIES];
+	DWORD m_Weights[OpcodeTable::NUM_PRIORITIES];
+	DWORD m_Turns[OpcodeTable::NUM_PRIORITIES];	// left in the round of POLICY_WEIGHTED.
+	ULONGLONG m_LastPop[OpcodeTable::NUM_PRIORITIES];	// the now of the last Pop() of each.
+	Stats m_Stats;
+	CRITICAL_SECTION m_CS;
+
+	volatile Policy m_Policy;
+	volatile DWORD m_StarvationMs;
+};
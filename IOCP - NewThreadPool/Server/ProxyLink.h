@@ -0,0 +1,68 @@
+#pragma once
+#include <Windows.h>
+#include <cassert>
+
+class Client;
+
+// The two connections of MODE_PROXY : a client the server accepted, and the connection to the backend made for it.
+// What is received on one is sent on the other, each way on its own :
+// a side isn't read from while its peer is behind in sending its bytes, and its FIN is passed on once they are all out.
+// The pair is removed together when both ways are shut down, or on any error of either.
+class ProxyLink
+{
+public:
+	enum
+	{
+		// A side isn't read from once its peer has more than PAUSE_BYTES of its bytes to send, until it's down to RESUME_BYTES.
+		PAUSE_BYTES = 256 * 1024,
+		RESUME_BYTES = 64 * 1024,
+	};
+
+public:
+	ProxyLink(Client* front, Client* back)
+	: m_Front(front),
+	  m_Back(back),
+	  m_NumShutdowns(0)
+	{
+		m_RecvPaused[0] = m_RecvPaused[1] = 0;
+		m_ShutdownPending[0] = m_ShutdownPending[1] = false;
+	}
+
+	Client* GetFront() { return m_Front; }
+	Client* GetBack() { return m_Back; }
+	Client* GetPeer(Client* client) { return GetSide(client) == 0 ? m_Back : m_Front; }
+
+	// Returns the previous state.
+	bool SetRecvPaused(Client* client, bool paused) { return InterlockedExchange(&m_RecvPaused[GetSide(client)], paused ? 1 : 0) != 0; }
+	bool IsRecvPaused(Client* client) { return m_RecvPaused[GetSide(client)] != 0; }
+
+	// The send side of the client is shut down once its queued sends are out. Both with its send queue locked.
+	void SetShutdownPending(Client* client) { m_ShutdownPending[GetSide(client)] = true; }
+	bool TakeShutdownPending(Client* client)
+	{
+		bool pending = m_ShutdownPending[GetSide(client)];
+		m_ShutdownPending[GetSide(client)] = false;
+		return pending;
+	}
+
+	// Call when a side has been shut down. Returns true when both ways are.
+	bool OnShutdown() { return InterlockedIncrement(&m_NumShutdowns) == 2; }
+
+private:
+	int GetSide(Client* client)
+	{
+		assert(client == m_Front || client == m_Back);
+		return client == m_Front ? 0 : 1;
+	}
+
+private:
+	ProxyLink(const ProxyLink& rhs);
+	ProxyLink& operator=(const ProxyLink& rhs);
+
+private:
+	Client* m_Front;
+	Client* m_Back;
+	volatile LONG m_RecvPaused[2];
+	bool m_ShutdownPending[2];
+	volatile LONG m_NumShutdowns;
+};
@@ -0,0 +1,406 @@
+#include "PubSub.h"
+
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+
+namespace
+{
+	// A channel table, a channel or a subscriber set found by a reader stays valid until the reader leaves.
+	// Writers retire what they replace or remove, and reclaim it after a grace period.
+	template <typename T> T* ReplacePointer(T* volatile& target, T* value)
+	{
+		return static_cast<T*>(InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&target), value));
+	}
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+/* static */ PubSub::SubscriberSet* PubSub::NewSubscriberSet(DWORD count)
+{
+	size_t size = sizeof(SubscriberSet) + (count > 0 ? count - 1 : 0) * sizeof(Client*);
+	SubscriberSet* set = static_cast<SubscriberSet*>(malloc(size));
+	set->count = count;
+	return set;
+}
+
+
+/* static */ PubSub::ChannelTable* PubSub::NewChannelTable(DWORD count)
+{
+	size_t size = sizeof(ChannelTable) + (count > 0 ? count - 1 : 0) * sizeof(Channel*);
+	ChannelTable* table = static_cast<ChannelTable*>(malloc(size));
+	table->count = count;
+	return table;
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+PubSub::PubSub()
+: m_Channels(NewChannelTable(0)),
+  m_TableChanged(false),
+  m_Epoch(0)
+{
+	m_Readers[0] = 0;
+	m_Readers[1] = 0;
+
+	InitializeCriticalSection(&m_CSForWriters);
+	InitializeCriticalSection(&m_CSForFlush);
+}
+
+
+PubSub::~PubSub()
+{
+	// Every channel of the table is here too.
+	for(ChannelMap::iterator itor = m_WriterChannels.begin() ; itor != m_WriterChannels.end() ; ++itor)
+	{
+		free(itor->second->subscribers);
+		delete itor->second;
+	}
+	free(m_Channels);
+
+	DeleteCriticalSection(&m_CSForFlush);
+	DeleteCriticalSection(&m_CSForWriters);
+}
+
+
+bool PubSub::Subscribe(DWORD channelId, Client* client)
+{
+	assert(client);
+
+	EnterCriticalSection(&m_CSForWriters);
+
+	bool added = false;
+
+	Channel* channel = GetOrAddChannel(channelId);
+	if(channel != NULL)
+	{
+		std::vector<Client*>& members = channel->members;
+		std::vector<Client*>::iterator pos = std::lower_bound(members.begin(), members.end(), client);
+
+		added = (pos == members.end() || *pos != client);
+		if(added)
+		{
+			members.insert(pos, client);
+			SetChanged(channel);
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForWriters);
+
+	return added;
+}
+
+
+bool PubSub::Unsubscribe(DWORD channelId, Client* client)
+{
+	assert(client);
+
+	EnterCriticalSection(&m_CSForWriters);
+
+	bool removed = false;
+
+	ChannelMap::iterator itor = m_WriterChannels.find(channelId);
+	if(itor != m_WriterChannels.end())
+	{
+		Channel* channel = itor->second;
+
+		std::vector<Client*>& members = channel->members;
+		std::vector<Client*>::iterator pos = std::lower_bound(members.begin(), members.end(), client);
+
+		if(pos != members.end() && *pos == client)
+		{
+			members.erase(pos);
+			SetChanged(channel);
+
+			removed = true;
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForWriters);
+
+	return removed;
+}
+
+
+void PubSub::UnsubscribeAll(Client* client, std::vector<DWORD>* channels)
+{
+	assert(client);
+
+	EnterCriticalSection(&m_CSForWriters);
+
+	for(ChannelMap::iterator itor = m_WriterChannels.begin() ; itor != m_WriterChannels.end() ; ++itor)
+	{
+		Channel* channel = itor->second;
+
+		std::vector<Client*>& members = channel->members;
+		std::vector<Client*>::iterator pos = std::lower_bound(members.begin(), members.end(), client);
+
+		if(pos != members.end() && *pos == client)
+		{
+			members.erase(pos);
+			SetChanged(channel);
+
+			if(channels != NULL)
+			{
+				channels->push_back(channel->id);
+			}
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForWriters);
+
+	// Publishers may still see the client until then.
+	Flush();
+}
+
+
+void PubSub::Flush()
+{
+	EnterCriticalSection(&m_CSForFlush);
+	EnterCriticalSection(&m_CSForWriters);
+
+	Retired retired;
+
+	// One copy per channel, however many changes it had.
+	for(size_t i = 0 ; i < m_Changed.size() ; ++i)
+	{
+		Channel* channel = m_Changed[i];
+		channel->changed = false;
+
+		if(channel->members.empty())
+		{
+			m_WriterChannels.erase(channel->id);
+			retired.channels.push_back(channel);
+			m_TableChanged = true;
+		}
+		else
+		{
+			SubscriberSet* newSet = NewSubscriberSet(static_cast<DWORD>(channel->members.size()));
+			std::copy(channel->members.begin(), channel->members.end(), newSet->clients);
+
+			retired.sets.push_back(ReplacePointer(channel->subscribers, newSet));
+		}
+	}
+	m_Changed.clear();
+
+	// Channels added or gone. The map is sorted by id as the table has to be.
+	if(m_TableChanged)
+	{
+		ChannelTable* newTable = NewChannelTable(static_cast<DWORD>(m_WriterChannels.size()));
+
+		DWORD index = 0;
+		for(ChannelMap::iterator itor = m_WriterChannels.begin() ; itor != m_WriterChannels.end() ; ++itor)
+		{
+			newTable->channels[index++] = itor->second;
+		}
+
+		retired.tables.push_back(ReplacePointer(m_Channels, newTable));
+		m_TableChanged = false;
+	}
+
+	LeaveCriticalSection(&m_CSForWriters);
+
+	// Writers go on meanwhile. Their changes are published by the next Flush().
+	Reclaim(retired);
+
+	LeaveCriticalSection(&m_CSForFlush);
+}
+
+
+size_t PubSub::Publish(DWORD channelId, Packet* packet, DeliverFunc deliver, void* context)
+{
+	assert(packet);
+	assert(deliver);
+
+	size_t delivered = 0;
+
+	LONG epoch = EnterRead();
+
+	Channel* channel = FindChannel(channelId);
+	if(channel != NULL)
+	{
+		SubscriberSet* set = channel->subscribers;
+		for(DWORD i = 0 ; i < set->count ; ++i)
+		{
+			deliver(context, set->clients[i], packet);
+		}
+		delivered = set->count;
+	}
+
+	LeaveRead(epoch);
+
+	return delivered;
+}
+
+
+size_t PubSub::GetNumChannels()
+{
+	// The table may be replaced and freed meanwhile.
+	LONG epoch = EnterRead();
+	size_t count = m_Channels->count;
+	LeaveRead(epoch);
+
+	return count;
+}
+
+
+size_t PubSub::GetNumSubscribers(DWORD channelId)
+{
+	size_t count = 0;
+
+	LONG epoch = EnterRead();
+
+	Channel* channel = FindChannel(channelId);
+	if(channel != NULL)
+	{
+		count = channel->subscribers->count;
+	}
+
+	LeaveRead(epoch);
+
+	return count;
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+PubSub::Channel* PubSub::FindChannel(DWORD channelId)
+{
+	ChannelTable* table = m_Channels;
+
+	// Binary search on the sorted ids.
+	DWORD low = 0, high = table->count;
+	while(low < high)
+	{
+		DWORD mid = (low + high) / 2;
+		DWORD id = table->channels[mid]->id;
+
+		if(id < channelId)
+		{
+			low = mid + 1;
+		}
+		else if(id > channelId)
+		{
+			high = mid;
+		}
+		else
+		{
+			return table->channels[mid];
+		}
+	}
+
+	return NULL;
+}
+
+
+PubSub::Channel* PubSub::GetOrAddChannel(DWORD channelId)
+{
+	ChannelMap::iterator itor = m_WriterChannels.find(channelId);
+	if(itor != m_WriterChannels.end())
+	{
+		return itor->second;
+	}
+
+	if(m_WriterChannels.size() >= MAX_CHANNELS)
+	{
+		return NULL;
+	}
+
+	// Publishers see it once it's in the table.
+	Channel* channel = new Channel;
+	channel->id = channelId;
+	channel->subscribers = NewSubscriberSet(0);
+	channel->changed = false;
+
+	m_WriterChannels.insert(ChannelMap::value_type(channelId, channel));
+	m_TableChanged = true;
+
+	return channel;
+}
+
+
+void PubSub::SetChanged(Channel* channel)
+{
+	if(!channel->changed)
+	{
+		channel->changed = true;
+		m_Changed.push_back(channel);
+	}
+}
+
+
+void PubSub::Reclaim(Retired& retired)
+{
+	if(retired.sets.empty() && retired.tables.empty() && retired.channels.empty())
+	{
+		return;
+	}
+
+	Synchronize();
+
+	for(size_t i = 0 ; i < retired.sets.size() ; ++i)
+	{
+		free(retired.sets[i]);
+	}
+	for(size_t i = 0 ; i < retired.tables.size() ; ++i)
+	{
+		free(retired.tables[i]);
+	}
+	for(size_t i = 0 ; i < retired.channels.size() ; ++i)
+	{
+		free(retired.channels[i]->subscribers);
+		delete retired.channels[i];
+	}
+
+	retired.sets.clear();
+	retired.tables.clear();
+	retired.channels.clear();
+}
+
+
+LONG PubSub::EnterRead()
+{
+	for(;;)
+	{
+		LONG epoch = m_Epoch;
+		InterlockedIncrement(&m_Readers[epoch & 1]);
+
+		// If a writer flipped the epoch in between, it may not wait for us. Try again.
+		if(epoch == m_Epoch)
+		{
+			return epoch;
+		}
+
+		InterlockedDecrement(&m_Readers[epoch & 1]);
+	}
+}
+
+
+void PubSub::LeaveRead(LONG epoch)
+{
+	InterlockedDecrement(&m_Readers[epoch & 1]);
+}
+
+
+void PubSub::Synchronize()
+{
+	// Readers that got in before the flip can still see the old pointers. Wait them out.
+	// Readers after the flip load the new pointers.
+	LONG epoch = m_Epoch;
+	InterlockedExchange(&m_Epoch, epoch + 1);
+
+	int spins = 0;
+	while(m_Readers[epoch & 1] != 0)
+	{
+		if(++spins < 1000)
+		{
+			YieldProcessor();
+		}
+		else
+		{
+			SwitchToThread();
+		}
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+#include <map>
+
+class Client;
+class Packet;
+
+// Channels of subscribers for fan-out.
+// Subscriber sets are immutable arrays replaced on every change (copy-on-write),
+// and old ones are reclaimed once no publisher can see them (epoch based, RCU style).
+// So Publish() never takes a lock. Subscribe() and Unsubscribe() only change the members that writers see,
+// and Flush() publishes all the changes since the last one with one copy per channel and one grace period.
+// A channel goes away with its last subscriber, the same way.
+// Clients are only compared and handed to the deliver function. They are never dereferenced here.
+class PubSub
+{
+public:
+	typedef void (*DeliverFunc)(void* context, Client* client, Packet* packet);
+
+	enum
+	{
+		// Most channels with subscribers at a time.
+		MAX_CHANNELS = 64 * 1024,
+	};
+
+public:
+	PubSub();
+	~PubSub();
+
+	// Returns false if the client was already in the channel, or if the channel is new and there are MAX_CHANNELS.
+	// Publish() sees the change after the next Flush().
+	bool Subscribe(DWORD channel, Client* client);
+	bool Unsubscribe(DWORD channel, Client* client);
+	// Flushes, so nothing is delivered to the client once this returns.
+	// The channels the client was in are added to channels, if it's given.
+	void UnsubscribeAll(Client* client, std::vector<DWORD>* channels = NULL);
+
+	// Waits for a grace period if there's anything to publish. So not with a lock that a deliver function takes.
+	void Flush();
+
+	// Calls deliver for every subscriber of the channel. Returns how many there were.
+	size_t Publish(DWORD channel, Packet* packet, DeliverFunc deliver, void* context);
+
+	size_t GetNumChannels();
+	size_t GetNumSubscribers(DWORD channel);
+
+private:
+	struct SubscriberSet
+	{
+		DWORD count;
+		Client* clients[1]; // sorted, count entries.
+	};
+
+	struct Channel
+	{
+		DWORD id;
+		SubscriberSet* volatile subscribers;
+
+		// Only seen by writers.
+		std::vector<Client*> members; // sorted.
+		bool changed;
+	};
+
+	typedef std::map<DWORD, Channel*> ChannelMap;
+
+	struct ChannelTable
+	{
+		DWORD count;
+		Channel* channels[1]; // sorted by id, count entries.
+	};
+
+	// What was replaced, for readers that may still see it. Freed after the next grace period.
+	struct Retired
+	{
+		std::vector<SubscriberSet*> sets;
+		std::vector<ChannelTable*> tables;
+		std::vector<Channel*> channels;
+	};
+
+	static SubscriberSet* NewSubscriberSet(DWORD count);
+	static ChannelTable* NewChannelTable(DWORD count);
+
+	Channel* FindChannel(DWORD channel);
+	// Only called by writers. NULL if there are MAX_CHANNELS.
+	Channel* GetOrAddChannel(DWORD channel);
+	void SetChanged(Channel* channel);
+
+	// Waits out the readers, then frees what was retired.
+	void Reclaim(Retired& retired);
+
+	// Read side. Returns the epoch to pass to LeaveRead().
+	LONG EnterRead();
+	void LeaveRead(LONG epoch);
+
+	// Write side. Waits until no reader can still see what was replaced before this call.
+	void Synchronize();
+
+private:
+	PubSub(const PubSub& rhs);
+	PubSub& operator=(const PubSub& rhs);
+
+private:
+	// What Publish() sees.
+	ChannelTable* volatile m_Channels;
+
+	// What writers see. Every channel of m_Channels is here, and the ones added since the last Flush().
+	ChannelMap m_WriterChannels;
+	std::vector<Channel*> m_Changed;
+	bool m_TableChanged;
+
+	volatile LONG m_Epoch;
+	volatile LONG m_Readers[2];
+
+	// Lock order : m_CSForFlush, then m_CSForWriters. Readers are waited for with only the former.
+	CRITICAL_SECTION m_CSForWriters;
+	CRITICAL_SECTION m_CSForFlush;
+};
@@ -0,0 +1,305 @@
+#include "RateLimiter.h"
+#include "CacheLine.h"
+
+#include <cassert>
+#include <emmintrin.h>
+
+using namespace std;
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+RateLimiter::Buckets::Buckets()
+: m_NumPages(0)
+{
+	ZeroMemory(m_Pages, sizeof(m_Pages));
+}
+
+
+RateLimiter::Buckets::~Buckets()
+{
+	for(DWORD i = 0 ; i < m_NumPages ; ++i)
+	{
+		_aligned_free(m_Pages[i]);
+	}
+}
+
+
+bool RateLimiter::Buckets::Reset(DWORD index, LONG level)
+{
+	assert(index < MAX_PAGES * PAGE_SIZE);
+
+	while(index / PAGE_SIZE >= m_NumPages)
+	{
+		Page* page = static_cast<Page*>(_aligned_malloc(sizeof(Page), CACHE_LINE_SIZE));
+		if(page == NULL)
+		{
+			return false;
+		}
+		ZeroMemory(page, sizeof(Page));
+
+		m_Pages[m_NumPages++] = page;
+	}
+
+	// The spent of the slot's last owner stays. Only the difference counts.
+	Page* page = m_Pages[index / PAGE_SIZE];
+	page->credits[index % PAGE_SIZE] = page->spent[index % PAGE_SIZE] + level;
+
+	return true;
+}
+
+
+void RateLimiter::Buckets::Refill(LONG amount, LONG burst, bool useSimd)
+{
+	if(amount <= 0)
+	{
+		return;
+	}
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i amounts = _mm_set1_epi32(amount);
+	const __m128i bursts = _mm_set1_epi32(burst);
+
+	for(DWORD p = 0 ; p < m_NumPages ; ++p)
+	{
+		Page* page = m_Pages[p];
+
+		// Free slots are refilled too. It's cheaper than skipping them, and Reset() sets them anyway.
+		DWORD i = 0;
+		if(useSimd)
+		{
+			for( ; i + 4 <= PAGE_SIZE ; i += 4)
+			{
+				__m128i* credits = reinterpret_cast<__m128i*>(const_cast<LONG*>(page->credits + i));
+				__m128i c = _mm_load_si128(credits);
+				__m128i level = _mm_sub_epi32(c, _mm_load_si128(reinterpret_cast<const __m128i*>(const_cast<LONG*>(page->spent + i))));
+
+				// min(max(burst - level, 0), amount). SSE2 has no min and max of 32-bit integers.
+				__m128i room = _mm_sub_epi32(bursts, level);
+				room = _mm_and_si128(room, _mm_cmpgt_epi32(room, zero));
+				__m128i less = _mm_cmplt_epi32(room, amounts);
+				__m128i add = _mm_or_si128(_mm_and_si128(less, room), _mm_andnot_si128(less, amounts));
+
+				_mm_store_si128(credits, _mm_add_epi32(c, add));
+			}
+		}
+
+		for( ; i < PAGE_SIZE ; ++i)
+		{
+			LONG room = burst - (page->credits[i] - page->spent[i]);
+			if(room > 0)
+			{
+				page->credits[i] += room < amount ? room : amount;
+			}
+		}
+	}
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+RateLimiter::RateLimiter()
+: m_Enabled(false),
+  m_UseSimd(true),
+  m_ConnectionOverRate(0),
+  m_AddressOverRate(0)
+{
+	ZeroMemory(m_Rates, sizeof(m_Rates));
+	ZeroMemory(m_Carry, sizeof(m_Carry));
+}
+
+
+RateLimiter::~RateLimiter()
+{
+}
+
+
+bool RateLimiter::SetLimits(const Limits& connection, const Limits& address)
+{
+	if(connection.messages > MAX_RATE || connection.bytes > MAX_RATE || address.messages > MAX_RATE || address.bytes > MAX_RATE)
+	{
+		return false;
+	}
+
+	m_Rates[CONNECTION_MESSAGES] = connection.messages;
+	m_Rates[CONNECTION_BYTES] = connection.bytes;
+	m_Rates[ADDRESS_MESSAGES] = address.messages;
+	m_Rates[ADDRESS_BYTES] = address.bytes;
+
+	m_Enabled = false;
+	for(int kind = 0 ; kind < NUM_KINDS ; ++kind)
+	{
+		m_Enabled = m_Enabled || m_Rates[kind] > 0;
+	}
+
+	return true;
+}
+
+
+bool RateLimiter::AddConnection(DWORD slot, const IN6_ADDR& address, DWORD& addressSlot)
+{
+	addressSlot = NO_ADDRESS;
+
+	for(int kind = CONNECTION_MESSAGES ; kind <= CONNECTION_BYTES ; ++kind)
+	{
+		if(m_Rates[kind] > 0 && !m_Buckets[kind].Reset(slot, m_Rates[kind]))
+		{
+			return false;
+		}
+	}
+
+	if(m_Rates[ADDRESS_MESSAGES] == 0 && m_Rates[ADDRESS_BYTES] == 0)
+	{
+		return true;
+	}
+
+	AddressKey key;
+	CopyMemory(&key.first, &address.s6_addr[0], sizeof(key.first));
+	CopyMemory(&key.second, &address.s6_addr[8], sizeof(key.second));
+
+	AddressMap::iterator itor = m_Addresses.find(key);
+	if(itor != m_Addresses.end())
+	{
+		++itor->second.connections;
+		addressSlot = itor->second.slot;
+		return true;
+	}
+
+	DWORD newSlot = NO_ADDRESS;
+	if(!m_FreeAddressSlots.empty())
+	{
+		newSlot = m_FreeAddressSlots.back();
+		m_FreeAddressSlots.pop_back();
+	}
+	else if(m_AddressKeys.size() < MAX_PAGES * PAGE_SIZE)
+	{
+		newSlot = static_cast<DWORD>(m_AddressKeys.size());
+		m_AddressKeys.push_back(key);
+	}
+	else
+	{
+		return true;
+	}
+
+	for(int kind = ADDRESS_MESSAGES ; kind <= ADDRESS_BYTES ; ++kind)
+	{
+		if(m_Rates[kind] > 0 && !m_Buckets[kind].Reset(newSlot, m_Rates[kind]))
+		{
+			m_FreeAddressSlots.push_back(newSlot);
+			return true;
+		}
+	}
+
+	m_AddressKeys[newSlot] = key;
+
+	AddressEntry entry = { newSlot, 1 };
+	m_Addresses.insert(make_pair(key, entry));
+
+	addressSlot = newSlot;
+	return true;
+}
+
+
+void RateLimiter::RemoveConnection(DWORD /* slot */, DWORD addressSlot)
+{
+	// The connection's buckets are reset by the next one in the slot.
+	if(addressSlot == NO_ADDRESS)
+	{
+		return;
+	}
+
+	AddressMap::iterator itor = m_Addresses.find(m_AddressKeys[addressSlot]);
+	assert(itor != m_Addresses.end());
+
+	if(--itor->second.connections == 0)
+	{
+		m_Addresses.erase(itor);
+		m_FreeAddressSlots.push_back(addressSlot);
+	}
+}
+
+
+bool RateLimiter::Charge(DWORD slot, DWORD addressSlot, DWORD messages, DWORD bytes)
+{
+	const LONG counts[NUM_KINDS] = { static_cast<LONG>(messages), static_cast<LONG>(bytes), static_cast<LONG>(messages), static_cast<LONG>(bytes) };
+
+	// Everything is charged, even past the first bucket that goes into debt. It has all been received.
+	bool connectionUnder = true;
+	for(int kind = CONNECTION_MESSAGES ; kind <= CONNECTION_BYTES ; ++kind)
+	{
+		if(m_Rates[kind] > 0 && !m_Buckets[kind].Take(slot, counts[kind]))
+		{
+			connectionUnder = false;
+		}
+	}
+
+	bool addressUnder = true;
+	if(addressSlot != NO_ADDRESS)
+	{
+		for(int kind = ADDRESS_MESSAGES ; kind <= ADDRESS_BYTES ; ++kind)
+		{
+			if(m_Rates[kind] > 0 && !m_Buckets[kind].Take(addressSlot, counts[kind]))
+			{
+				addressUnder = false;
+			}
+		}
+	}
+
+	if(!connectionUnder)
+	{
+		InterlockedIncrement64(&m_ConnectionOverRate);
+	}
+	if(!addressUnder)
+	{
+		InterlockedIncrement64(&m_AddressOverRate);
+	}
+
+	return connectionUnder && addressUnder;
+}
+
+
+bool RateLimiter::IsUnderRate(DWORD slot, DWORD addressSlot)
+{
+	for(int kind = 0 ; kind < NUM_KINDS ; ++kind)
+	{
+		DWORD index = kind < ADDRESS_MESSAGES ? slot : addressSlot;
+		if(m_Rates[kind] > 0 && index != NO_ADDRESS && m_Buckets[kind].GetLevel(index) < 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void RateLimiter::Refill(DWORD elapsedMs)
+{
+	for(int kind = 0 ; kind < NUM_KINDS ; ++kind)
+	{
+		if(m_Rates[kind] == 0)
+		{
+			continue;
+		}
+
+		// Nothing is lost to rounding when the timer is faster than a token.
+		ULONGLONG total = static_cast<ULONGLONG>(m_Rates[kind]) * elapsedMs + m_Carry[kind];
+		ULONGLONG amount = total / 1000;
+		m_Carry[kind] = total % 1000;
+
+		if(amount > static_cast<ULONGLONG>(m_Rates[kind]))
+		{
+			amount = m_Rates[kind];
+		}
+
+		m_Buckets[kind].Refill(static_cast<LONG>(amount), m_Rates[kind], m_UseSimd);
+	}
+}
+
+
+void RateLimiter::GetStats(Stats& stats)
+{
+	stats.addresses = static_cast<DWORD>(m_Addresses.size());
+	stats.connectionOverRate = m_ConnectionOverRate;
+	stats.addressOverRate = m_AddressOverRate;
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <winsock2.h>
+#include <Ws2tcpip.h>
+#include <vector>
+#include <utility>
+#include <boost/unordered_map.hpp>
+
+// Token buckets of messages and bytes per second, for each connection and for each address they come from.
+// A bucket is credits minus spent. Charge() adds to spent with an interlocked add on any thread, and only Refill()
+// and the adds put in credits, so the two never write the same word. What's charged has been received already,
+// so a charge can take a bucket into debt, and the connection is over its rate until refills pay it back.
+// Buckets are in arrays per field (SoA), in pages that are never moved, and Refill() goes over them with SSE2.
+// SetLimits(), AddConnection(), RemoveConnection() and Refill() are not thread-safe. Server calls them with m_CSForClients held.
+class RateLimiter
+{
+public:
+	enum
+	{
+		NO_ADDRESS = 0xFFFFFFFF,
+
+		PAGE_SIZE = 4096,
+		MAX_PAGES = 256,	// 1M connections, and as many addresses.
+
+		// So that a second's worth and the debt of a recv stay far from wrapping around.
+		MAX_RATE = 1 << 30,
+	};
+
+	// Per second. 0 is no limit.
+	struct Limits
+	{
+		DWORD messages;
+		DWORD bytes;
+	};
+
+	struct Stats
+	{
+		DWORD addresses;
+		ULONGLONG connectionOverRate;	// charges that took a connection over.
+		ULONGLONG addressOverRate;		// charges that took an address over.
+	};
+
+public:
+	RateLimiter();
+	~RateLimiter();
+
+	// Buckets hold a second's worth and start full. Returns false if a rate is over MAX_RATE.
+	bool SetLimits(const Limits& connection, const Limits& address);
+	bool IsEnabled() { return m_Enabled; }
+
+	// slot is the connection's in ConnectionTable. addressSlot is NO_ADDRESS when addresses aren't limited,
+	// or there are too many of them. Returns false if memory ran out for the connection's buckets.
+	bool AddConnection(DWORD slot, const IN6_ADDR& address, DWORD& addressSlot);
+	void RemoveConnection(DWORD slot, DWORD addressSlot);
+
+	// For the messages and bytes of a recv. Returns false if the connection or its address is over its rate after.
+	bool Charge(DWORD slot, DWORD addressSlot, DWORD messages, DWORD bytes);
+	// Whether the connection and its address are both within their rates again.
+	bool IsUnderRate(DWORD slot, DWORD addressSlot);
+
+	// Adds what elapsedMs is worth to every bucket, up to a second's worth.
+	void Refill(DWORD elapsedMs);
+
+	void GetStats(Stats& stats);
+
+	// SSE2 is on by default. Off is for comparing in benchmarks.
+	void EnableSimd(bool enable) { m_UseSimd = enable; }
+
+private:
+	enum Kind
+	{
+		CONNECTION_MESSAGES,
+		CONNECTION_BYTES,
+		ADDRESS_MESSAGES,
+		ADDRESS_BYTES,
+		NUM_KINDS,
+	};
+
+	// A kind of bucket for every slot.
+	class Buckets
+	{
+	public:
+		Buckets();
+		~Buckets();
+
+		// Fills the bucket, making room for it. Returns false if memory ran out.
+		bool Reset(DWORD index, LONG level);
+
+		// Returns false if the bucket is in debt after.
+		bool Take(DWORD index, LONG count)
+		{
+			Page* page = m_Pages[index / PAGE_SIZE];
+			LONG spent = InterlockedExchangeAdd(&page->spent[index % PAGE_SIZE], count) + count;
+			return page->credits[index % PAGE_SIZE] - spent >= 0;
+		}
+
+		LONG GetLevel(DWORD index)
+		{
+			Page* page = m_Pages[index / PAGE_SIZE];
+			return page->credits[index % PAGE_SIZE] - page->spent[index % PAGE_SIZE];
+		}
+
+		void Refill(LONG amount, LONG burst, bool useSimd);
+
+	private:
+		struct Page
+		{
+			volatile LONG credits[PAGE_SIZE];
+			volatile LONG spent[PAGE_SIZE];
+		};
+
+	private:
+		Buckets(const Buckets& rhs);
+		Buckets& operator=(const Buckets& rhs);
+
+	private:
+		Page* m_Pages[MAX_PAGES];
+		DWORD m_NumPages;
+	};
+
+	// 16 bytes of IN6_ADDR.
+	typedef std::pair<ULONGLONG, ULONGLONG> AddressKey;
+
+	struct AddressEntry
+	{
+		DWORD slot;
+		DWORD connections;
+	};
+
+	typedef boost::unordered_map<AddressKey, AddressEntry> AddressMap;
+
+private:
+	RateLimiter(const RateLimiter& rhs);
+	RateLimiter& operator=(const RateLimiter& rhs);
+
+private:
+	bool m_Enabled;
+	bool m_UseSimd;
+	LONG m_Rates[NUM_KINDS];
+	ULONGLONG m_Carry[NUM_KINDS];	// thousandths of a token left over from the refills so far.
+	Buckets m_Buckets[NUM_KINDS];
+
+	AddressMap m_Addresses;
+	std::vector<AddressKey> m_AddressKeys;	// by slot.
+	std::vector<DWORD> m_FreeAddressSlots;
+
+	volatile LONGLONG m_ConnectionOverRate;
+	volatile LONGLONG m_AddressOverRate;
+};
@@ -0,0 +1,453 @@
+#include "RespSession.h"
+#include "KeyValueStore.h"
+
+#include <cassert>
+
+using namespace std;
+
+
+namespace
+{
+	// Longest "*<count>\r\n" or "$<size>\r\n" there can be, with a sign and 20 digits.
+	const DWORD MAX_LINE_SIZE = 24;
+
+	// Of a command name in an error reply.
+	const DWORD MAX_NAME_IN_REPLY = 64;
+}
+
+
+RespSession::RespSession()
+{
+}
+
+
+RespSession::Result RespSession::Feed(const BYTE* data, DWORD size, KeyValueStore& store, DWORD& numCommands)
+{
+	numCommands = 0;
+
+	// Finish the split command first. Whole commands after it are read in place.
+	if(!m_Pending.empty())
+	{
+		m_Pending.insert(m_Pending.end(), data, data + size);
+		data = &m_Pending[0];
+		size = static_cast<DWORD>(m_Pending.size());
+	}
+
+	Result result = OK;
+
+	DWORD offset = 0;
+	while(offset < size)
+	{
+		DWORD consumed = 0;
+		ParseResult parsed = Parse(data + offset, size - offset, consumed);
+		if(parsed == INCOMPLETE)
+		{
+			break;
+		}
+
+		if(parsed == MALFORMED)
+		{
+			ReplyText('-', "ERR Protocol error");
+			result = PROTOCOL_ERROR;
+			break;
+		}
+
+		offset += consumed;
+
+		// An empty array or line is no command.
+		if(!m_Args.empty())
+		{
+			Run(store);
+			++numCommands;
+		}
+	}
+
+	if(result == OK && size - offset > MAX_PENDING_SIZE)
+	{
+		ReplyText('-', "ERR Protocol error: command too big");
+		result = PROTOCOL_ERROR;
+	}
+
+	if(result != OK)
+	{
+		m_Pending.clear();
+	}
+	else if(!m_Pending.empty())
+	{
+		// data points into m_Pending itself.
+		m_Pending.erase(m_Pending.begin(), m_Pending.begin() + offset);
+	}
+	else
+	{
+		m_Pending.assign(data + offset, data + size);
+	}
+
+	return result;
+}
+
+
+void RespSession::ClearReply()
+{
+	if(m_Reply.capacity() > KEEP_REPLY_SIZE)
+	{
+		vector<BYTE>().swap(m_Reply);
+	}
+	else
+	{
+		m_Reply.clear();
+	}
+}
+
+
+RespSession::ParseResult RespSession::Parse(const BYTE* data, DWORD size, DWORD& consumed)
+{
+	assert(size > 0);
+
+	if(data[0] != '*')
+	{
+		return ParseInline(data, size, consumed);
+	}
+
+	m_Args.clear();
+
+	DWORD offset = 0;
+	LONGLONG count = 0;
+
+	ParseResult result = ParseLine(data, size, '*', offset, count);
+	if(result != PARSED)
+	{
+		return result;
+	}
+
+	if(count > MAX_ARGS)
+	{
+		return MALFORMED;
+	}
+
+	for(LONGLONG i = 0 ; i < count ; ++i)
+	{
+		LONGLONG length = 0;
+		result = ParseLine(data, size, '$', offset, length);
+		if(result != PARSED)
+		{
+			return result;
+		}
+
+		if(length < 0 || length > MAX_BULK_SIZE)
+		{
+			return MALFORMED;
+		}
+
+		DWORD argSize = static_cast<DWORD>(length);
+		if(size - offset < argSize + 2)
+		{
+			return INCOMPLETE;
+		}
+
+		if(data[offset + argSize] != '\r' || data[offset + argSize + 1] != '\n')
+		{
+			return MALFORMED;
+		}
+
+		Arg arg = { data + offset, argSize };
+		m_Args.push_back(arg);
+
+		offset += argSize + 2;
+	}
+
+	consumed = offset;
+	return PARSED;
+}
+
+
+RespSession::ParseResult RespSession::ParseInline(const BYTE* data, DWORD size, DWORD& consumed)
+{
+	const BYTE* newLine = static_cast<const BYTE*>(memchr(data, '\n', size));
+	if(newLine == NULL)
+	{
+		return INCOMPLETE;
+	}
+
+	consumed = static_cast<DWORD>(newLine - data) + 1;
+
+	DWORD lineSize = consumed - 1;
+	if(lineSize > 0 && data[lineSize - 1] == '\r')
+	{
+		--lineSize;
+	}
+
+	m_Args.clear();
+
+	DWORD i = 0;
+	while(i < lineSize)
+	{
+		while(i < lineSize && (data[i] == ' ' || data[i] == '\t'))
+		{
+			++i;
+		}
+
+		DWORD start = i;
+		while(i < lineSize && data[i] != ' ' && data[i] != '\t')
+		{
+			++i;
+		}
+
+		if(i > start)
+		{
+			Arg arg = { data + start, i - start };
+			m_Args.push_back(arg);
+		}
+	}
+
+	return PARSED;
+}
+
+
+RespSession::ParseResult RespSession::ParseLine(const BYTE* data, DWORD size, BYTE prefix, DWORD& offset, LONGLONG& value)
+{
+	if(offset == size)
+	{
+		return INCOMPLETE;
+	}
+
+	if(data[offset] != prefix)
+	{
+		return MALFORMED;
+	}
+
+	DWORD end = offset + 1;
+	while(end < size && data[end] != '\r')
+	{
+		if(end - offset > MAX_LINE_SIZE)
+		{
+			return MALFORMED;
+		}
+		++end;
+	}
+
+	if(end + 1 >= size)
+	{
+		return INCOMPLETE;
+	}
+
+	if(data[end + 1] != '\n' || !KeyValueStore::ParseInteger(data + offset + 1, end - offset - 1, value))
+	{
+		return MALFORMED;
+	}
+
+	offset = end + 2;
+	return PARSED;
+}
+
+
+void RespSession::Run(KeyValueStore& store)
+{
+	assert(!m_Args.empty());
+
+	DWORD numArgs = static_cast<DWORD>(m_Args.size());
+
+	if(IsCommand("GET"))
+	{
+		if(numArgs != 2)
+		{
+			ReplyWrongArity();
+		}
+		else if(!store.Get(m_Args[1].data, m_Args[1].size, RespSession::OnValue, this))
+		{
+			ReplyNull();
+		}
+	}
+	else if(IsCommand("SET"))
+	{
+		// No options like EX or NX.
+		if(numArgs < 3)
+		{
+			ReplyWrongArity();
+		}
+		else if(numArgs > 3)
+		{
+			ReplyText('-', "ERR syntax error");
+		}
+		else if(!store.Set(m_Args[1].data, m_Args[1].size, m_Args[2].data, m_Args[2].size))
+		{
+			ReplyText('-', "OOM could not store the value");
+		}
+		else
+		{
+			ReplyText('+', "OK");
+		}
+	}
+	else if(IsCommand("DEL"))
+	{
+		if(numArgs < 2)
+		{
+			ReplyWrongArity();
+		}
+		else
+		{
+			LONGLONG deleted = 0;
+			for(DWORD i = 1 ; i < numArgs ; ++i)
+			{
+				if(store.Delete(m_Args[i].data, m_Args[i].size))
+				{
+					++deleted;
+				}
+			}
+			ReplyInteger(':', deleted);
+		}
+	}
+	else if(IsCommand("INCR"))
+	{
+		LONGLONG value = 0;
+
+		if(numArgs != 2)
+		{
+			ReplyWrongArity();
+		}
+		else
+		{
+			switch(store.Increment(m_Args[1].data, m_Args[1].size, 1, value))
+			{
+			case KeyValueStore::INCREMENT_OK:				ReplyInteger(':', value); break;
+			case KeyValueStore::INCREMENT_NOT_INTEGER:		ReplyText('-', "ERR value is not an integer or out of range"); break;
+			case KeyValueStore::INCREMENT_OVERFLOW:			ReplyText('-', "ERR increment or decrement would overflow"); break;
+			default:										ReplyText('-', "OOM could not store the value"); break;
+			}
+		}
+	}
+	else if(IsCommand("MGET"))
+	{
+		if(numArgs < 2)
+		{
+			ReplyWrongArity();
+		}
+		else
+		{
+			ReplyInteger('*', numArgs - 1);
+			for(DWORD i = 1 ; i < numArgs ; ++i)
+			{
+				if(!store.Get(m_Args[i].data, m_Args[i].size, RespSession::OnValue, this))
+				{
+					ReplyNull();
+				}
+			}
+		}
+	}
+	else if(IsCommand("PING"))
+	{
+		if(numArgs == 1)
+		{
+			ReplyText('+', "PONG");
+		}
+		else if(numArgs == 2)
+		{
+			ReplyBulk(m_Args[1].data, m_Args[1].size);
+		}
+		else
+		{
+			ReplyWrongArity();
+		}
+	}
+	else
+	{
+		Append("-ERR unknown command '", 22);
+		AppendCommandName();
+		Append("'\r\n", 3);
+	}
+}
+
+
+bool RespSession::IsCommand(const char* name)
+{
+	const Arg& command = m_Args[0];
+
+	DWORD i = 0;
+	for( ; i < command.size && name[i] != '\0' ; ++i)
+	{
+		// name is upper case.
+		BYTE c = command.data[i];
+		if(c >= 'a' && c <= 'z')
+		{
+			c = c - 'a' + 'A';
+		}
+
+		if(c != name[i])
+		{
+			return false;
+		}
+	}
+
+	return i == command.size && name[i] == '\0';
+}
+
+
+void RespSession::ReplyText(BYTE prefix, const char* text)
+{
+	m_Reply.push_back(prefix);
+	Append(text, static_cast<DWORD>(strlen(text)));
+	Append("\r\n", 2);
+}
+
+
+void RespSession::ReplyInteger(BYTE prefix, LONGLONG value)
+{
+	char text[21];
+	DWORD size = KeyValueStore::FormatInteger(value, text);
+
+	m_Reply.push_back(prefix);
+	Append(text, size);
+	Append("\r\n", 2);
+}
+
+
+void RespSession::ReplyBulk(const BYTE* data, DWORD size)
+{
+	ReplyInteger('$', size);
+	Append(data, size);
+	Append("\r\n", 2);
+}
+
+
+void RespSession::ReplyWrongArity()
+{
+	Append("-ERR wrong number of arguments for '", 36);
+	AppendCommandName();
+	Append("' command\r\n", 11);
+}
+
+
+void RespSession::AppendCommandName()
+{
+	DWORD size = m_Args[0].size < MAX_NAME_IN_REPLY ? m_Args[0].size : MAX_NAME_IN_REPLY;
+
+	for(DWORD i = 0 ; i < size ; ++i)
+	{
+		// In lower case like Redis, and without anything that would end the reply early.
+		BYTE c = m_Args[0].data[i];
+		if(c >= 'A' && c <= 'Z')
+		{
+			c = c - 'A' + 'a';
+		}
+		else if(c == '\r' || c == '\n')
+		{
+			c = ' ';
+		}
+		m_Reply.push_back(c);
+	}
+}
+
+
+void RespSession::Append(const void* data, DWORD size)
+{
+	const BYTE* bytes = static_cast<const BYTE*>(data);
+	m_Reply.insert(m_Reply.end(), bytes, bytes + size);
+}
+
+
+/* static */ void RespSession::OnValue(void* context, const BYTE* value, DWORD size)
+{
+	RespSession* session = static_cast<RespSession*>(context);
+	assert(session);
+
+	session->ReplyBulk(value, size);
+}
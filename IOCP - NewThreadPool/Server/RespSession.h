@@ -0,0 +1,83 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+class KeyValueStore;
+
+// One connection of MODE_RESP : RESP2, the protocol of Redis, with GET, SET, DEL, INCR, MGET and PING.
+// Commands are arrays of bulk strings, or inline commands of words separated by spaces.
+// Every whole command of a recv is parsed and run in one pass, with its arguments read where they are in the recv buffer,
+// and the replies are appended to one buffer so that they go out in one send.
+// Only a command split across recvs is copied, into a buffer of its own until the rest comes.
+class RespSession
+{
+public:
+	enum
+	{
+		KEEP_REPLY_SIZE = 64 * 1024,
+		MAX_BULK_SIZE = 512 * 1024,
+		MAX_ARGS = 64 * 1024,
+		// A command split across recvs can't be bigger than this. Inline ones included.
+		MAX_PENDING_SIZE = 2 * 1024 * 1024,
+	};
+
+	enum Result
+	{
+		OK,
+		PROTOCOL_ERROR,		// the connection has to go. The reply says why.
+	};
+
+public:
+	RespSession();
+
+	// Runs the whole commands in data and appends their replies to GetReply(). numCommands is how many ran.
+	Result Feed(const BYTE* data, DWORD size, KeyValueStore& store, DWORD& numCommands);
+
+	std::vector<BYTE>& GetReply() { return m_Reply; }
+	// Call once the reply is sent. A buffer grown by a big reply is given back.
+	void ClearReply();
+
+private:
+	struct Arg
+	{
+		const BYTE* data;
+		DWORD size;
+	};
+
+	enum ParseResult
+	{
+		PARSED,
+		INCOMPLETE,
+		MALFORMED,
+	};
+
+	// Parses the command at data into m_Args. consumed is its size.
+	ParseResult Parse(const BYTE* data, DWORD size, DWORD& consumed);
+	ParseResult ParseInline(const BYTE* data, DWORD size, DWORD& consumed);
+
+	// Reads "<prefix><integer>\r\n" at data[offset] and moves offset past it.
+	ParseResult ParseLine(const BYTE* data, DWORD size, BYTE prefix, DWORD& offset, LONGLONG& value);
+
+	void Run(KeyValueStore& store);
+	bool IsCommand(const char* name);
+
+	void ReplyText(BYTE prefix, const char* text);
+	void ReplyInteger(BYTE prefix, LONGLONG value);
+	void ReplyBulk(const BYTE* data, DWORD size);
+	void ReplyNull() { Append("$-1\r\n", 5); }
+	void ReplyWrongArity();
+	void Append(const void* data, DWORD size);
+	void AppendCommandName();
+
+	// KeyValueStore::ValueFunc
+	static void OnValue(void* context, const BYTE* value, DWORD size);
+
+private:
+	RespSession(const RespSession& rhs);
+	RespSession& operator=(const RespSession& rhs);
+
+private:
+	std::vector<BYTE> m_Pending;
+	std::vector<Arg> m_Args;
+	std::vector<BYTE> m_Reply;
+};
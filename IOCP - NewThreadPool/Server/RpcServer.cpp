@@ -0,0 +1,232 @@
+#include "RpcServer.h"
+#include "Packet.h"
+
+#include "..\Log.h"
+#include "..\Messages.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+
+RpcServer::RpcServer()
+{
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	InitializeCriticalSection(&m_CS);
+}
+
+
+RpcServer::~RpcServer()
+{
+	for(size_t i = 0 ; i < m_Waiting.size() ; ++i)
+	{
+		if(m_Waiting[i].response != NULL)
+		{
+			Packet::Destroy(m_Waiting[i].response);
+		}
+	}
+
+	DeleteCriticalSection(&m_CS);
+}
+
+
+void RpcServer::Call(Client* client, const Messages::RpcRequestView& request, ULONGLONG now, DeliverFunc deliver, void* context)
+{
+	assert(client);
+
+	DWORD id = request.GetId();
+	const BYTE* args = request.GetArgs();
+	DWORD argsSize = request.GetArgsCount();
+
+	EnterCriticalSection(&m_CS);
+
+	++m_Stats.calls;
+
+	switch(request.GetMethod())
+	{
+	case Protocol::RPC_METHOD_ECHO:
+		Answer(client, id, Protocol::RPC_OK, args, argsSize, deliver, context);
+		break;
+
+	case Protocol::RPC_METHOD_DELAY:
+		{
+			DWORD delayMs = argsSize >= sizeof(DWORD) ? Schema::Load<DWORD>(args) : 0;
+
+			if(argsSize < sizeof(DWORD) || delayMs > MAX_DELAY_MS)
+			{
+				Answer(client, id, Protocol::RPC_BAD_ARGS, NULL, 0, deliver, context);
+			}
+			else if(delayMs == 0)
+			{
+				Answer(client, id, Protocol::RPC_OK, args, argsSize, deliver, context);
+			}
+			else if(m_Waiting.size() >= MAX_WAITING_CALLS)
+			{
+				Answer(client, id, Protocol::RPC_OVERLOADED, NULL, 0, deliver, context);
+			}
+			else
+			{
+				WaitingCall call;
+				call.dueTime = now + static_cast<ULONGLONG>(delayMs) * 1000;
+				call.client = client;
+				call.id = id;
+				call.response = NULL;
+
+				ULONGLONG deadline = now + static_cast<ULONGLONG>(request.GetDeadlineMs()) * 1000;
+				bool expires = request.GetDeadlineMs() != 0 && deadline < call.dueTime;
+				if(expires)
+				{
+					// It would be done too late. Answered at the deadline with no result.
+					call.dueTime = deadline;
+				}
+				else
+				{
+					// The result is known already. It's only held back.
+					call.response = CreateResponse(id, Protocol::RPC_OK, args, argsSize);
+				}
+
+				if(!expires && call.response == NULL)
+				{
+					Answer(client, id, Protocol::RPC_OVERLOADED, NULL, 0, deliver, context);
+				}
+				else
+				{
+					m_Waiting.push_back(call);
+					push_heap(m_Waiting.begin(), m_Waiting.end(), LaterDue());
+				}
+			}
+		}
+		break;
+
+	default:
+		Answer(client, id, Protocol::RPC_UNKNOWN_METHOD, NULL, 0, deliver, context);
+		break;
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void RpcServer::Poll(ULONGLONG now, DeliverFunc deliver, void* context)
+{
+	EnterCriticalSection(&m_CS);
+
+	while(!m_Waiting.empty() && m_Waiting.front().dueTime <= now)
+	{
+		pop_heap(m_Waiting.begin(), m_Waiting.end(), LaterDue());
+		WaitingCall call = m_Waiting.back();
+		m_Waiting.pop_back();
+
+		if(call.response != NULL)
+		{
+			deliver(context, call.client, call.response);
+			Packet::Destroy(call.response);
+
+			CountAnswer(Protocol::RPC_OK);
+		}
+		else
+		{
+			Answer(call.client, call.id, Protocol::RPC_DEADLINE_EXCEEDED, NULL, 0, deliver, context);
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void RpcServer::RemoveClient(Client* client)
+{
+	EnterCriticalSection(&m_CS);
+
+	size_t kept = 0;
+	for(size_t i = 0 ; i < m_Waiting.size() ; ++i)
+	{
+		if(m_Waiting[i].client == client)
+		{
+			if(m_Waiting[i].response != NULL)
+			{
+				Packet::Destroy(m_Waiting[i].response);
+			}
+			++m_Stats.abandoned;
+		}
+		else
+		{
+			m_Waiting[kept++] = m_Waiting[i];
+		}
+	}
+
+	if(kept != m_Waiting.size())
+	{
+		m_Waiting.resize(kept);
+		make_heap(m_Waiting.begin(), m_Waiting.end(), LaterDue());
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+RpcServer::Stats RpcServer::GetStats()
+{
+	EnterCriticalSection(&m_CS);
+
+	Stats stats = m_Stats;
+	stats.waiting = static_cast<DWORD>(m_Waiting.size());
+
+	LeaveCriticalSection(&m_CS);
+
+	return stats;
+}
+
+
+/* static */ Packet* RpcServer::CreateResponse(DWORD id, Protocol::RpcStatus status, const BYTE* result, DWORD resultSize)
+{
+	DWORD size = Messages::RpcResponseBuilder::GetFrameSize(resultSize);
+
+	Packet* packet = Packet::Create(NULL, NULL, size);
+	if(packet == NULL)
+	{
+		ERROR_MSG("Could not allocate an RPC response of %d bytes.", size);
+		return NULL;
+	}
+
+	Messages::RpcResponseBuilder builder(packet->GetData(), resultSize);
+	builder.SetId(id);
+	builder.SetStatus(status);
+	if(resultSize > 0)
+	{
+		CopyMemory(builder.GetResult(), result, resultSize);
+	}
+
+	return packet;
+}
+
+
+void RpcServer::Answer(Client* client, DWORD id, Protocol::RpcStatus status, const BYTE* result, DWORD resultSize,
+					   DeliverFunc deliver, void* context)
+{
+	Packet* response = CreateResponse(id, status, result, resultSize);
+	if(response == NULL)
+	{
+		// The caller gets nothing back and has to time it out itself.
+		++m_Stats.abandoned;
+		return;
+	}
+
+	deliver(context, client, response);
+	Packet::Destroy(response);
+
+	CountAnswer(status);
+}
+
+
+void RpcServer::CountAnswer(Protocol::RpcStatus status)
+{
+	switch(status)
+	{
+	case Protocol::RPC_OK:					++m_Stats.succeeded; break;
+	case Protocol::RPC_DEADLINE_EXCEEDED:	++m_Stats.expired; break;
+	default:								++m_Stats.failed; break;
+	}
+}
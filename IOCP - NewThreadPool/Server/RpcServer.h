@@ -0,0 +1,89 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+#include "..\Protocol.h"
+
+class Client;
+class Packet;
+
+namespace Messages
+{
+	class RpcRequestView;
+}
+
+// Calls of OP_RPC_REQUEST. Every call is answered once with an OP_RPC_RESPONSE of its id,
+// when its method is done or when its deadline passes, whichever comes first.
+// Calls that can't be answered right away wait in a min-heap by the time they are due, and Poll() answers them.
+// So calls on one connection are answered in the order they are done, not the order they came in.
+// Clients are only compared and handed to the deliver function. They are never dereferenced here.
+class RpcServer
+{
+public:
+	enum
+	{
+		// Most calls waiting at once, over all clients. More are answered with RPC_OVERLOADED.
+		MAX_WAITING_CALLS = 64 * 1024,
+		MAX_DELAY_MS = 60 * 1000,
+	};
+
+	// Same as PubSub. deliver has to take its own reference of the packet.
+	typedef void (*DeliverFunc)(void* context, Client* client, Packet* packet);
+
+	struct Stats
+	{
+		ULONGLONG calls;
+		ULONGLONG succeeded;
+		ULONGLONG failed;		// unknown methods, bad args and overloaded.
+		ULONGLONG expired;		// deadline exceeded.
+		ULONGLONG abandoned;	// the client went away first.
+		DWORD waiting;
+	};
+
+public:
+	RpcServer();
+	~RpcServer();
+
+	// now is Clock::GetMicroseconds(). deliver is called before this returns if the call can be answered right away.
+	void Call(Client* client, const Messages::RpcRequestView& request, ULONGLONG now, DeliverFunc deliver, void* context);
+
+	// Answers the waiting calls that are done or past their deadlines by now.
+	void Poll(ULONGLONG now, DeliverFunc deliver, void* context);
+
+	// Drops the waiting calls of the client. No more deliveries to it once this returns.
+	void RemoveClient(Client* client);
+
+	Stats GetStats();
+
+private:
+	struct WaitingCall
+	{
+		ULONGLONG dueTime;		// when it's answered, microseconds.
+		Client* client;
+		DWORD id;
+		Packet* response;		// NULL if it's answered with RPC_DEADLINE_EXCEEDED.
+	};
+
+	// For std::push_heap() and std::pop_heap(), which make a max-heap.
+	struct LaterDue
+	{
+		bool operator()(const WaitingCall& lhs, const WaitingCall& rhs) const { return lhs.dueTime > rhs.dueTime; }
+	};
+
+	static Packet* CreateResponse(DWORD id, Protocol::RpcStatus status, const BYTE* result, DWORD resultSize);
+	void Answer(Client* client, DWORD id, Protocol::RpcStatus status, const BYTE* result, DWORD resultSize,
+		DeliverFunc deliver, void* context);
+
+	void CountAnswer(Protocol::RpcStatus status);
+
+private:
+	RpcServer(const RpcServer& rhs);
+	RpcServer& operator=(const RpcServer& rhs);
+
+private:
+	// Both guarded by m_CS, which is also held while delivering.
+	std::vector<WaitingCall> m_Waiting;
+	Stats m_Stats;
+
+	CRITICAL_SECTION m_CS;
+};
@@ -2,9 +2,16 @@
 #include "Client.h"
 #include "Packet.h"
 #include "IOEvent.h"
+#include "Snapshot.h"
+#include "RespSession.h"
+#include "ProxyLink.h"
+#include "BufferPool.h"
 
 #include "..\Log.h"
 #include "..\Network.h"
+#include "..\Clock.h"
+#include "..\Protocol.h"
+#include "..\Messages.h"
 #include <iostream>
 #include <cassert>
 #include <algorithm>
@@ -12,11 +19,49 @@
 using namespace std;
 
 
+namespace
+{
+	// Passed through FrameDecoder::Feed() to Server::OnFrame().
+	struct FrameContext
+	{
+		Server* server;
+		Client* client;
+		DWORD numFrames;
+	};
+
+	// Interest grid of MODE_FRAMED.
+	const float INTEREST_WORLD_SIZE = 10000.0f;
+	const float INTEREST_CELL_SIZE = 100.0f;
+	const float INTEREST_VIEW_RADIUS = 150.0f;
+
+	// Server::BenchRoute()
+	const DWORD ROUTE_BENCH_SERIAL_PINGS = 1000;
+	const LONG ROUTE_BENCH_WINDOW = 1024;		// pings in flight at most.
+	const DWORD ROUTE_BENCH_TIMEOUT_MS = 5000;
+
+	void StartTimer(TP_TIMER* timer, DWORD periodMs)
+	{
+		// Negative due time is relative, in 100 nanoseconds.
+		ULARGE_INTEGER dueTime;
+		dueTime.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(periodMs) * 10000);
+
+		FILETIME fileDueTime;
+		fileDueTime.dwHighDateTime = dueTime.HighPart;
+		fileDueTime.dwLowDateTime = dueTime.LowPart;
+
+		SetThreadpoolTimer(timer, &fileDueTime, periodMs, 0);
+	}
+}
+
+
 //---------------------------------------------------------------------------------//
 //---------------------------------------------------------------------------------//
-/* static */ void CALLBACK Server::IoCompletionCallback(PTP_CALLBACK_INSTANCE /* Instance */, PVOID /* Context */,
+/* static */ void CALLBACK Server::IoCompletionCallback(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context,
 														PVOID Overlapped, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred, PTP_IO /* Io */)
 {
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
 	IOEvent* event = CONTAINING_RECORD(Overlapped, IOEvent, GetOverlapped());
 	assert(event);
 
@@ -24,36 +69,51 @@ using namespace std;
 	{
 		ERROR_CODE(IoResult, "I/O operation failed. type[%d]", event->GetType());
 
+		// Do not start anything new on this client. It's going away.
+		if(event->GetType() != IOEvent::ACCEPT)
+		{
+			event->GetClient()->SetState(Client::DISCONNECTED);
+		}
+
 		switch(event->GetType())
 		{
 		case IOEvent::SEND:
-			Server::Instance()->OnSend(event, NumberOfBytesTransferred);
+			server->OnSend(event, NumberOfBytesTransferred);
 			break;
 		}
 
-		Server::Instance()->OnClose(event);
+		server->OnClose(event);
 	}
 	else
 	{	
 		switch(event->GetType())
 		{
 		case IOEvent::ACCEPT:	
-			Server::Instance()->OnAccept(event);
+			server->OnAccept(event);
+			break;
+
+		case IOEvent::CONNECT:
+			server->OnConnect(event);
 			break;
 
 		case IOEvent::RECV:		
 			if(NumberOfBytesTransferred > 0)
 			{
-				Server::Instance()->OnRecv(event, NumberOfBytesTransferred);
+				server->OnRecv(event, NumberOfBytesTransferred);
+			}
+			else if(event->GetClient()->GetProxyLink() != NULL)
+			{
+				// Only one way is done. The other can still have bytes to carry.
+				server->ForwardShutdown(event->GetClient());
 			}
 			else
 			{
-				Server::Instance()->OnClose(event);
+				server->OnClose(event);
 			}
 			break;
 
 		case IOEvent::SEND:
-			Server::Instance()->OnSend(event, NumberOfBytesTransferred);
+			server->OnSend(event, NumberOfBytesTransferred);
 			break;
 
 		default: assert(false); break;
@@ -81,7 +141,7 @@ void CALLBACK Server::WorkerAddClient(PTP_CALLBACK_INSTANCE /* Instance */, PVOI
 	Client* client = static_cast<Client*>(Context);
 	assert(client);
 
-	Server::Instance()->AddClient(client);
+	client->GetServer()->AddClient(client);
 }
 
 
@@ -90,45 +150,312 @@ void CALLBACK Server::WorkerRemoveClient(PTP_CALLBACK_INSTANCE /* Instance */, P
 	Client* client = static_cast<Client*>(Context);
 	assert(client);
 
-	Server::Instance()->RemoveClient(client);
+	client->GetServer()->RemoveClient(client);
 }
 
 
-void CALLBACK Server::WorkerProcessRecvPacket(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context)
+void CALLBACK Server::WorkerProcessLanes(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context)
 {
-	Packet* packet = static_cast<Packet*>(Context);
-	assert(packet);
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
+	// Not necessarily the packet this callback was submitted for. None once Destroy() has cleared the lanes.
+	Packet* packet = server->m_Lanes.Pop(Clock::GetMicroseconds());
+	if(packet != NULL)
+	{
+		server->ProcessPacket(packet);
+	}
+}
+
+
+void CALLBACK Server::WorkerResumePausedClients(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context)
+{
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
+	InterlockedExchange(&server->m_ResumeScheduled, 0);
+
+	server->ResumePausedClients();
+}
+
+
+void CALLBACK Server::WorkerInterestTick(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */)
+{
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
+	server->TickInterest();
+}
+
+
+void CALLBACK Server::WorkerSweepConnections(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */)
+{
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
+	server->SweepConnections();
+}
+
+
+void CALLBACK Server::WorkerRefillRates(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */)
+{
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
+	server->RefillRates();
+}
+
+
+void CALLBACK Server::WorkerPollRpc(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */)
+{
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
+	ULONGLONG now = Clock::GetMicroseconds();
+
+	server->m_RpcServer.Poll(now, Server::DeliverToClient, server);
+
+	if(server->m_UpstreamPool.GetNumBackends() > 0)
+	{
+		server->m_UpstreamPool.Poll(now, Server::DeliverToClient, server);
+		server->ConnectUpstreams();
+	}
+
+	if(server->m_Cluster.IsEnabled())
+	{
+		server->ConnectLinks();
+	}
+
+	if(server->m_NumLogicNotices > 0)
+	{
+		server->RetryLogicNotices();
+	}
+}
+
+
+void CALLBACK Server::WorkerFlushCluster(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context)
+{
+	Server* server = static_cast<Server*>(Context);
+	assert(server);
+
+	// What is routed from here on schedules the next flush.
+	InterlockedExchange(&server->m_ClusterFlushScheduled, 0);
+
+	server->m_Cluster.Flush(Server::SendToLink, server);
+}
+
+
+/* static */ void Server::OnTick(void* context, ULONGLONG tick)
+{
+	Server* server = static_cast<Server*>(context);
+	assert(server);
+
+	server->Tick(tick);
+}
+
+
+/* static */ void Server::OnLogicMessage(void* context, const SharedChannel::Message& message)
+{
+	Server* server = static_cast<Server*>(context);
+	assert(server);
+
+	server->ProcessLogicMessage(message);
+}
+
+
+/* static */ bool Server::OnFrame(void* context, const BYTE* frame, DWORD size)
+{
+	FrameContext* frameContext = static_cast<FrameContext*>(context);
+	assert(frameContext);
+
+	++frameContext->numFrames;
 
-	Server::Instance()->Echo(packet);
+	if(frameContext->client->IsUpstream())
+	{
+		return frameContext->server->OnUpstreamFrame(frameContext->client, frame, size);
+	}
+
+	if(frameContext->server->m_Cluster.IsEnabled() &&
+		(frameContext->client->GetClusterNode() != Cluster::NO_NODE || reinterpret_cast<const Protocol::Header*>(frame)->opcode == Protocol::OP_NODE_HELLO))
+	{
+		return frameContext->server->OnClusterFrame(frameContext->client, frame, size);
+	}
+
+	if(frameContext->server->m_LogicChannel.IsOpen())
+	{
+		return frameContext->server->ForwardToLogic(frameContext->client, frame, size);
+	}
+
+	return frameContext->server->DispatchPacket(frameContext->client, frame, size);
+}
+
+
+/* static */ void Server::DeliverToClient(void* context, Client* client, Packet* packet)
+{
+	Server* server = static_cast<Server*>(context);
+	assert(server);
+
+	// Every subscriber shares the same packet.
+	packet->AddRef();
+	server->PostSend(client, packet);
+}
+
+
+/* static */ void Server::SendToUpstream(void* context, Client* connection, Packet* packet)
+{
+	Server* server = static_cast<Server*>(context);
+	assert(server);
+
+	// The request goes on as it came in.
+	server->PostSend(connection, packet);
+}
+
+
+/* static */ void Server::SendToLink(void* context, Client* link, Packet* packet)
+{
+	Server* server = static_cast<Server*>(context);
+	assert(server);
+
+	server->PostSend(link, packet);
 }
 
 
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+// Frames of MODE_FRAMED. Only inline handlers run on I/O threads. The others are queued to a worker, or to the tick.
+OPCODE_HANDLER(Server, Protocol::OP_ECHO, Echo, false, PRIORITY_INTERACTIVE)
+OPCODE_HANDLER(Server, Protocol::OP_PING, Ping, true, PRIORITY_CONTROL)
+OPCODE_HANDLER(Server, Protocol::OP_SUBSCRIBE, Subscribe, false, PRIORITY_CONTROL)
+OPCODE_HANDLER(Server, Protocol::OP_UNSUBSCRIBE, Unsubscribe, false, PRIORITY_CONTROL)
+OPCODE_HANDLER(Server, Protocol::OP_PUBLISH, Publish, false, PRIORITY_BULK)
+OPCODE_HANDLER(Server, Protocol::OP_MOVE, Move, false, PRIORITY_INTERACTIVE)
+OPCODE_HANDLER(Server, Protocol::OP_SNAPSHOT_ACK, AckSnapshot, false, PRIORITY_CONTROL)
+OPCODE_HANDLER(Server, Protocol::OP_RPC_REQUEST, CallRpc, false, PRIORITY_INTERACTIVE)
+OPCODE_HANDLER(Server, Protocol::OP_LOGIN, Login, false, PRIORITY_CONTROL)
+OPCODE_HANDLER(Server, Protocol::OP_SEND_TO_USER, SendToUser, false, PRIORITY_INTERACTIVE)
+
+/* static */ const OpcodeTable::Entry<Server> Server::s_OpcodeTable[OpcodeTable::NUM_SLOTS] = OPCODE_TABLE(Server);
+
+
 //---------------------------------------------------------------------------------//
 //---------------------------------------------------------------------------------//
 Server::Server(void)
-: m_pTPIO(NULL),
+: m_NumThreads(0),
+  m_TPPOOL(NULL),
+  m_pTPIO(NULL),
   m_AcceptTPWORK(NULL),
   m_listenSocket(INVALID_SOCKET),
+  m_SweepTPTIMER(NULL),
+  m_IdleTimeout(0),
+  m_NumIdleCloses(0),
+  m_LastSweepTime(0),
+  m_MaxConnectionsPerAddress(0),
+  m_BulkRate(0),
+  m_NumBulkSenders(0),
+  m_RateTPTIMER(NULL),
+  m_LastRefill(0),
+  m_NumRateLimited(0),
+  m_NumRatePauses(0),
+  m_NumRateResumes(0),
   m_MaxPostAccept(0),
   m_NumPostAccept(0),
   m_ClientTPCLEAN(NULL),
-  m_ShuttingDown(true)
+  m_ShuttingDown(true),
+  m_ProtocolMode(MODE_RAW),
+  m_InterestGrid(INTEREST_WORLD_SIZE, INTEREST_CELL_SIZE, INTEREST_VIEW_RADIUS),
+  m_InterestTPTIMER(NULL),
+  m_RpcTPTIMER(NULL),
+  m_ConnectingUpstreams(0),
+  m_NumRespCommands(0),
+  m_ProxyBackendSize(0),
+  m_ProxyUpstreamBytes(0),
+  m_ProxyDownstreamBytes(0),
+  m_NumProxyPauses(0),
+  m_NumProxyHalfCloses(0),
+  m_NumLogicFrames(0),
+  m_NumLogicSends(0),
+  m_NumLogicDrops(0),
+  m_NumLogicOrphans(0),
+  m_NumLogicNotices(0),
+  m_ConnectingLinks(0),
+  m_ClusterFlushScheduled(0),
+  m_NumUserMessages(0),
+  m_NumRoutedUserMessages(0),
+  m_NumLostUserMessages(0),
+  m_NumRoutePongs(0),
+  m_TickRate(0),
+  m_SnapshotMode(false),
+  m_NumSnapshots(0),
+  m_NumDeltaSnapshots(0),
+  m_SnapshotEntities(0),
+  m_SnapshotBytes(0),
+  m_SnapshotFullBytes(0),
+  m_NumPausedClients(0),
+  m_ResumeScheduled(0),
+  m_SlowConsumerPolicy(SLOW_CONSUMER_IGNORE),
+  m_MaxOutstandingSendBytes(DEFAULT_MAX_OUTSTANDING_SEND_BYTES),
+  m_MaxSendLatency(DEFAULT_MAX_SEND_LATENCY_MS * 1000),
+  m_SendCoalescing(false)
 {
+	ZeroMemory(&m_LastInterestStats, sizeof(m_LastInterestStats));
+	ZeroMemory(&m_LastTotals, sizeof(m_LastTotals));
+	ZeroMemory(&m_ProxyBackend, sizeof(m_ProxyBackend));
+
+	for(int i = 0 ; i < NUM_REJECT_REASONS ; ++i)
+	{
+		m_NumRejects[i] = 0;
+	}
+
+	InitializeThreadpoolEnvironment(&m_TPENV);
 }
 
 
 Server::~Server(void)
 {
 	Destroy();
+
+	DestroyThreadpoolEnvironment(&m_TPENV);
+}
+
+
+bool Server::SetProxyBackend(const char* host, u_short port)
+{
+	// The first address is used for every client.
+	return Network::ResolveAddress(host, port, m_ProxyBackend, m_ProxyBackendSize);
 }
 
 
 bool Server::Create(short port, int maxPostAccept)
 {	
 	assert(maxPostAccept > 0);
+	assert(m_ProtocolMode != MODE_PROXY || m_ProxyBackendSize > 0);
+	assert(m_ProtocolMode == MODE_FRAMED || m_UpstreamPool.GetNumBackends() == 0);
+	assert(m_ProtocolMode == MODE_FRAMED || !m_LogicChannel.IsOpen());
+	assert(m_ProtocolMode == MODE_FRAMED || !m_Cluster.IsEnabled());
 
 	m_MaxPostAccept = maxPostAccept;
 
+	if(m_NumThreads > 0)
+	{
+		m_TPPOOL = CreateThreadpool(NULL);
+		if(m_TPPOOL == NULL)
+		{
+			ERROR_CODE(GetLastError(), "Could not create the thread pool.");
+			return false;
+		}
+
+		SetThreadpoolThreadMaximum(m_TPPOOL, m_NumThreads);
+		if(SetThreadpoolThreadMinimum(m_TPPOOL, m_NumThreads) == FALSE)
+		{
+			ERROR_CODE(GetLastError(), "Could not start %d threads.", m_NumThreads);
+			CloseThreadpool(m_TPPOOL);
+			m_TPPOOL = NULL;
+			return false;
+		}
+
+		SetThreadpoolCallbackPool(&m_TPENV, m_TPPOOL);
+	}
+
 	// Create Client Work Thread Env for using cleaning group. We need this for shutting down properly.
 	InitializeThreadpoolEnvironment(&m_ClientTPENV);
 	m_ClientTPCLEAN = CreateThreadpoolCleanupGroup();
@@ -138,6 +465,10 @@ bool Server::Create(short port, int maxPostAccept)
 		return false;
 	}
 	SetThreadpoolCallbackCleanupGroup(&m_ClientTPENV, m_ClientTPCLEAN, NULL);	
+	if(m_TPPOOL != NULL)
+	{
+		SetThreadpoolCallbackPool(&m_ClientTPENV, m_TPPOOL);
+	}
 
 	// Create Listen Socket
 	m_listenSocket = Network::CreateSocket(true, port);
@@ -156,7 +487,7 @@ bool Server::Create(short port, int maxPostAccept)
 	}
 
 	// Create & Start ThreaddPool for socket IO
-	m_pTPIO = CreateThreadpoolIo(reinterpret_cast<HANDLE>(m_listenSocket), Server::IoCompletionCallback, NULL, NULL);
+	m_pTPIO = CreateThreadpoolIo(reinterpret_cast<HANDLE>(m_listenSocket), Server::IoCompletionCallback, this, &m_TPENV);
 	if( m_pTPIO == NULL )
 	{
 		ERROR_CODE(WSAGetLastError(), "Could not assign the listen socket to the IOCP handle.");
@@ -174,9 +505,13 @@ bool Server::Create(short port, int maxPostAccept)
 
 	// Create critical sections for m_Clients
 	InitializeCriticalSection(&m_CSForClients);
+	InitializeCriticalSection(&m_CSForInterest);
+	InitializeCriticalSection(&m_CSForTickInput);
+	InitializeCriticalSection(&m_CSForPausedClients);
+	InitializeCriticalSection(&m_CSForUsers);
 
 	// Create Accept worker
-	m_AcceptTPWORK = CreateThreadpoolWork(Server::WorkerPostAccept, this, NULL);
+	m_AcceptTPWORK = CreateThreadpoolWork(Server::WorkerPostAccept, this, &m_TPENV);
 	if(m_AcceptTPWORK == NULL)
 	{
 		ERROR_CODE(GetLastError(), "Could not create AcceptEx worker TPIO.");
@@ -184,10 +519,93 @@ bool Server::Create(short port, int maxPostAccept)
 		return false;
 	}	
 
+	// Position updates only make sense with frames. In tick mode they go out on every tick.
+	if(m_ProtocolMode == MODE_FRAMED && m_TickRate == 0)
+	{
+		m_InterestTPTIMER = CreateThreadpoolTimer(Server::WorkerInterestTick, this, &m_TPENV);
+		if(m_InterestTPTIMER == NULL)
+		{
+			ERROR_CODE(GetLastError(), "Could not create the interest tick timer.");
+			Destroy();
+			return false;
+		}
+	}
+
+	if(m_ProtocolMode == MODE_FRAMED)
+	{
+		m_RpcTPTIMER = CreateThreadpoolTimer(Server::WorkerPollRpc, this, &m_TPENV);
+		if(m_RpcTPTIMER == NULL)
+		{
+			ERROR_CODE(GetLastError(), "Could not create the RPC timer.");
+			Destroy();
+			return false;
+		}
+	}
+
+	m_SweepTPTIMER = CreateThreadpoolTimer(Server::WorkerSweepConnections, this, &m_TPENV);
+	if(m_SweepTPTIMER == NULL)
+	{
+		ERROR_CODE(GetLastError(), "Could not create the sweep timer.");
+		Destroy();
+		return false;
+	}
+
+	if(m_RateLimiter.IsEnabled())
+	{
+		m_RateTPTIMER = CreateThreadpoolTimer(Server::WorkerRefillRates, this, &m_TPENV);
+		if(m_RateTPTIMER == NULL)
+		{
+			ERROR_CODE(GetLastError(), "Could not create the rate refill timer.");
+			Destroy();
+			return false;
+		}
+	}
+
 	m_ShuttingDown = false;	
 
 	SubmitThreadpoolWork(m_AcceptTPWORK);
 
+	StartTimer(m_SweepTPTIMER, SWEEP_MS);
+
+	if(m_RateTPTIMER != NULL)
+	{
+		m_LastRefill = GetTickCount();
+		StartTimer(m_RateTPTIMER, RATE_REFILL_MS);
+	}
+
+	if(m_InterestTPTIMER != NULL)
+	{
+		StartTimer(m_InterestTPTIMER, INTEREST_TICK_MS);
+	}
+
+	if(m_RpcTPTIMER != NULL)
+	{
+		StartTimer(m_RpcTPTIMER, RPC_POLL_MS);
+	}
+
+	// Up before the first calls if they can be. The timer makes the ones that fail again.
+	if(m_UpstreamPool.GetNumBackends() > 0)
+	{
+		ConnectUpstreams();
+	}
+
+	if(m_Cluster.IsEnabled())
+	{
+		ConnectLinks();
+	}
+
+	if(m_TickRate > 0 && !m_TickScheduler.Start(m_TickRate, Server::OnTick, this, &m_TPENV))
+	{
+		Destroy();
+		return false;
+	}
+
+	if(m_LogicChannel.IsOpen() && !m_LogicChannel.StartReading(SharedChannel::OUTBOUND, Server::OnLogicMessage, this, &m_TPENV))
+	{
+		Destroy();
+		return false;
+	}
+
 	return true;
 }
 
@@ -203,6 +621,43 @@ void Server::Destroy()
 		m_AcceptTPWORK = NULL;
 	}
 
+	if( m_InterestTPTIMER != NULL )
+	{
+		SetThreadpoolTimer( m_InterestTPTIMER, NULL, 0, 0 );
+		WaitForThreadpoolTimerCallbacks( m_InterestTPTIMER, true );
+		CloseThreadpoolTimer( m_InterestTPTIMER );
+		m_InterestTPTIMER = NULL;
+	}
+
+	if( m_RpcTPTIMER != NULL )
+	{
+		SetThreadpoolTimer( m_RpcTPTIMER, NULL, 0, 0 );
+		WaitForThreadpoolTimerCallbacks( m_RpcTPTIMER, true );
+		CloseThreadpoolTimer( m_RpcTPTIMER );
+		m_RpcTPTIMER = NULL;
+	}
+
+	if( m_SweepTPTIMER != NULL )
+	{
+		SetThreadpoolTimer( m_SweepTPTIMER, NULL, 0, 0 );
+		WaitForThreadpoolTimerCallbacks( m_SweepTPTIMER, true );
+		CloseThreadpoolTimer( m_SweepTPTIMER );
+		m_SweepTPTIMER = NULL;
+	}
+
+	if( m_RateTPTIMER != NULL )
+	{
+		SetThreadpoolTimer( m_RateTPTIMER, NULL, 0, 0 );
+		WaitForThreadpoolTimerCallbacks( m_RateTPTIMER, true );
+		CloseThreadpoolTimer( m_RateTPTIMER );
+		m_RateTPTIMER = NULL;
+	}
+
+	m_TickScheduler.Stop();
+
+	// The channel stays until the server is deleted, so that the logic doesn't see it go and come back.
+	m_LogicChannel.StopReading();
+
 	if( m_listenSocket != INVALID_SOCKET )
 	{
 		Network::CloseSocket(m_listenSocket);
@@ -226,15 +681,84 @@ void Server::Destroy()
 	}	
 	
 	EnterCriticalSection(&m_CSForClients);
+	// All closed first. A proxied client and its backend connection start I/O on each other.
 	for(ClientList::iterator itor = m_Clients.begin() ; itor != m_Clients.end() ; ++itor)	
 	{
+		(*itor)->Close();
+	}
+	for(ClientList::iterator itor = m_Clients.begin() ; itor != m_Clients.end() ; ++itor)	
+	{
+		ProxyLink* link = (*itor)->GetProxyLink();
+		if(link != NULL && link->GetFront() == *itor)
+		{
+			delete link;
+		}
+
+		if((*itor)->IsAdmitted())
+		{
+			m_AddressCounter.Release((*itor)->GetRemoteIp());
+		}
+
+		(*itor)->WaitForCallbacks();
+		DropAllSends(*itor);
+
+		if((*itor)->GetHandle() != ClientHandles::INVALID_HANDLE)
+		{
+			m_Handles.Remove((*itor)->GetHandle());
+		}
+
+		DWORD slot = (*itor)->GetTableSlot();
+		DWORD addressSlot = (*itor)->GetAddressSlot();
 		Client::Destroy(*itor);
+
+		// After its callbacks, which write its slot.
+		if(slot != ConnectionTable::NO_SLOT)
+		{
+			m_RateLimiter.RemoveConnection(slot, addressSlot);
+			m_ConnectionTable.Remove(slot);
+		}
 	}
 	m_Clients.clear();
+	EnterCriticalSection(&m_CSForPausedClients);
+	m_PausedClients.clear();
+	m_NumPausedClients = 0;
+	LeaveCriticalSection(&m_CSForPausedClients);
+	m_NumRateLimited = 0;
 	LeaveCriticalSection(&m_CSForClients);
 
+	// Its connections were destroyed with the clients. So were the links.
+	m_UpstreamPool.Clear();
+	m_Cluster.Clear();
 
+	EnterCriticalSection(&m_CSForUsers);
+	m_Users.clear();
+	LeaveCriticalSection(&m_CSForUsers);
+	DeleteCriticalSection(&m_CSForUsers);
+
+	// Packets that never got their tick.
+	EnterCriticalSection(&m_CSForTickInput);
+	for(size_t i = 0 ; i < m_TickInput.size() ; ++i)
+	{
+		Packet::Destroy(m_TickInput[i]);
+	}
+	m_TickInput.clear();
+	LeaveCriticalSection(&m_CSForTickInput);
+
+	// And the ones no worker took.
+	m_Lanes.Clear();
+
+	DeleteCriticalSection(&m_CSForTickInput);
+	DeleteCriticalSection(&m_CSForPausedClients);
+
+	DeleteCriticalSection(&m_CSForInterest);
 	DeleteCriticalSection(&m_CSForClients);
+
+	// Last, once nothing is left on it.
+	if(m_TPPOOL != NULL)
+	{
+		CloseThreadpool(m_TPPOOL);
+		m_TPPOOL = NULL;
+	}
 }
 
 
@@ -248,7 +772,7 @@ void Server::PostAccept()
 		int i = 0;
 		for(  ; i < count ; ++i )
 		{
-			Client* client = Client::Create();			
+			Client* client = Client::Create(this);			
 			if( !client )
 			{
 				break;
@@ -292,7 +816,7 @@ void Server::PostRecv(Client* client)
 
 	WSABUF recvBufferDescriptor;
 	recvBufferDescriptor.buf = reinterpret_cast<char*>(client->GetRecvBuff());
-	recvBufferDescriptor.len = Client::MAX_RECV_BUFFER;
+	recvBufferDescriptor.len = client->GetRecvBuffSize();
 
 	DWORD numberOfBytes = 0;
 	DWORD recvFlags = 0;
@@ -328,40 +852,311 @@ void Server::PostSend(Client* client, Packet* packet)
 	assert(client);
 	assert(packet);
 
-	WSABUF recvBufferDescriptor;
-	recvBufferDescriptor.buf = reinterpret_cast<char*>(packet->GetData());
-	recvBufferDescriptor.len = packet->GetSize();
-
-	DWORD sendFlags = 0;
-
 	IOEvent* event = IOEvent::Create(IOEvent::SEND, client, packet);
 	assert(event);
-	
-	StartThreadpoolIo(client->GetTPIO());
 
-	if(WSASend(client->GetSocket(), &recvBufferDescriptor, 1, NULL, sendFlags, &event->GetOverlapped(), NULL) == SOCKET_ERROR)
-	{
-		int error = WSAGetLastError();
+	m_MemoryBudget.ChargeOutbound(client, packet->GetSize());
 
-		if(error != ERROR_IO_PENDING)
-		{
-			CancelThreadpoolIo(client->GetTPIO());
+	IOEvent* dropped = NULL;
+	bool disconnect = false;
 
-			ERROR_CODE(error, "WSASend() failed.");
+	bool keyed = m_SendCoalescing && packet->GetCoalesceKey() != Packet::COALESCE_NONE;
+	Packet* replaced = NULL;
+	IOEvent* unused = NULL;
 
-			RemoveClient(client);
-		}
-	}
-	else
+	client->LockSendQueue();
+
+	if(keyed)
 	{
-		// In this case, the completion callback will have already been scheduled to be called.
+		replaced = client->ReplaceQueuedSend(packet);
 	}
-}
-
 
-void Server::OnAccept(IOEvent* event)
-{
-	assert(event);
+	if(replaced != NULL)
+	{
+		// The packet took over the queued send of the old one. The queue didn't grow, so it can't be slow because of it.
+		Client::SendStats& stats = client->GetSendStats();
+		++stats.coalescedPackets;
+		stats.coalescedBytes += replaced->GetSize();
+
+		unused = event;
+		event = NULL;
+	}
+	else if(IsSlowConsumer(client, packet->GetSize(), Clock::GetMicroseconds()))
+	{
+		++client->GetSendStats().slowDetections;
+
+		switch(m_SlowConsumerPolicy)
+		{
+		case SLOW_CONSUMER_DROP_OLDEST:
+			// The one in flight belongs to the kernel already. Only queued ones can go.
+			// At least one goes so that the queue doesn't grow while the peer is stuck.
+			do
+			{
+				IOEvent* oldest = client->PopSend();
+				if(oldest == NULL)
+				{
+					break;
+				}
+				oldest->SetNext(dropped);
+				dropped = oldest;
+			}
+			while(IsSlowConsumer(client, packet->GetSize(), 0));
+			break;
+
+		case SLOW_CONSUMER_DROP_NEWEST:
+			dropped = event;
+			event = NULL;
+			break;
+
+		case SLOW_CONSUMER_COALESCE_LATEST:
+			while(IOEvent* queued = client->PopSend())
+			{
+				queued->SetNext(dropped);
+				dropped = queued;
+			}
+			break;
+
+		case SLOW_CONSUMER_DISCONNECT:
+			dropped = event;
+			event = NULL;
+			disconnect = true;
+			break;
+
+		default: break;
+		}
+	}
+
+	if(event != NULL)
+	{
+		client->PushSend(event, keyed);
+	}
+
+	// In tick mode the sends of a tick wait for FlushSends() at the end of it.
+	IOEvent* issue = NULL;
+	if(m_TickRate == 0 && client->GetSendInFlight() == NULL && client->GetState() == Client::ACCEPTED)
+	{
+		issue = PopSendBatch(client);
+	}
+
+	client->UnlockSendQueue();
+
+	if(replaced != NULL)
+	{
+		m_MemoryBudget.ReleaseOutbound(client, replaced->GetSize());
+		Packet::Destroy(replaced);
+		IOEvent::Destroy(unused);
+
+		OnBufferedBytesReleased();
+	}
+
+	DropSends(dropped);
+
+	if(disconnect)
+	{
+		ERROR_MSG("Disconnecting a slow consumer. outstanding : %d bytes", client->GetOutboundBytes());
+		PostRemoveClient(client);
+	}
+
+	if(issue != NULL)
+	{
+		IssueSend(issue);
+	}
+}
+
+
+void Server::IssueSend(IOEvent* batch)
+{
+	assert(batch);
+
+	Client* client = batch->GetClient();
+
+	// Every packet of the batch goes out in one call. The first event carries the overlapped.
+	WSABUF sendBufferDescriptors[MAX_SEND_BATCH];
+	DWORD numBuffers = 0;
+	for(IOEvent* event = batch ; event != NULL ; event = event->GetNext())
+	{
+		assert(numBuffers < MAX_SEND_BATCH);
+
+		sendBufferDescriptors[numBuffers].buf = reinterpret_cast<char*>(event->GetPacket()->GetData());
+		sendBufferDescriptors[numBuffers].len = event->GetPacket()->GetSize();
+		++numBuffers;
+	}
+
+	m_SendBatchSizes.Record(numBuffers);
+
+	DWORD sendFlags = 0;
+
+	batch->SetPostTime(Clock::GetMicroseconds());
+	
+	StartThreadpoolIo(client->GetTPIO());
+
+	if(WSASend(client->GetSocket(), sendBufferDescriptors, numBuffers, NULL, sendFlags, &batch->GetOverlapped(), NULL) == SOCKET_ERROR)
+	{
+		int error = WSAGetLastError();
+
+		if(error != ERROR_IO_PENDING)
+		{
+			CancelThreadpoolIo(client->GetTPIO());
+
+			ERROR_CODE(error, "WSASend() failed.");
+
+			client->SetState(Client::DISCONNECTED);
+
+			client->LockSendQueue();
+			client->SetSendInFlight(NULL, 0);
+			client->UnlockSendQueue();
+
+			DropSends(batch);
+
+			// This can be in an I/O callback of the client, so it can't be removed right here.
+			PostRemoveClient(client);
+		}
+	}
+	else
+	{
+		// In this case, the completion callback will have already been scheduled to be called.
+	}
+}
+
+
+IOEvent* Server::PopSendBatch(Client* client)
+{
+	assert(client);
+	assert(client->GetSendInFlight() == NULL);
+
+	IOEvent* head = client->PopSend();
+	if(head == NULL)
+	{
+		return NULL;
+	}
+
+	IOEvent* tail = head;
+	DWORD bytes = head->GetPacket()->GetSize();
+
+	for(int i = 1 ; i < MAX_SEND_BATCH ; ++i)
+	{
+		IOEvent* event = client->PopSend();
+		if(event == NULL)
+		{
+			break;
+		}
+
+		tail->SetNext(event);
+		tail = event;
+		bytes += event->GetPacket()->GetSize();
+	}
+
+	client->SetSendInFlight(head, bytes);
+
+	return head;
+}
+
+
+void Server::FlushSends()
+{
+	EnterCriticalSection(&m_CSForClients);
+
+	for(ClientList::iterator itor = m_Clients.begin() ; itor != m_Clients.end() ; ++itor)
+	{
+		Client* client = *itor;
+
+		client->LockSendQueue();
+		IOEvent* batch = NULL;
+		if(client->GetSendInFlight() == NULL && client->GetState() == Client::ACCEPTED)
+		{
+			batch = PopSendBatch(client);
+		}
+		client->UnlockSendQueue();
+
+		if(batch != NULL)
+		{
+			IssueSend(batch);
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
+void Server::DropSends(IOEvent* events)
+{
+	if(events == NULL)
+	{
+		return;
+	}
+
+	while(events != NULL)
+	{
+		IOEvent* next = events->GetNext();
+
+		Client* client = events->GetClient();
+		Packet* packet = events->GetPacket();
+
+		Client::SendStats& stats = client->GetSendStats();
+		++stats.droppedPackets;
+		stats.droppedBytes += packet->GetSize();
+
+		m_MemoryBudget.ReleaseOutbound(client, packet->GetSize());
+		Packet::Destroy(packet);
+		IOEvent::Destroy(events);
+
+		events = next;
+	}
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::DropAllSends(Client* client)
+{
+	assert(client);
+
+	client->LockSendQueue();
+
+	// The batch in flight, then the sends that never made it to WSASend().
+	IOEvent* dropped = client->GetSendInFlight();
+	client->SetSendInFlight(NULL, 0);
+
+	while(IOEvent* queued = client->PopSend())
+	{
+		queued->SetNext(dropped);
+		dropped = queued;
+	}
+
+	client->UnlockSendQueue();
+
+	DropSends(dropped);
+}
+
+
+bool Server::IsSlowConsumer(Client* client, DWORD newBytes, ULONGLONG now)
+{
+	// Dropping proxied bytes would corrupt the stream. ProxyLink bounds what can be queued instead.
+	// Calls dropped on the way to a backend would only time out. UpstreamPool bounds them with MAX_PENDING_CALLS.
+	// A batch dropped on the way to another node is the messages of many clients. Cluster bounds the batches instead.
+	if(m_SlowConsumerPolicy == SLOW_CONSUMER_IGNORE || m_ProtocolMode == MODE_PROXY || client->IsUpstream() ||
+		client->GetClusterNode() != Cluster::NO_NODE)
+	{
+		return false;
+	}
+
+	IOEvent* inFlight = client->GetSendInFlight();
+
+	DWORD outstanding = client->GetQueuedSendBytes() + client->GetSendInFlightBytes() + newBytes;
+
+	if(outstanding > m_MaxOutstandingSendBytes)
+	{
+		return true;
+	}
+
+	// A send that doesn't complete means the peer stopped reading and the socket buffer is full.
+	return now != 0 && inFlight != NULL && now - inFlight->GetPostTime() > m_MaxSendLatency;
+}
+
+
+void Server::OnAccept(IOEvent* event)
+{
+	assert(event);
 
 	TRACE("[%d] Enter OnAccept()", GetCurrentThreadId());
 	assert(event->GetType() == IOEvent::ACCEPT);
@@ -383,6 +1178,45 @@ void Server::OnAccept(IOEvent* event)
 }
 
 
+void Server::OnConnect(IOEvent* event)
+{
+	assert(event);
+	assert(event->GetType() == IOEvent::CONNECT);
+
+	Client* back = event->GetClient();
+
+	// The socket does not enable previously set properties or options until SO_UPDATE_CONNECT_CONTEXT is set on it.
+	if(setsockopt(back->GetSocket(), SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, NULL, 0) == SOCKET_ERROR)
+	{
+		ERROR_CODE(WSAGetLastError(), "setsockopt() for ConnectEx() failed.");
+
+		PostRemoveClient(back);
+		return;
+	}
+
+	TRACE("[%d] Connected to the backend.", GetCurrentThreadId());
+
+	// Sends go out to ACCEPTED ones only.
+	back->SetState(Client::ACCEPTED);
+
+	if(back->GetProxyLink() != NULL)
+	{
+		PostRecv(back->GetProxyLink()->GetFront());
+	}
+	else if(back->IsUpstream())
+	{
+		m_UpstreamPool.OnConnected(back);
+	}
+	else if(back->GetClusterNode() != Cluster::NO_NODE)
+	{
+		m_Cluster.OnLinkConnected(back, Server::SendToLink, this);
+		ScheduleClusterFlush();
+	}
+
+	PostRecv(back);
+}
+
+
 void Server::OnRecv(IOEvent* event, DWORD dwNumberOfBytesTransfered)
 {
 	assert(event);
@@ -390,22 +1224,72 @@ void Server::OnRecv(IOEvent* event, DWORD dwNumberOfBytesTransfered)
 	TRACE("[%d] Enter OnRecv()", GetCurrentThreadId());
 
 	BYTE* buff = event->GetClient()->GetRecvBuff();
-	buff[dwNumberOfBytesTransfered] = '\0';
-	TRACE("[%d] OnRecv : %s", GetCurrentThreadId(), buff);
+	TRACE("[%d] OnRecv : %.*s", GetCurrentThreadId(), dwNumberOfBytesTransfered, buff);
 
-	// Create packet by copying recv buff.
-	Packet* packet = Packet::Create(event->GetClient(), event->GetClient()->GetRecvBuff(), dwNumberOfBytesTransfered);
+	if(event->GetClient()->GetTableSlot() != ConnectionTable::NO_SLOT)
+	{
+		m_ConnectionTable.OnRecv(event->GetClient()->GetTableSlot(), GetTickCount(), dwNumberOfBytesTransfered);
+	}
 
-	// If whatever game logics relying on the packet are fast enough, we can manage them here but I assume they are slow.	
-	// I think it's better to request receiving ASAP and handle packets received in another thread.
-	if(TrySubmitThreadpoolCallback(Server::WorkerProcessRecvPacket, packet, NULL) == false)
+	// Frames in MODE_FRAMED, recvs otherwise.
+	DWORD numMessages = 1;
+
+	if(m_ProtocolMode == MODE_FRAMED)
 	{
-		ERROR_CODE(GetLastError(), "Could not start WorkerProcessRecvPacket. call it directly.");
+		FrameContext context = { this, event->GetClient(), 0 };
 
-		Echo(packet);
+		FrameDecoder::Result result = event->GetClient()->GetFrameDecoder().Feed(buff, dwNumberOfBytesTransfered, Server::OnFrame, &context);
+		if(result != FrameDecoder::OK)
+		{
+			ERROR_MSG("Could not decode frames. result : %d", result);
+
+			OnClose(event);
+			return;
+		}
+
+		numMessages = context.numFrames;
+	}
+	else if(m_ProtocolMode == MODE_RESP)
+	{
+		if(!ProcessResp(event->GetClient(), buff, dwNumberOfBytesTransfered))
+		{
+			OnClose(event);
+			return;
+		}
+	}
+	else if(m_ProtocolMode == MODE_PROXY)
+	{
+		// It posts the next recv itself, or leaves it to the peer's sends when they are behind.
+		if(!ForwardRecv(event->GetClient(), dwNumberOfBytesTransfered))
+		{
+			OnClose(event);
+		}
+		return;
+	}
+	else if(!DispatchPacket(event->GetClient(), buff, dwNumberOfBytesTransfered))
+	{
+		OnClose(event);
+		return;
+	}
+
+	event->GetClient()->AdaptRecvBuff(dwNumberOfBytesTransfered);
+
+	// Stop reading from this client until refills bring it back within its rate.
+	if(!ChargeRecv(event->GetClient(), numMessages, dwNumberOfBytesTransfered))
+	{
+		TRACE("[%d] Leave OnRecv() over the rate", GetCurrentThreadId());
+		return;
 	}
 
-	PostRecv(event->GetClient());
+	// Stop reading from this client until its packets have been drained.
+	if(m_MemoryBudget.IsOverHigh(event->GetClient()))
+	{
+		PauseRecv(event->GetClient());
+	}
+	else
+	{
+		PostRecv(event->GetClient());
+	}
 
 	TRACE("[%d] Leave OnRecv()", GetCurrentThreadId());
 }
@@ -417,9 +1301,74 @@ void Server::OnSend(IOEvent* event, DWORD dwNumberOfBytesTransfered)
 
 	TRACE("[%d] OnSend : %d", GetCurrentThreadId(), dwNumberOfBytesTransfered);
 
+	Client* client = event->GetClient();
+
+	ULONGLONG latency = Clock::GetMicroseconds() - event->GetPostTime();
+
+	if(client->GetTableSlot() != ConnectionTable::NO_SLOT)
+	{
+		m_ConnectionTable.OnSend(client->GetTableSlot(), GetTickCount(), dwNumberOfBytesTransfered);
+	}
+
 	// This should be fast enough to do in this I/O thread.
 	// if not, we need to queue it like what we do in OnRecv().
-	Packet::Destroy(event->GetPacket());
+	client->LockSendQueue();
+
+	Client::SendStats& stats = client->GetSendStats();
+	for(IOEvent* sent = event ; sent != NULL ; sent = sent->GetNext())
+	{
+		++stats.sentPackets;
+	}
+	++stats.sentBatches;
+	stats.sentBytes += dwNumberOfBytesTransfered;
+	stats.totalLatency += latency;
+	if(latency > stats.maxLatency)
+	{
+		stats.maxLatency = latency;
+	}
+
+	client->SetSendInFlight(NULL, 0);
+	IOEvent* next = client->GetState() == Client::ACCEPTED ? PopSendBatch(client) : NULL;
+
+	// A FIN from the peer waits for the sends before it.
+	ProxyLink* link = client->GetProxyLink();
+	bool shutdown = next == NULL && link != NULL && link->TakeShutdownPending(client) && client->GetState() == Client::ACCEPTED;
+
+	client->UnlockSendQueue();
+
+	// The whole batch is done. The first event is destroyed by the caller.
+	IOEvent* batch = event;
+	while(batch != NULL)
+	{
+		IOEvent* following = batch->GetNext();
+
+		Packet* packet = batch->GetPacket();
+		m_MemoryBudget.ReleaseOutbound(client, packet->GetSize());
+		Packet::Destroy(packet);
+
+		if(batch != event)
+		{
+			IOEvent::Destroy(batch);
+		}
+		batch = following;
+	}
+
+	if(next != NULL)
+	{
+		IssueSend(next);
+	}
+
+	if(shutdown)
+	{
+		ShutdownSend(client);
+	}
+
+	if(link != NULL)
+	{
+		ResumeForward(link->GetPeer(client));
+	}
+
+	OnBufferedBytesReleased();
 }
 
 
@@ -429,12 +1378,20 @@ void Server::OnClose(IOEvent* event)
 
 	TRACE("Client's socket has been closed.");
 
+	PostRemoveClient(event->GetClient());
+}
+
+
+void Server::PostRemoveClient(Client* client)
+{
+	assert(client);
+
 	// If whatever game logics about this event are fast enough, we can manage them here but I assume they are slow.	
-	if(!m_ShuttingDown && TrySubmitThreadpoolCallback(Server::WorkerRemoveClient, event->GetClient(), &m_ClientTPENV) == false)
+	if(!m_ShuttingDown && TrySubmitThreadpoolCallback(Server::WorkerRemoveClient, client, &m_ClientTPENV) == false)
 	{
 		ERROR_CODE(GetLastError(), "can't start WorkerRemoveClient. call it directly.");
 
-		RemoveClient(event->GetClient());
+		RemoveClient(client);
 	}
 }
 
@@ -448,19 +1405,23 @@ void Server::AddClient(Client* client)
 	{
 		ERROR_CODE(WSAGetLastError(), "setsockopt() for AcceptEx() failed.");
 
-		RemoveClient(client);
+		DiscardClient(client);
 	}		
+	else if(!Admit(client))
+	{
+		DiscardClient(client);
+	}
 	else
 	{
 		client->SetState(Client::ACCEPTED);
 
 		// Connect the socket to IOCP
-		TP_IO* pTPIO = CreateThreadpoolIo(reinterpret_cast<HANDLE>(client->GetSocket()), Server::IoCompletionCallback, NULL, NULL);
+		TP_IO* pTPIO = CreateThreadpoolIo(reinterpret_cast<HANDLE>(client->GetSocket()), Server::IoCompletionCallback, this, &m_TPENV);
 		if(pTPIO == NULL)
 		{
 			ERROR_CODE(GetLastError(), "CreateThreadpoolIo failed for a client.");
 
-			RemoveClient(client);
+			DiscardClient(client);
 		}
 		else
 		{
@@ -473,58 +1434,1791 @@ void Server::AddClient(Client* client)
 
 			EnterCriticalSection(&m_CSForClients);
 			m_Clients.push_back(client);
-			LeaveCriticalSection(&m_CSForClients);
 
-			PostRecv(client);
-		}
-	}
-}
+			// Without a handle its packets would all be taken as from a client that's gone.
+			client->SetHandle(m_Handles.Add(client));
+			bool admitted = client->GetHandle() != ClientHandles::INVALID_HANDLE;
 
+			// Without a slot it's only never found idle, and never limited.
+			client->SetTableSlot(m_ConnectionTable.Add(client, GetTickCount()));
 
-void Server::RemoveClient(Client* client)
-{
-	assert(client);
+			if(admitted && m_RateLimiter.IsEnabled() && client->GetTableSlot() != ConnectionTable::NO_SLOT)
+			{
+				DWORD addressSlot = RateLimiter::NO_ADDRESS;
+				admitted = m_RateLimiter.AddConnection(client->GetTableSlot(), client->GetRemoteIp(), addressSlot);
+				client->SetAddressSlot(addressSlot);
+			}
 
+			// The logic hears of it before its first frame. A client without a handle is closed on its first frame.
+			if(admitted && m_LogicChannel.IsOpen())
+			{
+				client->SetLogicHandle(m_LogicHandles.Add(client));
+				if(client->GetLogicHandle() != ClientHandles::INVALID_HANDLE)
+				{
+					NotifyLogic(SharedChannel::MESSAGE_CONNECT, client->GetLogicHandle());
+				}
+			}
+			LeaveCriticalSection(&m_CSForClients);
+
+			if(!admitted)
+			{
+				ERROR_MSG("Could not allocate the handle or the rate buckets of a client.");
+
+				RemoveClient(client);
+			}
+			else if(m_ProtocolMode != MODE_PROXY)
+			{
+				PostRecv(client);
+			}
+			// Nothing is read from the client until its backend connection is up.
+			else if(!ConnectBackend(client))
+			{
+				RemoveClient(client);
+			}
+		}
+	}
+}
+
+
+bool Server::Admit(Client* client)
+{
+	assert(client);
+
+	// Readable once SO_UPDATE_ACCEPT_CONTEXT is set.
+	IN6_ADDR address;
+	RejectReason reason = NUM_REJECT_REASONS;
+
+	if(!Network::GetRemoteIp(client->GetSocket(), address))
+	{
+		reason = REJECT_NO_ADDRESS;
+	}
+	else if(m_Blocklist.Contains(address))
+	{
+		reason = REJECT_BLOCKED;
+	}
+	else if(m_OverloadControl.GetLevel() >= OverloadControl::LEVEL_REJECTING)
+	{
+		reason = REJECT_OVERLOAD;
+	}
+	else if(!m_AddressCounter.Acquire(address, m_MaxConnectionsPerAddress))
+	{
+		reason = REJECT_ADDRESS_LIMIT;
+	}
+	else
+	{
+		client->SetAdmitted(address);
+		return true;
+	}
+
+	TRACE("[%d] Reject a connection. reason : %d", GetCurrentThreadId(), reason);
+
+	InterlockedIncrement64(&m_NumRejects[reason]);
+	Network::ResetOnClose(client->GetSocket());
+
+	return false;
+}
+
+
+void Server::DiscardClient(Client* client)
+{
+	assert(client);
+
+	if(client->IsAdmitted())
+	{
+		m_AddressCounter.Release(client->GetRemoteIp());
+	}
+
+	// Without its TP_IO nothing is pending on it, and Destroy() only closes it.
+	Client::Destroy(client);
+}
+
+
+void Server::RemoveClient(Client* client)
+{
+	assert(client);
+
+	EnterCriticalSection(&m_CSForClients);
+
+	ClientList::iterator itor = std::find(m_Clients.begin(), m_Clients.end(), client);
+
+	if(itor != m_Clients.end())
+	{
+		TRACE("[%d] RemoveClient succeeded.", GetCurrentThreadId());
+
+		m_Clients.erase(itor);
+
+		// A proxied client and its backend connection go together.
+		ProxyLink* link = client->GetProxyLink();
+
+		Client* removed[2] = { client, link != NULL ? link->GetPeer(client) : NULL };
+		int numRemoved = removed[1] != NULL ? 2 : 1;
+
+		if(numRemoved == 2)
+		{
+			m_Clients.erase(std::remove(m_Clients.begin(), m_Clients.end(), removed[1]), m_Clients.end());
+		}
+
+		for(int i = 0 ; i < numRemoved ; ++i)
+		{
+			UnregisterClient(removed[i]);
+		}
+
+		// Both are closed and their callbacks are done before either is destroyed, as each starts I/O on the other.
+		for(int i = 0 ; i < numRemoved ; ++i)
+		{
+			removed[i]->Close();
+		}
+		for(int i = 0 ; i < numRemoved ; ++i)
+		{
+			removed[i]->WaitForCallbacks();
+		}
+
+		for(int i = 0 ; i < numRemoved ; ++i)
+		{
+			// After its callbacks, as the last of them may have paused it.
+			if(removed[i]->IsRecvPaused())
+			{
+				EnterCriticalSection(&m_CSForPausedClients);
+				m_PausedClients.erase(std::remove(m_PausedClients.begin(), m_PausedClients.end(), removed[i]), m_PausedClients.end());
+				InterlockedDecrement(&m_NumPausedClients);
+				LeaveCriticalSection(&m_CSForPausedClients);
+			}
+
+			DropAllSends(removed[i]);
+
+			// After its callbacks, which write its slot.
+			DWORD slot = removed[i]->GetTableSlot();
+			if(slot != ConnectionTable::NO_SLOT)
+			{
+				if(m_ConnectionTable.IsLimited(slot))
+				{
+					InterlockedDecrement(&m_NumRateLimited);
+				}
+
+				m_RateLimiter.RemoveConnection(slot, removed[i]->GetAddressSlot());
+				m_ConnectionTable.Remove(slot);
+			}
+
+			if(removed[i]->IsAdmitted())
+			{
+				m_AddressCounter.Release(removed[i]->GetRemoteIp());
+			}
+
+			Client::Destroy(removed[i]);
+		}
+
+		delete link;
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
+void Server::UnregisterClient(Client* client)
+{
+	assert(client);
+
+	// Packets of the client still queued find it gone from here on.
+	if(client->GetHandle() != ClientHandles::INVALID_HANDLE)
+	{
+		m_Handles.Remove(client->GetHandle());
+		client->SetHandle(ClientHandles::INVALID_HANDLE);
+	}
+
+	// No more deliveries from PubSub once this returns.
+	if(client->GetNumSubscriptions() > 0)
+	{
+		vector<DWORD> channels;
+		m_PubSub.UnsubscribeAll(client, m_Cluster.IsEnabled() ? &channels : NULL);
+
+		for(size_t i = 0 ; i < channels.size() ; ++i)
+		{
+			m_Cluster.RemoveLocalSubscriber(channels[i]);
+		}
+
+		if(!channels.empty())
+		{
+			ScheduleClusterFlush();
+		}
+	}
+
+	// No more position updates either.
+	if(client->GetEntityId() != InterestGrid::INVALID_ENTITY)
+	{
+		EnterCriticalSection(&m_CSForInterest);
+		m_InterestGrid.RemoveEntity(client->GetEntityId());
+		LeaveCriticalSection(&m_CSForInterest);
+
+		client->SetEntityId(InterestGrid::INVALID_ENTITY);
+	}
+
+	// Nor answers to its calls.
+	m_RpcServer.RemoveClient(client);
+
+	if(client->IsUpstream())
+	{
+		// Its calls are answered right here, to clients that are all alive while m_CSForClients is held.
+		m_UpstreamPool.RemoveConnection(client, Clock::GetMicroseconds(), Server::DeliverToClient, this);
+	}
+	else if(m_UpstreamPool.GetNumBackends() > 0)
+	{
+		m_UpstreamPool.RemoveClient(client);
+	}
+
+	// Nor messages to its user.
+	if(client->GetUserId() != 0)
+	{
+		EnterCriticalSection(&m_CSForUsers);
+		m_Users.erase(client->GetUserId());
+		LeaveCriticalSection(&m_CSForUsers);
+
+		client->SetUserId(0);
+	}
+
+	// Nor batches, if it's a link.
+	if(client->GetClusterNode() != Cluster::NO_NODE)
+	{
+		m_Cluster.RemoveLink(client, Clock::GetMicroseconds());
+	}
+
+	// Nor frames from the logic.
+	if(client->GetLogicHandle() != ClientHandles::INVALID_HANDLE)
+	{
+		m_LogicHandles.Remove(client->GetLogicHandle());
+		NotifyLogic(SharedChannel::MESSAGE_DISCONNECT, client->GetLogicHandle());
+
+		client->SetLogicHandle(ClientHandles::INVALID_HANDLE);
+	}
+
+	// Nothing new is sent to it.
+	client->SetState(Client::DISCONNECTED);
+}
+
+
+Client* Server::CreateConnection(int family)
+{
+	SOCKET socket = Network::CreateConnectSocket(family);
+	if(socket == INVALID_SOCKET)
+	{
+		return NULL;
+	}
+
+	Client* client = Client::Create(this, socket);
+	if(client == NULL)
+	{
+		return NULL;
+	}
+
+	TP_IO* pTPIO = CreateThreadpoolIo(reinterpret_cast<HANDLE>(socket), Server::IoCompletionCallback, this, &m_TPENV);
+	if(pTPIO == NULL)
+	{
+		ERROR_CODE(GetLastError(), "CreateThreadpoolIo failed for a connection.");
+
+		Client::Destroy(client);
+		return NULL;
+	}
+	client->SetTPIO(pTPIO);
+
+	return client;
+}
+
+
+bool Server::StartConnect(Client* client, const SOCKADDR_STORAGE& address, int addressSize)
+{
+	assert(client);
+
+	// Connections don't go through the opcode handlers, so one past ClientHandles::MAX_CLIENTS can do without a handle.
+	EnterCriticalSection(&m_CSForClients);
+	m_Clients.push_back(client);
+	client->SetHandle(m_Handles.Add(client));
+	LeaveCriticalSection(&m_CSForClients);
+
+	IOEvent* event = IOEvent::Create(IOEvent::CONNECT, client);
+	assert(event);
+
+	StartThreadpoolIo(client->GetTPIO());
+
+	if(Network::ConnectEx(client->GetSocket(), reinterpret_cast<const sockaddr*>(&address), addressSize, &event->GetOverlapped()) == FALSE)
+	{
+		int error = WSAGetLastError();
+
+		if(error != ERROR_IO_PENDING)
+		{
+			CancelThreadpoolIo(client->GetTPIO());
+
+			ERROR_CODE(error, "ConnectEx() failed.");
+
+			IOEvent::Destroy(event);
+			return false;
+		}
+	}
+	else
+	{
+		// In this case, the completion callback will have already been scheduled to be called.
+	}
+
+	return true;
+}
+
+
+bool Server::ConnectBackend(Client* front)
+{
+	assert(front);
+
+	Client* back = CreateConnection(m_ProxyBackend.ss_family);
+	if(back == NULL)
+	{
+		return false;
+	}
+
+	// From here on the pair is removed together.
+	ProxyLink* link = new ProxyLink(front, back);
+	front->SetProxyLink(link);
+	back->SetProxyLink(link);
+
+	return StartConnect(back, m_ProxyBackend, m_ProxyBackendSize);
+}
+
+
+bool Server::ForwardRecv(Client* client, DWORD size)
+{
+	assert(client);
+	assert(client->GetProxyLink());
+
+	Client* peer = client->GetProxyLink()->GetPeer(client);
+
+	// The bytes go out to the peer in the buffer they came in, and the client gets a new one for its next recv.
+	// A few bytes in a big buffer are copied instead, so that the buffer isn't tied up in the peer's send queue for them.
+	Packet* packet = NULL;
+	if(size >= client->GetRecvBuffSize() / 4)
+	{
+		BYTE* buffer = client->DetachRecvBuff(size);
+		if(buffer != NULL)
+		{
+			packet = Packet::Attach(client, buffer, size);
+		}
+	}
+
+	if(packet == NULL)
+	{
+		packet = Packet::Create(client, client->GetRecvBuff(), size);
+		if(packet == NULL)
+		{
+			ERROR_MSG("Could not allocate a packet of %d bytes. BufferPool is exhausted.", size);
+			return false;
+		}
+
+		client->AdaptRecvBuff(size);
+	}
+
+	InterlockedExchangeAdd64(client == client->GetProxyLink()->GetFront() ? &m_ProxyUpstreamBytes : &m_ProxyDownstreamBytes, size);
+
+	PostSend(peer, packet);
+
+	if(peer->GetOutboundBytes() <= ProxyLink::PAUSE_BYTES)
+	{
+		PostRecv(client);
+		return true;
+	}
+
+	// This way is paused until the peer's sends catch up. The other way goes on.
+	client->GetProxyLink()->SetRecvPaused(client, true);
+	InterlockedIncrement(&m_NumProxyPauses);
+
+	// The sends may have caught up before the flag was up, and nobody would resume it then.
+	ResumeForward(client);
+
+	return true;
+}
+
+
+void Server::ResumeForward(Client* client)
+{
+	assert(client);
+
+	ProxyLink* link = client->GetProxyLink();
+	assert(link);
+
+	// Whoever clears the flag posts the recv.
+	if(link->IsRecvPaused(client) &&
+	   link->GetPeer(client)->GetOutboundBytes() <= ProxyLink::RESUME_BYTES &&
+	   link->SetRecvPaused(client, false))
+	{
+		if(client->GetState() == Client::ACCEPTED)
+		{
+			PostRecv(client);
+		}
+	}
+}
+
+
+void Server::ForwardShutdown(Client* client)
+{
+	assert(client);
+
+	ProxyLink* link = client->GetProxyLink();
+	assert(link);
+
+	Client* peer = link->GetPeer(client);
+
+	InterlockedIncrement(&m_NumProxyHalfCloses);
+
+	// The FIN goes after the bytes that came before it. OnSend() passes it on if they aren't out yet.
+	peer->LockSendQueue();
+	bool now = peer->GetSendInFlight() == NULL && !peer->HasQueuedSends();
+	if(!now)
+	{
+		link->SetShutdownPending(peer);
+	}
+	peer->UnlockSendQueue();
+
+	if(now)
+	{
+		ShutdownSend(peer);
+	}
+}
+
+
+void Server::ShutdownSend(Client* client)
+{
+	assert(client);
+	assert(client->GetProxyLink());
+
+	if(shutdown(client->GetSocket(), SD_SEND) == SOCKET_ERROR)
+	{
+		ERROR_CODE(WSAGetLastError(), "shutdown() failed.");
+
+		PostRemoveClient(client);
+		return;
+	}
+
+	// Both ways are done.
+	if(client->GetProxyLink()->OnShutdown())
+	{
+		PostRemoveClient(client);
+	}
+}
+
+
+void Server::ConnectUpstreams()
+{
+	// Timer callbacks can run at the same time, and they would both make the same missing connections.
+	if(InterlockedCompareExchange(&m_ConnectingUpstreams, 1, 0) != 0)
+	{
+		return;
+	}
+
+	vector<DWORD> backends;
+	m_UpstreamPool.GetMissingConnections(Clock::GetMicroseconds(), backends);
+
+	for(size_t i = 0 ; i < backends.size() && !m_ShuttingDown ; ++i)
+	{
+		ConnectUpstream(backends[i]);
+	}
+
+	InterlockedExchange(&m_ConnectingUpstreams, 0);
+}
+
+
+bool Server::ConnectUpstream(DWORD backend)
+{
+	int addressSize = 0;
+	const SOCKADDR_STORAGE& address = m_UpstreamPool.GetAddress(backend, addressSize);
+
+	Client* connection = CreateConnection(address.ss_family);
+	if(connection == NULL)
+	{
+		return false;
+	}
+
+	connection->SetUpstream(true);
+	m_UpstreamPool.AddConnection(backend, connection);
+
+	if(!StartConnect(connection, address, addressSize))
+	{
+		// Counts as a failure of the backend. It's made again on a later poll.
+		RemoveClient(connection);
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Server::OnUpstreamFrame(Client* connection, const BYTE* frame, DWORD size)
+{
+	assert(connection);
+
+	// On the connection's I/O thread. The response is copied out of the recv buffer and delivered right here.
+	if(!m_UpstreamPool.OnResponse(connection, frame, size, Clock::GetMicroseconds(), Server::DeliverToClient, this))
+	{
+		ERROR_MSG("Unexpected frame from a backend. opcode : %d", reinterpret_cast<const Protocol::Header*>(frame)->opcode);
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Server::ForwardToLogic(Client* client, const BYTE* frame, DWORD size)
+{
+	assert(client);
+
+	if(client->GetLogicHandle() == ClientHandles::INVALID_HANDLE)
+	{
+		ERROR_MSG("A client without a handle on the logic channel.");
+		return false;
+	}
+
+	typedef char FramesFitInAChain[static_cast<DWORD>(Protocol::MAX_FRAME_SIZE) <= static_cast<DWORD>(SharedChannel::MAX_MESSAGE_SIZE) ? 1 : -1];
+
+	// On the I/O thread. The frame is copied once, out of the recv buffer, and the logic reads it where it is.
+	// One bigger than a block is copied into a chain of them. A logic that is behind or gone loses frames instead of holding up the recv.
+	// So does one behind a connect or a disconnect that is still waiting, so that the logic never sees a frame of a handle before its connect.
+	if(m_NumLogicNotices > 0)
+	{
+		InterlockedIncrement64(&m_NumLogicDrops);
+		return true;
+	}
+
+	DWORD block = m_LogicChannel.AllocBlocks(size);
+	if(block == SharedChannel::NO_BLOCK)
+	{
+		InterlockedIncrement64(&m_NumLogicDrops);
+		return true;
+	}
+
+	m_LogicChannel.WriteBlocks(block, frame, size);
+
+	SharedChannel::Message message;
+	message.type = SharedChannel::MESSAGE_FRAME;
+	message.reserved = 0;
+	message.handle = client->GetLogicHandle();
+	message.block = block;
+	message.size = size;
+
+	if(!m_LogicChannel.Push(SharedChannel::INBOUND, message))
+	{
+		m_LogicChannel.FreeBlock(block);
+		InterlockedIncrement64(&m_NumLogicDrops);
+		return true;
+	}
+
+	InterlockedIncrement64(&m_NumLogicFrames);
+	return true;
+}
+
+
+void Server::NotifyLogic(SharedChannel::MessageType type, DWORD handle)
+{
+	SharedChannel::Message message;
+	message.type = static_cast<WORD>(type);
+	message.reserved = 0;
+	message.handle = handle;
+	message.block = SharedChannel::NO_BLOCK;
+	message.size = 0;
+
+	// Never lost, since the logic would keep a client that's gone or never hear of one that came. There are 2 at most per client.
+	m_LogicNotices.push_back(message);
+	PushLogicNotices();
+}
+
+
+void Server::PushLogicNotices()
+{
+	size_t numPushed = 0;
+	while(numPushed < m_LogicNotices.size() && m_LogicChannel.Push(SharedChannel::INBOUND, m_LogicNotices[numPushed]))
+	{
+		++numPushed;
+	}
+
+	m_LogicNotices.erase(m_LogicNotices.begin(), m_LogicNotices.begin() + numPushed);
+
+	if(m_NumLogicNotices == 0 && !m_LogicNotices.empty())
+	{
+		ERROR_MSG("The logic channel is full. Connects and disconnects wait for room, and frames are dropped until then.");
+	}
+
+	InterlockedExchange(&m_NumLogicNotices, static_cast<LONG>(m_LogicNotices.size()));
+}
+
+
+void Server::RetryLogicNotices()
+{
+	EnterCriticalSection(&m_CSForClients);
+	PushLogicNotices();
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
+void Server::ProcessLogicMessage(const SharedChannel::Message& message)
+{
+	// On the reader of the channel, which is no I/O thread, so m_CSForClients can be taken.
+	if(message.block != SharedChannel::NO_BLOCK && (message.block >= SharedChannel::NUM_BLOCKS || message.size > SharedChannel::MAX_MESSAGE_SIZE))
+	{
+		ERROR_MSG("Bad message from the logic. block : %d, size : %d", message.block, message.size);
+		return;
+	}
+
+	EnterCriticalSection(&m_CSForClients);
+
+	Client* client = m_LogicHandles.Find(message.handle);
+
+	if(client == NULL)
+	{
+		InterlockedIncrement64(&m_NumLogicOrphans);
+	}
+	else if(message.type == SharedChannel::MESSAGE_FRAME && message.block != SharedChannel::NO_BLOCK)
+	{
+		// Copied, so that the blocks are free before the send completes.
+		Packet* packet = Packet::Create(NULL, NULL, message.size);
+		if(packet == NULL)
+		{
+			ERROR_MSG("Could not allocate a packet of %d bytes. BufferPool is exhausted.", message.size);
+		}
+		else if(!m_LogicChannel.ReadBlocks(message.block, packet->GetData(), message.size))
+		{
+			ERROR_MSG("Bad chain of blocks from the logic. block : %d, size : %d", message.block, message.size);
+			Packet::Destroy(packet);
+		}
+		else
+		{
+			PostSend(client, packet);
+			InterlockedIncrement64(&m_NumLogicSends);
+		}
+	}
+	else if(message.type == SharedChannel::MESSAGE_DISCONNECT)
+	{
+		// The logic wants it gone.
+		PostRemoveClient(client);
+	}
+	else
+	{
+		ERROR_MSG("Unexpected message from the logic : %d", message.type);
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	if(message.block != SharedChannel::NO_BLOCK)
+	{
+		m_LogicChannel.FreeBlock(message.block);
+	}
+}
+
+
+void Server::ConnectLinks()
+{
+	// Same as ConnectUpstreams().
+	if(InterlockedCompareExchange(&m_ConnectingLinks, 1, 0) != 0)
+	{
+		return;
+	}
+
+	vector<DWORD> nodes;
+	m_Cluster.GetMissingLinks(Clock::GetMicroseconds(), nodes);
+
+	for(size_t i = 0 ; i < nodes.size() && !m_ShuttingDown ; ++i)
+	{
+		ConnectLink(nodes[i]);
+	}
+
+	InterlockedExchange(&m_ConnectingLinks, 0);
+}
+
+
+bool Server::ConnectLink(DWORD node)
+{
+	int addressSize = 0;
+	const SOCKADDR_STORAGE& address = m_Cluster.GetAddress(node, addressSize);
+
+	Client* link = CreateConnection(address.ss_family);
+	if(link == NULL)
+	{
+		return false;
+	}
+
+	link->SetClusterLink(node, true);
+	m_Cluster.AddLink(node, link);
+
+	if(!StartConnect(link, address, addressSize))
+	{
+		// Made again after Cluster::RETRY_MS.
+		RemoveClient(link);
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Server::OnClusterFrame(Client* client, const BYTE* frame, DWORD size)
+{
+	assert(client);
+
+	if(client->GetClusterNode() == Cluster::NO_NODE)
+	{
+		Messages::NodeHelloView hello;
+		if(!hello.Init(frame, size) || !m_Cluster.AcceptLink(hello.GetNode(), client, client->GetRemoteIp()))
+		{
+			ERROR_MSG("Bad hello of a link.");
+			return false;
+		}
+
+		client->SetClusterLink(hello.GetNode(), false);
+		return true;
+	}
+
+	const Protocol::Header* header = reinterpret_cast<const Protocol::Header*>(frame);
+	DWORD node = client->GetClusterNode();
+
+	// Nothing but batches comes in, and only on the links the other nodes made.
+	if(client->IsOutboundLink() || header->opcode != Protocol::OP_NODE_BATCH)
+	{
+		ERROR_MSG("Unexpected frame on a link of node %d. opcode : %d", node, header->opcode);
+		return false;
+	}
+
+	// The messages are read where they are in the recv buffer. Only what is delivered to clients is copied.
+	DWORD numMessages = 0;
+	for(DWORD offset = Protocol::HEADER_SIZE ; offset < size ; ++numMessages)
+	{
+		const Protocol::Header* message = reinterpret_cast<const Protocol::Header*>(frame + offset);
+		if(size - offset < Protocol::HEADER_SIZE || message->size > size - offset - Protocol::HEADER_SIZE)
+		{
+			ERROR_MSG("Truncated batch from node %d.", node);
+			return false;
+		}
+
+		DWORD messageSize = Protocol::HEADER_SIZE + message->size;
+		if(!RouteMessage(node, frame + offset, messageSize))
+		{
+			ERROR_MSG("Bad message from node %d. opcode : %d", node, message->opcode);
+			return false;
+		}
+
+		offset += messageSize;
+	}
+
+	m_Cluster.OnReceived(node, numMessages);
+
+	return true;
+}
+
+
+bool Server::RouteMessage(DWORD node, const BYTE* frame, DWORD size)
+{
+	switch(reinterpret_cast<const Protocol::Header*>(frame)->opcode)
+	{
+	case Protocol::OP_ROUTE_TO_USER:
+		{
+			Messages::RouteToUserView view;
+			if(!view.Init(frame, size))
+			{
+				return false;
+			}
+
+			DeliverToUser(view.GetUser(), view.GetFrom(), view.GetData(), view.GetDataCount());
+		}
+		break;
+
+	case Protocol::OP_ROUTE_PUBLISH:
+		{
+			Messages::RoutePublishView view;
+			Messages::PublishView publish;
+			if(!view.Init(frame, size) || !publish.Init(view.GetFrame(), view.GetFrameCount()) || publish.GetChannel() != view.GetChannel())
+			{
+				return false;
+			}
+
+			PublishFrame(view.GetChannel(), view.GetFrame(), view.GetFrameCount(), node);
+		}
+		break;
+
+	case Protocol::OP_ROUTE_SUBSCRIBE:
+		{
+			Messages::RouteSubscribeView view;
+			if(!view.Init(frame, size))
+			{
+				return false;
+			}
+
+			m_Cluster.OnRemoteSubscriber(node, view.GetChannel(), true);
+		}
+		break;
+
+	case Protocol::OP_ROUTE_UNSUBSCRIBE:
+		{
+			Messages::RouteUnsubscribeView view;
+			if(!view.Init(frame, size))
+			{
+				return false;
+			}
+
+			m_Cluster.OnRemoteSubscriber(node, view.GetChannel(), false);
+		}
+		break;
+
+	case Protocol::OP_ROUTE_PING:
+		{
+			Messages::RoutePingView view;
+			if(!view.Init(frame, size))
+			{
+				return false;
+			}
+
+			m_Cluster.Pong(node, view.GetSequence(), view.GetSendTime());
+			ScheduleClusterFlush();
+		}
+		break;
+
+	case Protocol::OP_ROUTE_PONG:
+		{
+			Messages::RoutePongView view;
+			if(!view.Init(frame, size))
+			{
+				return false;
+			}
+
+			m_RouteRoundTrips.Record(Clock::GetMicroseconds() - view.GetSendTime());
+			InterlockedIncrement(&m_NumRoutePongs);
+		}
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+
+void Server::ScheduleClusterFlush()
+{
+	// Same as OnBufferedBytesReleased(). Flushed right here if it can't be scheduled, unless the server is going away.
+	if(InterlockedCompareExchange(&m_ClusterFlushScheduled, 1, 0) == 0)
+	{
+		if(m_ShuttingDown)
+		{
+			InterlockedExchange(&m_ClusterFlushScheduled, 0);
+		}
+		else if(TrySubmitThreadpoolCallback(Server::WorkerFlushCluster, this, &m_ClientTPENV) == false)
+		{
+			ERROR_CODE(GetLastError(), "Could not start WorkerFlushCluster. call it directly.");
+
+			InterlockedExchange(&m_ClusterFlushScheduled, 0);
+			m_Cluster.Flush(Server::SendToLink, this);
+		}
+	}
+}
+
+
+bool Server::DispatchPacket(Client* client, const BYTE* data, DWORD size)
+{
+	assert(client);
+
+	// Create packet by copying recv buff.
+	Packet* packet = Packet::Create(client, data, size);
+	if(packet == NULL)
+	{
+		ERROR_MSG("Could not allocate a packet of %d bytes. BufferPool is exhausted.", size);
+		return false;
+	}
+
+	m_MemoryBudget.ChargeInbound(client, packet->GetSize());
+
+	if(m_ProtocolMode == MODE_FRAMED)
+	{
+		WORD opcode = reinterpret_cast<const Protocol::Header*>(packet->GetData())->opcode;
+
+		const OpcodeTable::Entry<Server>& entry = OpcodeTable::Lookup(s_OpcodeTable, opcode);
+		if(entry.opcode == opcode && entry.runInline)
+		{
+			entry.call(this, packet);
+			return true;
+		}
+	}
+
+	if(m_TickRate > 0)
+	{
+		EnterCriticalSection(&m_CSForTickInput);
+		m_TickInput.push_back(packet);
+		LeaveCriticalSection(&m_CSForTickInput);
+
+		return true;
+	}
+
+	// If whatever game logics relying on the packet are fast enough, we can manage them here but I assume they are slow.	
+	// I think it's better to request receiving ASAP and handle packets received in another thread.
+	// Bulk senders' packets wait behind everyone else's, but for control, which is never shed.
+	OpcodeTable::Priority priority = GetPriority(packet);
+	DWORD slot = client->GetTableSlot();
+	if(priority == OpcodeTable::PRIORITY_INTERACTIVE && m_BulkRate > 0 && slot != ConnectionTable::NO_SLOT && m_ConnectionTable.IsBulk(slot))
+	{
+		priority = OpcodeTable::PRIORITY_BULK;
+	}
+
+	packet->SetPriority(priority);
+	packet->SetQueueTime(Clock::GetMicroseconds());
+	m_OverloadControl.OnQueued();
+	m_Lanes.Push(packet);
+
+	if(TrySubmitThreadpoolCallback(Server::WorkerProcessLanes, this, &m_TPENV) == false)
+	{
+		ERROR_CODE(GetLastError(), "Could not start WorkerProcessLanes. call it directly.");
+
+		WorkerProcessLanes(NULL, this);
+	}
+
+	return true;
+}
+
+
+void Server::ProcessPacket(Packet* packet)
+{
+	assert(packet);
+
+	// Read first, as the handler destroys the packet. Tick mode doesn't queue them.
+	OpcodeTable::Priority priority = packet->GetPriority();
+	ULONGLONG queueTime = packet->GetQueueTime();
+
+	if(queueTime != 0)
+	{
+		ULONGLONG now = Clock::GetMicroseconds();
+		if(m_OverloadControl.OnDequeue(priority, now - queueTime, now))
+		{
+			ShedPacket(packet);
+			return;
+		}
+	}
+
+	if(m_ProtocolMode == MODE_RAW)
+	{
+		Echo(packet);
+	}
+	else
+	{
+		const Protocol::Header* header = reinterpret_cast<const Protocol::Header*>(packet->GetData());
+
+		OpcodeTable::Dispatch(s_OpcodeTable, this, header->opcode, packet);
+	}
+
+	if(queueTime != 0)
+	{
+		m_LaneLatencies[priority].Record(Clock::GetMicroseconds() - queueTime);
+	}
+}
+
+
+OpcodeTable::Priority Server::GetPriority(Packet* packet)
+{
+	assert(packet);
+
+	// Raw echoes are all someone waiting for them.
+	if(m_ProtocolMode == MODE_RAW)
+	{
+		return OpcodeTable::PRIORITY_INTERACTIVE;
+	}
+
+	WORD opcode = reinterpret_cast<const Protocol::Header*>(packet->GetData())->opcode;
+
+	const OpcodeTable::Entry<Server>& entry = OpcodeTable::Lookup(s_OpcodeTable, opcode);
+	return entry.opcode == opcode ? entry.priority : OpcodeTable::PRIORITY_BULK;
+}
+
+
+void Server::ShedPacket(Packet* packet)
+{
+	assert(packet);
+
+	// A caller waits for an answer, and RPC_OVERLOADED tells it not to retry right away.
+	Packet* answer = NULL;
+	Messages::RpcRequestView request;
+	if(m_ProtocolMode == MODE_FRAMED && request.Init(packet->GetData(), packet->GetSize()))
+	{
+		answer = Packet::Create(NULL, NULL, Messages::RpcResponseBuilder::GetFrameSize(0));
+		if(answer != NULL)
+		{
+			Messages::RpcResponseBuilder builder(answer->GetData(), 0);
+			builder.SetId(request.GetId());
+			builder.SetStatus(Protocol::RPC_OVERLOADED);
+		}
+	}
+
+	EnterCriticalSection(&m_CSForClients);
+
+	Client* client = packet->GetSender();
+	bool alive = FindSender(packet) != NULL;
+	m_MemoryBudget.ReleaseInbound(alive ? client : NULL, packet->GetSize());
+
+	if(answer != NULL)
+	{
+		if(alive)
+		{
+			PostSend(client, answer);
+		}
+		else
+		{
+			Packet::Destroy(answer);
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	OnBufferedBytesReleased();
+
+	Packet::Destroy(packet);
+}
+
+
+bool Server::ProcessResp(Client* client, const BYTE* data, DWORD size)
+{
+	assert(client);
+
+	RespSession* session = client->GetRespSession();
+	if(session == NULL)
+	{
+		session = new RespSession;
+		client->SetRespSession(session);
+	}
+
+	// Commands are quick enough for the I/O thread, and pipelined ones come back in one send without a copy of the recv.
+	DWORD numCommands = 0;
+	RespSession::Result result = session->Feed(data, size, m_KeyValueStore, numCommands);
+	InterlockedExchangeAdd64(&m_NumRespCommands, numCommands);
+
+	// Split only if it's bigger than a packet can be.
+	vector<BYTE>& reply = session->GetReply();
+	for(size_t offset = 0 ; offset < reply.size() ; )
+	{
+		DWORD packetSize = static_cast<DWORD>(reply.size() - offset);
+		if(packetSize > BufferPool::MAX_BUFFER_SIZE)
+		{
+			packetSize = BufferPool::MAX_BUFFER_SIZE;
+		}
+
+		Packet* packet = Packet::Create(NULL, &reply[offset], packetSize);
+		if(packet == NULL)
+		{
+			ERROR_MSG("Could not allocate a packet of %d bytes for RESP replies.", packetSize);
+			session->ClearReply();
+			return false;
+		}
+
+		PostSend(client, packet);
+		offset += packetSize;
+	}
+	session->ClearReply();
+
+	if(result != RespSession::OK)
+	{
+		ERROR_MSG("RESP protocol error.");
+		return false;
+	}
+
+	return true;
+}
+
+
+void Server::OnUnknownOpcode(Packet* packet)
+{
+	assert(packet);
+
+	const Protocol::Header* header = reinterpret_cast<const Protocol::Header*>(packet->GetData());
+	ERROR_MSG("Unknown opcode : %d", header->opcode);
+
+	ReleaseInbound(packet);
+	Packet::Destroy(packet);
+}
+
+
+Client* Server::FindSender(Packet* packet)
+{
+	assert(packet);
+
+	// The handle's generation tells a client that took the slot of the sender, or its memory, from the sender.
+	Client* client = m_Handles.Find(packet->GetSenderHandle());
+	return client == packet->GetSender() ? client : NULL;
+}
+
+
+bool Server::ReleaseInbound(Packet* packet)
+{
+	assert(packet);
+
+	EnterCriticalSection(&m_CSForClients);
+
+	bool alive = FindSender(packet) != NULL;
+	m_MemoryBudget.ReleaseInbound(alive ? packet->GetSender() : NULL, packet->GetSize());
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	OnBufferedBytesReleased();
+
+	return alive;
+}
+
+
+void Server::Echo(Packet* packet)
+{
+	assert(packet);
+	assert(packet->GetSender());
+
+	EnterCriticalSection(&m_CSForClients);
+
+	if(FindSender(packet) == NULL)
+	{
+		// No client to send it back.
+		m_MemoryBudget.ReleaseInbound(NULL, packet->GetSize());
+		Packet::Destroy(packet);		
+	}
+	else
+	{
+		m_MemoryBudget.ReleaseInbound(packet->GetSender(), packet->GetSize());
+		PostSend(packet->GetSender(), packet);
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::Ping(Packet* packet)
+{
+	assert(packet);
+	assert(packet->GetSender());
+
+	// On the sender's I/O thread, so it's alive, and m_CSForClients must not be taken here.
+	m_MemoryBudget.ReleaseInbound(packet->GetSender(), packet->GetSize());
+	PostSend(packet->GetSender(), packet);
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::Subscribe(Packet* packet, bool subscribe)
+{
+	assert(packet);
+
+	// Same layout, different opcodes.
+	Messages::SubscribeView subscribeView;
+	Messages::UnsubscribeView unsubscribeView;
+
+	bool valid = subscribe ? subscribeView.Init(packet->GetData(), packet->GetSize()) : unsubscribeView.Init(packet->GetData(), packet->GetSize());
+	if(!valid)
+	{
+		ERROR_MSG("Subscription without a channel.");
+		ReleaseInbound(packet);
+		Packet::Destroy(packet);
+		return;
+	}
+
+	DWORD channel = subscribe ? subscribeView.GetChannel() : unsubscribeView.GetChannel();
+	Client* client = packet->GetSender();
+
+	// Keep the client from being removed in the middle, so that it can't stay subscribed after that.
+	EnterCriticalSection(&m_CSForClients);
+
+	if(FindSender(packet) != NULL)
+	{
+		if(subscribe && client->GetNumSubscriptions() >= MAX_SUBSCRIPTIONS_PER_CLIENT)
+		{
+			ERROR_MSG("Too many subscriptions. channel : %d", channel);
+		}
+		else if(subscribe && m_PubSub.Subscribe(channel, client))
+		{
+			client->AddSubscriptions(1);
+
+			if(m_Cluster.IsEnabled())
+			{
+				m_Cluster.AddLocalSubscriber(channel);
+			}
+		}
+		else if(!subscribe && m_PubSub.Unsubscribe(channel, client))
+		{
+			client->AddSubscriptions(-1);
+
+			if(m_Cluster.IsEnabled())
+			{
+				m_Cluster.RemoveLocalSubscriber(channel);
+			}
+		}
+
+		m_MemoryBudget.ReleaseInbound(client, packet->GetSize());
+	}
+	else
+	{
+		m_MemoryBudget.ReleaseInbound(NULL, packet->GetSize());
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	// Publishers see the change from here on. Subscribes that came in meanwhile go out with it.
+	m_PubSub.Flush();
+
+	Packet::Destroy(packet);
+
+	// The owner of the channel hears of the first subscriber here and the last.
+	if(m_Cluster.IsEnabled())
+	{
+		ScheduleClusterFlush();
+	}
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::Publish(Packet* packet)
+{
+	assert(packet);
+
+	Messages::PublishView view;
+	if(!view.Init(packet->GetData(), packet->GetSize()))
+	{
+		ERROR_MSG("Publish without a channel.");
+		ReleaseInbound(packet);
+		Packet::Destroy(packet);
+		return;
+	}
+
+	DWORD channel = view.GetChannel();
+
+	ReleaseInbound(packet);
+
+	// The frame goes out as it came in. Subscribers can't be removed while it's being delivered.
+	size_t delivered = m_PubSub.Publish(channel, packet, Server::DeliverToClient, this);
+	TRACE("[%d] Published to channel %d : %d subscribers", GetCurrentThreadId(), channel, delivered);
+
+	if(m_Cluster.IsEnabled() && m_Cluster.Publish(channel, packet->GetData(), packet->GetSize(), m_Cluster.GetSelf()) > 0)
+	{
+		ScheduleClusterFlush();
+	}
+
+	Packet::Destroy(packet);
+}
+
+
+void Server::Move(Packet* packet)
+{
+	assert(packet);
+
+	Client* client = packet->GetSender();
+
+	Messages::MoveView view;
+	bool valid = view.Init(packet->GetData(), packet->GetSize());
+	if(!valid)
+	{
+		ERROR_MSG("Move without a position.");
+	}
+
+	// Same as Subscribe(). The client can't be removed and leave its entity behind.
+	EnterCriticalSection(&m_CSForClients);
+
+	bool alive = FindSender(packet) != NULL;
+	if(alive && valid)
+	{
+		EnterCriticalSection(&m_CSForInterest);
+
+		if(client->GetEntityId() == InterestGrid::INVALID_ENTITY)
+		{
+			client->SetEntityId(m_InterestGrid.AddEntity(view.GetX(), view.GetY(), client));
+		}
+		else
+		{
+			m_InterestGrid.MoveEntity(client->GetEntityId(), view.GetX(), view.GetY());
+		}
+
+		LeaveCriticalSection(&m_CSForInterest);
+	}
+
+	m_MemoryBudget.ReleaseInbound(alive ? client : NULL, packet->GetSize());
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	Packet::Destroy(packet);
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::CallRpc(Packet* packet)
+{
+	assert(packet);
+
+	Messages::RpcRequestView request;
+	if(!request.Init(packet->GetData(), packet->GetSize()))
+	{
+		// Without an id there is nothing to answer.
+		ERROR_MSG("Malformed RPC request.");
+		ReleaseInbound(packet);
+		Packet::Destroy(packet);
+		return;
+	}
+
+	// m_CSForClients is held so that the caller can't be removed before its call is in m_RpcServer.
+	EnterCriticalSection(&m_CSForClients);
+
+	Client* client = packet->GetSender();
+	bool alive = FindSender(packet) != NULL;
+	m_MemoryBudget.ReleaseInbound(alive ? client : NULL, packet->GetSize());
+
+	bool forwarded = false;
+	if(alive && m_UpstreamPool.GetNumBackends() > 0)
+	{
+		// The packet goes on to a backend.
+		m_UpstreamPool.Call(client, packet, request, Clock::GetMicroseconds(), Server::SendToUpstream, Server::DeliverToClient, this);
+		forwarded = true;
+	}
+	else if(alive)
+	{
+		m_RpcServer.Call(client, request, Clock::GetMicroseconds(), Server::DeliverToClient, this);
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	OnBufferedBytesReleased();
+
+	if(!forwarded)
+	{
+		Packet::Destroy(packet);
+	}
+}
+
+
+void Server::Login(Packet* packet)
+{
+	assert(packet);
+
+	Messages::LoginView view;
+	if(!view.Init(packet->GetData(), packet->GetSize()) || view.GetUser() == 0)
+	{
+		ERROR_MSG("Login without a user.");
+		ReleaseInbound(packet);
+		Packet::Destroy(packet);
+		return;
+	}
+
+	DWORD user = view.GetUser();
+	DWORD owner = m_Cluster.IsEnabled() ? m_Cluster.GetOwner(user) : Cluster::NO_NODE;
+
+	Protocol::LoginStatus status = Protocol::LOGIN_OK;
+	if(owner != m_Cluster.GetSelf())
+	{
+		status = Protocol::LOGIN_WRONG_NODE;
+	}
+
+	// The address is for the client to connect to instead.
+	const string empty;
+	const string& address = (status == Protocol::LOGIN_WRONG_NODE) ? m_Cluster.GetName(owner) : empty;
+	DWORD addressSize = static_cast<DWORD>(address.size());
+
+	Packet* result = Packet::Create(NULL, NULL, Messages::LoginResultBuilder::GetFrameSize(addressSize));
+
+	EnterCriticalSection(&m_CSForClients);
+
+	Client* client = packet->GetSender();
+	if(FindSender(packet) != NULL)
+	{
+		if(status == Protocol::LOGIN_OK)
+		{
+			EnterCriticalSection(&m_CSForUsers);
+
+			if(client->GetUserId() != 0 || m_Users.find(user) != m_Users.end())
+			{
+				status = Protocol::LOGIN_IN_USE;
+			}
+			else
+			{
+				m_Users[user] = client;
+				client->SetUserId(user);
+			}
+
+			LeaveCriticalSection(&m_CSForUsers);
+		}
+
+		if(result == NULL)
+		{
+			ERROR_MSG("Could not allocate a login result.");
+		}
+		else
+		{
+			Messages::LoginResultBuilder builder(result->GetData(), addressSize);
+			builder.SetUser(user);
+			builder.SetStatus(status);
+			builder.SetNode(owner != Cluster::NO_NODE ? owner : 0);
+			CopyMemory(builder.GetAddress(), address.c_str(), addressSize);
+
+			PostSend(client, result);
+			result = NULL;
+		}
+
+		m_MemoryBudget.ReleaseInbound(client, packet->GetSize());
+	}
+	else
+	{
+		m_MemoryBudget.ReleaseInbound(NULL, packet->GetSize());
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	if(result != NULL)
+	{
+		Packet::Destroy(result);
+	}
+	Packet::Destroy(packet);
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::SendToUser(Packet* packet)
+{
+	assert(packet);
+
+	Messages::SendToUserView view;
+	if(!view.Init(packet->GetData(), packet->GetSize()))
+	{
+		ERROR_MSG("SendToUser without a user.");
+		ReleaseInbound(packet);
+		Packet::Destroy(packet);
+		return;
+	}
+
+	// The sender's user has to be read while it can't go away.
 	EnterCriticalSection(&m_CSForClients);
 
-	ClientList::iterator itor = std::remove(m_Clients.begin(), m_Clients.end(), client);
+	Client* client = packet->GetSender();
+	bool alive = FindSender(packet) != NULL;
+	DWORD from = alive ? client->GetUserId() : 0;
+	m_MemoryBudget.ReleaseInbound(alive ? client : NULL, packet->GetSize());
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	if(alive)
+	{
+		DWORD owner = m_Cluster.IsEnabled() ? m_Cluster.GetOwner(view.GetUser()) : Cluster::NO_NODE;
+
+		if(owner == m_Cluster.GetSelf())
+		{
+			DeliverToUser(view.GetUser(), from, view.GetData(), view.GetDataCount());
+		}
+		else
+		{
+			m_Cluster.RouteToUser(owner, view.GetUser(), from, view.GetData(), view.GetDataCount());
+			InterlockedIncrement64(&m_NumRoutedUserMessages);
+
+			ScheduleClusterFlush();
+		}
+	}
+
+	Packet::Destroy(packet);
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::DeliverToUser(DWORD user, DWORD from, const BYTE* data, DWORD size)
+{
+	Packet* packet = Packet::Create(NULL, NULL, Messages::UserMessageBuilder::GetFrameSize(size));
+	if(packet == NULL)
+	{
+		ERROR_MSG("Could not allocate a user message of %d bytes.", size);
+		return;
+	}
+
+	Messages::UserMessageBuilder builder(packet->GetData(), size);
+	builder.SetFrom(from);
+	CopyMemory(builder.GetData(), data, size);
+
+	// Not m_CSForClients, as this runs on the I/O threads of links too.
+	EnterCriticalSection(&m_CSForUsers);
+
+	UserMap::iterator itor = m_Users.find(user);
+	if(itor != m_Users.end())
+	{
+		PostSend(itor->second, packet);
+		InterlockedIncrement64(&m_NumUserMessages);
+	}
+	else
+	{
+		Packet::Destroy(packet);
+		InterlockedIncrement64(&m_NumLostUserMessages);
+	}
+
+	LeaveCriticalSection(&m_CSForUsers);
+}
+
+
+void Server::PublishFrame(DWORD channel, const BYTE* frame, DWORD size, DWORD from)
+{
+	// Copied once for all the subscribers here.
+	Packet* packet = Packet::Create(NULL, frame, size);
+	if(packet == NULL)
+	{
+		ERROR_MSG("Could not allocate a packet of %d bytes. BufferPool is exhausted.", size);
+	}
+	else
+	{
+		m_PubSub.Publish(channel, packet, Server::DeliverToClient, this);
+		Packet::Destroy(packet);
+	}
+
+	if(m_Cluster.Publish(channel, frame, size, from) > 0)
+	{
+		ScheduleClusterFlush();
+	}
+}
+
+
+void Server::TickInterest(DWORD tick)
+{
+	if(m_ShuttingDown)
+	{
+		return;
+	}
+
+	// Removing a client takes this lock too, so every observer is alive while its updates are delivered.
+	EnterCriticalSection(&m_CSForInterest);
+
+	InterestGrid::TickStats stats;
+	m_InterestGrid.Tick(Server::DeliverToClient, this, &stats, tick);
+	m_LastInterestStats = stats;
+
+	LeaveCriticalSection(&m_CSForInterest);
+}
+
+
+void Server::Tick(ULONGLONG tick)
+{
+	if(m_ShuttingDown)
+	{
+		return;
+	}
+
+	// The input of this tick. Whatever arrives from now on is for the next one.
+	EnterCriticalSection(&m_CSForTickInput);
+	m_TickInputInProcess.swap(m_TickInput);
+	LeaveCriticalSection(&m_CSForTickInput);
+
+	// In the order they arrived, so each client's packets stay in order.
+	for(size_t i = 0 ; i < m_TickInputInProcess.size() ; ++i)
+	{
+		ProcessPacket(m_TickInputInProcess[i]);
+	}
+	m_TickInputInProcess.clear();
+
+	if(m_ProtocolMode == MODE_FRAMED)
+	{
+		if(m_SnapshotMode)
+		{
+			SendSnapshots();
+		}
+		else
+		{
+			TickInterest(static_cast<DWORD>(tick));
+		}
+	}
+
+	FlushSends();
+}
+
+
+void Server::SendSnapshots()
+{
+	// Same order as RemoveClient(). Clients and their entities stay while their snapshots are made.
+	EnterCriticalSection(&m_CSForClients);
+	EnterCriticalSection(&m_CSForInterest);
+
+	m_InterestGrid.Update();
+
+	for(ClientList::iterator itor = m_Clients.begin() ; itor != m_Clients.end() ; ++itor)
+	{
+		Client* client = *itor;
+		if(client->GetEntityId() == InterestGrid::INVALID_ENTITY)
+		{
+			continue;
+		}
+
+		SnapshotHistory* history = client->GetSnapshotHistory();
+		if(history == NULL)
+		{
+			history = new SnapshotHistory;
+			client->SetSnapshotHistory(history);
+		}
+
+		float x = 0.0f, y = 0.0f;
+		m_InterestGrid.GetPosition(client->GetEntityId(), x, y);
+		m_InterestGrid.Query(x, y, INTEREST_VIEW_RADIUS, m_SnapshotIds);
+		std::sort(m_SnapshotIds.begin(), m_SnapshotIds.end());
+
+		Snapshot& snapshot = history->Push();
+		snapshot.entities.resize(m_SnapshotIds.size());
+		for(size_t i = 0 ; i < m_SnapshotIds.size() ; ++i)
+		{
+			m_InterestGrid.GetPosition(m_SnapshotIds[i], x, y);
+
+			EntityState& state = snapshot.entities[i];
+			state.id = m_SnapshotIds[i];
+			state.x = SnapshotCodec::Quantize(x);
+			state.y = SnapshotCodec::Quantize(y);
+		}
+
+		// After Push(). The baseline may have been the oldest one, which is gone now.
+		const Snapshot* baseline = history->GetBaseline();
+
+		m_SnapshotBuffer.resize(Protocol::HEADER_SIZE);
+		SnapshotCodec::Encode(snapshot, baseline, m_SnapshotBuffer);
+
+		Protocol::Header* header = reinterpret_cast<Protocol::Header*>(&m_SnapshotBuffer[0]);
+		header->size = static_cast<DWORD>(m_SnapshotBuffer.size()) - Protocol::HEADER_SIZE;
+		header->opcode = Protocol::OP_SNAPSHOT;
+		header->flags = 0;
+
+		Packet* packet = Packet::Create(NULL, &m_SnapshotBuffer[0], static_cast<DWORD>(m_SnapshotBuffer.size()));
+		if(packet == NULL)
+		{
+			ERROR_MSG("Could not allocate a snapshot of %d bytes.", m_SnapshotBuffer.size());
+			continue;
+		}
+
+		// An unsent snapshot is worthless once there's a newer one. Both are against acked baselines.
+		packet->SetCoalesceKey(Packet::MakeCoalesceKey(Packet::COALESCE_SNAPSHOT, 0));
+
+		++m_NumSnapshots;
+		m_NumDeltaSnapshots += baseline != NULL ? 1 : 0;
+		m_SnapshotEntities += snapshot.entities.size();
+		m_SnapshotBytes += packet->GetSize();
+		m_SnapshotFullBytes += Messages::EntityUpdatesBuilder::GetFrameSize(static_cast<DWORD>(snapshot.entities.size()));
+
+		PostSend(client, packet);
+	}
+
+	LeaveCriticalSection(&m_CSForInterest);
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
+void Server::AckSnapshot(Packet* packet)
+{
+	assert(packet);
+
+	Client* client = packet->GetSender();
+
+	Messages::SnapshotAckView view;
+	DWORD sequence = SnapshotCodec::NO_BASELINE;
+	if(view.Init(packet->GetData(), packet->GetSize()))
+	{
+		sequence = view.GetSequence();
+	}
+	else
+	{
+		ERROR_MSG("Snapshot ack without a sequence.");
+	}
+
+	EnterCriticalSection(&m_CSForClients);
+
+	bool alive = FindSender(packet) != NULL;
+	if(alive && client->GetSnapshotHistory() != NULL)
+	{
+		client->GetSnapshotHistory()->Ack(sequence);
+	}
+
+	m_MemoryBudget.ReleaseInbound(alive ? client : NULL, packet->GetSize());
+
+	LeaveCriticalSection(&m_CSForClients);
+
+	Packet::Destroy(packet);
+
+	OnBufferedBytesReleased();
+}
+
+
+void Server::PauseRecv(Client* client)
+{
+	assert(client);
+
+	TRACE("[%d] Pause recv. buffered : %d bytes", GetCurrentThreadId(), client->GetBufferedBytes());
+
+	// This is an I/O callback, so m_CSForClients can't be taken here. See OnBufferedBytesReleased().
+	EnterCriticalSection(&m_CSForPausedClients);
 
-	if(itor != m_Clients.end())
+	client->SetRecvPaused(true);
+	m_PausedClients.push_back(client);
+	InterlockedIncrement(&m_NumPausedClients);
+
+	// Packets may have been drained before the client got on the list, and nobody would resume it then.
+	bool resume = m_MemoryBudget.IsUnderLow(client);
+	if(resume)
 	{
-		TRACE("[%d] RemoveClient succeeded.", GetCurrentThreadId());
+		m_PausedClients.pop_back();
+		InterlockedDecrement(&m_NumPausedClients);
+		client->SetRecvPaused(false);
+	}
 
-		Client::Destroy(client);
+	LeaveCriticalSection(&m_CSForPausedClients);
 
-		m_Clients.erase(itor);
+	if(resume)
+	{
+		PostRecv(client);
 	}
-
-	LeaveCriticalSection(&m_CSForClients);
 }
 
 
-void Server::Echo(Packet* packet)
+void Server::ResumePausedClients()
 {
-	assert(packet);
-	assert(packet->GetSender());
-
+	// m_CSForClients first, so that none of them can be removed until they're resumed.
 	EnterCriticalSection(&m_CSForClients);
+	EnterCriticalSection(&m_CSForPausedClients);
 
-	ClientList::iterator itor = std::find(m_Clients.begin(), m_Clients.end(), packet->GetSender());
-
-	if( itor == m_Clients.end())
+	ClientList resumed;
+	for(ClientList::iterator itor = m_PausedClients.begin() ; itor != m_PausedClients.end() ; )
 	{
-		// No client to send it back.
-		Packet::Destroy(packet);		
+		if(m_MemoryBudget.IsUnderLow(*itor))
+		{
+			(*itor)->SetRecvPaused(false);
+			resumed.push_back(*itor);
+			itor = m_PausedClients.erase(itor);
+			InterlockedDecrement(&m_NumPausedClients);
+		}
+		else
+		{
+			++itor;
+		}
 	}
-	else
+
+	LeaveCriticalSection(&m_CSForPausedClients);
+
+	// Still in m_CSForClients so that none of them can be removed in the middle.
+	for(ClientList::iterator itor = resumed.begin() ; itor != resumed.end() ; ++itor)
 	{
-		PostSend(packet->GetSender(), packet);
+		TRACE("[%d] Resume recv.", GetCurrentThreadId());
+		PostRecv(*itor);
 	}
 
 	LeaveCriticalSection(&m_CSForClients);
 }
 
 
+void Server::OnBufferedBytesReleased()
+{
+	// Cheap checks first. This runs for every packet sent.
+	if(m_NumPausedClients == 0 || !m_MemoryBudget.IsGlobalUnderLow())
+	{
+		return;
+	}
+
+	// This can be called in I/O callbacks, which must not wait for m_CSForClients.
+	// RemoveClient() holds it while it waits for the client's I/O callbacks to finish.
+	if(InterlockedCompareExchange(&m_ResumeScheduled, 1, 0) == 0)
+	{
+		if(m_ShuttingDown || TrySubmitThreadpoolCallback(Server::WorkerResumePausedClients, this, &m_ClientTPENV) == false)
+		{
+			InterlockedExchange(&m_ResumeScheduled, 0);
+		}
+	}
+}
+
+
 size_t Server::GetNumClients()
 {
 	EnterCriticalSection(&m_CSForClients);
@@ -540,3 +3234,458 @@ long Server::GetNumPostAccepts()
 {
 	return m_NumPostAccept;
 }
+
+long Server::GetNumPausedClients()
+{
+	return m_NumPausedClients;
+}
+
+
+void Server::SetSlowConsumerPolicy(SlowConsumerPolicy policy, DWORD maxOutstandingBytes, DWORD maxSendLatencyMs)
+{
+	m_SlowConsumerPolicy = policy;
+	m_MaxOutstandingSendBytes = maxOutstandingBytes;
+	m_MaxSendLatency = static_cast<ULONGLONG>(maxSendLatencyMs) * 1000;
+}
+
+
+void Server::SweepConnections()
+{
+	DWORD idleTimeout = m_IdleTimeout;
+	vector<Client*> idle;
+
+	EnterCriticalSection(&m_CSForClients);
+
+	ULONGLONG start = Clock::GetMicroseconds();
+
+	if(idleTimeout > 0)
+	{
+		m_ConnectionTable.FindIdle(GetTickCount(), idleTimeout, idle);
+	}
+	m_ConnectionTable.Sum(m_LastTotals);
+
+	// Run through while it's off as well, so that turning it on doesn't take every byte since as one sweep's.
+	DWORD bulkRate = m_BulkRate;
+	ULONGLONG bytesPerSweep = bulkRate > 0 ? static_cast<ULONGLONG>(bulkRate) * SWEEP_MS / 1000 : MAXULONGLONG;
+	m_NumBulkSenders = m_ConnectionTable.ClassifyBulk(bytesPerSweep);
+
+	m_LastSweepTime = Clock::GetMicroseconds() - start;
+
+	for(size_t i = 0 ; i < idle.size() ; ++i)
+	{
+		Client* client = idle[i];
+
+		// Paused and limited ones aren't read from, and links are quiet when there's nothing to route.
+		if(client->IsRecvPaused() || m_ConnectionTable.IsLimited(client->GetTableSlot()) || client->GetClusterNode() != Cluster::NO_NODE || client->GetState() != Client::ACCEPTED)
+		{
+			continue;
+		}
+
+		// Its recv fails and it goes the way of any other that does.
+		CancelIoEx(reinterpret_cast<HANDLE>(client->GetSocket()), NULL);
+		InterlockedIncrement64(&m_NumIdleCloses);
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
+bool Server::ChargeRecv(Client* client, DWORD messages, DWORD bytes)
+{
+	assert(client);
+
+	DWORD slot = client->GetTableSlot();
+	if(!m_RateLimiter.IsEnabled() || slot == ConnectionTable::NO_SLOT || client->GetClusterNode() != Cluster::NO_NODE)
+	{
+		return true;
+	}
+
+	if(m_RateLimiter.Charge(slot, client->GetAddressSlot(), messages, bytes))
+	{
+		return true;
+	}
+
+	// Counted first, so that a refill that clears the mark right away never takes the count below 0.
+	// This is an I/O callback, so m_CSForClients can't be taken here. See OnBufferedBytesReleased().
+	InterlockedIncrement(&m_NumRateLimited);
+	InterlockedIncrement64(&m_NumRatePauses);
+	m_ConnectionTable.SetLimited(slot, true);
+
+	return false;
+}
+
+
+void Server::RefillRates()
+{
+	vector<Client*> limited;
+
+	EnterCriticalSection(&m_CSForClients);
+
+	DWORD now = GetTickCount();
+	m_RateLimiter.Refill(now - m_LastRefill);
+	m_LastRefill = now;
+
+	if(m_NumRateLimited > 0)
+	{
+		m_ConnectionTable.FindLimited(limited);
+	}
+
+	// Still in the lock so that none of them can be removed in the middle.
+	for(size_t i = 0 ; i < limited.size() ; ++i)
+	{
+		Client* client = limited[i];
+		if(!m_RateLimiter.IsUnderRate(client->GetTableSlot(), client->GetAddressSlot()))
+		{
+			continue;
+		}
+
+		m_ConnectionTable.SetLimited(client->GetTableSlot(), false);
+		InterlockedDecrement(&m_NumRateLimited);
+		InterlockedIncrement64(&m_NumRateResumes);
+
+		TRACE("[%d] Resume recv within the rate.", GetCurrentThreadId());
+
+		// The memory budget may have been crossed by what the client sent last.
+		if(m_MemoryBudget.IsOverHigh(client))
+		{
+			PauseRecv(client);
+		}
+		else
+		{
+			PostRecv(client);
+		}
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
+void Server::TraceRateStats()
+{
+	EnterCriticalSection(&m_CSForClients);
+	RateLimiter::Stats stats;
+	m_RateLimiter.GetStats(stats);
+	LeaveCriticalSection(&m_CSForClients);
+
+	TRACE(" Rate limiting : %s, addresses : %d", m_RateLimiter.IsEnabled() ? "on" : "off", stats.addresses);
+	TRACE("   over the rate : connections %I64d times, addresses %I64d times", stats.connectionOverRate, stats.addressOverRate);
+	TRACE("   limited now : %d, paused : %I64d, resumed : %I64d", m_NumRateLimited, m_NumRatePauses, m_NumRateResumes);
+}
+
+
+void Server::TraceAdmissionStats()
+{
+	Blocklist::Stats stats;
+	m_Blocklist.GetStats(stats);
+
+	TRACE(" Rejected : blocked %I64d, over the limit of %d per address %I64d, overloaded %I64d, without an address %I64d",
+		m_NumRejects[REJECT_BLOCKED], m_MaxConnectionsPerAddress, m_NumRejects[REJECT_ADDRESS_LIMIT], m_NumRejects[REJECT_OVERLOAD],
+		m_NumRejects[REJECT_NO_ADDRESS]);
+	TRACE("   addresses with connections : %d", m_AddressCounter.GetNumAddresses());
+	TRACE("   blocklist : %d addresses, checks : %I64d, past the filter : %I64d, blocked : %I64d",
+		stats.addresses, stats.checks, stats.filterPasses, stats.blocked);
+}
+
+
+void Server::TraceOverloadStats()
+{
+	OverloadControl::Stats stats;
+	m_OverloadControl.GetStats(stats);
+
+	static const char* const LEVEL_NAMES[OverloadControl::NUM_LEVELS] = { "normal", "rejecting", "shedding" };
+
+	TRACE(" Overload control : %s, target %d ms, interval %d ms, level : %s, queued : %d",
+		m_OverloadControl.IsEnabled() ? "on" : "off", m_OverloadControl.GetTargetMs(), m_OverloadControl.GetIntervalMs(),
+		LEVEL_NAMES[stats.level], stats.queued);
+	TRACE("   intervals : %I64d, overloaded : %I64d, ms normal : %I64d, rejecting : %I64d, shedding : %I64d",
+		stats.intervals, stats.overloadedIntervals, stats.timeAtLevel[OverloadControl::LEVEL_NORMAL] / 1000,
+		stats.timeAtLevel[OverloadControl::LEVEL_REJECTING] / 1000, stats.timeAtLevel[OverloadControl::LEVEL_SHEDDING] / 1000);
+	TRACE("   shed : interactive %I64d, bulk %I64d, connections rejected : %I64d",
+		stats.shed[OpcodeTable::PRIORITY_INTERACTIVE], stats.shed[OpcodeTable::PRIORITY_BULK], m_NumRejects[REJECT_OVERLOAD]);
+	m_OverloadControl.GetSojourns().Trace("Queue sojourn", "us");
+}
+
+
+void Server::TraceLaneStats()
+{
+	PacketLanes::Stats stats;
+	m_Lanes.GetStats(stats);
+
+	static const char* const POLICY_NAMES[] = { "fifo", "strict", "weighted" };
+	static const char* const LANE_NAMES[OpcodeTable::NUM_PRIORITIES] = { "Lane control", "Lane interactive", "Lane bulk" };
+
+	TRACE(" Packet lanes : %s, starvation limit %d ms, bulk rate %d bytes/s, bulk senders : %d",
+		POLICY_NAMES[m_Lanes.GetPolicy()], m_Lanes.GetStarvationLimit(), m_BulkRate, m_NumBulkSenders);
+	TRACE("   queued : control %d, interactive %d, bulk %d",
+		stats.queued[OpcodeTable::PRIORITY_CONTROL], stats.queued[OpcodeTable::PRIORITY_INTERACTIVE], stats.queued[OpcodeTable::PRIORITY_BULK]);
+	TRACE("   popped : control %I64d, interactive %I64d, bulk %I64d",
+		stats.popped[OpcodeTable::PRIORITY_CONTROL], stats.popped[OpcodeTable::PRIORITY_INTERACTIVE], stats.popped[OpcodeTable::PRIORITY_BULK]);
+	TRACE("   rescued from starving : control %I64d, interactive %I64d, bulk %I64d",
+		stats.rescued[OpcodeTable::PRIORITY_CONTROL], stats.rescued[OpcodeTable::PRIORITY_INTERACTIVE], stats.rescued[OpcodeTable::PRIORITY_BULK]);
+
+	for(int i = 0 ; i < OpcodeTable::NUM_PRIORITIES ; ++i)
+	{
+		m_LaneLatencies[i].Trace(LANE_NAMES[i], "us");
+	}
+}
+
+
+void Server::TraceConnectionStats()
+{
+	EnterCriticalSection(&m_CSForClients);
+	ConnectionTable::Totals totals = m_LastTotals;
+	ULONGLONG sweepTime = m_LastSweepTime;
+	LeaveCriticalSection(&m_CSForClients);
+
+	TRACE(" Connections : %d, received %I64d bytes, sent %I64d bytes, as of the last sweep (%I64d us)",
+		totals.connections, totals.recvBytes, totals.sentBytes, sweepTime);
+	TRACE(" Idle timeout : %d ms, closed for it : %I64d", m_IdleTimeout, m_NumIdleCloses);
+}
+
+
+void Server::TraceSendStats()
+{
+	EnterCriticalSection(&m_CSForClients);
+
+	for(ClientList::iterator itor = m_Clients.begin() ; itor != m_Clients.end() ; ++itor)
+	{
+		Client* client = *itor;
+
+		client->LockSendQueue();
+		Client::SendStats stats = client->GetSendStats();
+		DWORD queued = client->GetQueuedSendBytes();
+		client->UnlockSendQueue();
+
+		// Only the ones worth looking at.
+		if(stats.slowDetections == 0 && stats.droppedPackets == 0 && stats.coalescedPackets == 0 && queued == 0)
+		{
+			continue;
+		}
+
+		std::string ip;
+		u_short port = 0;
+		Network::GetRemoteAddress(client->GetSocket(), ip, port);
+
+		ULONGLONG avgLatency = stats.sentBatches > 0 ? stats.totalLatency / stats.sentBatches : 0;
+
+		TRACE(" ip[%s], port[%d] queued : %d bytes, slow : %d, latency avg : %I64d us, max : %I64d us",
+			ip.c_str(), port, queued, stats.slowDetections, avgLatency, stats.maxLatency);
+		TRACE("   sent : %d (%I64d bytes), dropped : %d (%I64d bytes), coalesced : %d (%I64d bytes)",
+			stats.sentPackets, stats.sentBytes, stats.droppedPackets, stats.droppedBytes, stats.coalescedPackets, stats.coalescedBytes);
+	}
+
+	LeaveCriticalSection(&m_CSForClients);
+}
+
+
+void Server::TraceInterestStats()
+{
+	EnterCriticalSection(&m_CSForInterest);
+	InterestGrid::TickStats stats = m_LastInterestStats;
+	LeaveCriticalSection(&m_CSForInterest);
+
+	TRACE(" Last interest tick : %d entities, %d observers, sort : %I64d us, interest : %I64d us",
+		stats.entities, stats.observers, stats.sortTime, stats.interestTime);
+	TRACE("   %d cell packets (%I64d bytes) shared by %d deliveries (%I64d bytes)",
+		stats.cellPackets, stats.packetBytes, stats.deliveries, stats.sentBytes);
+}
+
+
+void Server::TraceRpcStats()
+{
+	RpcServer::Stats stats = m_RpcServer.GetStats();
+
+	TRACE(" RPC calls : %I64d, succeeded : %I64d, failed : %I64d, expired : %I64d, abandoned : %I64d, waiting : %d",
+		stats.calls, stats.succeeded, stats.failed, stats.expired, stats.abandoned, stats.waiting);
+}
+
+
+void Server::TraceBalanceStats()
+{
+	if(m_UpstreamPool.GetNumBackends() == 0)
+	{
+		TRACE(" No backends. RPC calls are answered here.");
+		return;
+	}
+
+	UpstreamPool::Stats stats = m_UpstreamPool.GetStats();
+
+	TRACE(" Forwarded calls : %I64d, succeeded : %I64d, failed : %I64d, expired : %I64d, abandoned : %I64d, late : %I64d, pending : %d",
+		stats.calls, stats.succeeded, stats.failed, stats.expired, stats.abandoned, stats.late, stats.pending);
+
+	m_UpstreamPool.TraceBackends();
+}
+
+
+void Server::TraceKeyValueStats()
+{
+	KeyValueStore::Stats stats;
+	m_KeyValueStore.GetStats(stats);
+
+	TRACE(" RESP commands : %I64d, keys : %I64d, keys and values : %I64d bytes, arenas : %I64d bytes",
+		m_NumRespCommands, stats.keys, stats.recordBytes, stats.arenaBytes);
+}
+
+
+void Server::TraceProxyStats()
+{
+	TRACE(" Proxied : upstream %I64d bytes, downstream %I64d bytes, paused : %d times, half-closed : %d ways",
+		m_ProxyUpstreamBytes, m_ProxyDownstreamBytes, m_NumProxyPauses, m_NumProxyHalfCloses);
+}
+
+
+void Server::TraceLogicStats()
+{
+	if(!m_LogicChannel.IsOpen())
+	{
+		TRACE(" No logic channel.");
+		return;
+	}
+
+	EnterCriticalSection(&m_CSForClients);
+	DWORD numHandles = m_LogicHandles.GetNumClients();
+	LeaveCriticalSection(&m_CSForClients);
+
+	SharedChannel::Stats inbound = m_LogicChannel.GetStats(SharedChannel::INBOUND);
+	SharedChannel::Stats outbound = m_LogicChannel.GetStats(SharedChannel::OUTBOUND);
+
+	TRACE(" Logic process %d : clients %d, frames to %I64d, dropped %I64d, sends from %I64d, for clients gone %I64d, connects and disconnects waiting %d",
+		m_LogicChannel.GetLogicProcessId(), numHandles, m_NumLogicFrames, m_NumLogicDrops, m_NumLogicSends, m_NumLogicOrphans, m_NumLogicNotices);
+	TRACE(" inbound : queued %d, full %I64d, wakeups %I64d / outbound : queued %d, full %I64d, wakeups %I64d / blocks in use %d",
+		inbound.queued, inbound.full, inbound.wakeups, outbound.queued, outbound.full, outbound.wakeups, inbound.blocksInUse);
+}
+
+
+void Server::TraceClusterStats()
+{
+	if(!m_Cluster.IsEnabled())
+	{
+		TRACE(" No cluster.");
+		return;
+	}
+
+	EnterCriticalSection(&m_CSForUsers);
+	DWORD numUsers = static_cast<DWORD>(m_Users.size());
+	LeaveCriticalSection(&m_CSForUsers);
+
+	TRACE(" Node %d of %d : users %d, user messages delivered %I64d, routed %I64d, to users not here %I64d",
+		m_Cluster.GetSelf(), m_Cluster.GetNumNodes(), numUsers, m_NumUserMessages, m_NumRoutedUserMessages, m_NumLostUserMessages);
+
+	for(DWORD i = 0 ; i < m_Cluster.GetNumNodes() ; ++i)
+	{
+		DWORD node = m_Cluster.GetNodeId(i);
+		if(node == m_Cluster.GetSelf())
+		{
+			continue;
+		}
+
+		Cluster::NodeStats stats = m_Cluster.GetStats(node);
+
+		TRACE("  node %d %s : %s, sent %I64d in %I64d batches (%I64d bytes), dropped %I64d, received %I64d",
+			node, m_Cluster.GetName(node).c_str(), stats.connected ? "linked" : "not linked",
+			stats.records, stats.batches, stats.bytes, stats.dropped, stats.received);
+	}
+}
+
+
+void Server::TraceTickStats()
+{
+	if(!m_TickScheduler.IsRunning())
+	{
+		TRACE(" Tick mode is off.");
+	}
+	else
+	{
+		m_TickScheduler.TraceStats();
+	}
+
+	m_SendBatchSizes.Trace("Sends per WSASend", "sends");
+
+	if(m_SnapshotMode && m_NumSnapshots > 0)
+	{
+		TRACE(" Snapshots : %I64d (%I64d deltas), %I64d entities/snapshot, %I64d bytes/snapshot, %I64d%% of full updates",
+			m_NumSnapshots, m_NumDeltaSnapshots, m_SnapshotEntities / m_NumSnapshots, m_SnapshotBytes / m_NumSnapshots,
+			m_SnapshotFullBytes > 0 ? m_SnapshotBytes * 100 / m_SnapshotFullBytes : 0);
+	}
+}
+
+
+void Server::BenchRoute(DWORD node, DWORD count)
+{
+	if(!m_Cluster.IsEnabled() || node == m_Cluster.GetSelf() || !m_Cluster.IsNode(node))
+	{
+		TRACE(" Needs another node of the cluster.");
+		return;
+	}
+
+	if(!m_Cluster.GetStats(node).connected)
+	{
+		TRACE(" No link to node %d.", node);
+		return;
+	}
+
+	// One at a time, for the time a message takes there and back alone.
+	m_RouteRoundTrips.Reset();
+	InterlockedExchange(&m_NumRoutePongs, 0);
+
+	for(DWORD i = 0 ; i < ROUTE_BENCH_SERIAL_PINGS ; ++i)
+	{
+		m_Cluster.Ping(node, i, Clock::GetMicroseconds());
+		ScheduleClusterFlush();
+
+		if(!WaitForRoutePongs(i + 1))
+		{
+			return;
+		}
+	}
+
+	TRACE(" Node %d, one at a time. A hop is half of a round trip.", node);
+	m_RouteRoundTrips.Trace("Round trips", "us");
+
+	// Many at a time, for how many go through the links. Each ping and its pong are routed once each.
+	m_RouteRoundTrips.Reset();
+	InterlockedExchange(&m_NumRoutePongs, 0);
+
+	ULONGLONG startTime = Clock::GetMicroseconds();
+
+	for(DWORD i = 0 ; i < count ; ++i)
+	{
+		while(static_cast<LONG>(i) - m_NumRoutePongs >= ROUTE_BENCH_WINDOW)
+		{
+			Sleep(0);
+		}
+
+		m_Cluster.Ping(node, i, Clock::GetMicroseconds());
+		ScheduleClusterFlush();
+	}
+
+	if(!WaitForRoutePongs(count))
+	{
+		return;
+	}
+
+	ULONGLONG elapsed = Clock::GetMicroseconds() - startTime;
+
+	TRACE(" Node %d, up to %d at a time : %d pings in %I64d us, %I64d routed messages/sec",
+		node, ROUTE_BENCH_WINDOW, count, elapsed, elapsed > 0 ? static_cast<ULONGLONG>(count) * 2 * 1000000 / elapsed : 0);
+	m_RouteRoundTrips.Trace("Round trips", "us");
+}
+
+
+bool Server::WaitForRoutePongs(LONG count)
+{
+	ULONGLONG deadline = Clock::GetMicroseconds() + static_cast<ULONGLONG>(ROUTE_BENCH_TIMEOUT_MS) * 1000;
+
+	while(m_NumRoutePongs < count)
+	{
+		if(Clock::GetMicroseconds() > deadline)
+		{
+			TRACE(" Only %d of %d pongs came back. The link is lost, or dropping.", m_NumRoutePongs, count);
+			return false;
+		}
+
+		Sleep(0);
+	}
+
+	return true;
+}
@@ -2,15 +2,36 @@
 
 #include <winsock2.h>
 #include <vector>
+#include <boost/unordered_map.hpp>
 
-#include "..\TSingleton.h"
+#include "MemoryBudget.h"
+#include "PubSub.h"
+#include "InterestGrid.h"
+#include "RpcServer.h"
+#include "UpstreamPool.h"
+#include "SharedChannel.h"
+#include "ClientHandles.h"
+#include "ConnectionTable.h"
+#include "RateLimiter.h"
+#include "AddressCounter.h"
+#include "Blocklist.h"
+#include "OverloadControl.h"
+#include "PacketLanes.h"
+#include "Cluster.h"
+#include "KeyValueStore.h"
+#include "TickScheduler.h"
+#include "OpcodeTable.h"
+#include "..\Histogram.h"
 
 class Client;
 class Packet;
 class IOEvent;
 
-class Server :  public TSingleton<Server>
+class Server
 {
+	// The handlers registered in Server.cpp.
+	template<class T, int OPCODE> friend struct OpcodeTable::Handler;
+
 private:
 	// Callback Routine
 	static void CALLBACK IoCompletionCallback(PTP_CALLBACK_INSTANCE Instance, PVOID Context, PVOID Overlapped, ULONG IoResult, ULONG_PTR NumberOfBytesTransferred, PTP_IO Io);
@@ -20,38 +41,330 @@ private:
 
 	static void CALLBACK WorkerAddClient(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context);
 	static void CALLBACK WorkerRemoveClient(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context);
-	static void CALLBACK WorkerProcessRecvPacket(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context);
+	static void CALLBACK WorkerProcessLanes(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context);
+	static void CALLBACK WorkerResumePausedClients(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context);
+	static void CALLBACK WorkerInterestTick(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */);
+	static void CALLBACK WorkerPollRpc(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */);
+	static void CALLBACK WorkerFlushCluster(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context);
+	static void CALLBACK WorkerSweepConnections(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */);
+	static void CALLBACK WorkerRefillRates(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */);
+
+	// FrameDecoder, PubSub, InterestGrid, RpcServer, UpstreamPool and Cluster callbacks
+	static bool OnFrame(void* context, const BYTE* frame, DWORD size);
+	static void DeliverToClient(void* context, Client* client, Packet* packet);
+	static void SendToUpstream(void* context, Client* connection, Packet* packet);
+	static void SendToLink(void* context, Client* link, Packet* packet);
+
+	// TickScheduler callback
+	static void OnTick(void* context, ULONGLONG tick);
+
+	// SharedChannel callback, for what the logic process sends.
+	static void OnLogicMessage(void* context, const SharedChannel::Message& message);
+
+public:
+	enum ProtocolMode
+	{
+		MODE_RAW,		// every recv is echoed back as it is.
+		MODE_FRAMED,	// Protocol frames dispatched by opcode.
+		MODE_RESP,		// Redis commands on m_KeyValueStore. See RespSession.
+		MODE_PROXY,		// bytes are relayed to and from a connection to the backend made for each client. See ProxyLink.
+	};
+
+	// What to do with a client whose sends are piling up.
+	enum SlowConsumerPolicy
+	{
+		SLOW_CONSUMER_IGNORE,
+		SLOW_CONSUMER_DROP_OLDEST,		// drop queued sends until the new one fits.
+		SLOW_CONSUMER_DROP_NEWEST,		// drop the new one.
+		SLOW_CONSUMER_COALESCE_LATEST,	// drop all queued sends and keep the new one.
+		SLOW_CONSUMER_DISCONNECT,
+	};
+
+	// Why an accepted connection was closed before it became a client.
+	enum RejectReason
+	{
+		REJECT_NO_ADDRESS,		// gone before its address could be read.
+		REJECT_BLOCKED,			// on m_Blocklist.
+		REJECT_ADDRESS_LIMIT,	// too many open from its address.
+		REJECT_OVERLOAD,		// the workers are behind. See SetOverloadTarget().
+		NUM_REJECT_REASONS,
+	};
+
+	enum
+	{
+		DEFAULT_MAX_OUTSTANDING_SEND_BYTES = 256 * 1024,
+		DEFAULT_MAX_SEND_LATENCY_MS = 5000,
+
+		// How often position updates go out in MODE_FRAMED, unless they go out every tick.
+		INTEREST_TICK_MS = 100,
+
+		// How often delayed RPC calls and deadlines are checked in MODE_FRAMED. Deadlines are this late at most.
+		// Lost connections to backends and links to nodes of the cluster are made again on the same timer.
+		RPC_POLL_MS = 10,
+
+		// Most sends that go out in one WSASend().
+		MAX_SEND_BATCH = 64,
+
+		// Most channels a client can be subscribed to in MODE_FRAMED.
+		MAX_SUBSCRIPTIONS_PER_CLIENT = 256,
+
+		// How often m_ConnectionTable is swept for idle clients and totals.
+		SWEEP_MS = 1000,
+
+		// How often the buckets of m_RateLimiter are refilled, and clients back within their rates are read from again.
+		RATE_REFILL_MS = 50,
+	};
 
 public:
 	Server();
 	virtual ~Server();
 
+	// Call before Create(). The I/O and workers of this server run on a thread pool of its own with numThreads threads,
+	// so that servers in one process share nothing. 0 is the process's default pool, the default.
+	void SetThreadPool(DWORD numThreads) { m_NumThreads = numThreads; }
+
+	// Call before Create().
+	void SetProtocolMode(ProtocolMode mode) { m_ProtocolMode = mode; }
+
+	// Call before Create(). 0 is off, the default.
+	// In tick mode received packets wait for the next tick, are processed together on the tick,
+	// and whatever the tick sent to a client goes out in one WSASend() at the end of it.
+	void SetTickRate(DWORD ticksPerSecond) { m_TickRate = ticksPerSecond; }
+
+	// Call before Create(). Needs MODE_FRAMED and tick mode.
+	// Instead of the updates of the cells around it, each client is sent a snapshot of what it can see
+	// every tick, delta encoded against the last snapshot it acknowledged.
+	void SetSnapshotMode(bool enable) { m_SnapshotMode = enable; }
+
+	// Call before Create(). Needs MODE_PROXY. Returns false if the address can't be resolved.
+	bool SetProxyBackend(const char* host, u_short port);
+
+	// Call before Create(). Needs MODE_FRAMED. Returns false if the address can't be resolved.
+	// With backends, RPC calls are forwarded to them on pooled connections instead of being answered here. See UpstreamPool.
+	bool AddBackend(const char* host, u_short port) { return m_UpstreamPool.AddBackend(host, port); }
+	void SetBalancePolicy(Balancer::Policy policy) { m_UpstreamPool.SetPolicy(policy); }
+
+	// Call before Create(). Needs MODE_FRAMED. Returns false if the channel can't be created.
+	// Frames of clients go to a logic process over the channel instead of being dispatched here,
+	// and the frames it sends back go out to their clients. See SharedChannel and LogicHost.
+	bool SetLogicChannel(const char* name) { return m_LogicChannel.Create(name); }
+
+	// Call before Create(). Needs MODE_FRAMED. Returns false if the file can't be loaded.
+	// This server is node self of the cluster in the file, and users and channels of the other nodes are reached over links to them.
+	bool SetCluster(const char* path, DWORD self) { return m_Cluster.Load(path, self); }
+	Cluster& GetCluster() { return m_Cluster; }
+
 	bool Create(short port, int maxPostAccept);
 	void Destroy();
 
 	size_t GetNumClients();
 	long GetNumPostAccepts();
+	long GetNumPausedClients();
+
+	MemoryBudget& GetMemoryBudget() { return m_MemoryBudget; }
+
+	// A client is slow when its queued and in-flight send bytes exceed maxOutstandingBytes,
+	// or its in-flight send has not completed for maxSendLatencyMs.
+	void SetSlowConsumerPolicy(SlowConsumerPolicy policy, DWORD maxOutstandingBytes, DWORD maxSendLatencyMs);
+
+	// Off by default. When on, a packet with a coalescing key replaces a queued, unsent one with the same key,
+	// so a client that lags behind holds at most one cell update per cell and one snapshot.
+	void SetSendCoalescing(bool enable) { m_SendCoalescing = enable; }
+	void TraceSendStats();
+
+	// Clients that have received and sent nothing for this long are disconnected. 0 is off, the default.
+	// Links of the cluster are left alone.
+	void SetIdleTimeout(DWORD seconds) { m_IdleTimeout = seconds * 1000; }
+	void TraceConnectionStats();
+
+	// Call before Create(). Returns false if a rate is over RateLimiter::MAX_RATE. Nothing is limited by default.
+	// A client over the rate of its own or of its address isn't read from until refills bring it back within both.
+	// Links of the cluster and MODE_PROXY are not limited.
+	bool SetRateLimits(const RateLimiter::Limits& connection, const RateLimiter::Limits& address) { return m_RateLimiter.SetLimits(connection, address); }
+	RateLimiter& GetRateLimiter() { return m_RateLimiter; }
+	void TraceRateStats();
+
+	// Accepted connections are checked before anything is set up for them, and the ones on the blocklist or from
+	// an address with max connections open already are reset. Links from other nodes count like any other.
+	// Any time. 0 is no limit, the default.
+	void SetMaxConnectionsPerAddress(DWORD max) { m_MaxConnectionsPerAddress = max; }
+	// Any time. Returns false if the file can't be loaded, and the blocklist is left as it was then.
+	bool LoadBlocklist(const char* path) { return m_Blocklist.Load(path); }
+	void TraceAdmissionStats();
+
+	// Any time. 0 is off, the default. When packets have waited for a worker longer than targetMs through a whole
+	// interval, accepted connections are reset, and if it goes on for another, packets of low priority that waited
+	// too long are dropped instead of handled. RPC calls dropped are answered with RPC_OVERLOADED. See OverloadControl.
+	// Only packets queued for workers count, so it doesn't go with tick mode.
+	void SetOverloadTarget(DWORD targetMs, DWORD intervalMs) { m_OverloadControl.SetTarget(targetMs, intervalMs); }
+	void TraceOverloadStats();
+
+	// Any time. Packets wait for workers in a lane of the priority of their opcode, and those of bulk senders in
+	// the bulk lane, whatever the opcode. POLICY_FIFO, the default, takes them in the order they came, as if there
+	// were one queue. The latency of each lane, from the recv to the end of the handler, is traced with the stats.
+	// Only packets queued for workers go through the lanes, so it doesn't go with tick mode. See PacketLanes.
+	void SetLanePolicy(PacketLanes::Policy policy) { m_Lanes.SetPolicy(policy); }
+	void SetStarvationLimit(DWORD ms) { m_Lanes.SetStarvationLimit(ms); }
+	// Any time. A client that sent more than this over a sweep is a bulk sender until a sweep finds it under.
+	// 0 is off, the default.
+	void SetBulkRate(DWORD bytesPerSecond) { m_BulkRate = bytesPerSecond; }
+	void TraceLaneStats();
+
+	void TraceInterestStats();
+	void TraceRpcStats();
+	void TraceBalanceStats();
+	void TraceKeyValueStats();
+	void TraceProxyStats();
+	void TraceLogicStats();
+	void TraceClusterStats();
+	void TraceTickStats();
+
+	// Pings the node over the links, one at a time and then count of them at once,
+	// and traces the round trips and how many messages were routed per second.
+	void BenchRoute(DWORD node, DWORD count);
 
 private:
 	void PostAccept();
 	void PostRecv(Client* client);
 	void PostSend(Client* client, Packet* packet);
+	void IssueSend(IOEvent* batch);
+	// Takes up to MAX_SEND_BATCH queued sends and puts them in flight. Call with the send queue locked.
+	IOEvent* PopSendBatch(Client* client);
+	// Issues the queued sends of every client that has nothing in flight.
+	void FlushSends();
+	void DropSends(IOEvent* events);
+	// Drops the queued sends of a client that's going and the batch it had in flight, whose completion
+	// Client::WaitForCallbacks() may have cancelled. Call once its callbacks are done.
+	void DropAllSends(Client* client);
+	bool IsSlowConsumer(Client* client, DWORD newBytes, ULONGLONG now);
 
 	void OnAccept(IOEvent* event);
+	void OnConnect(IOEvent* event);
 	void OnRecv(IOEvent* event, DWORD dwNumberOfBytesTransfered);
 	void OnSend(IOEvent* event, DWORD dwNumberOfBytesTransfered);
 	void OnClose(IOEvent* event);
 
 	void AddClient(Client* client);
+	// Checks an accepted client against m_Blocklist and m_AddressCounter, and counts it there if it's let in.
+	bool Admit(Client* client);
+	// An accepted client that never made it to m_Clients.
+	void DiscardClient(Client* client);
 	void RemoveClient(Client* client);
+	void PostRemoveClient(Client* client);
+
+	// A client for a connection the server makes. Returns NULL if it couldn't be created.
+	Client* CreateConnection(int family);
+	// Adds the client to m_Clients and starts connecting it. Returns false if it couldn't be started.
+	bool StartConnect(Client* client, const SOCKADDR_STORAGE& address, int addressSize);
+
+	// MODE_PROXY. Connects a new client's backend connection. Returns false if it couldn't be started.
+	bool ConnectBackend(Client* front);
+	// Sends the bytes of a recv on to the peer and posts the next recv, unless the peer is too far behind.
+	bool ForwardRecv(Client* client, DWORD size);
+	// The client sent FIN. The peer's send side is shut down once the bytes before it are out.
+	void ForwardShutdown(Client* client);
+	void ShutdownSend(Client* client);
+	void ResumeForward(Client* client);
+
+	// Makes the connections to backends that UpstreamPool is missing.
+	void ConnectUpstreams();
+	bool ConnectUpstream(DWORD backend);
+	// A frame from a backend, which has to be an RPC response.
+	bool OnUpstreamFrame(Client* connection, const BYTE* frame, DWORD size);
 
+	// Hands the frame to the logic process, or drops it if the channel is full. Returns false if the client has to go.
+	bool ForwardToLogic(Client* client, const BYTE* frame, DWORD size);
+	// Call with m_CSForClients held. One that finds the channel full waits in m_LogicNotices, and goes before any frame.
+	void NotifyLogic(SharedChannel::MessageType type, DWORD handle);
+	// Pushes what it can of m_LogicNotices, in order. Call with m_CSForClients held.
+	void PushLogicNotices();
+	// On the RPC timer, while there are any.
+	void RetryLogicNotices();
+	void ProcessLogicMessage(const SharedChannel::Message& message);
+
+	// Makes the links to the other nodes that Cluster is missing.
+	void ConnectLinks();
+	bool ConnectLink(DWORD node);
+	// A frame on a link : the hello of a link another node made, then its batches. On the link's I/O thread,
+	// so that the messages of a node are handled in the order it sent them. Returns false if the link can't be trusted any more.
+	bool OnClusterFrame(Client* client, const BYTE* frame, DWORD size);
+	bool RouteMessage(DWORD node, const BYTE* frame, DWORD size);
+	// Batches go out when the flush runs. Whatever is routed until then goes with them.
+	void ScheduleClusterFlush();
+
+	// Sends a UserMessage to the user if it's logged in here. Any thread.
+	void DeliverToUser(DWORD user, DWORD from, const BYTE* data, DWORD size);
+	// The subscribers here of a Publish frame, and the nodes the owner of its channel sends it on to.
+	void PublishFrame(DWORD channel, const BYTE* frame, DWORD size, DWORD from);
+	bool WaitForRoutePongs(LONG count);
+
+	// Takes the client out of everything but m_Clients. Call with m_CSForClients held.
+	void UnregisterClient(Client* client);
+
+	// Disconnects idle clients and takes the totals of m_ConnectionTable.
+	void SweepConnections();
+
+	// Refills m_RateLimiter and resumes the clients that are back within their rates.
+	void RefillRates();
+	// Charges the recv to the client's buckets. Returns false if the client is over its rate, and it's marked as limited then.
+	bool ChargeRecv(Client* client, DWORD messages, DWORD bytes);
+
+	// Read backpressure driven by m_MemoryBudget.
+	void PauseRecv(Client* client);
+	void ResumePausedClients();
+	void OnBufferedBytesReleased();
+
+	// Creates a packet of the received bytes and queues it in m_Lanes for WorkerProcessLanes.
+	bool DispatchPacket(Client* client, const BYTE* data, DWORD size);
+	void ProcessPacket(Packet* packet);
+	OpcodeTable::Priority GetPriority(Packet* packet);
+	// Drops a packet m_OverloadControl has shed.
+	void ShedPacket(Packet* packet);
+
+	// Runs the RESP commands of a recv on the I/O thread and sends their replies. Returns false if the client has to go.
+	bool ProcessResp(Client* client, const BYTE* data, DWORD size);
+
+	// The sender of the packet, or NULL if it's gone. Call with m_CSForClients held.
+	Client* FindSender(Packet* packet);
+
+	// Releases the packet's inbound bytes. Returns false if the sender is gone.
+	bool ReleaseInbound(Packet* packet);
+
+	// Opcode handlers. See s_OpcodeTable.
 	void Echo(Packet* packet);
+	void Ping(Packet* packet);
+	void Subscribe(Packet* packet) { Subscribe(packet, true); }
+	void Unsubscribe(Packet* packet) { Subscribe(packet, false); }
+	void Subscribe(Packet* packet, bool subscribe);
+	void Publish(Packet* packet);
+	void Move(Packet* packet);
+	void CallRpc(Packet* packet);
+	void Login(Packet* packet);
+	void SendToUser(Packet* packet);
+	void OnUnknownOpcode(Packet* packet);
+
+	// Sends every observer the updates of the cells around it. The updates carry the tick in tick mode.
+	void TickInterest(DWORD tick = InterestGrid::NO_TICK);
+
+	// Processes the packets received since the last tick, then flushes sends.
+	void Tick(ULONGLONG tick);
+
+	void SendSnapshots();
+	void AckSnapshot(Packet* packet);
 
 private:
 	Server& operator=(Server& rhs);
 	Server(const Server& rhs);
 
 private:
+	static const OpcodeTable::Entry<Server> s_OpcodeTable[OpcodeTable::NUM_SLOTS];
+
+	// Everything of this server is created in m_TPENV, and m_ClientTPENV uses the same pool.
+	// m_TPPOOL is NULL if it's the default one.
+	DWORD m_NumThreads;
+	TP_POOL* m_TPPOOL;
+	TP_CALLBACK_ENVIRON m_TPENV;
+
 	TP_IO* m_pTPIO;
 	SOCKET m_listenSocket;
 
@@ -59,6 +372,39 @@ private:
 
 	typedef std::vector<Client*> ClientList;
 	ClientList m_Clients;
+	ClientHandles m_Handles; // of the clients in m_Clients, guarded by m_CSForClients.
+
+	// Guarded by m_CSForClients, but for the slots of clients, which their I/O callbacks write.
+	ConnectionTable m_ConnectionTable;
+	TP_TIMER* m_SweepTPTIMER;
+	volatile DWORD m_IdleTimeout; // milliseconds
+	volatile LONGLONG m_NumIdleCloses;
+	ConnectionTable::Totals m_LastTotals; // of the last sweep.
+	ULONGLONG m_LastSweepTime; // microseconds the last sweep took.
+
+	// Both thread-safe. Only accepted clients are counted, and uncounted as they're destroyed.
+	AddressCounter m_AddressCounter;
+	Blocklist m_Blocklist;
+	volatile DWORD m_MaxConnectionsPerAddress;
+	volatile LONGLONG m_NumRejects[NUM_REJECT_REASONS];
+
+	// Sees every packet queued for WorkerProcessLanes, and tells Admit() and ProcessPacket() what to turn away.
+	OverloadControl m_OverloadControl;
+
+	// Packets queued for workers. A callback is submitted for each, which takes whatever m_Lanes picks then.
+	PacketLanes m_Lanes;
+	volatile DWORD m_BulkRate;			// bytes a second.
+	volatile LONG m_NumBulkSenders;		// as of the last sweep.
+	Histogram m_LaneLatencies[OpcodeTable::NUM_PRIORITIES];	// microseconds.
+
+	// Buckets of the clients by the slots in m_ConnectionTable, which marks the ones over their rates.
+	// Guarded by m_CSForClients, but for the charges of the I/O callbacks.
+	RateLimiter m_RateLimiter;
+	TP_TIMER* m_RateTPTIMER;
+	DWORD m_LastRefill; // GetTickCount()
+	volatile LONG m_NumRateLimited;
+	volatile LONGLONG m_NumRatePauses;
+	volatile LONGLONG m_NumRateResumes;
 
 	int	m_MaxPostAccept;
 	volatile long m_NumPostAccept;
@@ -69,4 +415,86 @@ private:
 	TP_CLEANUP_GROUP* m_ClientTPCLEAN;
 
 	volatile bool m_ShuttingDown;
+
+	ProtocolMode m_ProtocolMode;
+	PubSub m_PubSub;
+
+	InterestGrid m_InterestGrid; // guarded by m_CSForInterest.
+	InterestGrid::TickStats m_LastInterestStats;
+	CRITICAL_SECTION m_CSForInterest;
+	TP_TIMER* m_InterestTPTIMER;
+
+	// Lock order : m_CSForClients, then RpcServer's. Calls are answered with both held, or RpcServer's alone.
+	RpcServer m_RpcServer;
+	TP_TIMER* m_RpcTPTIMER;
+
+	// Lock order : m_CSForClients, then UpstreamPool's. Same as RpcServer.
+	UpstreamPool m_UpstreamPool;
+	volatile LONG m_ConnectingUpstreams;
+
+	KeyValueStore m_KeyValueStore;
+	volatile LONGLONG m_NumRespCommands;
+
+	SOCKADDR_STORAGE m_ProxyBackend;
+	int m_ProxyBackendSize;
+	volatile LONGLONG m_ProxyUpstreamBytes;		// from clients to the backend.
+	volatile LONGLONG m_ProxyDownstreamBytes;
+	volatile LONG m_NumProxyPauses;
+	volatile LONG m_NumProxyHalfCloses;
+
+	SharedChannel m_LogicChannel;
+	ClientHandles m_LogicHandles; // guarded by m_CSForClients.
+	volatile LONGLONG m_NumLogicFrames;		// to the logic.
+	volatile LONGLONG m_NumLogicSends;		// from the logic.
+	volatile LONGLONG m_NumLogicDrops;		// frames to the logic that found the channel full.
+	volatile LONGLONG m_NumLogicOrphans;	// frames from the logic for clients that are gone.
+	std::vector<SharedChannel::Message> m_LogicNotices; // guarded by m_CSForClients. Connects and disconnects that found the channel full.
+	volatile LONG m_NumLogicNotices;		// its size, for ForwardToLogic().
+
+	// Lock order : m_CSForClients, then Cluster's or m_CSForUsers. Never both of those.
+	Cluster m_Cluster;
+	volatile LONG m_ConnectingLinks;
+	volatile LONG m_ClusterFlushScheduled;
+
+	// Users logged in here. Taken out in UnregisterClient(), so a client found here can be sent to while m_CSForUsers is held.
+	typedef boost::unordered_map<DWORD, Client*> UserMap;
+	UserMap m_Users; // guarded by m_CSForUsers.
+	CRITICAL_SECTION m_CSForUsers;
+	volatile LONGLONG m_NumUserMessages;		// delivered here.
+	volatile LONGLONG m_NumRoutedUserMessages;	// to the owners of their users.
+	volatile LONGLONG m_NumLostUserMessages;	// to users that aren't logged in.
+
+	Histogram m_RouteRoundTrips; // of BenchRoute().
+	volatile LONG m_NumRoutePongs;
+
+	DWORD m_TickRate;
+	TickScheduler m_TickScheduler;
+	std::vector<Packet*> m_TickInput; // guarded by m_CSForTickInput.
+	std::vector<Packet*> m_TickInputInProcess; // only touched by the tick.
+	CRITICAL_SECTION m_CSForTickInput;
+
+	Histogram m_SendBatchSizes; // sends per WSASend().
+
+	// Only touched by the tick.
+	bool m_SnapshotMode;
+	std::vector<DWORD> m_SnapshotIds;
+	std::vector<BYTE> m_SnapshotBuffer;
+	ULONGLONG m_NumSnapshots;
+	ULONGLONG m_NumDeltaSnapshots;
+	ULONGLONG m_SnapshotEntities;
+	ULONGLONG m_SnapshotBytes;
+	ULONGLONG m_SnapshotFullBytes; // if they had been sent as EntityUpdates.
+
+	MemoryBudget m_MemoryBudget;
+	// Lock order : m_CSForClients, then m_CSForPausedClients. The I/O callbacks pause clients with only the latter,
+	// which is never held while callbacks are waited for.
+	ClientList m_PausedClients; // guarded by m_CSForPausedClients.
+	CRITICAL_SECTION m_CSForPausedClients;
+	volatile long m_NumPausedClients;
+	volatile long m_ResumeScheduled;
+
+	SlowConsumerPolicy m_SlowConsumerPolicy;
+	DWORD m_MaxOutstandingSendBytes;
+	ULONGLONG m_MaxSendLatency; // microseconds
+	volatile bool m_SendCoalescing;
 };
@@ -0,0 +1,822 @@
+#include "SharedChannel.h"
+
+#include "..\Log.h"
+#include <cstdio>
+#include <cassert>
+#include <vector>
+
+
+namespace
+{
+	const DWORD CHANNEL_MAGIC = 0x4C4E4843; // "CHNL"
+	const DWORD CHANNEL_VERSION = 3;
+
+	// Tags of the blocks. A logic tags them with its epoch, which counts up from 1 with each Open().
+	const LONG OWNER_NONE = 0;		// free.
+	const LONG OWNER_FRONT = -1;
+
+	// What Recover() puts in a position that a dead writer took and never wrote. TryPop() skips it.
+	const WORD MESSAGE_LOST = 0xFFFF;
+
+	// What the reader and the writers of a ring touch is kept apart, so that they don't take cache lines from each other.
+	const int CACHE_LINE = 64;
+
+	// A process that took the id of a dead logic looks like it, and the channel can't be opened until it's gone too.
+	bool IsProcessRunning(DWORD processId)
+	{
+		if(processId == GetCurrentProcessId())
+		{
+			return true;
+		}
+
+		HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, processId);
+		if(process == NULL)
+		{
+			// It's there, but someone else's.
+			return GetLastError() == ERROR_ACCESS_DENIED;
+		}
+
+		bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+		CloseHandle(process);
+
+		return running;
+	}
+}
+
+
+// A bounded queue where a cell is free to push at position p when its sequence is p, and holds the message of p when it's p + 1.
+// Writers take positions with a compare and exchange, so any number of them can push. Positions wrap around at 2^32.
+struct SharedChannel::Ring
+{
+	struct Cell
+	{
+		volatile LONG sequence;
+		Message message;
+	};
+
+	volatile LONG enqueuePos;	// moved by the writers.
+	BYTE pad0[CACHE_LINE - sizeof(LONG)];
+
+	volatile LONG dequeuePos;	// only moved by the reader.
+	BYTE pad1[CACHE_LINE - sizeof(LONG)];
+
+	volatile LONG readerWaiting;
+	volatile LONG reserved;
+	volatile LONGLONG full;
+	volatile LONGLONG wakeups;
+	BYTE pad2[CACHE_LINE - 2 * sizeof(LONG) - 2 * sizeof(LONGLONG)];
+
+	Cell cells[RING_SIZE];
+};
+
+
+struct SharedChannel::Layout
+{
+	// Set last by Create(). Open() checks them.
+	volatile DWORD magic;
+	DWORD version;
+	DWORD size;
+	volatile LONG logicProcessId;
+	volatile LONG logicEpoch;
+	BYTE pad0[CACHE_LINE - 5 * sizeof(DWORD)];
+
+	Ring rings[NUM_DIRECTIONS];
+
+	// Free blocks as a stack. The index of the top one is in the low 32 bits, and the high ones count the changes
+	// so that a top that was taken and put back in between doesn't look the same.
+	volatile LONGLONG freeTop;
+	volatile LONG blocksInUse;
+	BYTE pad1[CACHE_LINE - sizeof(LONGLONG) - sizeof(LONG)];
+
+	volatile LONG nextFree[NUM_BLOCKS];
+	// The next block of a message, while the block is in use.
+	volatile LONG nextInChain[NUM_BLOCKS];
+	// Who has each block. Taken over by the reader of a message before its position is free again,
+	// so that a block in a ring is never lost between the two. See Recover().
+	volatile LONG blockOwners[NUM_BLOCKS];
+	BYTE blocks[NUM_BLOCKS][BLOCK_SIZE];
+};
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+/* static */ void CALLBACK SharedChannel::WorkerRead(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_WAIT /* Wait */, TP_WAIT_RESULT /* WaitResult */)
+{
+	SharedChannel* channel = static_cast<SharedChannel*>(Context);
+	assert(channel);
+
+	Direction direction = channel->m_ReadDirection;
+
+	Message message;
+	for(;;)
+	{
+		while(!channel->m_StopReading && channel->TryPop(direction, message))
+		{
+			channel->m_Read(channel->m_ReadContext, message);
+		}
+
+		if(channel->m_StopReading)
+		{
+			return;
+		}
+
+		if(channel->PrepareWait(direction))
+		{
+			break;
+		}
+	}
+
+	// Writers signal the event from now on.
+	SetThreadpoolWait(channel->m_ReadTPWAIT, channel->m_Events[direction], NULL);
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+SharedChannel::SharedChannel()
+: m_Mapping(NULL),
+  m_Layout(NULL),
+  m_SpinCount(SPIN_COUNT),
+  m_Owner(OWNER_NONE),
+  m_ReadTPWAIT(NULL),
+  m_ReadDirection(INBOUND),
+  m_Read(NULL),
+  m_ReadContext(NULL),
+  m_StopReading(false)
+{
+	for(int i = 0 ; i < NUM_DIRECTIONS ; ++i)
+	{
+		m_Events[i] = NULL;
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	if(info.dwNumberOfProcessors < 2)
+	{
+		m_SpinCount = 0;
+	}
+}
+
+
+SharedChannel::~SharedChannel()
+{
+	Close();
+}
+
+
+bool SharedChannel::Create(const char* name)
+{
+	if(!Map(name, true))
+	{
+		return false;
+	}
+
+	// The mapping comes zeroed.
+	for(int d = 0 ; d < NUM_DIRECTIONS ; ++d)
+	{
+		Ring& ring = m_Layout->rings[d];
+		for(DWORD i = 0 ; i < RING_SIZE ; ++i)
+		{
+			ring.cells[i].sequence = static_cast<LONG>(i);
+		}
+	}
+
+	for(DWORD i = 0 ; i < NUM_BLOCKS ; ++i)
+	{
+		m_Layout->nextFree[i] = i + 1 < NUM_BLOCKS ? i + 1 : NO_BLOCK;
+	}
+	m_Layout->freeTop = 0;
+
+	m_Layout->version = CHANNEL_VERSION;
+	m_Layout->size = sizeof(Layout);
+
+	MemoryBarrier();
+	m_Layout->magic = CHANNEL_MAGIC;
+
+	m_Owner = OWNER_FRONT;
+
+	return true;
+}
+
+
+bool SharedChannel::Open(const char* name)
+{
+	if(!Map(name, false))
+	{
+		return false;
+	}
+
+	if(m_Layout->magic != CHANNEL_MAGIC || m_Layout->version != CHANNEL_VERSION || m_Layout->size != sizeof(Layout))
+	{
+		ERROR_MSG("The channel %s is not one of this build.", name);
+		Close();
+		return false;
+	}
+
+	LONG previous = m_Layout->logicProcessId;
+	if(previous != 0 && IsProcessRunning(static_cast<DWORD>(previous)))
+	{
+		ERROR_MSG("The channel %s is in use by the logic process %d.", name, previous);
+		Close();
+		return false;
+	}
+
+	if(InterlockedCompareExchange(&m_Layout->logicProcessId, static_cast<LONG>(GetCurrentProcessId()), previous) != previous)
+	{
+		ERROR_MSG("Another logic process opened the channel %s meanwhile.", name);
+		Close();
+		return false;
+	}
+
+	m_Owner = InterlockedIncrement(&m_Layout->logicEpoch);
+
+	Recover(static_cast<DWORD>(previous));
+
+	return true;
+}
+
+
+void SharedChannel::Close()
+{
+	StopReading();
+
+	if(m_Layout != NULL)
+	{
+		// The next logic doesn't wait for this one to end then.
+		if(m_Owner != OWNER_NONE && m_Owner != OWNER_FRONT)
+		{
+			InterlockedCompareExchange(&m_Layout->logicProcessId, 0, static_cast<LONG>(GetCurrentProcessId()));
+		}
+		m_Owner = OWNER_NONE;
+
+		UnmapViewOfFile(m_Layout);
+		m_Layout = NULL;
+	}
+
+	for(int i = 0 ; i < NUM_DIRECTIONS ; ++i)
+	{
+		if(m_Events[i] != NULL)
+		{
+			CloseHandle(m_Events[i]);
+			m_Events[i] = NULL;
+		}
+	}
+
+	if(m_Mapping != NULL)
+	{
+		CloseHandle(m_Mapping);
+		m_Mapping = NULL;
+	}
+}
+
+
+DWORD SharedChannel::GetLogicProcessId()
+{
+	assert(m_Layout);
+
+	return static_cast<DWORD>(m_Layout->logicProcessId);
+}
+
+
+DWORD SharedChannel::AllocBlock()
+{
+	assert(m_Layout);
+
+	for(;;)
+	{
+		LONGLONG top = m_Layout->freeTop;
+
+		DWORD block = static_cast<DWORD>(top);
+		if(block == NO_BLOCK)
+		{
+			return NO_BLOCK;
+		}
+
+		// The block may be taken by another thread right now, and next be anything. The exchange fails then.
+		DWORD next = static_cast<DWORD>(m_Layout->nextFree[block]);
+		LONGLONG newTop = (static_cast<LONGLONG>(static_cast<DWORD>(top >> 32) + 1) << 32) | next;
+
+		if(InterlockedCompareExchange64(&m_Layout->freeTop, newTop, top) == top)
+		{
+			InterlockedIncrement(&m_Layout->blocksInUse);
+			m_Layout->blockOwners[block] = m_Owner;
+			m_Layout->nextInChain[block] = NO_BLOCK;
+			return block;
+		}
+	}
+}
+
+
+DWORD SharedChannel::AllocBlocks(DWORD size)
+{
+	assert(m_Layout);
+
+	if(size > MAX_MESSAGE_SIZE)
+	{
+		return NO_BLOCK;
+	}
+
+	// Taken from the last to the first, each linked to the one taken before it.
+	DWORD first = NO_BLOCK;
+	for(DWORD i = GetNumBlocks(size) ; i > 0 ; --i)
+	{
+		DWORD block = AllocBlock();
+		if(block == NO_BLOCK)
+		{
+			if(first != NO_BLOCK)
+			{
+				FreeBlock(first);
+			}
+			return NO_BLOCK;
+		}
+
+		m_Layout->nextInChain[block] = static_cast<LONG>(first);
+		first = block;
+	}
+
+	return first;
+}
+
+
+void SharedChannel::FreeBlock(DWORD block)
+{
+	assert(m_Layout);
+	assert(block < NUM_BLOCKS);
+
+	// A block that is free already ends the chain, so a bad link can't put one on the stack twice.
+	for(DWORD i = 0 ; i < NUM_BLOCKS && block < NUM_BLOCKS ; ++i)
+	{
+		DWORD next = static_cast<DWORD>(m_Layout->nextInChain[block]);
+
+		// Before it's on the stack, or Recover() could take it back from a dead logic that had it a second time.
+		if(InterlockedExchange(&m_Layout->blockOwners[block], OWNER_NONE) == OWNER_NONE)
+		{
+			break;
+		}
+
+		PushFreeBlock(block);
+		block = next;
+	}
+}
+
+
+void SharedChannel::PushFreeBlock(DWORD block)
+{
+	for(;;)
+	{
+		LONGLONG top = m_Layout->freeTop;
+
+		m_Layout->nextFree[block] = static_cast<LONG>(static_cast<DWORD>(top));
+		LONGLONG newTop = (static_cast<LONGLONG>(static_cast<DWORD>(top >> 32) + 1) << 32) | block;
+
+		if(InterlockedCompareExchange64(&m_Layout->freeTop, newTop, top) == top)
+		{
+			InterlockedDecrement(&m_Layout->blocksInUse);
+			return;
+		}
+	}
+}
+
+
+BYTE* SharedChannel::GetBlock(DWORD block)
+{
+	assert(m_Layout);
+	assert(block < NUM_BLOCKS);
+
+	return m_Layout->blocks[block];
+}
+
+
+DWORD SharedChannel::GetNextBlock(DWORD block)
+{
+	assert(m_Layout);
+	assert(block < NUM_BLOCKS);
+
+	return static_cast<DWORD>(m_Layout->nextInChain[block]);
+}
+
+
+void SharedChannel::WriteBlocks(DWORD block, const BYTE* data, DWORD size)
+{
+	assert(m_Layout);
+
+	for(DWORD offset = 0 ; offset < size ; offset += BLOCK_SIZE)
+	{
+		assert(block < NUM_BLOCKS);
+
+		DWORD bytes = size - offset < BLOCK_SIZE ? size - offset : BLOCK_SIZE;
+		CopyMemory(m_Layout->blocks[block], data + offset, bytes);
+		block = static_cast<DWORD>(m_Layout->nextInChain[block]);
+	}
+}
+
+
+bool SharedChannel::ReadBlocks(DWORD block, BYTE* data, DWORD size)
+{
+	assert(m_Layout);
+
+	// The chain comes from the other process. It's checked as it's walked.
+	for(DWORD offset = 0 ; offset < size ; offset += BLOCK_SIZE)
+	{
+		if(block >= NUM_BLOCKS)
+		{
+			return false;
+		}
+
+		DWORD bytes = size - offset < BLOCK_SIZE ? size - offset : BLOCK_SIZE;
+		CopyMemory(data + offset, m_Layout->blocks[block], bytes);
+		block = static_cast<DWORD>(m_Layout->nextInChain[block]);
+	}
+
+	return true;
+}
+
+
+bool SharedChannel::Push(Direction direction, const Message& message)
+{
+	assert(m_Layout);
+
+	Ring& ring = GetRing(direction);
+
+	LONG position = ring.enqueuePos;
+	Ring::Cell* cell = NULL;
+	for(;;)
+	{
+		cell = &ring.cells[position & (RING_SIZE - 1)];
+
+		LONG difference = cell->sequence - position;
+		if(difference == 0)
+		{
+			LONG seen = InterlockedCompareExchange(&ring.enqueuePos, position + 1, position);
+			if(seen == position)
+			{
+				break;
+			}
+			position = seen;
+		}
+		else if(difference < 0)
+		{
+			// Still holds the message of a lap ago.
+			InterlockedIncrement64(&ring.full);
+			return false;
+		}
+		else
+		{
+			// Another writer took it.
+			position = ring.enqueuePos;
+		}
+	}
+
+	cell->message = message;
+
+	// A full barrier, so the message is out before readerWaiting is read. See PrepareWait().
+	InterlockedExchange(&cell->sequence, position + 1);
+
+	WakeReader(direction);
+
+	return true;
+}
+
+
+bool SharedChannel::Pop(Direction direction, Message& message, DWORD timeoutMs)
+{
+	assert(m_Layout);
+
+	DWORD startTime = GetTickCount();
+
+	for(;;)
+	{
+		if(TryPop(direction, message))
+		{
+			return true;
+		}
+
+		if(PrepareWait(direction))
+		{
+			DWORD elapsed = GetTickCount() - startTime;
+			if(timeoutMs != INFINITE && elapsed >= timeoutMs)
+			{
+				CancelWait(direction);
+				return false;
+			}
+
+			// A signal left over from a writer that raced with CancelWait() wakes this for nothing. It loops then.
+			WaitForSingleObject(m_Events[direction], timeoutMs == INFINITE ? INFINITE : timeoutMs - elapsed);
+			CancelWait(direction);
+		}
+	}
+}
+
+
+bool SharedChannel::StartReading(Direction direction, ReadFunc read, void* context, PTP_CALLBACK_ENVIRON env)
+{
+	assert(m_Layout);
+	assert(m_ReadTPWAIT == NULL);
+	assert(read);
+
+	m_ReadDirection = direction;
+	m_Read = read;
+	m_ReadContext = context;
+	m_StopReading = false;
+
+	m_ReadTPWAIT = CreateThreadpoolWait(SharedChannel::WorkerRead, this, env);
+	if(m_ReadTPWAIT == NULL)
+	{
+		ERROR_CODE(GetLastError(), "Could not create the channel reader.");
+		return false;
+	}
+
+	// What was pushed before this is read right away.
+	SetEvent(m_Events[direction]);
+	SetThreadpoolWait(m_ReadTPWAIT, m_Events[direction], NULL);
+
+	return true;
+}
+
+
+void SharedChannel::StopReading()
+{
+	if(m_ReadTPWAIT == NULL)
+	{
+		return;
+	}
+
+	m_StopReading = true;
+
+	// A callback that was running when the wait was cleared may have set it again before it saw m_StopReading.
+	SetThreadpoolWait(m_ReadTPWAIT, NULL, NULL);
+	WaitForThreadpoolWaitCallbacks(m_ReadTPWAIT, false);
+	SetThreadpoolWait(m_ReadTPWAIT, NULL, NULL);
+	WaitForThreadpoolWaitCallbacks(m_ReadTPWAIT, true);
+
+	CloseThreadpoolWait(m_ReadTPWAIT);
+	m_ReadTPWAIT = NULL;
+
+	CancelWait(m_ReadDirection);
+}
+
+
+SharedChannel::Stats SharedChannel::GetStats(Direction direction)
+{
+	assert(m_Layout);
+
+	Ring& ring = GetRing(direction);
+
+	Stats stats;
+	stats.queued = static_cast<DWORD>(ring.enqueuePos - ring.dequeuePos);
+	stats.full = ring.full;
+	stats.wakeups = ring.wakeups;
+	stats.blocksInUse = static_cast<DWORD>(m_Layout->blocksInUse);
+
+	return stats;
+}
+
+
+bool SharedChannel::Map(const char* name, bool create)
+{
+	assert(name);
+	assert(m_Layout == NULL);
+
+	// Local to the session, so that no privilege is needed.
+	char mappingName[MAX_PATH];
+	sprintf_s(mappingName, sizeof(mappingName), "Local\\IOCP_Channel_%s", name);
+
+	if(create)
+	{
+		ULARGE_INTEGER size;
+		size.QuadPart = sizeof(Layout);
+
+		m_Mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, mappingName);
+		if(m_Mapping != NULL && GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			ERROR_MSG("The channel %s is in use by another front-end.", name);
+			Close();
+			return false;
+		}
+	}
+	else
+	{
+		m_Mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mappingName);
+	}
+
+	if(m_Mapping == NULL)
+	{
+		ERROR_CODE(GetLastError(), "Could not %s the channel %s.", create ? "create" : "open", name);
+		return false;
+	}
+
+	m_Layout = static_cast<Layout*>(MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Layout)));
+	if(m_Layout == NULL)
+	{
+		ERROR_CODE(GetLastError(), "Could not map the channel %s.", name);
+		Close();
+		return false;
+	}
+
+	for(int i = 0 ; i < NUM_DIRECTIONS ; ++i)
+	{
+		char eventName[MAX_PATH];
+		sprintf_s(eventName, sizeof(eventName), "%s_%d", mappingName, i);
+
+		m_Events[i] = create ? CreateEventA(NULL, FALSE, FALSE, eventName) : OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, eventName);
+		if(m_Events[i] == NULL)
+		{
+			ERROR_CODE(GetLastError(), "Could not %s the events of the channel %s.", create ? "create" : "open", name);
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void SharedChannel::Recover(DWORD previousProcessId)
+{
+	// No logic writes OUTBOUND or reads INBOUND now, but the front still reads the one and writes the other.
+	Ring& inbound = GetRing(INBOUND);
+	Ring& outbound = GetRing(OUTBOUND);
+
+	// The logic before may have freed a position of INBOUND and died before it moved on. The front may have written it again since.
+	LONG position = inbound.dequeuePos;
+	if(inbound.cells[position & (RING_SIZE - 1)].sequence - position > 1)
+	{
+		inbound.dequeuePos = position + 1;
+	}
+
+	// Positions of OUTBOUND it took and never wrote. The front reads up to the first of them, and skips them once they're written.
+	DWORD numLost = 0;
+	LONG end = outbound.enqueuePos;
+	for(position = outbound.dequeuePos ; position - end < 0 ; ++position)
+	{
+		Ring::Cell& cell = outbound.cells[position & (RING_SIZE - 1)];
+		if(cell.sequence == position)
+		{
+			cell.message.type = MESSAGE_LOST;
+			cell.message.handle = 0;
+			cell.message.block = NO_BLOCK;
+			cell.message.size = 0;
+
+			InterlockedExchange(&cell.sequence, position + 1);
+			++numLost;
+		}
+	}
+
+	if(numLost > 0)
+	{
+		WakeReader(OUTBOUND);
+	}
+
+	// Blocks still tagged with a logic before this one are its, unless they are in a ring to be read.
+	// One the front reads from OUTBOUND from now on was seen here, as it takes a block over before it frees its position.
+	std::vector<bool> queued(NUM_BLOCKS, false);
+	for(int d = 0 ; d < NUM_DIRECTIONS ; ++d)
+	{
+		Ring& ring = m_Layout->rings[d];
+
+		end = ring.enqueuePos;
+		for(position = ring.dequeuePos ; position - end < 0 ; ++position)
+		{
+			Ring::Cell& cell = ring.cells[position & (RING_SIZE - 1)];
+			if(cell.sequence != position + 1)
+			{
+				continue;
+			}
+
+			DWORD block = cell.message.block;
+			for(DWORD i = GetNumBlocks(cell.message.size) ; i > 0 && block < NUM_BLOCKS ; --i)
+			{
+				queued[block] = true;
+				block = static_cast<DWORD>(m_Layout->nextInChain[block]);
+			}
+		}
+	}
+
+	DWORD numFreed = 0;
+	for(DWORD block = 0 ; block < NUM_BLOCKS ; ++block)
+	{
+		LONG owner = m_Layout->blockOwners[block];
+		if(owner == OWNER_NONE || owner == OWNER_FRONT || owner == m_Owner || queued[block])
+		{
+			continue;
+		}
+
+		if(InterlockedCompareExchange(&m_Layout->blockOwners[block], OWNER_NONE, owner) == owner)
+		{
+			PushFreeBlock(block);
+			++numFreed;
+		}
+	}
+
+	if(previousProcessId != 0)
+	{
+		TRACE("The logic %d died with the channel open. %d messages it was writing are lost, and %d blocks it had are free again.", previousProcessId, numLost, numFreed);
+	}
+}
+
+
+/* static */ DWORD SharedChannel::GetNumBlocks(DWORD size)
+{
+	if(size <= BLOCK_SIZE)
+	{
+		return 1;
+	}
+
+	if(size > MAX_MESSAGE_SIZE)
+	{
+		size = MAX_MESSAGE_SIZE;
+	}
+
+	return (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+
+SharedChannel::Ring& SharedChannel::GetRing(Direction direction)
+{
+	assert(direction < NUM_DIRECTIONS);
+
+	return m_Layout->rings[direction];
+}
+
+
+bool SharedChannel::TryPop(Direction direction, Message& message)
+{
+	Ring& ring = GetRing(direction);
+
+	for(;;)
+	{
+		LONG position = ring.dequeuePos;
+		Ring::Cell& cell = ring.cells[position & (RING_SIZE - 1)];
+
+		if(cell.sequence != position + 1)
+		{
+			return false;
+		}
+
+		message = cell.message;
+
+		DWORD block = message.block;
+		for(DWORD i = GetNumBlocks(message.size) ; i > 0 && block < NUM_BLOCKS ; --i)
+		{
+			m_Layout->blockOwners[block] = m_Owner;
+			block = static_cast<DWORD>(m_Layout->nextInChain[block]);
+		}
+
+		// Free for the writer a lap ahead.
+		InterlockedExchange(&cell.sequence, position + static_cast<LONG>(RING_SIZE));
+		ring.dequeuePos = position + 1;
+
+		if(message.type != MESSAGE_LOST)
+		{
+			return true;
+		}
+	}
+}
+
+
+bool SharedChannel::PrepareWait(Direction direction)
+{
+	Ring& ring = GetRing(direction);
+
+	// Cheaper than a sleep and a signal if the writers are still at it.
+	for(DWORD i = 0 ; i < m_SpinCount ; ++i)
+	{
+		LONG position = ring.dequeuePos;
+		if(ring.cells[position & (RING_SIZE - 1)].sequence == position + 1)
+		{
+			return false;
+		}
+
+		YieldProcessor();
+	}
+
+	// A full barrier as in Push(). Either the writer sees the flag, or this sees its message.
+	InterlockedExchange(&ring.readerWaiting, 1);
+
+	LONG position = ring.dequeuePos;
+	if(ring.cells[position & (RING_SIZE - 1)].sequence == position + 1)
+	{
+		CancelWait(direction);
+		return false;
+	}
+
+	return true;
+}
+
+
+void SharedChannel::CancelWait(Direction direction)
+{
+	InterlockedExchange(&GetRing(direction).readerWaiting, 0);
+}
+
+
+void SharedChannel::WakeReader(Direction direction)
+{
+	Ring& ring = GetRing(direction);
+
+	if(ring.readerWaiting != 0 && InterlockedCompareExchange(&ring.readerWaiting, 0, 1) == 1)
+	{
+		InterlockedIncrement64(&ring.wakeups);
+		SetEvent(m_Events[direction]);
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <Windows.h>
+
+// Messages between the network front-end, which is Server, and a logic process, over a named file mapping.
+// Frames of clients go in on INBOUND tagged with the handle of their client, and the frames to send come back on OUTBOUND.
+// The bytes of a message are in a block of the arena shared by both directions, or a chain of them if they don't fit in one,
+// and only the index of the first block goes through the ring, so nothing is copied from one process to the other.
+// Rings and the arena are lock-free and hold offsets only, as the mapping is at a different address in each process.
+// The front creates the channel and keeps it, so the logic process can go away and open it again without the sockets noticing.
+// A logic that died may have left a position of OUTBOUND taken and never written, which the front would wait on forever,
+// and blocks that nobody frees. Each block is tagged with who has it, and the next logic clears up after the dead one when it opens.
+//
+// A reader that finds its ring empty waits on a named event, and a writer only signals it when it's waiting.
+// Writers don't pay for an idle reader, and a busy reader is never woken.
+class SharedChannel
+{
+public:
+	enum Direction
+	{
+		INBOUND,	// from the front to the logic.
+		OUTBOUND,	// from the logic to the front.
+		NUM_DIRECTIONS,
+	};
+
+	enum MessageType
+	{
+		MESSAGE_CONNECT,		// a client is in. No block.
+		MESSAGE_DISCONNECT,		// a client is gone. No block. Nothing sent to its handle goes out any more.
+		MESSAGE_FRAME,			// a Protocol frame in the block.
+	};
+
+	enum
+	{
+		RING_SIZE = 16 * 1024,	// messages. Power of 2.
+		BLOCK_SIZE = 4 * 1024,	// bigger messages take a chain of blocks.
+		NUM_BLOCKS = 16 * 1024,	// 64 MB, for both directions.
+		MAX_MESSAGE_SIZE = 1024 * 1024,	// the biggest frame of Protocol.
+
+		NO_BLOCK = 0xFFFFFFFF,
+
+		// Checks of an empty ring before its reader goes to sleep. None on a single processor, where the writer can't run meanwhile.
+		SPIN_COUNT = 1000,
+	};
+
+	struct Message
+	{
+		WORD type;
+		WORD reserved;
+		DWORD handle;	// of the client.
+		DWORD block;	// the first of the chain. NO_BLOCK if there's none.
+		DWORD size;		// bytes in the chain.
+	};
+
+	struct Stats
+	{
+		DWORD queued;			// in the ring now.
+		ULONGLONG full;			// pushes that failed.
+		ULONGLONG wakeups;		// signals of the waiting reader.
+		DWORD blocksInUse;		// of both directions.
+	};
+
+	// Called on the reader of a direction for each message. The blocks, if any, are the callee's to free.
+	typedef void (*ReadFunc)(void* context, const Message& message);
+
+private:
+	// Thread pool wait of the reader
+	static void CALLBACK WorkerRead(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_WAIT /* Wait */, TP_WAIT_RESULT /* WaitResult */);
+
+public:
+	SharedChannel();
+	~SharedChannel();
+
+	// The front creates the channel, and the logic process opens it. Both return false if it can't be done.
+	// Only one logic at a time has it open, and Open() fails while the one before is still running.
+	bool Create(const char* name);
+	bool Open(const char* name);
+	void Close();
+
+	bool IsOpen() { return m_Layout != NULL; }
+
+	// The process id of the logic that has the channel open, or had it when it died. 0 if none has.
+	DWORD GetLogicProcessId();
+
+	// Any thread of either process. Returns NO_BLOCK if they are all in use.
+	DWORD AllocBlock();
+	// A chain of as many blocks as size bytes take. Returns NO_BLOCK if there aren't enough free, or size is over MAX_MESSAGE_SIZE.
+	DWORD AllocBlocks(DWORD size);
+	// Frees the block and the ones chained after it.
+	void FreeBlock(DWORD block);
+	BYTE* GetBlock(DWORD block);
+	// NO_BLOCK at the end of a chain.
+	DWORD GetNextBlock(DWORD block);
+
+	// Copy size bytes into or out of a chain, a block at a time. Read returns false if the chain is shorter than that.
+	void WriteBlocks(DWORD block, const BYTE* data, DWORD size);
+	bool ReadBlocks(DWORD block, BYTE* data, DWORD size);
+
+	// Any thread. Returns false if the ring is full, and the block is still the caller's then.
+	bool Push(Direction direction, const Message& message);
+
+	// Only one thread at a time reads a direction, with either of these.
+	// Pop() waits up to timeoutMs for a message, and returns false if none came.
+	bool Pop(Direction direction, Message& message, DWORD timeoutMs);
+	// Calls read for every message on the thread pool until StopReading(). env can be NULL for the default pool.
+	bool StartReading(Direction direction, ReadFunc read, void* context, PTP_CALLBACK_ENVIRON env);
+	void StopReading();
+
+	Stats GetStats(Direction direction);
+
+private:
+	struct Layout;
+	struct Ring;
+
+	bool Map(const char* name, bool create);
+	// By Open(), before the new logic reads or writes anything. The front may go on meanwhile.
+	void Recover(DWORD previousProcessId);
+	void PushFreeBlock(DWORD block);
+	// Blocks a message of size bytes takes. Never more than a chain of MAX_MESSAGE_SIZE, so a bad size can't make a walk long.
+	static DWORD GetNumBlocks(DWORD size);
+
+	Ring& GetRing(Direction direction);
+	bool TryPop(Direction direction, Message& message);
+	// Checks the ring m_SpinCount times, then marks its reader as waiting.
+	// Returns false if a message came in meanwhile, and the reader shouldn't wait.
+	bool PrepareWait(Direction direction);
+	void CancelWait(Direction direction);
+	void WakeReader(Direction direction);
+
+private:
+	SharedChannel(const SharedChannel& rhs);
+	SharedChannel& operator=(const SharedChannel& rhs);
+
+private:
+	HANDLE m_Mapping;
+	Layout* m_Layout;
+	HANDLE m_Events[NUM_DIRECTIONS];	// auto-reset, set when a waiting reader has something to read.
+	DWORD m_SpinCount;
+	LONG m_Owner;	// what the blocks this process takes are tagged with.
+
+	TP_WAIT* m_ReadTPWAIT;
+	Direction m_ReadDirection;
+	ReadFunc m_Read;
+	void* m_ReadContext;
+	volatile bool m_StopReading;
+};
@@ -0,0 +1,350 @@
+#include "Snapshot.h"
+#include "BitStream.h"
+
+#include <cassert>
+
+using namespace std;
+
+
+namespace
+{
+	const DWORD MAX_POSITION = (1 << SnapshotCodec::POSITION_BITS) - 1;
+	const DWORD MAX_SMALL_DELTA = (1 << SnapshotCodec::SMALL_DELTA_BITS) - 1;
+
+	DWORD ZigZag(DWORD from, DWORD to)
+	{
+		LONG delta = static_cast<LONG>(to - from);
+		return static_cast<DWORD>((delta << 1) ^ (delta >> 31));
+	}
+
+	DWORD UnZigZag(DWORD from, DWORD zigzag)
+	{
+		LONG delta = static_cast<LONG>(zigzag >> 1) ^ -static_cast<LONG>(zigzag & 1);
+		return from + delta;
+	}
+
+	// Changed : 1 bit. Then small : 1 bit and a zigzag delta, or the whole value.
+	void WriteField(BitWriter& writer, DWORD from, DWORD to)
+	{
+		writer.WriteBool(from != to);
+		if(from == to)
+		{
+			return;
+		}
+
+		DWORD zigzag = ZigZag(from, to);
+		writer.WriteBool(zigzag <= MAX_SMALL_DELTA);
+		if(zigzag <= MAX_SMALL_DELTA)
+		{
+			writer.Write(zigzag, SnapshotCodec::SMALL_DELTA_BITS);
+		}
+		else
+		{
+			writer.Write(to, SnapshotCodec::POSITION_BITS);
+		}
+	}
+
+	DWORD ReadField(BitReader& reader, DWORD from)
+	{
+		if(!reader.ReadBool())
+		{
+			return from;
+		}
+
+		if(reader.ReadBool())
+		{
+			return UnZigZag(from, reader.Read(SnapshotCodec::SMALL_DELTA_BITS));
+		}
+
+		return reader.Read(SnapshotCodec::POSITION_BITS);
+	}
+
+	bool IsSame(const EntityState& lhs, const EntityState& rhs)
+	{
+		return lhs.x == rhs.x && lhs.y == rhs.y;
+	}
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+SnapshotHistory::SnapshotHistory()
+: m_NextSequence(1),
+  m_Acked(SnapshotCodec::NO_BASELINE)
+{
+	for(int i = 0 ; i < RING_SIZE ; ++i)
+	{
+		m_Ring[i].sequence = SnapshotCodec::NO_BASELINE;
+	}
+}
+
+
+Snapshot& SnapshotHistory::Push()
+{
+	DWORD sequence = m_NextSequence++;
+	if(m_NextSequence == SnapshotCodec::NO_BASELINE)
+	{
+		++m_NextSequence;
+	}
+
+	Snapshot& snapshot = m_Ring[sequence % RING_SIZE];
+	snapshot.sequence = sequence;
+	snapshot.entities.clear(); // keeps the capacity.
+
+	return snapshot;
+}
+
+
+void SnapshotHistory::Ack(DWORD sequence)
+{
+	if(sequence == SnapshotCodec::NO_BASELINE)
+	{
+		return;
+	}
+
+	// Must have been sent, and newer than what we have. Sequences wrap around.
+	if(static_cast<LONG>(sequence - m_NextSequence) >= 0)
+	{
+		return;
+	}
+
+	if(m_Acked == SnapshotCodec::NO_BASELINE || static_cast<LONG>(sequence - m_Acked) > 0)
+	{
+		m_Acked = sequence;
+	}
+}
+
+
+const Snapshot* SnapshotHistory::GetBaseline()
+{
+	if(m_Acked == SnapshotCodec::NO_BASELINE)
+	{
+		return NULL;
+	}
+
+	// Overwritten if it's too old.
+	const Snapshot& snapshot = m_Ring[m_Acked % RING_SIZE];
+	return snapshot.sequence == m_Acked ? &snapshot : NULL;
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+/* static */ DWORD SnapshotCodec::Quantize(float value)
+{
+	float scaled = value * POSITION_SCALE + 0.5f;
+	if(!(scaled > 0.0f))
+	{
+		return 0;
+	}
+
+	DWORD quantized = static_cast<DWORD>(scaled);
+	return quantized < MAX_POSITION ? quantized : MAX_POSITION;
+}
+
+
+/* static */ float SnapshotCodec::Dequantize(DWORD value)
+{
+	return static_cast<float>(value) / POSITION_SCALE;
+}
+
+
+/* static */ void SnapshotCodec::Encode(const Snapshot& current, const Snapshot* baseline, vector<BYTE>& out)
+{
+	static const vector<EntityState> s_Empty;
+	const vector<EntityState>& cur = current.entities;
+	const vector<EntityState>& base = baseline != NULL ? baseline->entities : s_Empty;
+
+	// Count first. The counts go before the entries.
+	DWORD numRemoved = 0, numChanged = 0;
+	{
+		size_t i = 0, j = 0;
+		while(i < cur.size() || j < base.size())
+		{
+			if(j == base.size() || (i < cur.size() && cur[i].id < base[j].id))
+			{
+				++numChanged; ++i;		// new
+			}
+			else if(i == cur.size() || base[j].id < cur[i].id)
+			{
+				++numRemoved; ++j;
+			}
+			else
+			{
+				if(!IsSame(cur[i], base[j])) ++numChanged;
+				++i; ++j;
+			}
+		}
+	}
+
+	BitWriter writer(out);
+	writer.Write(current.sequence, 32);
+	writer.Write(baseline != NULL ? baseline->sequence : NO_BASELINE, 32);
+
+	// Removed ids as gaps from the previous one.
+	writer.WriteVar(numRemoved);
+	{
+		DWORD previous = 0;
+		size_t i = 0;
+		for(size_t j = 0 ; j < base.size() ; ++j)
+		{
+			while(i < cur.size() && cur[i].id < base[j].id) ++i;
+
+			if(i == cur.size() || cur[i].id != base[j].id)
+			{
+				writer.WriteVar(base[j].id - previous);
+				previous = base[j].id;
+			}
+		}
+	}
+
+	// Changed and new ones.
+	writer.WriteVar(numChanged);
+	{
+		DWORD previous = 0;
+		size_t j = 0;
+		for(size_t i = 0 ; i < cur.size() ; ++i)
+		{
+			while(j < base.size() && base[j].id < cur[i].id) ++j;
+
+			bool isNew = j == base.size() || base[j].id != cur[i].id;
+			if(!isNew && IsSame(cur[i], base[j]))
+			{
+				continue;
+			}
+
+			writer.WriteVar(cur[i].id - previous);
+			previous = cur[i].id;
+
+			writer.WriteBool(isNew);
+			if(isNew)
+			{
+				writer.Write(cur[i].x, POSITION_BITS);
+				writer.Write(cur[i].y, POSITION_BITS);
+			}
+			else
+			{
+				WriteField(writer, base[j].x, cur[i].x);
+				WriteField(writer, base[j].y, cur[i].y);
+			}
+		}
+	}
+
+	writer.Flush();
+}
+
+
+/* static */ bool SnapshotCodec::ReadSequences(const BYTE* data, DWORD size, DWORD& sequence, DWORD& baselineSequence)
+{
+	BitReader reader(data, size);
+	sequence = reader.Read(32);
+	baselineSequence = reader.Read(32);
+
+	return reader.IsValid();
+}
+
+
+/* static */ bool SnapshotCodec::Decode(const BYTE* data, DWORD size, const Snapshot* baseline, Snapshot& out)
+{
+	BitReader reader(data, size);
+
+	out.sequence = reader.Read(32);
+	DWORD baselineSequence = reader.Read(32);
+
+	if(baselineSequence != NO_BASELINE && (baseline == NULL || baseline->sequence != baselineSequence))
+	{
+		return false;
+	}
+
+	static const vector<EntityState> s_Empty;
+	const vector<EntityState>& base = baselineSequence != NO_BASELINE ? baseline->entities : s_Empty;
+
+	vector<DWORD> removed(reader.ReadVar());
+	{
+		DWORD previous = 0;
+		for(size_t r = 0 ; r < removed.size() && reader.IsValid() ; ++r)
+		{
+			previous += reader.ReadVar();
+			removed[r] = previous;
+		}
+	}
+
+	DWORD numChanged = reader.ReadVar();
+	if(!reader.IsValid())
+	{
+		return false;
+	}
+
+	out.entities.clear();
+	out.entities.reserve(base.size() + numChanged);
+
+	// Merge the baseline with the changes, all in id order.
+	size_t j = 0, r = 0;
+	DWORD changedId = 0;
+	bool changedIsNew = false;
+	DWORD changedLeft = numChanged;
+	bool hasChanged = false;
+
+	for(;;)
+	{
+		if(!hasChanged && changedLeft > 0)
+		{
+			changedId += reader.ReadVar();
+			changedIsNew = reader.ReadBool();
+			--changedLeft;
+			hasChanged = true;
+		}
+
+		if(!reader.IsValid())
+		{
+			return false;
+		}
+
+		if(j < base.size() && (!hasChanged || base[j].id < changedId))
+		{
+			// Unchanged, unless it's gone.
+			while(r < removed.size() && removed[r] < base[j].id) ++r;
+			if(r == removed.size() || removed[r] != base[j].id)
+			{
+				out.entities.push_back(base[j]);
+			}
+			++j;
+		}
+		else if(hasChanged)
+		{
+			EntityState state;
+			state.id = changedId;
+
+			if(changedIsNew)
+			{
+				if(j < base.size() && base[j].id == changedId)
+				{
+					return false;
+				}
+
+				state.x = reader.Read(POSITION_BITS);
+				state.y = reader.Read(POSITION_BITS);
+			}
+			else
+			{
+				if(j == base.size() || base[j].id != changedId)
+				{
+					return false;
+				}
+
+				state.x = ReadField(reader, base[j].x);
+				state.y = ReadField(reader, base[j].y);
+				++j;
+			}
+
+			out.entities.push_back(state);
+			hasChanged = false;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	return reader.IsValid();
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+// What a client is sent about an entity. Positions are quantized by SnapshotCodec.
+struct EntityState
+{
+	DWORD id;
+	DWORD x;
+	DWORD y;
+};
+
+struct Snapshot
+{
+	DWORD sequence;
+	std::vector<EntityState> entities; // sorted by id.
+};
+
+
+// The last RING_SIZE snapshots sent to a client and which of them it has acknowledged.
+class SnapshotHistory
+{
+public:
+	enum
+	{
+		RING_SIZE = 32,
+	};
+
+public:
+	SnapshotHistory();
+
+	// Slot of the next snapshot, with a new sequence and no entities. Overwrites the oldest one.
+	Snapshot& Push();
+
+	// Older acknowledgements than the current one are ignored.
+	void Ack(DWORD sequence);
+
+	// The acknowledged snapshot if it is still in the ring. NULL means a full snapshot has to be sent.
+	const Snapshot* GetBaseline();
+
+private:
+	SnapshotHistory(const SnapshotHistory& rhs);
+	SnapshotHistory& operator=(const SnapshotHistory& rhs);
+
+private:
+	Snapshot m_Ring[RING_SIZE];
+	DWORD m_NextSequence;
+	DWORD m_Acked; // 0 for none.
+};
+
+
+// Bit-packed delta encoding of a snapshot against a baseline.
+// Only entities that changed, appeared or disappeared since the baseline are written,
+// and a field that changed a little is written as a short delta.
+class SnapshotCodec
+{
+public:
+	enum
+	{
+		POSITION_SCALE = 16,	// steps per unit.
+		POSITION_BITS = 18,		// 0 ~ 16383.9 units.
+		SMALL_DELTA_BITS = 7,	// zigzag deltas of less than 64 steps.
+
+		NO_BASELINE = 0,		// sequences start from 1.
+	};
+
+public:
+	static DWORD Quantize(float value);
+	static float Dequantize(DWORD value);
+
+	// Appends the encoded bytes to out. baseline is NULL for a full snapshot.
+	static void Encode(const Snapshot& current, const Snapshot* baseline, std::vector<BYTE>& out);
+
+	// So that the receiver can find the baseline before decoding.
+	static bool ReadSequences(const BYTE* data, DWORD size, DWORD& sequence, DWORD& baselineSequence);
+
+	// baseline has to be the one it was encoded against. Returns false on a mismatch or broken data.
+	static bool Decode(const BYTE* data, DWORD size, const Snapshot* baseline, Snapshot& out);
+
+private:
+	SnapshotCodec();
+	~SnapshotCodec();
+	SnapshotCodec(const SnapshotCodec& rhs);
+	SnapshotCodec& operator=(const SnapshotCodec& rhs);
+};
@@ -0,0 +1,158 @@
+#include "TickScheduler.h"
+
+#include "..\Log.h"
+#include "..\Clock.h"
+
+#include <cassert>
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+/* static */ void CALLBACK TickScheduler::WorkerTick(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */)
+{
+	TickScheduler* scheduler = static_cast<TickScheduler*>(Context);
+	assert(scheduler);
+
+	scheduler->RunDueTicks();
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+TickScheduler::TickScheduler()
+: m_TPTIMER(NULL),
+  m_Func(NULL),
+  m_Context(NULL),
+  m_Stopping(false),
+  m_Period(0),
+  m_StartTime(0),
+  m_NextTick(0),
+  m_NumTicks(0),
+  m_NumOverruns(0),
+  m_NumSkipped(0)
+{
+}
+
+
+TickScheduler::~TickScheduler()
+{
+	Stop();
+}
+
+
+bool TickScheduler::Start(DWORD ticksPerSecond, TickFunc func, void* context, PTP_CALLBACK_ENVIRON env)
+{
+	assert(ticksPerSecond > 0 && ticksPerSecond <= 1000);
+	assert(func);
+	assert(m_TPTIMER == NULL);
+
+	m_Func = func;
+	m_Context = context;
+	m_Stopping = false;
+	m_Period = 1000000 / ticksPerSecond;
+	m_NextTick = 0;
+
+	m_TPTIMER = CreateThreadpoolTimer(TickScheduler::WorkerTick, this, env);
+	if(m_TPTIMER == NULL)
+	{
+		ERROR_CODE(GetLastError(), "Could not create the tick timer.");
+		return false;
+	}
+
+	m_StartTime = Clock::GetMicroseconds();
+	ArmTimer(m_StartTime);
+
+	return true;
+}
+
+
+void TickScheduler::Stop()
+{
+	if(m_TPTIMER == NULL)
+	{
+		return;
+	}
+
+	m_Stopping = true;
+
+	// A tick running now may re-arm the timer before it sees m_Stopping. Cancel again after it's done.
+	SetThreadpoolTimer(m_TPTIMER, NULL, 0, 0);
+	WaitForThreadpoolTimerCallbacks(m_TPTIMER, true);
+	SetThreadpoolTimer(m_TPTIMER, NULL, 0, 0);
+	WaitForThreadpoolTimerCallbacks(m_TPTIMER, true);
+
+	CloseThreadpoolTimer(m_TPTIMER);
+	m_TPTIMER = NULL;
+}
+
+
+void TickScheduler::TraceStats()
+{
+	TRACE(" Tick period : %d us, ticks : %I64d, overruns : %I64d, skipped : %I64d", m_Period, m_NumTicks, m_NumOverruns, m_NumSkipped);
+	m_Durations.Trace("Tick duration", "us");
+	m_Lateness.Trace("Tick lateness", "us");
+}
+
+
+//---------------------------------------------------------------------------------//
+//---------------------------------------------------------------------------------//
+void TickScheduler::RunDueTicks()
+{
+	ULONGLONG now = Clock::GetMicroseconds();
+	ULONGLONG dueTime = m_StartTime + m_NextTick * m_Period;
+
+	// The timer has millisecond resolution at best and can fire a bit early.
+	if(now >= dueTime && !m_Stopping)
+	{
+		ULONGLONG lateness = now - dueTime;
+
+		// Don't try to catch up on ticks we've missed. Running them back to back only makes the next ones late too.
+		if(lateness >= m_Period)
+		{
+			ULONGLONG missed = lateness / m_Period;
+			m_NextTick += missed;
+			InterlockedExchangeAdd64(&m_NumSkipped, static_cast<LONGLONG>(missed));
+
+			dueTime = m_StartTime + m_NextTick * m_Period;
+			lateness = now - dueTime;
+		}
+
+		m_Lateness.Record(lateness);
+
+		m_Func(m_Context, m_NextTick);
+
+		ULONGLONG duration = Clock::GetMicroseconds() - now;
+		m_Durations.Record(duration);
+		if(duration > m_Period)
+		{
+			InterlockedIncrement64(&m_NumOverruns);
+		}
+
+		InterlockedIncrement64(&m_NumTicks);
+		++m_NextTick;
+		dueTime += m_Period;
+	}
+
+	if(!m_Stopping)
+	{
+		ArmTimer(dueTime);
+	}
+}
+
+
+void TickScheduler::ArmTimer(ULONGLONG dueTime)
+{
+	ULONGLONG now = Clock::GetMicroseconds();
+	ULONGLONG wait = dueTime > now ? dueTime - now : 0;
+
+	// Negative due time is relative, in 100 nanoseconds.
+	ULARGE_INTEGER relative;
+	relative.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(wait * 10));
+
+	FILETIME fileDueTime;
+	fileDueTime.dwHighDateTime = relative.HighPart;
+	fileDueTime.dwLowDateTime = relative.LowPart;
+
+	// One shot. RunDueTicks() arms it again.
+	SetThreadpoolTimer(m_TPTIMER, &fileDueTime, 0, 0);
+}
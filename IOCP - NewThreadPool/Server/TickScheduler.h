@@ -0,0 +1,63 @@
+#pragma once
+#include <Windows.h>
+
+#include "..\Histogram.h"
+
+// Calls a function at a fixed rate on a thread pool thread.
+// Tick n is due at n * period after Start(). Ticks never overlap. The timer is re-armed for the next due time
+// after each tick, so a slow tick delays the next one instead of piling them up.
+// A tick longer than the period is an overrun. Ticks that are a whole period late or more are skipped.
+class TickScheduler
+{
+public:
+	// tick counts from 0 and jumps over skipped ticks.
+	typedef void (*TickFunc)(void* context, ULONGLONG tick);
+
+public:
+	TickScheduler();
+	~TickScheduler();
+
+	// env can be NULL for the default pool.
+	bool Start(DWORD ticksPerSecond, TickFunc func, void* context, PTP_CALLBACK_ENVIRON env);
+	void Stop();
+
+	bool IsRunning() { return m_TPTIMER != NULL; }
+	DWORD GetPeriod() { return m_Period; } // microseconds
+
+	ULONGLONG GetNumTicks() { return m_NumTicks; }
+	ULONGLONG GetNumOverruns() { return m_NumOverruns; }
+	ULONGLONG GetNumSkipped() { return m_NumSkipped; }
+
+	// Microseconds a tick took, and how late it started.
+	const Histogram& GetDurations() { return m_Durations; }
+	const Histogram& GetLateness() { return m_Lateness; }
+
+	void TraceStats();
+
+private:
+	static void CALLBACK WorkerTick(PTP_CALLBACK_INSTANCE /* Instance */, PVOID Context, PTP_TIMER /* Timer */);
+
+	void RunDueTicks();
+	void ArmTimer(ULONGLONG dueTime);
+
+private:
+	TickScheduler(const TickScheduler& rhs);
+	TickScheduler& operator=(const TickScheduler& rhs);
+
+private:
+	TP_TIMER* m_TPTIMER;
+	TickFunc m_Func;
+	void* m_Context;
+	volatile bool m_Stopping;
+
+	DWORD m_Period;
+	ULONGLONG m_StartTime;
+	ULONGLONG m_NextTick;
+
+	volatile LONGLONG m_NumTicks;
+	volatile LONGLONG m_NumOverruns;
+	volatile LONGLONG m_NumSkipped;
+
+	Histogram m_Durations;
+	Histogram m_Lateness;
+};
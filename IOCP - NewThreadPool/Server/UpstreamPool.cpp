@@ -0,0 +1,526 @@
+#include "UpstreamPool.h"
+#include "Packet.h"
+
+#include "..\Log.h"
+#include "..\Clock.h"
+#include "..\Network.h"
+#include "..\Messages.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+using namespace std;
+
+
+UpstreamPool::UpstreamPool()
+: m_NextId(1)
+{
+	ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+	InitializeCriticalSection(&m_CS);
+}
+
+
+UpstreamPool::~UpstreamPool()
+{
+	DeleteCriticalSection(&m_CS);
+}
+
+
+bool UpstreamPool::AddBackend(const char* host, u_short port)
+{
+	assert(host);
+
+	Backend backend;
+	if(!Network::ResolveAddress(host, port, backend.address, backend.addressSize))
+	{
+		return false;
+	}
+
+	char name[300] = "";
+	sprintf_s(name, sizeof(name), "%s:%d", host, port);
+	backend.name = name;
+
+	EnterCriticalSection(&m_CS);
+
+	m_Backends.push_back(backend);
+	DWORD index = m_Balancer.AddBackend();
+	assert(index == m_Backends.size() - 1);
+
+	LeaveCriticalSection(&m_CS);
+
+	return true;
+}
+
+
+const SOCKADDR_STORAGE& UpstreamPool::GetAddress(DWORD backend, int& size)
+{
+	assert(backend < m_Backends.size());
+
+	size = m_Backends[backend].addressSize;
+	return m_Backends[backend].address;
+}
+
+
+void UpstreamPool::SetPolicy(Balancer::Policy policy)
+{
+	EnterCriticalSection(&m_CS);
+
+	m_Balancer.SetPolicy(policy);
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void UpstreamPool::AddConnection(DWORD backend, Client* connection)
+{
+	assert(backend < m_Backends.size());
+	assert(connection);
+
+	Connection added;
+	added.client = connection;
+	added.backend = backend;
+	added.pending = 0;
+	added.connected = false;
+
+	EnterCriticalSection(&m_CS);
+
+	m_Connections.push_back(added);
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void UpstreamPool::OnConnected(Client* connection)
+{
+	EnterCriticalSection(&m_CS);
+
+	// It may have been removed on an error already.
+	Connection* found = FindConnection(connection);
+	if(found != NULL && !found->connected)
+	{
+		found->connected = true;
+		m_Balancer.OnConnected(found->backend);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void UpstreamPool::RemoveConnection(Client* connection, ULONGLONG now, DeliverFunc deliver, void* context)
+{
+	EnterCriticalSection(&m_CS);
+
+	Connection* found = FindConnection(connection);
+	if(found != NULL)
+	{
+		Connection removed = *found;
+		m_Connections.erase(m_Connections.begin() + (found - &m_Connections[0]));
+
+		if(removed.connected)
+		{
+			m_Balancer.OnDisconnected(removed.backend);
+		}
+
+		// Once for the connection, however many calls it had.
+		m_Balancer.OnConnectionFailure(removed.backend, now);
+
+		// Not retried on another backend. They may have been done already.
+		for(PendingMap::iterator itor = m_Pending.begin() ; removed.pending > 0 && itor != m_Pending.end() ; )
+		{
+			if(itor->second.connection != connection)
+			{
+				++itor;
+				continue;
+			}
+
+			PendingCall call = itor->second;
+			itor = m_Pending.erase(itor);
+			--removed.pending;
+
+			m_Balancer.OnDone(call.backend, Balancer::CANCELLED, now - call.startTime, now);
+
+			if(call.client != NULL)
+			{
+				Answer(call.client, call.clientId, Protocol::RPC_UNAVAILABLE, deliver, context);
+			}
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void UpstreamPool::GetMissingConnections(ULONGLONG now, vector<DWORD>& backends)
+{
+	backends.clear();
+
+	EnterCriticalSection(&m_CS);
+
+	for(DWORD backend = 0 ; backend < m_Backends.size() ; ++backend)
+	{
+		if(m_Balancer.IsEjected(backend, now))
+		{
+			continue;
+		}
+
+		DWORD numConnections = 0;
+		for(size_t i = 0 ; i < m_Connections.size() ; ++i)
+		{
+			if(m_Connections[i].backend == backend)
+			{
+				++numConnections;
+			}
+		}
+
+		for( ; numConnections < CONNECTIONS_PER_BACKEND ; ++numConnections)
+		{
+			backends.push_back(backend);
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void UpstreamPool::Call(Client* client, Packet* packet, const Messages::RpcRequestView& request, ULONGLONG now,
+						SendFunc send, DeliverFunc deliver, void* context)
+{
+	assert(client);
+	assert(packet);
+
+	DWORD clientId = request.GetId();
+	DWORD deadlineMs = request.GetDeadlineMs();
+
+	EnterCriticalSection(&m_CS);
+
+	++m_Stats.calls;
+
+	DWORD backend = m_Pending.size() < MAX_PENDING_CALLS ? m_Balancer.Pick(now) : Balancer::NO_BACKEND;
+
+	if(backend == Balancer::NO_BACKEND)
+	{
+		Answer(client, clientId, m_Pending.size() < MAX_PENDING_CALLS ? Protocol::RPC_UNAVAILABLE : Protocol::RPC_OVERLOADED,
+			deliver, context);
+		Packet::Destroy(packet);
+	}
+	else
+	{
+		// Balancer only picks backends with a connection up.
+		Connection* connection = PickConnection(backend);
+		assert(connection);
+
+		DWORD id = m_NextId++;
+		while(m_Pending.find(id) != m_Pending.end())
+		{
+			id = m_NextId++;
+		}
+
+		PendingCall call;
+		call.client = client;
+		call.clientId = clientId;
+		call.connection = connection->client;
+		call.backend = backend;
+		call.startTime = now;
+		call.callerDeadline = deadlineMs != 0 && deadlineMs < TIMEOUT_MS;
+		call.dueTime = now + static_cast<ULONGLONG>(call.callerDeadline ? deadlineMs : TIMEOUT_MS) * 1000;
+
+		m_Pending.insert(PendingMap::value_type(id, call));
+		++connection->pending;
+
+		Deadline deadline = { call.dueTime, id };
+		m_Deadlines.push_back(deadline);
+		push_heap(m_Deadlines.begin(), m_Deadlines.end(), LaterDue());
+
+		// id is the first field of RpcRequest. The rest goes as it came, the deadline included.
+		Schema::Store<DWORD>(packet->GetData() + Protocol::HEADER_SIZE, id);
+		send(context, call.connection, packet);
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+bool UpstreamPool::OnResponse(Client* connection, const BYTE* frame, DWORD size, ULONGLONG now, DeliverFunc deliver, void* context)
+{
+	Messages::RpcResponseView response;
+	if(!response.Init(frame, size))
+	{
+		return false;
+	}
+
+	DWORD id = response.GetId();
+	DWORD status = response.GetStatus();
+
+	EnterCriticalSection(&m_CS);
+
+	PendingMap::iterator itor = m_Pending.find(id);
+	if(itor == m_Pending.end() || itor->second.connection != connection)
+	{
+		// Answered at its deadline already.
+		++m_Stats.late;
+	}
+	else
+	{
+		PendingCall call = itor->second;
+
+		// Overloaded is the only answer that says the backend isn't well.
+		bool failed = status == Protocol::RPC_OVERLOADED || status == Protocol::RPC_UNAVAILABLE;
+		EndCall(id, failed ? Balancer::FAILED : Balancer::SUCCEEDED, now);
+
+		if(call.client != NULL)
+		{
+			// The frame goes back as it came, with the caller's id.
+			Packet* packet = Packet::Create(NULL, frame, size);
+			if(packet == NULL)
+			{
+				ERROR_MSG("Could not allocate an RPC response of %d bytes.", size);
+				++m_Stats.abandoned;
+			}
+			else
+			{
+				// id is the first field of RpcResponse.
+				Schema::Store<DWORD>(packet->GetData() + Protocol::HEADER_SIZE, call.clientId);
+
+				deliver(context, call.client, packet);
+				Packet::Destroy(packet);
+
+				CountAnswer(status);
+			}
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+
+	return true;
+}
+
+
+void UpstreamPool::Poll(ULONGLONG now, DeliverFunc deliver, void* context)
+{
+	EnterCriticalSection(&m_CS);
+
+	while(!m_Deadlines.empty() && m_Deadlines.front().dueTime <= now)
+	{
+		pop_heap(m_Deadlines.begin(), m_Deadlines.end(), LaterDue());
+		Deadline deadline = m_Deadlines.back();
+		m_Deadlines.pop_back();
+
+		PendingMap::iterator itor = m_Pending.find(deadline.id);
+		if(itor == m_Pending.end() || itor->second.dueTime != deadline.dueTime)
+		{
+			// Answered before its deadline.
+			continue;
+		}
+
+		PendingCall call = itor->second;
+
+		// Only TIMEOUT_MS says something about the backend. A caller's deadline may be too short for anyone.
+		EndCall(deadline.id, call.callerDeadline ? Balancer::CANCELLED : Balancer::FAILED, now);
+
+		if(call.client != NULL)
+		{
+			Answer(call.client, call.clientId, Protocol::RPC_DEADLINE_EXCEEDED, deliver, context);
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void UpstreamPool::RemoveClient(Client* client)
+{
+	EnterCriticalSection(&m_CS);
+
+	// The calls stay until they are answered or due, so that the backends are accounted for.
+	for(PendingMap::iterator itor = m_Pending.begin() ; itor != m_Pending.end() ; ++itor)
+	{
+		if(itor->second.client == client)
+		{
+			itor->second.client = NULL;
+			++m_Stats.abandoned;
+		}
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+void UpstreamPool::Clear()
+{
+	EnterCriticalSection(&m_CS);
+
+	ULONGLONG now = Clock::GetMicroseconds();
+
+	for(PendingMap::iterator itor = m_Pending.begin() ; itor != m_Pending.end() ; ++itor)
+	{
+		m_Balancer.OnDone(itor->second.backend, Balancer::CANCELLED, now - itor->second.startTime, now);
+	}
+	m_Pending.clear();
+	m_Deadlines.clear();
+
+	for(size_t i = 0 ; i < m_Connections.size() ; ++i)
+	{
+		if(m_Connections[i].connected)
+		{
+			m_Balancer.OnDisconnected(m_Connections[i].backend);
+		}
+	}
+	m_Connections.clear();
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+UpstreamPool::Stats UpstreamPool::GetStats()
+{
+	EnterCriticalSection(&m_CS);
+
+	Stats stats = m_Stats;
+	stats.pending = static_cast<DWORD>(m_Pending.size());
+
+	LeaveCriticalSection(&m_CS);
+
+	return stats;
+}
+
+
+void UpstreamPool::TraceBackends()
+{
+	const char* POLICY_NAMES[] = { "round robin", "least outstanding", "ewma" };
+
+	EnterCriticalSection(&m_CS);
+
+	ULONGLONG now = Clock::GetMicroseconds();
+
+	TRACE(" Balance policy : %s", POLICY_NAMES[m_Balancer.GetPolicy()]);
+
+	for(DWORD backend = 0 ; backend < m_Backends.size() ; ++backend)
+	{
+		Balancer::BackendStats stats = m_Balancer.GetStats(backend, now);
+
+		TRACE("   [%d] %s : connections %d/%d, outstanding %d, ewma %I64d us, calls %I64d, failures %I64d, ejections %d%s",
+			backend, m_Backends[backend].name.c_str(), stats.connections, CONNECTIONS_PER_BACKEND, stats.outstanding,
+			stats.ewmaLatency, stats.calls, stats.failures, stats.ejections, stats.ejected ? " (ejected)" : "");
+	}
+
+	LeaveCriticalSection(&m_CS);
+}
+
+
+UpstreamPool::Connection* UpstreamPool::FindConnection(Client* connection)
+{
+	for(size_t i = 0 ; i < m_Connections.size() ; ++i)
+	{
+		if(m_Connections[i].client == connection)
+		{
+			return &m_Connections[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+UpstreamPool::Connection* UpstreamPool::PickConnection(DWORD backend)
+{
+	Connection* picked = NULL;
+
+	for(size_t i = 0 ; i < m_Connections.size() ; ++i)
+	{
+		Connection& connection = m_Connections[i];
+		if(connection.backend != backend || !connection.connected)
+		{
+			continue;
+		}
+
+		if(picked == NULL || connection.pending < picked->pending)
+		{
+			picked = &connection;
+		}
+	}
+
+	return picked;
+}
+
+
+void UpstreamPool::EndCall(DWORD id, Balancer::Outcome outcome, ULONGLONG now)
+{
+	PendingMap::iterator itor = m_Pending.find(id);
+	assert(itor != m_Pending.end());
+
+	const PendingCall& call = itor->second;
+
+	m_Balancer.OnDone(call.backend, outcome, now - call.startTime, now);
+
+	Connection* connection = FindConnection(call.connection);
+	if(connection != NULL)
+	{
+		assert(connection->pending > 0);
+		--connection->pending;
+	}
+
+	m_Pending.erase(itor);
+
+	// Answered calls would pile up in m_Deadlines at the call rate times TIMEOUT_MS. Compacting once they are
+	// half of it keeps it within twice m_Pending, at a cost that is spread over the calls answered in between.
+	if(m_Deadlines.size() > MIN_DEADLINES_TO_COMPACT && m_Deadlines.size() > 2 * m_Pending.size())
+	{
+		CompactDeadlines();
+	}
+}
+
+
+void UpstreamPool::CompactDeadlines()
+{
+	// Same check as Poll()'s. Ids wrap around, so the due time has to match as well.
+	size_t live = 0;
+	for(size_t i = 0 ; i < m_Deadlines.size() ; ++i)
+	{
+		PendingMap::iterator itor = m_Pending.find(m_Deadlines[i].id);
+		if(itor != m_Pending.end() && itor->second.dueTime == m_Deadlines[i].dueTime)
+		{
+			m_Deadlines[live++] = m_Deadlines[i];
+		}
+	}
+
+	m_Deadlines.resize(live);
+	make_heap(m_Deadlines.begin(), m_Deadlines.end(), LaterDue());
+}
+
+
+void UpstreamPool::Answer(Client* client, DWORD id, Protocol::RpcStatus status, DeliverFunc deliver, void* context)
+{
+	// Only statuses without a result are answered here.
+	DWORD size = Messages::RpcResponseBuilder::GetFrameSize(0);
+
+	Packet* packet = Packet::Create(NULL, NULL, size);
+	if(packet == NULL)
+	{
+		// The caller gets nothing back and has to time it out itself.
+		ERROR_MSG("Could not allocate an RPC response of %d bytes.", size);
+		++m_Stats.abandoned;
+		return;
+	}
+
+	Messages::RpcResponseBuilder builder(packet->GetData(), 0);
+	builder.SetId(id);
+	builder.SetStatus(status);
+
+	deliver(context, client, packet);
+	Packet::Destroy(packet);
+
+	CountAnswer(status);
+}
+
+
+void UpstreamPool::CountAnswer(DWORD status)
+{
+	switch(status)
+	{
+	case Protocol::RPC_OK:					++m_Stats.succeeded; break;
+	case Protocol::RPC_DEADLINE_EXCEEDED:	++m_Stats.expired; break;
+	default:								++m_Stats.failed; break;
+	}
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <winsock2.h>
+#include <vector>
+#include <string>
+#include <boost/unordered_map.hpp>
+
+#include "Balancer.h"
+#include "..\Protocol.h"
+
+class Client;
+class Packet;
+
+namespace Messages
+{
+	class RpcRequestView;
+}
+
+// Calls of OP_RPC_REQUEST forwarded to backends, which are servers in MODE_FRAMED themselves.
+// Each backend has CONNECTIONS_PER_BACKEND connections that stay open and carry the calls of every client,
+// so no client waits for a connection of its own to be made.
+// Balancer picks the backend of a call, and the connection of the backend with the fewest calls on it carries it.
+// A call gets an id of its own on the way to the backend, and its response goes back to the caller with the caller's id.
+// Every call is answered once : with the backend's response, with RPC_DEADLINE_EXCEEDED at its deadline or TIMEOUT_MS,
+// or with RPC_UNAVAILABLE if there's no backend to take it or its connection is lost.
+// Clients and connections are only compared and handed to the send and deliver functions. They are never dereferenced here.
+class UpstreamPool
+{
+public:
+	enum
+	{
+		CONNECTIONS_PER_BACKEND = 4,
+
+		// Most calls in progress at once, over all backends. More are answered with RPC_OVERLOADED.
+		MAX_PENDING_CALLS = 64 * 1024,
+
+		// Of a call without a deadline, or with a later one. The backend is failing if it takes this long.
+		TIMEOUT_MS = 5000,
+
+		// Stale deadlines are only taken out of a heap bigger than this, so that a few calls don't compact it on every answer.
+		MIN_DEADLINES_TO_COMPACT = 1024,
+	};
+
+	// Same as RpcServer. deliver has to take its own reference of the packet.
+	typedef void (*DeliverFunc)(void* context, Client* client, Packet* packet);
+	// send takes over the packet.
+	typedef void (*SendFunc)(void* context, Client* connection, Packet* packet);
+
+	struct Stats
+	{
+		ULONGLONG calls;
+		ULONGLONG succeeded;
+		ULONGLONG failed;		// answered by the backend with something else than RPC_OK, overloaded and unavailable.
+		ULONGLONG expired;		// deadline exceeded, here or on the backend.
+		ULONGLONG abandoned;	// the client went away first.
+		ULONGLONG late;			// responses to calls that had been answered already.
+		DWORD pending;
+	};
+
+public:
+	UpstreamPool();
+	~UpstreamPool();
+
+	// Call before the server starts. Returns false if the address can't be resolved.
+	bool AddBackend(const char* host, u_short port);
+	DWORD GetNumBackends() { return static_cast<DWORD>(m_Backends.size()); }
+	const SOCKADDR_STORAGE& GetAddress(DWORD backend, int& size);
+
+	void SetPolicy(Balancer::Policy policy);
+
+	// A connection to the backend that is being made.
+	void AddConnection(DWORD backend, Client* connection);
+	// It's made. Calls go on it from now on.
+	void OnConnected(Client* connection);
+	// It's lost, or couldn't be made. Its calls are answered with RPC_UNAVAILABLE. Nothing is sent on it once this returns.
+	void RemoveConnection(Client* connection, ULONGLONG now, DeliverFunc deliver, void* context);
+
+	// One backend per connection that should be made now. Ejected backends wait until their retry time.
+	void GetMissingConnections(ULONGLONG now, std::vector<DWORD>& backends);
+
+	// packet is the request frame, and it's taken over : it goes on to the backend with its id rewritten,
+	// or the call is answered before this returns.
+	void Call(Client* client, Packet* packet, const Messages::RpcRequestView& request, ULONGLONG now,
+		SendFunc send, DeliverFunc deliver, void* context);
+
+	// A frame from a connection. Returns false if it's not an RpcResponse, and the connection can't be trusted any more.
+	bool OnResponse(Client* connection, const BYTE* frame, DWORD size, ULONGLONG now, DeliverFunc deliver, void* context);
+
+	// Answers the calls that are past their deadlines by now.
+	void Poll(ULONGLONG now, DeliverFunc deliver, void* context);
+
+	// The responses to the client's calls are dropped. No more deliveries to it once this returns.
+	void RemoveClient(Client* client);
+
+	// Forgets every connection and call without answering them. The server is going away.
+	void Clear();
+
+	Stats GetStats();
+	void TraceBackends();
+
+private:
+	struct Backend
+	{
+		SOCKADDR_STORAGE address;
+		int addressSize;
+		std::string name;		// host:port as it was given.
+	};
+
+	struct Connection
+	{
+		Client* client;
+		DWORD backend;
+		DWORD pending;
+		bool connected;
+	};
+
+	struct PendingCall
+	{
+		Client* client;			// NULL once it's gone.
+		DWORD clientId;
+		Client* connection;
+		DWORD backend;
+		ULONGLONG startTime;
+		ULONGLONG dueTime;
+		bool callerDeadline;	// dueTime is the caller's deadline, not TIMEOUT_MS.
+	};
+
+	// Calls by due time, for Poll(). The ones answered before it stay until then and are skipped, or until
+	// they outnumber the calls still pending, and CompactDeadlines() takes them out.
+	struct Deadline
+	{
+		ULONGLONG dueTime;
+		DWORD id;
+	};
+
+	// For std::push_heap() and std::pop_heap(), which make a max-heap.
+	struct LaterDue
+	{
+		bool operator()(const Deadline& lhs, const Deadline& rhs) const { return lhs.dueTime > rhs.dueTime; }
+	};
+
+	Connection* FindConnection(Client* connection);
+	// The connected one of the backend with the fewest calls. NULL if there's none.
+	Connection* PickConnection(DWORD backend);
+
+	// Ends the call with the balancer and takes it out. The call has to be in m_Pending.
+	void EndCall(DWORD id, Balancer::Outcome outcome, ULONGLONG now);
+	// Takes the deadlines of calls that were answered out of m_Deadlines.
+	void CompactDeadlines();
+
+	void Answer(Client* client, DWORD id, Protocol::RpcStatus status, DeliverFunc deliver, void* context);
+	void CountAnswer(DWORD status);
+
+private:
+	UpstreamPool(const UpstreamPool& rhs);
+	UpstreamPool& operator=(const UpstreamPool& rhs);
+
+private:
+	// Set up before the server starts, and only read after.
+	std::vector<Backend> m_Backends;
+
+	// All guarded by m_CS, which is also held while sending and delivering.
+	Balancer m_Balancer;
+	std::vector<Connection> m_Connections;
+
+	typedef boost::unordered_map<DWORD, PendingCall> PendingMap;
+	PendingMap m_Pending;
+	std::vector<Deadline> m_Deadlines;
+	DWORD m_NextId;
+
+	Stats m_Stats;
+
+	CRITICAL_SECTION m_CS;
+};
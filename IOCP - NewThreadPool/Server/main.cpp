@@ -1,20 +1,97 @@
 
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <vector>
 using namespace std;
 
 #include "..\\Log.h"
 #include "..\\Network.h"
 #include "Server.h"
+#include "Client.h"
+#include "BufferPool.h"
+#include "Benchmark.h"
+#include "LogicHost.h"
+
+namespace
+{
+	// Upper bound of memory held by packets and recv buffers. Shared by every instance.
+	const LONGLONG BUFFER_POOL_HIGH_WATER_MARK = 512 * 1024 * 1024;
+
+	// -instances
+	const DWORD MAX_INSTANCES = 64;
+
+	void DeleteServers(vector<Server*>& servers)
+	{
+		for( size_t i = 0 ; i < servers.size() ; ++i )
+		{
+			delete servers[i];
+		}
+		servers.clear();
+	}
+
+	// Server.exe -logic <channel>. The game logic of a front-end started with -channel <channel>.
+	void RunLogic(const char* channel)
+	{
+		LogicHost host;
+		if(!host.Start(channel))
+		{
+			ERROR_MSG("Could not open the channel %s. Start the front-end first.", channel);
+			return;
+		}
+
+#ifndef _DEBUG
+		Log::EnableTrace(false);
+#endif
+
+		string input;
+		bool loop = true;
+		while(loop)
+		{
+			std::getline(cin, input);
+
+			if(input == "`logic_stats")
+			{
+				host.TraceStats();
+			}
+			else if(input == "`enable_trace")
+			{
+				Log::EnableTrace(true);
+			}
+			else if(input == "`disable_trace")
+			{
+				Log::EnableTrace(false);
+			}
+		}
+	}
+}
 
 void main(int argc, char* argv[])
 {
 	Log::Setup();
 
-	if( argc != 3)
+	if( argc == 3 && string(argv[1]) == "-logic" )
+	{
+		RunLogic(argv[2]);
+		Log::Cleanup();
+		return;
+	}
+
+	if( argc < 3 )
 	{
-		TRACE("Please add port and max number of accept posts.");
+		TRACE("Please add port and max number of accept posts. The others are optional.");
 		TRACE("(ex) 17000 100");
+		TRACE("(ex) 17000 100 -recv 256 65536 -mode framed -tick 30 -snapshot");
+		TRACE("(ex) 6379 100 -mode resp");
+		TRACE("(ex) 17001 100 -proxy 127.0.0.1 17000");
+		TRACE("(ex) 17100 100 -mode framed -backend 127.0.0.1 17000 -backend 127.0.0.1 17001 -balance ewma");
+		TRACE("(ex) 17000 100 -mode framed -channel game, then -logic game in another process");
+		TRACE("(ex) 17000 100 -mode framed -cluster cluster.cfg 1, and each other node of cluster.cfg in a process of its own");
+		TRACE("(ex) 17000 100 -instances 4 -threads 2, for servers on 17000 ~ 17003 with 2 threads each");
+		TRACE("(ex) 17000 100 -mode framed -rate 100 65536 1000 1048576, for messages and bytes a second per client, then per address");
+		TRACE("(ex) 17000 100 -max_per_ip 16 -blocklist blocked.txt, with an address a line in blocked.txt");
+		TRACE("(ex) 17000 100 -mode framed -overload 5 100, for a target and an interval of queue delay in ms");
+		TRACE("(ex) 17000 100 -mode framed -lanes strict -starvation 50 -bulk_rate 1048576, for packets taken by priority");
 		return;
 	}
 
@@ -23,21 +100,363 @@ void main(int argc, char* argv[])
 
 	TRACE("Input : port : %d, max accept : %d", port, maxPostAccept);
 
+	Server::ProtocolMode mode = Server::MODE_RAW;
+	DWORD tickRate = 0;
+	bool snapshot = false;
+	string backendHost;
+	u_short backendPort = 0;
+	vector< pair<string, u_short> > balancedBackends;
+	Balancer::Policy balancePolicy = Balancer::POLICY_EWMA;
+	string logicChannel;
+	string clusterFile;
+	DWORD clusterNode = 0;
+	DWORD numInstances = 1;
+	DWORD numThreads = 0;
+	bool rateLimited = false;
+	RateLimiter::Limits connectionRate = { 0, 0 };
+	RateLimiter::Limits addressRate = { 0, 0 };
+	DWORD maxPerAddress = 0;
+	string blocklistFile;
+	DWORD overloadTarget = 0;
+	DWORD overloadInterval = OverloadControl::DEFAULT_INTERVAL_MS;
+	PacketLanes::Policy lanePolicy = PacketLanes::POLICY_FIFO;
+	DWORD starvationLimit = PacketLanes::DEFAULT_STARVATION_MS;
+	DWORD bulkRate = 0;
+
+	for( int i = 3 ; i < argc ; ++i )
+	{
+		string option = argv[i];
+
+		if( option == "-recv" && i + 2 < argc )
+		{
+			DWORD minRecvBuffer = static_cast<DWORD>( atoi(argv[++i]) );
+			DWORD maxRecvBuffer = static_cast<DWORD>( atoi(argv[++i]) );
+			if( minRecvBuffer == 0 || minRecvBuffer > maxRecvBuffer || maxRecvBuffer > BufferPool::MAX_BUFFER_SIZE )
+			{
+				ERROR_MSG("Invalid recv buffer bounds. min : %d, max : %d", minRecvBuffer, maxRecvBuffer);
+				return;
+			}
+
+			TRACE("Input : recv buffer : %d ~ %d", minRecvBuffer, maxRecvBuffer);
+			Client::SetRecvBuffBounds(minRecvBuffer, maxRecvBuffer);
+		}
+		else if( option == "-mode" && i + 1 < argc )
+		{
+			string name = argv[++i];
+			if( name == "raw" ) mode = Server::MODE_RAW;
+			else if( name == "framed" ) mode = Server::MODE_FRAMED;
+			else if( name == "resp" ) mode = Server::MODE_RESP;
+			else
+			{
+				ERROR_MSG("Unknown mode : %s", name.c_str());
+				return;
+			}
+
+			TRACE("Input : mode : %s", name.c_str());
+		}
+		else if( option == "-tick" && i + 1 < argc )
+		{
+			tickRate = static_cast<DWORD>( atoi(argv[++i]) );
+			if( tickRate > 1000 )
+			{
+				ERROR_MSG("Invalid tick rate : %d", tickRate);
+				return;
+			}
+
+			TRACE("Input : tick rate : %d", tickRate);
+		}
+		else if( option == "-snapshot" )
+		{
+			snapshot = true;
+		}
+		else if( option == "-proxy" && i + 2 < argc )
+		{
+			mode = Server::MODE_PROXY;
+			backendHost = argv[++i];
+			backendPort = static_cast<u_short>( atoi(argv[++i]) );
+
+			TRACE("Input : proxy to : %s:%d", backendHost.c_str(), backendPort);
+		}
+		else if( option == "-backend" && i + 2 < argc )
+		{
+			string host = argv[++i];
+			u_short port = static_cast<u_short>( atoi(argv[++i]) );
+			balancedBackends.push_back(make_pair(host, port));
+
+			TRACE("Input : backend : %s:%d", host.c_str(), port);
+		}
+		else if( option == "-balance" && i + 1 < argc )
+		{
+			string name = argv[++i];
+			if( name == "round_robin" ) balancePolicy = Balancer::POLICY_ROUND_ROBIN;
+			else if( name == "least" ) balancePolicy = Balancer::POLICY_LEAST_OUTSTANDING;
+			else if( name == "ewma" ) balancePolicy = Balancer::POLICY_EWMA;
+			else
+			{
+				ERROR_MSG("Unknown balance policy : %s", name.c_str());
+				return;
+			}
+
+			TRACE("Input : balance policy : %s", name.c_str());
+		}
+		else if( option == "-channel" && i + 1 < argc )
+		{
+			logicChannel = argv[++i];
+
+			TRACE("Input : logic channel : %s", logicChannel.c_str());
+		}
+		else if( option == "-cluster" && i + 2 < argc )
+		{
+			clusterFile = argv[++i];
+			clusterNode = static_cast<DWORD>( atoi(argv[++i]) );
+
+			TRACE("Input : cluster : %s, node %d", clusterFile.c_str(), clusterNode);
+		}
+		else if( option == "-instances" && i + 1 < argc )
+		{
+			numInstances = static_cast<DWORD>( atoi(argv[++i]) );
+			if( numInstances == 0 || numInstances > MAX_INSTANCES )
+			{
+				ERROR_MSG("Invalid number of instances : %d", numInstances);
+				return;
+			}
+
+			TRACE("Input : instances : %d", numInstances);
+		}
+		else if( option == "-threads" && i + 1 < argc )
+		{
+			numThreads = static_cast<DWORD>( atoi(argv[++i]) );
+			if( numThreads == 0 )
+			{
+				ERROR_MSG("Invalid number of threads : %d", numThreads);
+				return;
+			}
+
+			TRACE("Input : threads per instance : %d", numThreads);
+		}
+		else if( option == "-rate" && i + 4 < argc )
+		{
+			// 0 for no limit on one of them.
+			connectionRate.messages = static_cast<DWORD>( atoi(argv[++i]) );
+			connectionRate.bytes = static_cast<DWORD>( atoi(argv[++i]) );
+			addressRate.messages = static_cast<DWORD>( atoi(argv[++i]) );
+			addressRate.bytes = static_cast<DWORD>( atoi(argv[++i]) );
+			rateLimited = true;
+
+			TRACE("Input : rate per client : %d messages/s, %d bytes/s, per address : %d messages/s, %d bytes/s",
+				connectionRate.messages, connectionRate.bytes, addressRate.messages, addressRate.bytes);
+		}
+		else if( option == "-max_per_ip" && i + 1 < argc )
+		{
+			maxPerAddress = static_cast<DWORD>( atoi(argv[++i]) );
+
+			TRACE("Input : max connections per address : %d", maxPerAddress);
+		}
+		else if( option == "-blocklist" && i + 1 < argc )
+		{
+			blocklistFile = argv[++i];
+
+			TRACE("Input : blocklist : %s", blocklistFile.c_str());
+		}
+		else if( option == "-overload" && i + 2 < argc )
+		{
+			overloadTarget = static_cast<DWORD>( atoi(argv[++i]) );
+			overloadInterval = static_cast<DWORD>( atoi(argv[++i]) );
+			if( overloadTarget == 0 || overloadTarget >= overloadInterval )
+			{
+				ERROR_MSG("Invalid overload target : %d ms, interval : %d ms", overloadTarget, overloadInterval);
+				return;
+			}
+
+			TRACE("Input : overload target : %d ms, interval : %d ms", overloadTarget, overloadInterval);
+		}
+		else if( option == "-lanes" && i + 1 < argc )
+		{
+			string name = argv[++i];
+			if( name == "fifo" ) lanePolicy = PacketLanes::POLICY_FIFO;
+			else if( name == "strict" ) lanePolicy = PacketLanes::POLICY_STRICT;
+			else if( name == "weighted" ) lanePolicy = PacketLanes::POLICY_WEIGHTED;
+			else
+			{
+				ERROR_MSG("Unknown lane policy : %s", name.c_str());
+				return;
+			}
+
+			TRACE("Input : lane policy : %s", name.c_str());
+		}
+		else if( option == "-starvation" && i + 1 < argc )
+		{
+			starvationLimit = static_cast<DWORD>( atoi(argv[++i]) );
+
+			TRACE("Input : starvation limit : %d ms", starvationLimit);
+		}
+		else if( option == "-bulk_rate" && i + 1 < argc )
+		{
+			bulkRate = static_cast<DWORD>( atoi(argv[++i]) );
+
+			TRACE("Input : bulk rate : %d bytes/s", bulkRate);
+		}
+		else
+		{
+			ERROR_MSG("Unknown option : %s", option.c_str());
+			return;
+		}
+	}
+
+	if( snapshot && (mode != Server::MODE_FRAMED || tickRate == 0) )
+	{
+		ERROR_MSG("-snapshot needs -mode framed and -tick.");
+		return;
+	}
+
+	if( mode == Server::MODE_PROXY && tickRate > 0 )
+	{
+		ERROR_MSG("-proxy doesn't go with -tick.");
+		return;
+	}
+
+	if( !balancedBackends.empty() && mode != Server::MODE_FRAMED )
+	{
+		ERROR_MSG("-backend needs -mode framed.");
+		return;
+	}
+
+	if( !logicChannel.empty() && mode != Server::MODE_FRAMED )
+	{
+		ERROR_MSG("-channel needs -mode framed.");
+		return;
+	}
+
+	// Frames of clients go to the logic with -channel, and the logic process doesn't know the cluster.
+	if( !clusterFile.empty() && (mode != Server::MODE_FRAMED || !logicChannel.empty()) )
+	{
+		ERROR_MSG("-cluster needs -mode framed, and doesn't go with -channel.");
+		return;
+	}
+
+	// A proxied client is read from as fast as its backend takes the bytes.
+	if( rateLimited && mode == Server::MODE_PROXY )
+	{
+		ERROR_MSG("-rate doesn't go with -proxy.");
+		return;
+	}
+
+	// Only packets queued for workers are measured.
+	if( overloadTarget > 0 && ((mode != Server::MODE_RAW && mode != Server::MODE_FRAMED) || tickRate > 0) )
+	{
+		ERROR_MSG("-overload only goes with raw or framed mode, without -tick.");
+		return;
+	}
+
+	// Same for the lanes.
+	if( (lanePolicy != PacketLanes::POLICY_FIFO || bulkRate > 0) && ((mode != Server::MODE_RAW && mode != Server::MODE_FRAMED) || tickRate > 0) )
+	{
+		ERROR_MSG("-lanes and -bulk_rate only go with raw or framed mode, without -tick.");
+		return;
+	}
+
+	if( port + numInstances - 1 > 0xFFFF )
+	{
+		ERROR_MSG("Not enough ports for %d instances from %d.", numInstances, port);
+		return;
+	}
+
+	// A channel has one front-end, and a node of the cluster one port.
+	if( numInstances > 1 && (!logicChannel.empty() || !clusterFile.empty()) )
+	{
+		ERROR_MSG("-instances doesn't go with -channel or -cluster.");
+		return;
+	}
+
 	if(Network::Initialize() == false)
 	{
 		ERROR_MSG("Network::Initialize() failed");
 		return;
 	}
 
-	Server::New();
-	
-	if(Server::Instance()->Create(port, maxPostAccept) == false)
+	BufferPool::Setup(BUFFER_POOL_HIGH_WATER_MARK);
+
+	// Each instance has its own clients, pools and threads, and listens on the next port.
+	vector<Server*> servers;
+	for( DWORD i = 0 ; i < numInstances ; ++i )
 	{
-		ERROR_MSG("Server::Create() failed");
-		Network::Deinitialize();
-		return;
+		u_short instancePort = static_cast<u_short>(port + i);
+
+		Server* server = new Server;
+		servers.push_back(server);
+
+		server->SetThreadPool(numThreads);
+		server->SetProtocolMode(mode);
+		server->SetTickRate(tickRate);
+		server->SetSnapshotMode(snapshot);
+
+		bool ready = true;
+
+		if( !server->SetRateLimits(connectionRate, addressRate) )
+		{
+			ERROR_MSG("Rates go up to %d a second.", RateLimiter::MAX_RATE);
+			ready = false;
+		}
+
+		server->SetMaxConnectionsPerAddress(maxPerAddress);
+		server->SetOverloadTarget(overloadTarget, overloadInterval);
+		server->SetLanePolicy(lanePolicy);
+		server->SetStarvationLimit(starvationLimit);
+		server->SetBulkRate(bulkRate);
+
+		if( ready && !blocklistFile.empty() && !server->LoadBlocklist(blocklistFile.c_str()) )
+		{
+			ready = false;
+		}
+
+		if( mode == Server::MODE_PROXY && !server->SetProxyBackend(backendHost.c_str(), backendPort) )
+		{
+			ERROR_MSG("Could not resolve the backend.");
+			ready = false;
+		}
+
+		for( size_t k = 0 ; ready && k < balancedBackends.size() ; ++k )
+		{
+			if( !server->AddBackend(balancedBackends[k].first.c_str(), balancedBackends[k].second) )
+			{
+				ERROR_MSG("Could not resolve the backend : %s:%d", balancedBackends[k].first.c_str(), balancedBackends[k].second);
+				ready = false;
+			}
+		}
+		server->SetBalancePolicy(balancePolicy);
+
+		if( ready && !logicChannel.empty() && !server->SetLogicChannel(logicChannel.c_str()) )
+		{
+			ERROR_MSG("Could not create the logic channel : %s", logicChannel.c_str());
+			ready = false;
+		}
+
+		// The other nodes link to the port in the file.
+		if( ready && !clusterFile.empty() &&
+			(!server->SetCluster(clusterFile.c_str(), clusterNode) || server->GetCluster().GetPort(clusterNode) != instancePort) )
+		{
+			ERROR_MSG("Could not join the cluster as node %d on port %d.", clusterNode, instancePort);
+			ready = false;
+		}
+
+		if( ready && server->Create(instancePort, maxPostAccept) == false )
+		{
+			ERROR_MSG("Server::Create() failed");
+			ready = false;
+		}
+
+		if( !ready )
+		{
+			DeleteServers(servers);
+			BufferPool::Cleanup();
+			Network::Deinitialize();
+			return;
+		}
 	}
 
+	// The console commands are for this one. `instance <index> picks another.
+	Server* server = servers[0];
+
 #ifndef _DEBUG
 	Log::EnableTrace(false);
 #endif
@@ -50,11 +469,271 @@ void main(int argc, char* argv[])
 
 		if(input == "`client_size")
 		{
-			TRACE(" Number of Clients : %d", Server::Instance()->GetNumClients());
+			TRACE(" Number of Clients : %d", server->GetNumClients());
 		}
 		if(input == "`accept_size")
 		{
-			TRACE(" Number of Accept posts : %d", Server::Instance()->GetNumPostAccepts());
+			TRACE(" Number of Accept posts : %d", server->GetNumPostAccepts());
+		}
+		else if(input == "`buffer_stats")
+		{
+			BufferPool::TraceStats();
+		}
+		else if(input == "`memory_stats")
+		{
+			server->GetMemoryBudget().TraceStats();
+			TRACE(" Number of paused clients : %d", server->GetNumPausedClients());
+		}
+		else if(input == "`send_stats")
+		{
+			server->TraceSendStats();
+		}
+		else if(input == "`conn_stats")
+		{
+			server->TraceConnectionStats();
+		}
+		else if(input.compare(0, 13, "`idle_timeout") == 0)
+		{
+			// `idle_timeout <seconds>, 0 for off.
+			DWORD seconds = static_cast<DWORD>( atoi(input.substr(13).c_str()) );
+
+			server->SetIdleTimeout(seconds);
+			TRACE(" Idle timeout : %d s", seconds);
+		}
+		else if(input == "`rate_stats")
+		{
+			server->TraceRateStats();
+		}
+		else if(input == "`admission_stats")
+		{
+			server->TraceAdmissionStats();
+		}
+		else if(input == "`overload_stats")
+		{
+			server->TraceOverloadStats();
+		}
+		else if(input.compare(0, 9, "`overload") == 0)
+		{
+			// `overload <target ms> [interval ms], 0 for off.
+			istringstream args(input.substr(9));
+			DWORD target = 0, interval = 0;
+			args >> target;
+			if(!(args >> interval)) interval = OverloadControl::DEFAULT_INTERVAL_MS;
+
+			if(target > 0 && target >= interval)
+			{
+				TRACE("`overload <target ms> [interval ms], with the target under the interval. 0 for off.");
+			}
+			else
+			{
+				server->SetOverloadTarget(target, interval);
+				TRACE(" Overload target : %d ms, interval : %d ms", target, interval);
+			}
+		}
+		else if(input == "`lane_stats")
+		{
+			server->TraceLaneStats();
+		}
+		else if(input.compare(0, 6, "`lanes") == 0)
+		{
+			// `lanes <fifo|strict|weighted>
+			istringstream args(input.substr(6));
+			string name;
+			args >> name;
+
+			if(name == "fifo") server->SetLanePolicy(PacketLanes::POLICY_FIFO);
+			else if(name == "strict") server->SetLanePolicy(PacketLanes::POLICY_STRICT);
+			else if(name == "weighted") server->SetLanePolicy(PacketLanes::POLICY_WEIGHTED);
+			else TRACE("`lanes <fifo|strict|weighted>");
+		}
+		else if(input.compare(0, 11, "`starvation") == 0)
+		{
+			// `starvation <ms>, 0 for no limit.
+			DWORD ms = static_cast<DWORD>( atoi(input.substr(11).c_str()) );
+
+			server->SetStarvationLimit(ms);
+			TRACE(" Starvation limit : %d ms", ms);
+		}
+		else if(input.compare(0, 10, "`bulk_rate") == 0)
+		{
+			// `bulk_rate <bytes/s>, 0 for off.
+			DWORD rate = static_cast<DWORD>( atoi(input.substr(10).c_str()) );
+
+			server->SetBulkRate(rate);
+			TRACE(" Bulk rate : %d bytes/s", rate);
+		}
+		else if(input.compare(0, 11, "`max_per_ip") == 0)
+		{
+			// `max_per_ip <connections>, 0 for no limit.
+			DWORD max = static_cast<DWORD>( atoi(input.substr(11).c_str()) );
+
+			server->SetMaxConnectionsPerAddress(max);
+			TRACE(" Max connections per address : %d", max);
+		}
+		else if(input.compare(0, 10, "`blocklist") == 0)
+		{
+			// `blocklist <file>, loaded again over the one there is.
+			istringstream args(input.substr(10));
+			string path;
+			args >> path;
+
+			server->LoadBlocklist(path.c_str());
+		}
+		else if(input.compare(0, 12, "`slow_policy") == 0)
+		{
+			// `slow_policy <ignore|drop_oldest|drop_newest|coalesce|disconnect> [max outstanding bytes] [max send latency ms]
+			istringstream args(input.substr(12));
+			string name;
+			DWORD maxBytes = 0, maxLatencyMs = 0;
+			args >> name;
+			if(!(args >> maxBytes)) maxBytes = Server::DEFAULT_MAX_OUTSTANDING_SEND_BYTES;
+			if(!(args >> maxLatencyMs)) maxLatencyMs = Server::DEFAULT_MAX_SEND_LATENCY_MS;
+
+			Server::SlowConsumerPolicy policy = Server::SLOW_CONSUMER_IGNORE;
+			if(name == "drop_oldest") policy = Server::SLOW_CONSUMER_DROP_OLDEST;
+			else if(name == "drop_newest") policy = Server::SLOW_CONSUMER_DROP_NEWEST;
+			else if(name == "coalesce") policy = Server::SLOW_CONSUMER_COALESCE_LATEST;
+			else if(name == "disconnect") policy = Server::SLOW_CONSUMER_DISCONNECT;
+
+			server->SetSlowConsumerPolicy(policy, maxBytes, maxLatencyMs);
+			TRACE(" Slow consumer policy : %d, max outstanding : %d bytes, max latency : %d ms", policy, maxBytes, maxLatencyMs);
+		}
+		else if(input.compare(0, 9, "`coalesce") == 0)
+		{
+			// `coalesce <on|off>
+			bool enable = input.find("on", 9) != string::npos;
+
+			server->SetSendCoalescing(enable);
+			TRACE(" Send coalescing : %s", enable ? "on" : "off");
+		}
+		else if(input == "`bench_pubsub")
+		{
+			Benchmark::PubSubFanOut();
+		}
+		else if(input == "`bench_interest")
+		{
+			Benchmark::InterestTick();
+		}
+		else if(input == "`bench_snapshot")
+		{
+			Benchmark::SnapshotDelta();
+		}
+		else if(input == "`bench_dispatch")
+		{
+			Benchmark::OpcodeDispatch();
+		}
+		else if(input == "`bench_schema")
+		{
+			Benchmark::SchemaCodec();
+		}
+		else if(input == "`bench_resp")
+		{
+			Benchmark::RespPipeline();
+		}
+		else if(input == "`bench_balance")
+		{
+			Benchmark::BalancerMix();
+		}
+		else if(input.compare(0, 15, "`balance_policy") == 0)
+		{
+			// `balance_policy <round_robin|least|ewma>
+			istringstream args(input.substr(15));
+			string name;
+			args >> name;
+
+			if(name == "round_robin") server->SetBalancePolicy(Balancer::POLICY_ROUND_ROBIN);
+			else if(name == "least") server->SetBalancePolicy(Balancer::POLICY_LEAST_OUTSTANDING);
+			else if(name == "ewma") server->SetBalancePolicy(Balancer::POLICY_EWMA);
+			else TRACE("`balance_policy <round_robin|least|ewma>");
+		}
+		else if(input == "`balance_stats")
+		{
+			server->TraceBalanceStats();
+		}
+		else if(input == "`bench_channel")
+		{
+			Benchmark::SharedChannelRoundTrip();
+		}
+		else if(input == "`bench_echo")
+		{
+			Benchmark::Echo();
+		}
+		else if(input == "`bench_layout")
+		{
+			Benchmark::ConnectionLayout();
+		}
+		else if(input == "`bench_sweep")
+		{
+			Benchmark::ConnectionSweep();
+		}
+		else if(input == "`bench_rate")
+		{
+			Benchmark::RateLimit();
+		}
+		else if(input == "`bench_admission")
+		{
+			Benchmark::Admission();
+		}
+		else if(input == "`bench_overload")
+		{
+			Benchmark::Overload();
+		}
+		else if(input == "`bench_lanes")
+		{
+			Benchmark::Lanes();
+		}
+		else if(input == "`logic_stats")
+		{
+			server->TraceLogicStats();
+		}
+		else if(input == "`cluster_stats")
+		{
+			server->TraceClusterStats();
+		}
+		else if(input.compare(0, 12, "`bench_route") == 0)
+		{
+			// `bench_route <node> [pings]
+			istringstream args(input.substr(12));
+			DWORD node = 0, count = 0;
+			args >> node;
+			if(!(args >> count)) count = 100000;
+
+			server->BenchRoute(node, count);
+		}
+		else if(input == "`interest_stats")
+		{
+			server->TraceInterestStats();
+		}
+		else if(input == "`tick_stats")
+		{
+			server->TraceTickStats();
+		}
+		else if(input == "`kv_stats")
+		{
+			server->TraceKeyValueStats();
+		}
+		else if(input == "`rpc_stats")
+		{
+			server->TraceRpcStats();
+		}
+		else if(input == "`proxy_stats")
+		{
+			server->TraceProxyStats();
+		}
+		else if(input.compare(0, 9, "`instance") == 0)
+		{
+			// `instance <index>
+			istringstream args(input.substr(9));
+			DWORD index = 0;
+			if((args >> index) && index < servers.size())
+			{
+				server = servers[index];
+				TRACE(" Instance %d, port %d", index, port + index);
+			}
+			else
+			{
+				TRACE("`instance <0 ~ %d>", servers.size() - 1);
+			}
 		}
 		else if(input == "`enable_trace")
 		{
@@ -66,7 +745,9 @@ void main(int argc, char* argv[])
 		}
 	}
 
-	Server::Delete();
+	DeleteServers(servers);
+
+	BufferPool::Cleanup();
 
 	Network::Deinitialize();
 